@@ -1,7 +1,7 @@
 #!/usr/bin/env python
 
 import argparse
-import json
+import os
 import re
 from multiprocessing.dummy import Pool as ThreadPool
 try:
@@ -15,10 +15,22 @@ GATT_URL = 'https://www.bluetooth.com/specifications/gatt'
 SERVICES_URL = GATT_URL + '/services';
 CHARACTERISTICS_URL = GATT_URL + '/characteristics'
 CHARACTERISTIC_URL = 'https://www.bluetooth.com/api/gatt/XmlFile?xmlFileName='
+UNITS_URL = 'https://www.bluetooth.com/specifications/assigned-numbers/units'
+
+SNAPSHOT_DIR = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'gatt')
+SNAPSHOT_VERSION = 1
+UNIT_PREFIX = 'org.bluetooth.unit.'
+
+# All formats defined by the GATT specification, the generated enum doesn't
+# depend on the snapshot contents
+FORMATS = ['boolean', '2bit', '4bit', 'nibble', '8bit', 'uint8', 'sint8',
+  'uint12', '16bit', 'uint16', 'sint16', '24bit', 'uint24', 'sint24', '32bit',
+  'uint32', 'sint32', 'uint40', 'uint48', 'utf8s', 'float64', 'sfloat', 'float',
+  'reg-cert-data-list', 'variable', 'gatt-uuid']
 
 services = {}
 characteristics = {}
-characteristics_types = {}
+units = {}
 cj = CookieJar()
 
 def build_gatt_regex(gatt_type):
@@ -27,47 +39,67 @@ def build_gatt_regex(gatt_type):
     '(org.bluetooth.' + gatt_type + '.[^<]*)</td>[^<]*<td[^>]*>([^<]*)<'
 
 def build_sig_uuid(uuid):
-  return '%08x-0000-1000-8000-00805f9b34fb' % (int(uuid, 16))
+  return '%08x-0000-1000-8000-00805f9b34fb' % (uuid)
 
+# Online refresh, scrapes bluetooth.com and updates the snapshot
 def parse_services(data):
   regex = build_gatt_regex('service')
 
   # Parse all services
   for service in re.findall(regex, data):
     # service[0] = Name, service[1] = Type, service[2] = Assigned Number
-    uuid = build_sig_uuid(service[2])
-    services[uuid] = {
-      'name': service[0].replace(' ', ''),
+    services[int(service[2], 16)] = {
+      'name': service[0],
+      'id': service[1],
+    }
+
+def parse_units(data):
+  regex = build_gatt_regex('unit')
+
+  # Parse all units
+  for unit in re.findall(regex, data):
+    # unit[0] = Name, unit[1] = Type, unit[2] = Assigned Number
+    units[int(unit[2], 16)] = {
+      'name': unit[0],
+      'id': unit[1],
     }
 
-def get_characteristics_types(uuid):
-  url = CHARACTERISTIC_URL + characteristics[uuid]['org'] + '.xml'
+def get_characteristic_fields(uuid):
+  url = CHARACTERISTIC_URL + characteristics[uuid]['id'] + '.xml'
   opener = urlrequest.build_opener(urlrequest.HTTPCookieProcessor(cj))
   data = opener.open(url).read().decode('utf-8')
-  print('Downloaded ' + characteristics[uuid]['org'])
+  print('Downloaded ' + characteristics[uuid]['id'])
 
-  for char_type in re.findall(r'<Format>([^<]*)<\/Format>', data):
-    enum_type = 'CHAR_TYPE_' + char_type.replace('-', '_').upper()
-    characteristics[uuid]['types'].append(enum_type)
-    characteristics_types[enum_type] = True
+  for field in re.findall(r'<Field name="([^"]*)"[^>]*>(.*?)</Field>', data,
+    re.S):
+    fmt = re.search(r'<Format>([^<]*)</Format>', field[1])
+    if not fmt:
+      continue
+    unit = re.search(r'<Unit>([^<]*)</Unit>', field[1])
+    exponent = re.search(r'<DecimalExponent>([^<]*)</DecimalExponent>',
+      field[1])
+    characteristics[uuid]['fields'].append({
+      'name': field[0],
+      'format': fmt.group(1).lower(),
+      'unit': unit.group(1) if unit else None,
+      'exponent': int(exponent.group(1)) if exponent else 0,
+    })
 
 def parse_characteristics(data):
   regex = build_gatt_regex('characteristic')
-  threads = []
 
   # Parse all characteristics
   for char in re.findall(regex, data):
     # char[0] = Name, char[1] = Type, char[2] = Assigned Number
-    uuid = build_sig_uuid(char[2])
-    characteristics[uuid] = {
-      'name': char[0].replace(' ', ''),
-      'org': char[1],
-      'types': []
+    characteristics[int(char[2], 16)] = {
+      'name': char[0],
+      'id': char[1],
+      'fields': []
     }
 
   # Download all characteristic definitions
   pool = ThreadPool(10)
-  pool.map(get_characteristics_types, characteristics.keys())
+  pool.map(get_characteristic_fields, characteristics.keys())
   pool.close()
   pool.join()
 
@@ -76,6 +108,175 @@ def get_list(url, parser):
   data = opener.open(url).read().decode('utf-8')
   parser(data)
 
+def yaml_scalar(value):
+  if isinstance(value, int):
+    return str(value)
+  if re.match(r'^[\w .,()/-]*$', value) and value.strip() == value:
+    return value
+  return '"%s"' % value.replace('\\', '\\\\').replace('"', '\\"')
+
+def write_snapshot(filename, what, entries):
+  with open(filename, 'w') as outfile:
+    outfile.write(
+      '# Bluetooth SIG GATT %s, generated by get_gatt_assigned_numbers.py\n' \
+      '# --refresh. Edit with care, the build only uses this snapshot\n' \
+      'version: %d\n' \
+      'uuids:\n' % (what, SNAPSHOT_VERSION))
+    for uuid, entry in sorted(entries.items()):
+      outfile.write('  - uuid: 0x%04X\n' % uuid)
+      outfile.write('    name: %s\n' % yaml_scalar(entry['name']))
+      outfile.write('    id: %s\n' % yaml_scalar(entry['id']))
+      if not entry.get('fields'):
+        continue
+      outfile.write('    fields:\n')
+      for field in entry['fields']:
+        outfile.write('      - name: %s\n' % yaml_scalar(field['name']))
+        outfile.write('        format: %s\n' % field['format'])
+        if field['unit']:
+          outfile.write('        unit: %s\n' % field['unit'])
+        if field['exponent']:
+          outfile.write('        exponent: %d\n' % field['exponent'])
+
+def refresh(snapshot):
+  print('Getting list of services')
+  get_list(SERVICES_URL, parse_services)
+  print('Getting list of characteristics')
+  get_list(CHARACTERISTICS_URL, parse_characteristics)
+  print('Getting list of units')
+  get_list(UNITS_URL, parse_units)
+
+  print('Writing snapshot to ' + snapshot)
+  write_snapshot(os.path.join(snapshot, 'services.yaml'), 'services',
+    services)
+  write_snapshot(os.path.join(snapshot, 'characteristics.yaml'),
+    'characteristics', characteristics)
+  write_snapshot(os.path.join(snapshot, 'units.yaml'), 'units', units)
+
+# Offline generation from the snapshot. The snapshot follows the layout of the
+# SIG assigned numbers YAML files, only the subset of YAML used by them is
+# supported so no external modules are needed
+def yaml_value(value):
+  if len(value) >= 2 and value[0] == value[-1] and value[0] in '"\'':
+    return value[1:-1].replace('\\"', '"').replace('\\\\', '\\')
+  try:
+    return int(value, 0)
+  except ValueError:
+    return value
+
+def yaml_load(filename):
+  root = {}
+  # Stack of (indentation, container) pairs, and the key of a mapping waiting
+  # for its nested value
+  stack = [(0, root)]
+  pending = None
+
+  with open(filename) as infile:
+    for lineno, line in enumerate(infile, 1):
+      if not line.strip() or line.lstrip().startswith('#'):
+        continue
+
+      indent = len(line) - len(line.lstrip())
+      line = line.strip()
+      is_item = line.startswith('- ')
+
+      if pending is not None:
+        # The nested value is either more indented or a sequence
+        if indent > stack[-1][0] or (is_item and indent == stack[-1][0]):
+          stack[-1][1][pending] = [] if is_item else {}
+          stack.append((indent, stack[-1][1][pending]))
+        pending = None
+
+      while indent < stack[-1][0]:
+        stack.pop()
+      indent_top, parent = stack[-1]
+      if not is_item and isinstance(parent, list):
+        stack.pop()
+        indent_top, parent = stack[-1]
+
+      if is_item:
+        if not isinstance(parent, list) or indent != indent_top:
+          raise ValueError('%s:%d: unexpected sequence' % (filename, lineno))
+        parent.append({})
+        parent = parent[-1]
+        line = line[2:].strip()
+        stack.append((indent + 2, parent))
+
+      key, sep, value = line.partition(':')
+      if not sep or not isinstance(parent, dict):
+        raise ValueError('%s:%d: expected a mapping' % (filename, lineno))
+      key, value = key.strip(), value.strip()
+      if value:
+        parent[key] = yaml_value(value)
+      else:
+        parent[key] = None
+        pending = key
+
+  return root
+
+def load_entries(filename, entries):
+  data = yaml_load(filename)
+  if data.get('version', 1) > SNAPSHOT_VERSION:
+    raise ValueError('%s: unsupported snapshot version' % filename)
+
+  for entry in data.get('uuids', []):
+    entries[entry['uuid']] = entry
+    entry['fields'] = entry.get('fields') or []
+    for field in entry['fields']:
+      field['name'] = str(field['name'])
+      field['format'] = str(field['format']).lower()
+      if field['format'] not in FORMATS:
+        raise ValueError('%s: unknown format %s' % (filename, field['format']))
+      field.setdefault('unit', None)
+      field.setdefault('exponent', 0)
+
+def load_snapshot(snapshot):
+  load_entries(os.path.join(snapshot, 'services.yaml'), services)
+  load_entries(os.path.join(snapshot, 'characteristics.yaml'), characteristics)
+  load_entries(os.path.join(snapshot, 'units.yaml'), units)
+
+  # Resolve unit identifiers to their assigned numbers
+  unit_ids = dict((unit['id'], uuid) for uuid, unit in units.items())
+  for char in characteristics.values():
+    for field in char['fields']:
+      if field['unit'] and field['unit'] not in unit_ids:
+        raise ValueError('Unknown unit %s in %s' % (field['unit'], char['id']))
+      field['unit'] = unit_ids.get(field['unit'], 0)
+
+def c_name(name):
+  return name.replace(' ', '')
+
+def c_type(fmt):
+  return 'CHAR_TYPE_' + fmt.replace('-', '_').upper()
+
+def unit_name(unit):
+  return unit['id'][len(UNIT_PREFIX):] if unit['id'].startswith(UNIT_PREFIX) \
+    else c_name(unit['name'])
+
+class StringPool(object):
+  """ Shared, de-duplicated pool of NUL terminated strings """
+  def __init__(self):
+    self.offsets = {}
+    self.data = ''
+
+  def add(self, s):
+    if s not in self.offsets:
+      self.offsets[s] = len(self.data)
+      self.data += s + '\0'
+    return self.offsets[s]
+
+class TypesPool(object):
+  """ Shared, de-duplicated pool of CHAR_TYPES_END terminated type vectors """
+  def __init__(self):
+    self.offsets = {}
+    self.data = []
+
+  def add(self, types):
+    key = tuple(types)
+    if key not in self.offsets:
+      self.offsets[key] = len(self.data)
+      self.data += list(types) + ['CHAR_TYPES_END']
+    return self.offsets[key]
+
 def write_h(filename):
   with open(filename, 'w') as outfile:
     outfile.write(
@@ -83,92 +284,292 @@ def write_h(filename):
       '#define GATT_H\n' \
       '\n' \
       '#include "ble_utils.h"\n' \
+      '#include <stddef.h>\n' \
+      '#include <stdint.h>\n' \
       '\n' \
       'typedef enum {\n' \
       '    CHAR_TYPE_UNKNOWN,\n'
       '    %s\n'
       '} characteristic_type_t;\n' \
       '\n' \
+      '#define CHAR_TYPES_END 0xFF\n' \
+      '\n' \
+      '/* All tables are sorted by the 16-bit SIG assigned number. Names, type\n' \
+      ' * vectors and fields are offsets into the shared gatt_names, gatt_types\n' \
+      ' * and gatt_fields pools */\n' \
       'typedef struct {\n' \
-      '    ble_uuid_t uuid;\n' \
-      '    char *name;\n' \
-      '    characteristic_type_t *types;\n' \
+      '    uint16_t uuid;\n' \
+      '    uint16_t name;\n' \
+      '    uint16_t types;\n' \
+      '    uint16_t fields;\n' \
       '} characteristic_desc_t;\n' \
       '\n' \
+      '/* Fields are terminated by an entry with a CHAR_TYPES_END type */\n' \
+      'typedef struct {\n' \
+      '    uint16_t name;\n' \
+      '    uint16_t unit; /* Unit assigned number, 0 if not specified */\n' \
+      '    int8_t exponent; /* Decimal exponent of the value */\n' \
+      '    uint8_t type;\n' \
+      '} field_desc_t;\n' \
+      '\n' \
       'typedef struct {\n' \
-      '    ble_uuid_t uuid;\n' \
-      '    char *name;\n' \
+      '    uint16_t uuid;\n' \
+      '    uint16_t name;\n' \
       '} service_desc_t;\n' \
       '\n' \
-      'extern service_desc_t services[];\n' \
-      'extern characteristic_desc_t characteristics[];\n' \
+      'typedef struct {\n' \
+      '    uint16_t uuid;\n' \
+      '    uint16_t name;\n' \
+      '} unit_desc_t;\n' \
+      '\n' \
+      '/* Specialized decoders write the textual value, each field followed by a\n' \
+      ' * comma, at *out and advance it. They return the number of bytes consumed\n' \
+      ' * or 0 if the value is too short */\n' \
+      'typedef size_t (*characteristic_decoder_t)(const uint8_t *data, size_t len,\n' \
+      '    char **out);\n' \
       '\n' \
-      '#endif' % (',\n    '.join(sorted(characteristics_types.keys())))
+      'extern const char gatt_names[];\n' \
+      'extern const uint8_t gatt_types[];\n' \
+      'extern const field_desc_t gatt_fields[];\n' \
+      'extern const service_desc_t services[];\n' \
+      'extern const size_t services_count;\n' \
+      'extern const characteristic_desc_t characteristics[];\n' \
+      'extern const size_t characteristics_count;\n' \
+      '/* Indexed as the characteristics table, NULL if there\'s no decoder */\n' \
+      'extern const characteristic_decoder_t characteristic_decoders[];\n' \
+      'extern const unit_desc_t units[];\n' \
+      'extern const size_t units_count;\n' \
+      '\n' \
+      '#endif' % (',\n    '.join(c_type(f) for f in FORMATS))
     )
-    outfile.close()
+
+# Specialized decoders. Each format maps to its size in bytes and a C
+# expression formatting the value at data[o]
+def le(size):
+  # Little endian value of size bytes at offset o
+  parts = ['data[%%(o%d)d]' % i if i == 0 else
+    '%sdata[%%(o%d)d] << %d' % ('(uint64_t)' if i >= 4 else
+    '(uint32_t)' if i == 3 else '', i, 8 * i) for i in range(size)]
+  return '(' + ' | '.join(parts) + ')'
+
+DECODERS = {
+  'boolean': (1, 'format_bool(p, data[%(o0)d])'),
+  '2bit': (1, 'format_uint32(p, data[%(o0)d] & 0x03)'),
+  '4bit': (1, 'format_uint32(p, data[%(o0)d] & 0x0F)'),
+  'nibble': (1, 'format_uint32(p, data[%(o0)d] & 0x0F)'),
+  '8bit': (1, 'format_uint32(p, data[%(o0)d])'),
+  'uint8': (1, 'format_uint32(p, data[%(o0)d])'),
+  'sint8': (1, 'format_int32(p, (int8_t)data[%(o0)d])'),
+  'uint12': (2, 'format_uint32(p, ' + le(2) + ' & 0x0FFF)'),
+  '16bit': (2, 'format_uint32(p, ' + le(2) + ')'),
+  'uint16': (2, 'format_uint32(p, ' + le(2) + ')'),
+  'sint16': (2, 'format_int32(p, (int16_t)' + le(2) + ')'),
+  '24bit': (3, 'format_uint32(p, ' + le(3) + ')'),
+  'uint24': (3, 'format_uint32(p, ' + le(3) + ')'),
+  'sint24': (3, 'format_int32(p, (int32_t)((' + le(3) +
+    ' ^ 0x800000) - 0x800000))'),
+  '32bit': (4, 'format_uint32(p, ' + le(4) + ')'),
+  'uint32': (4, 'format_uint32(p, ' + le(4) + ')'),
+  'sint32': (4, 'format_int32(p, ' + le(4) + ')'),
+  'uint40': (5, 'format_uint64(p, ' + le(5) + ')'),
+  'uint48': (6, 'format_uint64(p, ' + le(6) + ')'),
+  'float64': (8, 'format_float64(p, &data[%(o0)d])'),
+  'sfloat': (2, 'format_sfloat(p, ' + le(2) + ')'),
+  'float': (4, 'format_float(p, ' + le(4) + ')'),
+}
+
+def decoder_body(formats):
+  """ Returns the statements of a decoder for the given formats, or None if
+  one of them can't be decoded without parsing the value """
+  body = []
+  offset = 0
+
+  for fmt in formats:
+    if fmt == 'utf8s':
+      # Strings consume the rest of the value
+      rest = 'len - %d' % offset if offset else 'len'
+      body.append('    memcpy(p, &data[%d], %s);\n' % (offset, rest))
+      body.append('    p += %s;\n' % rest)
+      body.append('    *p++ = \',\';\n')
+      return body, offset, 'len'
+    if fmt not in DECODERS:
+      return None
+    size, expr = DECODERS[fmt]
+    body.append('    p = %s;\n' % (expr % dict(('o%d' % i, offset + i)
+      for i in range(size))))
+    body.append('    *p++ = \',\';\n')
+    offset += size
+
+  return body, offset, str(offset)
+
+def write_decoders(outfile):
+  decoders = {}
+
+  for uuid, char in sorted(characteristics.items()):
+    formats = tuple(f['format'] for f in char['fields'])
+    char['decoder'] = 'NULL'
+    if not formats:
+      continue
+    if formats in decoders:
+      char['decoder'] = decoders[formats]
+      continue
+
+    decoder = decoder_body(formats)
+    if not decoder:
+      continue
+    body, min_len, consumed = decoder
+    name = 'decode_%04x' % uuid
+    decoders[formats] = char['decoder'] = name
+
+    outfile.write(
+      '/* %s */\n' \
+      'static size_t %s(const uint8_t *data, size_t len, char **out)\n' \
+      '{\n' \
+      '    char *p = *out;\n' \
+      '\n' \
+      '    if (len < %d)\n' \
+      '        return 0;\n' \
+      '\n' \
+      '%s' \
+      '\n' \
+      '    *out = p;\n' \
+      '    return %s;\n' \
+      '}\n' \
+      '\n' % (', '.join(formats), name, max(min_len, 1), ''.join(body),
+      consumed))
+
+def c_string(s):
+  return '"%s"' % s.replace('\\', '\\\\').replace('"', '\\"')
 
 def write_c(filename):
+  names = StringPool()
+  types = TypesPool()
+  fields = []
+  fields_offsets = {}
+
+  for uuid, service in sorted(services.items()):
+    service['name_offset'] = names.add(c_name(service['name']))
+  for uuid, char in sorted(characteristics.items()):
+    char['name_offset'] = names.add(c_name(char['name']))
+    char['types_offset'] = types.add([c_type(f['format'])
+      for f in char['fields']])
+    key = tuple((f['name'], f['unit'], f['exponent'], f['format'])
+      for f in char['fields'])
+    if key not in fields_offsets:
+      fields_offsets[key] = len(fields)
+      fields += [(names.add(f[0]), f[1], f[2], c_type(f[3])) for f in key]
+      fields.append((0, 0, 0, 'CHAR_TYPES_END'))
+    char['fields_offset'] = fields_offsets[key]
+  # All units are included, Presentation Format descriptors may refer to any
+  for uuid, unit in sorted(units.items()):
+    unit['name_offset'] = names.add(unit_name(unit))
+
   with open(filename, 'w') as outfile:
     outfile.write(
       '#include "gatt.h"\n' \
-      '#include <stdlib.h>\n' \
+      '#include "format.h"\n' \
+      '#include <string.h>\n' \
       '\n' \
-      'service_desc_t services[] = {\n');
+      'const char gatt_names[] =\n')
+
+    # Write the names pool, one string per line
+    outfile.write('\n'.join('    %s' % c_string(name)[:-1] + '\\0"'
+      for name in names.data.split('\0')[:-1]) + ';\n\n')
+
+    # Write the type vectors pool
+    outfile.write('const uint8_t gatt_types[] = {\n')
+    for i in range(0, len(types.data), 4):
+      outfile.write('    %s,\n' % ', '.join(types.data[i:i + 4]))
+    outfile.write('};\n\n')
+
+    # Write the fields pool
+    outfile.write('const field_desc_t gatt_fields[] = {\n')
+    for field in fields:
+      outfile.write('    { %d, 0x%04x, %d, %s },\n' % field)
+    outfile.write('};\n\n')
 
     # Write services definitions
+    outfile.write('const service_desc_t services[] = {\n')
     for uuid, service in sorted(services.items()):
-      outfile.write(
-        '    {\n' \
-        '        .uuid = { %s },\n' \
-        '        .name = "%s",\n' \
-        '    },\n' % (', '.join('0x{0}'.format(t) for t in
-        re.findall('..', uuid.replace('-', ''))[::-1]), service['name']));
-
-    # Terminate services list
+      outfile.write('    { 0x%04x, %d },\n' % (uuid, service['name_offset']))
     outfile.write(
-      '    {}\n' \
       '};\n' \
-      '\n');
+      'const size_t services_count = sizeof(services) / sizeof(services[0]);\n' \
+      '\n')
 
-    # Write characteristic types for each characteristic
+    # Write characteristics definitions
+    outfile.write('const characteristic_desc_t characteristics[] = {\n')
     for uuid, char in sorted(characteristics.items()):
-      outfile.write('static characteristic_type_t types_%s[] = { %s-1 };\n' %
-        (uuid.replace('-', '_'),
-        ''.join('{0}, '.format(t) for t in char['types'])));
+      outfile.write('    { 0x%04x, %d, %d, %d },\n' % (uuid,
+        char['name_offset'], char['types_offset'], char['fields_offset']))
+    outfile.write(
+      '};\n' \
+      'const size_t characteristics_count =\n' \
+      '    sizeof(characteristics) / sizeof(characteristics[0]);\n' \
+      '\n')
 
-    # Write characteristics definitions
-    outfile.write('\ncharacteristic_desc_t characteristics[] = {\n' );
+    # Write specialized decoders
+    write_decoders(outfile)
+    outfile.write('const characteristic_decoder_t characteristic_decoders[] = {\n')
     for uuid, char in sorted(characteristics.items()):
-      outfile.write(
-        '    {\n' \
-        '        .uuid = { %s },\n' \
-        '        .name = "%s",\n' \
-        '        .types = types_%s,\n' \
-        '    },\n' %
-        (', '.join('0x{0}'.format(t) for t in
-        re.findall('..', uuid.replace('-', ''))[::-1]), char['name'],
-        uuid.replace('-', '_')));
-
-    # Terminate characteristics list
+      outfile.write('    %s, /* 0x%04x */\n' % (char['decoder'], uuid))
+    outfile.write('};\n\n')
+
+    # Write units definitions
+    outfile.write('const unit_desc_t units[] = {\n')
+    for uuid, unit in sorted(units.items()):
+      outfile.write('    { 0x%04x, %d },\n' % (uuid, unit['name_offset']))
     outfile.write(
-      '    {}\n' \
-      '};');
-    outfile.close
+      '};\n' \
+      'const size_t units_count = sizeof(units) / sizeof(units[0]);\n')
+
+  return names, types, fields
+
+def size_report(names, types, fields):
+  # Sizes on the ESP32 (32-bit pointers, 32-bit enums). The previous tables
+  # held full 128-bit UUIDs, a name pointer and a pointer to a per
+  # characteristic, -1 terminated, type array. The tables and type arrays
+  # weren't const and were placed in DRAM, the name literals were in flash
+  old_names = sum(len(c_name(x['name'])) + 1 for x in
+    list(services.values()) + list(characteristics.values()))
+  old_types = sum(4 * (len(x['fields']) + 1) for x in characteristics.values())
+  old_dram = (len(services) + 1) * 20 + (len(characteristics) + 1) * 24 + \
+    old_types
+  # All current tables are const and stay in flash
+  tables = len(services) * 4 + len(characteristics) * 8 + len(units) * 4
+  new_flash = tables + len(names.data) + len(types.data) + len(fields) * 6
+
+  print('GATT tables size report:')
+  print('  Services: %d, characteristics: %d, units: %d' % (len(services),
+    len(characteristics), len(units)))
+  print('  Previous: DRAM %d bytes (tables: %d, types: %d), flash %d bytes '
+    '(names)' % (old_dram, old_dram - old_types, old_types, old_names))
+  print('  Current: DRAM 0 bytes, flash %d bytes (tables: %d, names: %d, '
+    'types: %d, fields: %d)' % (new_flash, tables, len(names.data),
+    len(types.data), len(fields) * 6))
+  print('  DRAM saved: %d bytes, flash change: %+d bytes' % (old_dram,
+    new_flash - old_names))
 
 def main():
   parser = argparse.ArgumentParser(description='Obtain Bluetooth SIG GATT IDs')
   parser.add_argument('-C', metavar='gatt.c', help='Output C file')
   parser.add_argument('-H', metavar='gatt.h', help='Output H file')
+  parser.add_argument('-s', '--snapshot', metavar='DIR', default=SNAPSHOT_DIR,
+    help='Snapshot directory (default: %(default)s)')
+  parser.add_argument('--refresh', action='store_true',
+    help='Download the definitions from bluetooth.com and update the snapshot')
   args = parser.parse_args()
 
-  print('Getting list of services')
-  get_list(SERVICES_URL, parse_services)
-  print('Getting list of characteristics')
-  get_list(CHARACTERISTICS_URL, parse_characteristics)
+  if args.refresh:
+    refresh(args.snapshot)
+    return
+
+  print('Loading snapshot from ' + args.snapshot)
+  load_snapshot(args.snapshot)
 
   print('Generating source code')
   write_h(args.H)
-  write_c(args.C)
+  size_report(*write_c(args.C))
 
 if __name__ == '__main__':
   main()
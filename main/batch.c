@@ -0,0 +1,138 @@
+#include "batch.h"
+#include "cbor.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Constants */
+#define BATCH_SIZE_MAX 4096
+/* Room for the array head, written once the batch is complete */
+#define BATCH_HEAD_MAX 9
+/* Sample array head and timestamp */
+#define BATCH_SAMPLE_OVERHEAD 10
+
+static const char *TAG = "Batch";
+
+/* Types */
+typedef struct batch_t {
+    struct batch_t *next;
+    mac_addr_t mac;
+    ble_uuid_t service;
+    ble_uuid_t characteristic;
+    uint32_t count;
+    size_t len;
+    size_t size;
+    uint8_t buf[];
+} batch_t;
+
+/* Internal state */
+static batch_t *batches = NULL;
+
+/* Callback functions */
+static batch_on_ready_cb_t on_ready_cb = NULL;
+
+void batch_set_on_ready_cb(batch_on_ready_cb_t cb)
+{
+    on_ready_cb = cb;
+}
+
+static batch_t *batch_get(mac_addr_t mac, ble_uuid_t service,
+    ble_uuid_t characteristic, uint32_t samples, size_t len)
+{
+    batch_t *batch;
+    size_t size;
+
+    for (batch = batches; batch; batch = batch->next)
+    {
+        if (!memcmp(batch->mac, mac, sizeof(mac_addr_t)) &&
+            !memcmp(batch->characteristic, characteristic, sizeof(ble_uuid_t)))
+        {
+            return batch;
+        }
+    }
+
+    /* Sized by the first value, later ones may be published early if larger */
+    size = samples * (len + BATCH_SAMPLE_OVERHEAD);
+    if (size > BATCH_SIZE_MAX)
+        size = BATCH_SIZE_MAX;
+
+    if (!(batch = malloc(sizeof(*batch) + BATCH_HEAD_MAX + size)))
+        return NULL;
+
+    memcpy(batch->mac, mac, sizeof(mac_addr_t));
+    memcpy(batch->service, service, sizeof(ble_uuid_t));
+    memcpy(batch->characteristic, characteristic, sizeof(ble_uuid_t));
+    batch->count = 0;
+    batch->len = 0;
+    batch->size = size;
+    batch->next = batches;
+    batches = batch;
+
+    return batch;
+}
+
+static void batch_publish(batch_t *batch)
+{
+    uint8_t *start;
+
+    if (!batch->count)
+        return;
+
+    /* The head is placed right before the first sample */
+    start = batch->buf + BATCH_HEAD_MAX - cbor_head_len(batch->count);
+    cbor_head(start, CBOR_MAJOR_ARRAY, batch->count);
+
+    if (on_ready_cb)
+    {
+        on_ready_cb(batch->mac, batch->service, batch->characteristic, start,
+            batch->buf + BATCH_HEAD_MAX + batch->len - start);
+    }
+
+    batch->count = 0;
+    batch->len = 0;
+}
+
+int batch_add(mac_addr_t mac, ble_uuid_t service, ble_uuid_t characteristic,
+    uint32_t samples, const uint8_t *value, size_t len)
+{
+    batch_t *batch = batch_get(mac, service, characteristic, samples, len);
+    uint8_t *p;
+
+    if (!batch || len + BATCH_SAMPLE_OVERHEAD > batch->size)
+        return -1;
+
+    if (len + BATCH_SAMPLE_OVERHEAD > batch->size - batch->len)
+        batch_publish(batch);
+
+    p = batch->buf + BATCH_HEAD_MAX + batch->len;
+    p = cbor_head(p, CBOR_MAJOR_ARRAY, 2);
+    p = cbor_uint(p, esp_timer_get_time() / 1000);
+    memcpy(p, value, len);
+    batch->len = p + len - (batch->buf + BATCH_HEAD_MAX);
+
+    if (++batch->count >= samples)
+        batch_publish(batch);
+
+    return 0;
+}
+
+void batch_flush(mac_addr_t mac)
+{
+    batch_t **cur = &batches, *batch;
+
+    while (*cur)
+    {
+        batch = *cur;
+        if (memcmp(batch->mac, mac, sizeof(mac_addr_t)))
+        {
+            cur = &batch->next;
+            continue;
+        }
+
+        ESP_LOGD(TAG, "Flushing %u pending samples", batch->count);
+        batch_publish(batch);
+        *cur = batch->next;
+        free(batch);
+    }
+}
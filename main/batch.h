@@ -0,0 +1,24 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "ble_utils.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* Event callback types */
+typedef void (*batch_on_ready_cb_t)(mac_addr_t mac, ble_uuid_t service,
+    ble_uuid_t characteristic, uint8_t *payload, size_t len);
+
+/* Callback registration */
+void batch_set_on_ready_cb(batch_on_ready_cb_t cb);
+
+/* Batches of CBOR encoded values. Each value is added as a
+ * [timestamp, value] array, with the timestamp in milliseconds since boot, and
+ * the batch is published as an array of these once it holds the requested
+ * number of samples or the next one doesn't fit */
+int batch_add(mac_addr_t mac, ble_uuid_t service, ble_uuid_t characteristic,
+    uint32_t samples, const uint8_t *value, size_t len);
+/* Publishes and releases any pending batches of a device */
+void batch_flush(mac_addr_t mac);
+
+#endif
@@ -1,4 +1,7 @@
 #include "ble.h"
+#include "capture.h"
+#include "metrics.h"
+#include "trace.h"
 #include <esp_bt.h>
 #include <esp_bt_main.h>
 #include <esp_gap_ble_api.h>
@@ -7,6 +10,7 @@
 #include <esp_gatt_common_api.h>
 #include <esp_err.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/timers.h>
 #include <string.h>
@@ -15,6 +19,12 @@
 #define INVALID_HANDLE 0
 
 static const char *TAG = "BLE";
+
+/* Constants */
+/* Bond removals are reported as completed after this long even if the stack
+ * didn't raise all of their completion events */
+#define BOND_REMOVAL_TIMEOUT_MS 5000
+
 static esp_ble_scan_params_t ble_scan_params = {
     .scan_type = BLE_SCAN_TYPE_ACTIVE,
     .own_addr_type = BLE_ADDR_TYPE_RANDOM,
@@ -34,6 +44,8 @@ static esp_ble_scan_params_t ble_scan_params = {
      * Time Range: 2.5 msec to 10240 msec
      */
     .scan_window = 16, /* 16 * 0.625ms = 10ms */
+    /* Devices are only reported once per scan, see ble_scan_restart() */
+    .scan_duplicate = BLE_SCAN_DUPLICATE_ENABLE,
 };
 
 /* Types */
@@ -41,6 +53,8 @@ typedef enum {
     BLE_OPERATION_TYPE_READ,
     BLE_OPERATION_TYPE_WRITE,
     BLE_OPERATION_TYPE_WRITE_CHAR,
+    BLE_OPERATION_TYPE_READ_FORMAT,
+    BLE_OPERATION_TYPE_READ_DESCRIPTION,
 } ble_operation_type_t;
 
 typedef struct ble_operation_t {
@@ -50,6 +64,7 @@ typedef struct ble_operation_t {
     ble_characteristic_t *characteristic;
     size_t len;
     uint8_t *value;
+    int64_t enqueued;
 } ble_operation_t;
 
 /* Internal state */
@@ -57,6 +72,13 @@ static uint8_t scan_requested = 0;
 static esp_gatt_if_t g_gattc_if = ESP_GATT_IF_NONE;
 static ble_device_t *devices_list = NULL;
 static ble_operation_t *operation_queue = NULL;
+static ble_operation_t *operation_current = NULL;
+static int pending_bond_removals = 0;
+static TimerHandle_t bond_removal_timer = NULL;
+static uint8_t is_privacy_set = 0;
+static uint16_t whitelist_size = 0;
+static uint16_t whitelist_pending = 0;
+static uint8_t whitelist_failed = 0;
 
 /* Callback functions */
 static ble_on_device_discovered_cb_t on_device_discovered_cb = NULL;
@@ -67,6 +89,7 @@ static ble_on_device_services_discovered_cb_t
 static ble_on_device_characteristic_value_cb_t
     on_device_characteristic_value_cb = NULL;
 static ble_on_passkey_requested_cb_t on_passkey_requested_cb = NULL;
+static ble_on_bonds_removed_cb_t on_bonds_removed_cb = NULL;
 
 void ble_set_on_device_discovered_cb(ble_on_device_discovered_cb_t cb)
 {
@@ -100,22 +123,145 @@ void ble_set_on_passkey_requested_cb(ble_on_passkey_requested_cb_t cb)
     on_passkey_requested_cb = cb;
 }
 
-void ble_clear_bonding_info(void)
+void ble_set_on_bonds_removed_cb(ble_on_bonds_removed_cb_t cb)
 {
-    int i, dev_num = esp_ble_get_bond_device_num();
+    on_bonds_removed_cb = cb;
+}
 
-    esp_ble_bond_dev_t *dev_list = (esp_ble_bond_dev_t *)malloc(
-        sizeof(esp_ble_bond_dev_t) * dev_num);
+static int ble_device_is_bonded(mac_addr_t mac)
+{
+    int i, dev_num = esp_ble_get_bond_device_num(), found = 0;
+    esp_ble_bond_dev_t *dev_list;
+
+    if (dev_num <= 0 ||
+        !(dev_list = malloc(sizeof(esp_ble_bond_dev_t) * dev_num)))
+    {
+        return 0;
+    }
 
+    esp_ble_get_bond_device_list(&dev_num, dev_list);
+    for (i = 0; i < dev_num && !found; i++)
+        found = !memcmp(dev_list[i].bd_addr, mac, sizeof(mac_addr_t));
+
+    free(dev_list);
+    return found;
+}
+
+/* A bond removal completed or failed, notify app once all requested bonds
+ * were removed. Called from both the BLE task and the caller of
+ * ble_remove_bonds() */
+static void ble_bond_removal_done(void)
+{
+    int pending = __atomic_load_n(&pending_bond_removals, __ATOMIC_SEQ_CST);
+
+    /* Nothing is pending if the removals timed out or weren't requested */
+    do
+    {
+        if (!pending)
+            return;
+    } while (!__atomic_compare_exchange_n(&pending_bond_removals, &pending,
+        pending - 1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+
+    if (pending > 1)
+        return;
+
+    xTimerStop(bond_removal_timer, 0);
+    if (on_bonds_removed_cb)
+        on_bonds_removed_cb();
+}
+
+static void ble_bond_removal_timer_cb(TimerHandle_t xTimer)
+{
+    /* Nothing left pending if the last removal completed meanwhile */
+    if (!__atomic_exchange_n(&pending_bond_removals, 0, __ATOMIC_SEQ_CST))
+        return;
+
+    ESP_LOGE(TAG, "Timed out waiting for bond removals to complete");
+    if (on_bonds_removed_cb)
+        on_bonds_removed_cb();
+}
+
+int ble_remove_bonds(ble_should_remove_bond_cb_t should_remove)
+{
+    int i, count = 0, dev_num = esp_ble_get_bond_device_num();
+    esp_ble_bond_dev_t *dev_list;
+
+    if (dev_num <= 0 ||
+        !(dev_list = malloc(sizeof(esp_ble_bond_dev_t) * dev_num)))
+    {
+        return 0;
+    }
+
+    /* Select the bonds first, completions of the first removals may be
+     * handled before the following ones are issued */
     esp_ble_get_bond_device_list(&dev_num, dev_list);
     for (i = 0; i < dev_num; i++)
-        esp_ble_remove_bond_device(dev_list[i].bd_addr);
+    {
+        if (!should_remove || should_remove(dev_list[i].bd_addr))
+            memcpy(&dev_list[count++], &dev_list[i], sizeof(dev_list[0]));
+    }
+
+    if (count && !bond_removal_timer && !(bond_removal_timer =
+        xTimerCreate("ble_bonds", pdMS_TO_TICKS(BOND_REMOVAL_TIMEOUT_MS),
+        pdFALSE, NULL, ble_bond_removal_timer_cb)))
+    {
+        free(dev_list);
+        return 0;
+    }
 
-    /* Block until all bonding information is removed */
-    while (esp_ble_get_bond_device_num())
-        vTaskDelay(500 / portTICK_PERIOD_MS);
+    /* Removal completes asynchronously, see
+     * ESP_GAP_BLE_REMOVE_BOND_DEV_COMPLETE_EVT */
+    __atomic_store_n(&pending_bond_removals, count, __ATOMIC_SEQ_CST);
+    if (count)
+        xTimerStart(bond_removal_timer, 0);
+    for (i = 0; i < count; i++)
+    {
+        ESP_LOGI(TAG, "Removing bond of %s", mactoa(dev_list[i].bd_addr));
+        if (esp_ble_remove_bond_device(dev_list[i].bd_addr))
+        {
+            ESP_LOGE(TAG, "Failed removing bond of %s",
+                mactoa(dev_list[i].bd_addr));
+            ble_bond_removal_done();
+        }
+    }
 
     free(dev_list);
+    return count;
+}
+
+/* Scan parameters are set once local privacy is configured and the
+ * controller whitelist is programmed. Advertisements of devices not in the
+ * whitelist are then dropped by the controller instead of the host. The
+ * whitelist API doesn't take an address type, entries are added as public
+ * addresses */
+static void ble_scan_params_update(void)
+{
+    if (!is_privacy_set || whitelist_pending)
+        return;
+
+    ble_scan_params.scan_filter_policy = whitelist_size && !whitelist_failed ?
+        BLE_SCAN_FILTER_ALLOW_ONLY_WLST : BLE_SCAN_FILTER_ALLOW_ALL;
+    ESP_ERROR_CHECK(esp_ble_gap_set_scan_params(&ble_scan_params));
+}
+
+int ble_whitelist_add(mac_addr_t mac)
+{
+    uint16_t max_size;
+
+    /* If any device can't be added, scans are filtered on the host only */
+    if (esp_ble_gap_get_whitelist_size(&max_size) ||
+        whitelist_size == max_size || esp_ble_gap_update_whitelist(true, mac))
+    {
+        ESP_LOGW(TAG, "Failed adding %s to the controller whitelist",
+            mactoa(mac));
+        whitelist_failed = 1;
+        ble_scan_params_update();
+        return -1;
+    }
+
+    whitelist_size++;
+    whitelist_pending++;
+    return 0;
 }
 
 int ble_scan_start(void)
@@ -135,6 +281,17 @@ int ble_scan_stop(void)
     return esp_ble_gap_stop_scanning();
 }
 
+/* Restarting the scan resets the controller's duplicate filter, so devices
+ * removed from the cache are reported again */
+static void ble_scan_restart(void)
+{
+    if (!scan_requested)
+        return;
+
+    esp_ble_gap_stop_scanning();
+    esp_ble_gap_start_scanning(-1);
+}
+
 int ble_connect(mac_addr_t mac)
 {
     ble_device_t *dev = ble_device_find_by_mac(devices_list, mac);
@@ -219,7 +376,8 @@ static void ble_update_cache(ble_device_t *dev)
         free(db);
         return;
     }
-    
+    capture_gattc_db(dev->conn_id, db, count);
+
     /* Find all characteristics and cache them */
     for (i = 0; i < count; i++)
     {
@@ -235,15 +393,53 @@ static void ble_update_cache(ble_device_t *dev)
                 characteristic_uuid, db[i].attribute_handle, db[i].properties);
         }
         else if (db[i].type == ESP_GATT_DB_DESCRIPTOR &&
-            db[i].uuid.len == ESP_UUID_LEN_16 &&
-            db[i].uuid.uuid.uuid16 == ESP_GATT_UUID_CHAR_CLIENT_CONFIG)
+            db[i].uuid.len == ESP_UUID_LEN_16)
         {
-            characteristic->client_config_handle = db[i].attribute_handle;
+            switch (db[i].uuid.uuid.uuid16)
+            {
+            case ESP_GATT_UUID_CHAR_CLIENT_CONFIG:
+                characteristic->client_config_handle = db[i].attribute_handle;
+                break;
+            /* Aggregated values have several, only the first is used */
+            case ESP_GATT_UUID_CHAR_PRESENT_FORMAT:
+                if (!characteristic->presentation_format_handle)
+                {
+                    characteristic->presentation_format_handle =
+                        db[i].attribute_handle;
+                }
+                break;
+            case ESP_GATT_UUID_CHAR_DESCRIPTION:
+                characteristic->user_description_handle =
+                    db[i].attribute_handle;
+                break;
+            }
         }
     }
     free(db);
 }
 
+static ble_characteristic_t *ble_device_characteristic_find_by_descriptor(
+    ble_device_t *dev, uint16_t handle)
+{
+    ble_service_t *service;
+    ble_characteristic_t *characteristic;
+
+    for (service = dev->services; service; service = service->next)
+    {
+        for (characteristic = service->characteristics; characteristic;
+            characteristic = characteristic->next)
+        {
+            if (characteristic->presentation_format_handle == handle ||
+                characteristic->user_description_handle == handle)
+            {
+                return characteristic;
+            }
+        }
+    }
+
+    return NULL;
+}
+
 int ble_foreach_characteristic(mac_addr_t mac,
     ble_on_device_characteristic_found_cb_t cb)
 {
@@ -271,52 +467,135 @@ int ble_foreach_characteristic(mac_addr_t mac,
     return 0;
 }
 
-static inline void ble_operation_perform(ble_operation_t *operation)
+static inline esp_err_t ble_operation_perform(ble_operation_t *operation)
 {
     switch (operation->type)
     {
     case BLE_OPERATION_TYPE_READ:
-        esp_ble_gattc_read_char(g_gattc_if, operation->device->conn_id,
+        return esp_ble_gattc_read_char(g_gattc_if, operation->device->conn_id,
             operation->characteristic->handle, ESP_GATT_AUTH_REQ_NONE);
-        break;
     case BLE_OPERATION_TYPE_WRITE:
-        esp_ble_gattc_write_char(g_gattc_if, operation->device->conn_id,
+        return esp_ble_gattc_write_char(g_gattc_if, operation->device->conn_id,
             operation->characteristic->handle, operation->len, operation->value,
             ESP_GATT_WRITE_TYPE_RSP, ESP_GATT_AUTH_REQ_NONE);
-        break;
     case BLE_OPERATION_TYPE_WRITE_CHAR:
-        esp_ble_gattc_write_char_descr(g_gattc_if, operation->device->conn_id,
+        return esp_ble_gattc_write_char_descr(g_gattc_if,
+            operation->device->conn_id,
             operation->characteristic->client_config_handle, operation->len,
             operation->value,
             ESP_GATT_WRITE_TYPE_RSP, ESP_GATT_AUTH_REQ_NONE);
-        break;
+    case BLE_OPERATION_TYPE_READ_FORMAT:
+        return esp_ble_gattc_read_char_descr(g_gattc_if,
+            operation->device->conn_id,
+            operation->characteristic->presentation_format_handle,
+            ESP_GATT_AUTH_REQ_NONE);
+    case BLE_OPERATION_TYPE_READ_DESCRIPTION:
+        return esp_ble_gattc_read_char_descr(g_gattc_if,
+            operation->device->conn_id,
+            operation->characteristic->user_description_handle,
+            ESP_GATT_AUTH_REQ_NONE);
     }
 
+    return ESP_FAIL;
+}
+
+static void ble_operation_free(ble_operation_t *operation)
+{
+    if (!operation)
+        return;
+
     if (operation->len)
         free(operation->value);
     free(operation);
 }
 
+/* A descriptor read completed or failed. Once all were read, notify app that
+ * the services were discovered */
+static void ble_device_descriptor_read(ble_device_t *device)
+{
+    if (device->pending_descriptors && !--device->pending_descriptors &&
+        on_device_services_discovered_cb)
+    {
+        on_device_services_discovered_cb(device->mac);
+    }
+}
+
 static void ble_operation_dequeue(ble_operation_t **queue)
 {
-    ble_operation_t *operation = *queue;
+    ble_operation_t **iter, *operation;
 
-    /* Queue is empty, nothing to do */
-    if (!operation)
-        return;
+    /* The operation in progress, if any, has completed */
+    ble_operation_free(operation_current);
+    operation_current = NULL;
 
-    *queue = operation->next;
-    ESP_LOGD(TAG, "Dequeue: type: %d, device: %s, char: %s, len: %u, val: %p",
-        operation->type, mactoa(operation->device->mac),
-        uuidtoa(operation->characteristic->uuid), operation->len,
-        operation->value);
-    ble_operation_perform(operation);
+    while (1)
+    {
+        /* Operations of devices being authenticated are parked until it
+         * completes */
+        for (iter = queue; *iter && (*iter)->device->is_authenticating;
+            iter = &(*iter)->next);
+
+        /* Queue is empty or parked, nothing to do */
+        if (!(operation = *iter))
+            return;
+
+        *iter = operation->next;
+        metrics_gauge_add(METRICS_GAUGE_QUEUE_DEPTH, -1);
+        metrics_histogram_record(METRICS_HISTOGRAM_QUEUE_WAIT,
+            esp_timer_get_time() - operation->enqueued);
+        ESP_LOGD(TAG, "Dequeue: type: %d, device: %s, char: %s, len: %u, "
+            "val: %p", operation->type, mactoa(operation->device->mac),
+            uuidtoa(operation->characteristic->uuid),
+            (unsigned)operation->len, operation->value);
+
+        /* No completion event follows a failed request, move on */
+        if (!ble_operation_perform(operation))
+            break;
+
+        ESP_LOGE(TAG, "Failed performing operation %d on %s",
+            operation->type, mactoa(operation->device->mac));
+        if (operation->type == BLE_OPERATION_TYPE_READ_FORMAT ||
+            operation->type == BLE_OPERATION_TYPE_READ_DESCRIPTION)
+        {
+            ble_device_descriptor_read(operation->device);
+        }
+        ble_operation_free(operation);
+    }
+
+    operation_current = operation;
+}
+
+/* Drops the operations of a disconnected device */
+static void ble_operation_remove_by_device(ble_operation_t **queue,
+    ble_device_t *device)
+{
+    ble_operation_t **iter = queue, *operation;
+
+    while (*iter)
+    {
+        if ((*iter)->device != device)
+        {
+            iter = &(*iter)->next;
+            continue;
+        }
+
+        operation = *iter;
+        *iter = operation->next;
+        metrics_gauge_add(METRICS_GAUGE_QUEUE_DEPTH, -1);
+        ble_operation_free(operation);
+    }
+
+    /* Its completion event won't arrive */
+    if (operation_current && operation_current->device == device)
+        ble_operation_dequeue(queue);
 }
 
 static void ble_queue_timer_cb(TimerHandle_t xTimer)
 {
     ESP_LOGD(TAG, "Queue timer expired");
-    ble_operation_dequeue(&operation_queue);
+    /* Operations are otherwise started as the previous one completes */
+    if (!operation_current)
+        ble_operation_dequeue(&operation_queue);
 }
 
 static void ble_operation_enqueue(ble_operation_t **queue,
@@ -338,14 +617,16 @@ static void ble_operation_enqueue(ble_operation_t **queue,
     }
     else
         operation->value = NULL;
+    operation->enqueued = esp_timer_get_time();
 
     ESP_LOGD(TAG, "Enqueue: type: %d, device: %s, char: %s, len: %u, val: %p",
         operation->type, mactoa(operation->device->mac),
-        uuidtoa(operation->characteristic->uuid), operation->len,
+        uuidtoa(operation->characteristic->uuid), (unsigned)operation->len,
         operation->value);
 
     for (iter = queue; *iter; iter = &(*iter)->next);
     *iter = operation;
+    metrics_gauge_add(METRICS_GAUGE_QUEUE_DEPTH, 1);
 
     /* Create timer */
     if (timer == NULL)
@@ -354,11 +635,95 @@ static void ble_operation_enqueue(ble_operation_t **queue,
             ble_queue_timer_cb);
     }
 
-    /* First item in queue or timer is already running, reset timer */
-    if (!(*queue)->next || xTimerIsTimerActive(timer))
+    /* No operation in progress or timer is already running, reset timer */
+    if (!operation_current || xTimerIsTimerActive(timer))
         xTimerReset(timer, 0);
 }
 
+static void ble_device_encrypt(ble_device_t *device)
+{
+    if (device->is_authenticating)
+        return;
+
+    device->is_authenticating = 1;
+    esp_ble_set_encryption(device->mac, ESP_BLE_SEC_ENCRYPT_MITM);
+}
+
+/* An operation rejected for lack of security is parked at the head of the
+ * queue and retried once the device is authenticated, unless this was already
+ * attempted on this connection */
+static int ble_operation_park(ble_operation_t **queue, esp_gatt_status_t status)
+{
+    ble_operation_t *operation = operation_current;
+
+    if (!operation || (status != ESP_GATT_INSUF_AUTHENTICATION &&
+        status != ESP_GATT_INSUF_ENCRYPTION) ||
+        operation->device->is_authenticated ||
+        operation->device->is_auth_failed)
+    {
+        return -1;
+    }
+
+    ESP_LOGD(TAG, "Parking operation %d until %s is authenticated",
+        operation->type, mactoa(operation->device->mac));
+    operation_current = NULL;
+    operation->next = *queue;
+    *queue = operation;
+    metrics_gauge_add(METRICS_GAUGE_QUEUE_DEPTH, 1);
+    ble_device_encrypt(operation->device);
+
+    return 0;
+}
+
+/* Time from connecting until the first value received over an encrypted
+ * link */
+static void ble_device_value_received(ble_device_t *device)
+{
+    if (!device->is_authenticated || !device->connected)
+        return;
+
+    metrics_histogram_record(METRICS_HISTOGRAM_FIRST_SECURE_VALUE,
+        esp_timer_get_time() - device->connected);
+    device->connected = 0;
+}
+
+/* Descriptors are read once per characteristic UUID, as devices of the same
+ * kind share them */
+static void ble_read_descriptors(ble_device_t *dev)
+{
+    ble_service_t *service;
+    ble_characteristic_t *characteristic;
+
+    for (service = dev->services; service; service = service->next)
+    {
+        for (characteristic = service->characteristics; characteristic;
+            characteristic = characteristic->next)
+        {
+            if (ble_characteristic_descriptors_are_known(dev->mac,
+                characteristic->uuid))
+            {
+                continue;
+            }
+
+            if (characteristic->presentation_format_handle)
+            {
+                ble_operation_enqueue(&operation_queue,
+                    BLE_OPERATION_TYPE_READ_FORMAT, dev, characteristic, 0,
+                    NULL);
+                dev->pending_descriptors++;
+            }
+
+            if (characteristic->user_description_handle)
+            {
+                ble_operation_enqueue(&operation_queue,
+                    BLE_OPERATION_TYPE_READ_DESCRIPTION, dev, characteristic,
+                    0, NULL);
+                dev->pending_descriptors++;
+            }
+        }
+    }
+}
+
 int ble_characteristic_read(mac_addr_t mac, ble_uuid_t service_uuid,
     ble_uuid_t characteristic_uuid)
 {
@@ -418,7 +783,7 @@ int ble_characteristic_write(mac_addr_t mac, ble_uuid_t service_uuid,
 int ble_characteristic_notify_register(mac_addr_t mac, ble_uuid_t service_uuid,
     ble_uuid_t characteristic_uuid)
 {
-    uint16_t notify_en = 1;
+    uint16_t client_config;
     ble_device_t *device;
     ble_service_t *service;
     ble_characteristic_t *characteristic;
@@ -435,7 +800,12 @@ int ble_characteristic_notify_register(mac_addr_t mac, ble_uuid_t service_uuid,
         return -1;
     }
 
-    if (!(characteristic->properties & CHAR_PROP_NOTIFY))
+    /* Notifications are preferred as they aren't confirmed */
+    if (characteristic->properties & CHAR_PROP_NOTIFY)
+        client_config = 0x0001;
+    else if (characteristic->properties & CHAR_PROP_INDICATE)
+        client_config = 0x0002;
+    else
         return -1;
 
     if (characteristic->client_config_handle == 0)
@@ -448,7 +818,8 @@ int ble_characteristic_notify_register(mac_addr_t mac, ble_uuid_t service_uuid,
     }
 
     ble_operation_enqueue(&operation_queue, BLE_OPERATION_TYPE_WRITE_CHAR,
-        device, characteristic, sizeof(notify_en), (uint8_t *)&notify_en);
+        device, characteristic, sizeof(client_config),
+        (uint8_t *)&client_config);
 
     return 0;
 }
@@ -479,6 +850,8 @@ int ble_characteristic_notify_unregister(mac_addr_t mac,
 static void gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
 {
     ESP_LOGD(TAG, "Received GAP event %d (%s)", event, gap_event_to_str(event));
+    metrics_ble_gap_event(event);
+    capture_gap_event(event, param);
 
     switch (event)
     {
@@ -489,7 +862,19 @@ static void gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
                 param->local_privacy_cmpl.status);
             break;
         }
-        ESP_ERROR_CHECK(esp_ble_gap_set_scan_params(&ble_scan_params));
+        is_privacy_set = 1;
+        ble_scan_params_update();
+        break;
+    case ESP_GAP_BLE_ADD_WHITELIST_COMPLETE_EVT:
+        if (param->add_whitelist_cmpl.status != ESP_BT_STATUS_SUCCESS)
+        {
+            ESP_LOGE(TAG, "Updating whitelist failed, status: 0x%x",
+                param->add_whitelist_cmpl.status);
+            whitelist_failed = 1;
+        }
+
+        if (whitelist_pending && !--whitelist_pending)
+            ble_scan_params_update();
         break;
     case ESP_GAP_BLE_SCAN_START_COMPLETE_EVT:
         if (param->scan_start_cmpl.status != ESP_BT_STATUS_SUCCESS)
@@ -542,16 +927,36 @@ static void gap_cb(esp_gap_ble_cb_event_t event, esp_ble_gap_cb_param_t *param)
         ble_device_t *device = ble_device_find_by_mac(devices_list,
             param->ble_security.auth_cmpl.bd_addr);
 
-        if (device)
-            device->is_authenticating = 0;
-
         if (!param->ble_security.auth_cmpl.success)
         {
             ESP_LOGE(TAG, "Authentication failed, status: 0x%x",
                 param->ble_security.auth_cmpl.fail_reason);
         }
+
+        if (!device)
+            break;
+
+        device->is_authenticating = 0;
+        if (param->ble_security.auth_cmpl.success)
+            device->is_authenticated = 1;
+        else
+            device->is_auth_failed = 1;
+
+        /* Resume the operations parked meanwhile */
+        if (!operation_current)
+            ble_operation_dequeue(&operation_queue);
         break;
     }
+    case ESP_GAP_BLE_REMOVE_BOND_DEV_COMPLETE_EVT:
+        if (param->remove_bond_dev_cmpl.status != ESP_BT_STATUS_SUCCESS)
+        {
+            ESP_LOGE(TAG, "Removing bond of %s failed, status: 0x%x",
+                mactoa(param->remove_bond_dev_cmpl.bd_addr),
+                param->remove_bond_dev_cmpl.status);
+        }
+
+        ble_bond_removal_done();
+        break;
     default:
         ESP_LOGD(TAG, "GAP event %d wasn't handled", event);
         break;
@@ -565,6 +970,8 @@ static void esp_gattc_cb(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if,
 
     ESP_LOGD(TAG, "Received GATTC event %d (%s), gattc_if %d", event,
         gattc_event_to_str(event), gattc_if);
+    metrics_ble_gattc_event(event);
+    capture_gattc_event(event, gattc_if, param);
 
     switch (event)
     {
@@ -590,6 +997,13 @@ static void esp_gattc_cb(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if,
         /* Save device connection ID */
         device = ble_device_find_by_mac(devices_list, param->open.remote_bda);
         device->conn_id = param->open.conn_id;
+        device->connected = esp_timer_get_time();
+        metrics_counter_inc(METRICS_COUNTER_BLE_CONNECTS);
+
+        /* Bonded devices are encrypted right away instead of after their
+         * first rejected operation */
+        if (ble_device_is_bonded(device->mac))
+            ble_device_encrypt(device);
 
         /* Configure MTU */
         ESP_ERROR_CHECK(esp_ble_gattc_send_mtu_req(gattc_if,
@@ -598,14 +1012,28 @@ static void esp_gattc_cb(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if,
         break;
     }
     case ESP_GATTC_CLOSE_EVT:
+    {
+        ble_device_t *device;
+
         ESP_LOGI(TAG, "Connection closed, reason = 0x%x", param->close.reason);
+        metrics_counter_inc(METRICS_COUNTER_BLE_DISCONNECTS);
+        metrics_ble_disconnected(param->close.remote_bda);
         /* Notify app that the device is disconnected */
         if (on_device_disconnected_cb)
             on_device_disconnected_cb(param->close.remote_bda);
 
+        /* Drop its pending operations */
+        if ((device = ble_device_find_by_mac(devices_list,
+            param->close.remote_bda)))
+        {
+            ble_operation_remove_by_device(&operation_queue, device);
+        }
+
         /* Remove device from cache */
         ble_device_remove_by_mac(&devices_list, param->close.remote_bda);
+        ble_scan_restart();
         break;
+    }
     case ESP_GATTC_CFG_MTU_EVT:
         if (param->cfg_mtu.status != ESP_GATT_OK)
         {
@@ -625,6 +1053,9 @@ static void esp_gattc_cb(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if,
 
         break;
     case ESP_GATTC_SEARCH_CMPL_EVT:
+    {
+        ble_device_t *dev;
+
         if (param->search_cmpl.status != ESP_GATT_OK)
         {
             ESP_LOGE(TAG, "Searching services failed, status = 0x%x",
@@ -632,17 +1063,60 @@ static void esp_gattc_cb(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if,
             break;
         }
 
-        /* Notify app that the services were discovered */
-        if (on_device_services_discovered_cb)
+        if (!(dev = ble_device_find_by_conn_id(devices_list,
+            param->search_cmpl.conn_id)))
         {
-            ble_device_t *dev = ble_device_find_by_conn_id(devices_list,
-                param->search_cmpl.conn_id);
+            break;
+        }
 
-            if (dev)
-                on_device_services_discovered_cb(dev->mac);
+        /* Descriptors decoding and naming characteristics are read first */
+        if (!dev->services)
+            ble_update_cache(dev);
+        ble_read_descriptors(dev);
+
+        /* Notify app that the services were discovered */
+        if (!dev->pending_descriptors && on_device_services_discovered_cb)
+            on_device_services_discovered_cb(dev->mac);
+
+        break;
+    }
+    case ESP_GATTC_READ_DESCR_EVT:
+    {
+        ble_device_t *device = ble_device_find_by_conn_id(devices_list,
+            param->read.conn_id);
+        ble_characteristic_t *characteristic;
+
+        need_dequeue = 1;
+
+        if (!device)
+            break;
+
+        characteristic = ble_device_characteristic_find_by_descriptor(device,
+            param->read.handle);
+        if (param->read.status != ESP_GATT_OK)
+        {
+            ESP_LOGE(TAG, "Failed reading descriptor, status = 0x%x",
+                param->read.status);
+        }
+        else if (!characteristic)
+            ESP_LOGE(TAG, "Unknown descriptor 0x%x", param->read.handle);
+        else if (param->read.handle ==
+            characteristic->presentation_format_handle)
+        {
+            ble_characteristic_presentation_format_set(device->mac,
+                characteristic->uuid, param->read.value,
+                param->read.value_len);
+        }
+        else
+        {
+            ble_characteristic_user_description_set(device->mac,
+                characteristic->uuid, param->read.value,
+                param->read.value_len);
         }
 
+        ble_device_descriptor_read(device);
         break;
+    }
     case ESP_GATTC_READ_CHAR_EVT:
     {
         ble_device_t *device = ble_device_find_by_conn_id(devices_list,
@@ -658,39 +1132,30 @@ static void esp_gattc_cb(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if,
         if (param->read.status != ESP_GATT_OK)
         {
             /* Check if authentication/encryption is needed */
-            if (param->read.status == ESP_GATT_INSUF_AUTHENTICATION ||
-                param->read.status == ESP_GATT_INSUF_ENCRYPTION)
-            {
-                if (!device->is_authenticating)
-                {
-                    device->is_authenticating = 1;
-                    esp_ble_set_encryption(device->mac,
-                        ESP_BLE_SEC_ENCRYPT_MITM);
-                }
-                /* Try again */
-                esp_ble_gattc_read_char(g_gattc_if, param->read.conn_id,
-                        param->read.handle, ESP_GATT_AUTH_REQ_NONE);
-                need_dequeue = 0;
-            }
-            else
+            if (ble_operation_park(&operation_queue, param->read.status))
             {
                 ESP_LOGE(TAG, "Failed reading characteristic, status = 0x%x",
                         param->read.status);
+                metrics_counter_inc(METRICS_COUNTER_BLE_VALUES_DROPPED);
             }
         }
         else if (!ble_device_info_get_by_conn_id_handle(devices_list,
             param->read.conn_id, param->read.handle, &device, &service,
             &characteristic) && on_device_characteristic_value_cb)
         {
+            ble_device_value_received(device);
+            trace_begin(TRACE_STAGE_BLE_READ);
             on_device_characteristic_value_cb(device->mac, service->uuid,
                 characteristic->uuid, param->read.value, param->read.value_len);
+            trace_end();
         }
 
         break;
     }
     case ESP_GATTC_WRITE_CHAR_EVT:
         need_dequeue = 1;
-        if (param->write.status != ESP_GATT_OK)
+        if (param->write.status != ESP_GATT_OK &&
+            ble_operation_park(&operation_queue, param->write.status))
         {
             ESP_LOGE(TAG, "Failed writing characteristic, status = 0x%x",
                 param->write.status);
@@ -698,6 +1163,14 @@ static void esp_gattc_cb(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if,
         break;
     case ESP_GATTC_WRITE_DESCR_EVT:
         need_dequeue = 1;
+        /* Notifications of secured characteristics are enabled once
+         * authenticated */
+        if (param->write.status != ESP_GATT_OK &&
+            ble_operation_park(&operation_queue, param->write.status))
+        {
+            ESP_LOGE(TAG, "Failed writing descriptor, status = 0x%x",
+                param->write.status);
+        }
         break;
     case ESP_GATTC_REG_FOR_NOTIFY_EVT:
         if (param->reg_for_notify.status != ESP_GATT_OK)
@@ -712,13 +1185,29 @@ static void esp_gattc_cb(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if,
         ble_service_t *service;
         ble_characteristic_t *characteristic;
 
-        if (!ble_device_info_get_by_conn_id_handle(devices_list,
+        /* Indications were already confirmed by Bluedroid before this event
+         * was raised, so the device may send the next one while this value is
+         * published. They don't go through the operation queue */
+        if (!param->notify.is_notify)
+            metrics_counter_inc(METRICS_COUNTER_BLE_INDICATIONS);
+
+        if (ble_device_info_get_by_conn_id_handle(devices_list,
             param->notify.conn_id, param->notify.handle, &device, &service,
-            &characteristic) && on_device_characteristic_value_cb)
+            &characteristic))
+        {
+            metrics_counter_inc(METRICS_COUNTER_BLE_VALUES_DROPPED);
+            break;
+        }
+
+        metrics_ble_notification(device->mac);
+        ble_device_value_received(device);
+        if (on_device_characteristic_value_cb)
         {
+            trace_begin(TRACE_STAGE_BLE_NOTIFY);
             on_device_characteristic_value_cb(device->mac, service->uuid,
                 characteristic->uuid, param->notify.value,
                 param->notify.value_len);
+            trace_end();
         }
 
         break;
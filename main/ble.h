@@ -27,6 +27,8 @@ typedef void (*ble_on_device_characteristic_value_cb_t)(mac_addr_t mac,
     ble_uuid_t service, ble_uuid_t characteristic, uint8_t *value,
     size_t value_len);
 typedef uint32_t (*ble_on_passkey_requested_cb_t)(mac_addr_t mac);
+typedef void (*ble_on_bonds_removed_cb_t)(void);
+typedef uint8_t (*ble_should_remove_bond_cb_t)(mac_addr_t mac);
 
 /* Event handlers */
 void ble_set_on_device_discovered_cb(ble_on_device_discovered_cb_t cb);
@@ -37,10 +39,18 @@ void ble_set_on_device_services_discovered_cb(
 void ble_set_on_device_characteristic_value_cb(
     ble_on_device_characteristic_value_cb_t cb);
 void ble_set_on_passkey_requested_cb(ble_on_passkey_requested_cb_t cb);
+void ble_set_on_bonds_removed_cb(ble_on_bonds_removed_cb_t cb);
 
 /* BLE Operations */
-void ble_clear_bonding_info(void);
+/* Removes the bonds of the devices selected by the callback, or of all devices
+ * if it's NULL. Returns the number of bonds being removed, the bonds removed
+ * callback is called once they all are, or after a timeout if the stack
+ * doesn't report it */
+int ble_remove_bonds(ble_should_remove_bond_cb_t should_remove);
 
+/* Scans only report whitelisted devices once any was added. Entries are
+ * public device addresses, devices using random addresses aren't reported */
+int ble_whitelist_add(mac_addr_t mac);
 int ble_scan_start(void);
 int ble_scan_stop(void);
 
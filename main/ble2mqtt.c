@@ -1,8 +1,18 @@
 #include "config.h"
+#include "batch.h"
 #include "ble.h"
 #include "ble_utils.h"
+#include "capture.h"
+#include "dedup.h"
+#include "dlog.h"
+#include "layout.h"
+#include "metrics.h"
 #include "mqtt.h"
+#include "notify.h"
 #include "ota.h"
+#include "state.h"
+#include "trace.h"
+#include "transform.h"
 #include "wifi.h"
 #include <esp_err.h>
 #include <esp_log.h>
@@ -20,6 +30,14 @@ typedef struct {
     ble_uuid_t characteristic;
 } mqtt_ctx_t;
 
+typedef enum {
+    DEVICE_STATE_OFF,
+    DEVICE_STATE_BOTH,
+    DEVICE_STATE_ONLY,
+} device_state_mode_t;
+
+static device_state_mode_t device_state_mode = DEVICE_STATE_OFF;
+
 static char *device_name_get(void)
 {
     static char name[14] = {};
@@ -34,16 +52,30 @@ static char *device_name_get(void)
 }
 
 /* OTA functions */
+static uint8_t ble_on_bond_changed(mac_addr_t mac)
+{
+    /* Only devices whose passkey or connection policy changed pair again */
+    return config_ble_device_changed(mactoa(mac));
+}
+
+static void ble_on_bonds_removed(void)
+{
+    ESP_LOGI(TAG, "Stale bonds removed, restarting");
+    esp_restart();
+}
+
 static void ota_on_completed(ota_type_t type, ota_err_t err)
 {
     ESP_LOGI(TAG, "Update completed: %s", ota_err_to_str(err));
 
-    /* All done, restart */
+    /* All done, restart once stale bonds are removed */
     if (err == OTA_ERR_SUCCESS)
     {
-        if (type == OTA_TYPE_CONFIG)
-            ble_clear_bonding_info();
-        esp_restart();
+        if (type != OTA_TYPE_CONFIG ||
+            !ble_remove_bonds(ble_on_bond_changed))
+        {
+            esp_restart();
+        }
     }
     else
         ble_scan_start();
@@ -98,8 +130,182 @@ static void ota_unsubscribe(void)
     mqtt_unsubscribe("BLE2MQTT/OTA/Config");
 }
 
+/* Metrics functions */
+static void metrics_on_report(const char *json, size_t len)
+{
+    char topic[21];
+
+    sprintf(topic, "%s/Stats", device_name_get());
+    mqtt_publish(topic, (uint8_t *)json, len, 0, 0);
+}
+
+/* Trace functions */
+static void trace_on_dump_chunk(const char *json, size_t len)
+{
+    char topic[21];
+
+    sprintf(topic, "%s/Trace", device_name_get());
+    mqtt_publish(topic, (uint8_t *)json, len, 0, 0);
+}
+
+static void trace_on_mqtt(const char *topic, const uint8_t *payload,
+    size_t len, void *ctx)
+{
+    ESP_LOGI(TAG, "Dumping trace buffer");
+    trace_dump(trace_on_dump_chunk);
+}
+
+static void trace_subscribe(void)
+{
+    char topic[26];
+
+    sprintf(topic, "%s/Trace/Dump", device_name_get());
+    mqtt_subscribe(topic, 0, trace_on_mqtt, NULL, NULL);
+}
+
+static void trace_unsubscribe(void)
+{
+    char topic[26];
+
+    sprintf(topic, "%s/Trace/Dump", device_name_get());
+    mqtt_unsubscribe(topic);
+}
+
+/* Device state functions */
+static void state_on_publish(mac_addr_t mac, const char *json, size_t len)
+{
+    char topic[24];
+
+    sprintf(topic, "%s/State", mactoa(mac));
+    DLOGI(TAG, "Publishing: %s = %.*s", topic, (int)len, json);
+    mqtt_publish(topic, (uint8_t *)json, len, config_mqtt_qos_get(),
+        config_mqtt_retained_get());
+}
+
+static void state_initialize_from_config(void)
+{
+    const char *mode = config_mqtt_device_state_mode_get();
+
+    if (!strcmp(mode, "both"))
+        device_state_mode = DEVICE_STATE_BOTH;
+    else if (!strcmp(mode, "only"))
+        device_state_mode = DEVICE_STATE_ONLY;
+    else
+        return;
+
+    ESP_ERROR_CHECK(state_initialize(config_mqtt_device_state_debounce_get()));
+    state_set_on_publish_cb(state_on_publish);
+}
+
+/* Transform functions */
+static void transform_on_config(const char *uuid, size_t field,
+    const char *expression)
+{
+    ble_uuid_t characteristic;
+
+    if (atouuid(uuid, characteristic) ||
+        transform_add(characteristic, field, expression))
+    {
+        ESP_LOGE(TAG, "Ignoring transform of field %u of %s: %s",
+            (unsigned)field, uuid, expression);
+    }
+}
+
+/* Layout functions */
+static void layout_on_config(const char *uuid, struct cJSON *layout)
+{
+    ble_uuid_t characteristic;
+
+    if (atouuid(uuid, characteristic) || layout_add(characteristic, layout))
+        ESP_LOGE(TAG, "Ignoring layout of %s", uuid);
+}
+
+/* Log functions */
+static void log_on_mqtt(const char *topic, const uint8_t *payload, size_t len,
+    void *ctx)
+{
+    char *buf = malloc(len + 1), *tag = "*", *level = buf, *sep;
+    esp_log_level_t log_level;
+
+    if (!buf)
+        return;
+
+    memcpy(buf, payload, len);
+    buf[len] = '\0';
+
+    /* Payload is either "<tag>=<level>" or "<level>" for all tags */
+    if ((sep = strchr(buf, '=')))
+    {
+        *sep = '\0';
+        tag = buf;
+        level = sep + 1;
+    }
+
+    if (dlog_atolevel(level, &log_level) || dlog_level_set(tag, log_level))
+        ESP_LOGE(TAG, "Failed setting log level of %s to %s", tag, level);
+    else
+        ESP_LOGI(TAG, "Set log level of %s to %s", tag, level);
+
+    free(buf);
+}
+
+static void log_subscribe(void)
+{
+    char topic[24];
+
+    sprintf(topic, "%s/Log/Level", device_name_get());
+    mqtt_subscribe(topic, 0, log_on_mqtt, NULL, NULL);
+}
+
+static void log_unsubscribe(void)
+{
+    char topic[24];
+
+    sprintf(topic, "%s/Log/Level", device_name_get());
+    mqtt_unsubscribe(topic);
+}
+
+/* Capture functions */
+static void capture_on_data(const uint8_t *data, size_t len)
+{
+    char topic[23];
+
+    sprintf(topic, "%s/Capture", device_name_get());
+    mqtt_publish(topic, (uint8_t *)data, len, 1, 0);
+}
+
+static void capture_on_mqtt(const char *topic, const uint8_t *payload,
+    size_t len, void *ctx)
+{
+    if (len == 4 && !memcmp(payload, "true", 4))
+        capture_start();
+    else
+        capture_stop();
+}
+
+static void capture_subscribe(void)
+{
+    char topic[27];
+
+    sprintf(topic, "%s/Capture/Set", device_name_get());
+    mqtt_subscribe(topic, 0, capture_on_mqtt, NULL, NULL);
+}
+
+static void capture_unsubscribe(void)
+{
+    char topic[27];
+
+    sprintf(topic, "%s/Capture/Set", device_name_get());
+    mqtt_unsubscribe(topic);
+}
+
 static void cleanup(void)
 {
+    capture_stop();
+    capture_unsubscribe();
+    metrics_stop();
+    trace_unsubscribe();
+    log_unsubscribe();
     ble_disconnect_all();
     ble_scan_stop();
     ota_unsubscribe();
@@ -127,6 +333,10 @@ static void mqtt_on_connected(void)
 {
     ESP_LOGI(TAG, "Connected to MQTT, scanning for BLE devices");
     ota_subscribe();
+    trace_subscribe();
+    log_subscribe();
+    capture_subscribe();
+    metrics_start();
     ble_scan_start();
 }
 
@@ -145,7 +355,7 @@ static void ble_on_mqtt_connected_cb(const char *topic, const uint8_t *payload,
 {
     char new_topic[28];
 
-    if (!strncmp((char *)payload, "true", len))
+    if (len == 4 && !memcmp(payload, "true", 4))
         return;
 
     /* Someone published our device is disconnected, set them straight */
@@ -201,6 +411,19 @@ static void ble_on_device_discovered(mac_addr_t mac)
     ble_connect(mac);
 }
 
+static void ble_on_whitelist_entry(const char *mac_str)
+{
+    mac_addr_t mac;
+
+    if (atomac(mac_str, mac))
+    {
+        ESP_LOGE(TAG, "Invalid whitelist entry: %s", mac_str);
+        return;
+    }
+
+    ble_whitelist_add(mac);
+}
+
 static void ble_on_device_connected(mac_addr_t mac)
 {
     ESP_LOGI(TAG, "Connected to device: %s, scanning", mactoa(mac));
@@ -227,7 +450,7 @@ static char *ble_topic(mac_addr_t mac, ble_uuid_t service_uuid,
     i = sprintf(topic, "%s/%s", mactoa(mac),
         ble_service_name_get(service_uuid));
     sprintf(topic + i, "/%s",
-        ble_characteristic_name_get(characteristic_uuid));
+        ble_characteristic_name_get(mac, characteristic_uuid));
 
     return topic;
 }
@@ -242,18 +465,15 @@ static void ble_on_characteristic_removed(mac_addr_t mac, ble_uuid_t service_uui
 
     if (properties & CHAR_PROP_WRITE)
         mqtt_unsubscribe(ble_topic_suffix(topic, 0));
-
-    if (properties & CHAR_PROP_NOTIFY)
-    {
-        ble_characteristic_notify_unregister(mac, service_uuid,
-            characteristic_uuid);
-    }
 }
 
 static void ble_on_device_disconnected(mac_addr_t mac)
 {
     ESP_LOGI(TAG, "Disconnected from device: %s", mactoa(mac));
     ble_publish_connected(mac, 0);
+    batch_flush(mac);
+    state_remove(mac);
+    notify_remove(mac);
     ble_foreach_characteristic(mac, ble_on_characteristic_removed);
 }
 
@@ -269,11 +489,20 @@ static void ble_on_mqtt_get(const char *topic, const uint8_t *payload,
 static void ble_on_mqtt_set(const char *topic, const uint8_t *payload,
     size_t len, void *ctx)
 {
-    ESP_LOGD(TAG, "Got write request: %s, len: %u", topic, len);
+    ESP_LOGD(TAG, "Got write request: %s, len: %u", topic, (unsigned)len);
     mqtt_ctx_t *data = (mqtt_ctx_t *)ctx;
-    size_t buf_len;
-    uint8_t *buf = atochar(data->characteristic, (const char *)payload,
-        len, &buf_len);
+    uint8_t buf[512];
+    size_t err_field;
+    int buf_len = atochar(data->mac, data->characteristic,
+        ble_payload_format_get(data->service, data->characteristic),
+        (const char *)payload, len, buf, sizeof(buf), &err_field);
+
+    if (buf_len < 0)
+    {
+        ESP_LOGE(TAG, "Failed parsing field %u of write request: %s",
+            (unsigned)err_field, topic);
+        return;
+    }
 
     ble_characteristic_write(data->mac, data->service, data->characteristic,
         buf, buf_len);
@@ -315,11 +544,14 @@ static void ble_on_characteristic_found(mac_addr_t mac, ble_uuid_t service_uuid,
             characteristic_uuid), free);
     }
 
-    /* Characteristic can notify on changes */
-    if (properties & CHAR_PROP_NOTIFY)
+    /* Characteristic can notify or indicate on changes, or is polled if there
+     * are no notification registrations left */
+    if ((properties & (CHAR_PROP_NOTIFY | CHAR_PROP_INDICATE)) &&
+        notify_add(mac, service_uuid, characteristic_uuid,
+        properties & CHAR_PROP_READ,
+        config_ble_characteristic_priority_get(uuidtoa(characteristic_uuid))))
     {
-        ble_characteristic_notify_register(mac, service_uuid,
-            characteristic_uuid);
+        ESP_LOGE(TAG, "Values of %s won't be published", topic);
     }
 }
 
@@ -333,13 +565,74 @@ static void ble_on_device_characteristic_value(mac_addr_t mac,
     ble_uuid_t service, ble_uuid_t characteristic, uint8_t *value,
     size_t value_len)
 {
-    char *topic = ble_topic(mac, service, characteristic);
-    char *payload = chartoa(characteristic, value, value_len);
-    size_t payload_len = strlen(payload);
+    int64_t start = trace_now();
+    ble_payload_format_t format;
+    size_t payload_len;
+    uint32_t samples;
+    char *payload, *topic;
+
+    /* The device state is kept in JSON, regardless of the payload format */
+    if (device_state_mode != DEVICE_STATE_OFF)
+    {
+        payload = chartoa(mac, characteristic, BLE_PAYLOAD_FORMAT_JSON,
+            value, value_len, &payload_len);
+        if (payload)
+            state_update(mac, service, characteristic, payload, payload_len);
+
+        if (device_state_mode == DEVICE_STATE_ONLY)
+        {
+            trace_record(TRACE_STAGE_DECODE, start);
+            return;
+        }
+    }
+
+    format = ble_payload_format_get(service, characteristic);
+    payload = chartoa(mac, characteristic, format, value, value_len,
+        &payload_len);
+    trace_record(TRACE_STAGE_DECODE, start);
+    if (!payload)
+    {
+        ESP_LOGE(TAG, "Value of %s is too long to publish",
+            uuidtoa(characteristic));
+        metrics_counter_inc(METRICS_COUNTER_BLE_VALUES_DROPPED);
+        return;
+    }
+
+    /* Batched values are published once the batch is complete */
+    if (format == BLE_PAYLOAD_FORMAT_CBOR && (samples =
+        config_ble_characteristic_batch_get(uuidtoa(characteristic))) > 1)
+    {
+        if (batch_add(mac, service, characteristic, samples,
+            (uint8_t *)payload, payload_len))
+        {
+            metrics_counter_inc(METRICS_COUNTER_BLE_VALUES_DROPPED);
+        }
+        return;
+    }
+
+    start = trace_now();
+    topic = ble_topic(mac, service, characteristic);
+    trace_record(TRACE_STAGE_TOPIC, start);
 
-    ESP_LOGI(TAG, "Publishing: %s = %s", topic, payload);
+    if (format == BLE_PAYLOAD_FORMAT_RAW || format == BLE_PAYLOAD_FORMAT_CBOR)
+        DLOGI(TAG, "Publishing: %s = <%u bytes>", topic,
+            (unsigned)payload_len);
+    else
+        DLOGI(TAG, "Publishing: %s = %s", topic, payload);
+    start = trace_now();
     mqtt_publish(topic, (uint8_t *)payload, payload_len, config_mqtt_qos_get(),
         config_mqtt_retained_get());
+    trace_record(TRACE_STAGE_PUBLISH, start);
+}
+
+static void ble_on_batch_ready(mac_addr_t mac, ble_uuid_t service,
+    ble_uuid_t characteristic, uint8_t *payload, size_t len)
+{
+    char *topic = ble_topic(mac, service, characteristic);
+
+    DLOGI(TAG, "Publishing: %s = <%u bytes>", topic, (unsigned)len);
+    mqtt_publish(topic, payload, len, config_mqtt_qos_get(),
+        config_mqtt_retained_get());
 }
 
 static uint32_t ble_on_passkey_requested(mac_addr_t mac)
@@ -363,10 +656,36 @@ void app_main()
     }
     ESP_ERROR_CHECK(ret);
 
+    /* Init deferred logging */
+    ESP_ERROR_CHECK(dlog_initialize(4096));
+
     ESP_LOGI(TAG, "Version: %s", BLE2MQTT_VER);
 
     /* Init configuration */
     ESP_ERROR_CHECK(config_initialize());
+    config_ble_characteristic_transforms_foreach(transform_on_config);
+    config_ble_characteristic_layouts_foreach(layout_on_config);
+
+    /* Init metrics */
+    ESP_ERROR_CHECK(metrics_initialize(config_metrics_interval_get()));
+    metrics_set_on_report_cb(metrics_on_report);
+
+    /* Init tracing */
+    ESP_ERROR_CHECK(trace_initialize(config_trace_size_get()));
+
+    /* Init retained publication deduplication */
+    if (strcmp(config_mqtt_dedup_get(), "off"))
+    {
+        ESP_ERROR_CHECK(dedup_initialize(
+            !strcmp(config_mqtt_dedup_get(), "persistent")));
+    }
+
+    /* Init device state */
+    state_initialize_from_config();
+
+    /* Init BLE event capture */
+    ESP_ERROR_CHECK(capture_initialize(4096));
+    capture_set_on_data_cb(capture_on_data);
 
     /* Init OTA */
     ota_initialize();
@@ -391,6 +710,17 @@ void app_main()
     ble_set_on_device_characteristic_value_cb(
         ble_on_device_characteristic_value);
     ble_set_on_passkey_requested_cb(ble_on_passkey_requested);
+    ble_set_on_bonds_removed_cb(ble_on_bonds_removed);
+    /* Controller whitelist entries have no address type, so devices using
+     * random addresses would be filtered out */
+    if (config_ble_controller_whitelist_get())
+        config_ble_whitelist_foreach(ble_on_whitelist_entry);
+
+    /* Init batching */
+    batch_set_on_ready_cb(ble_on_batch_ready);
+
+    /* Init notification registrations */
+    ESP_ERROR_CHECK(notify_initialize(config_ble_poll_interval_get()));
 
     /* Start by connecting to WiFi */
     wifi_hostname_set(device_name_get());
@@ -1,8 +1,16 @@
 #include "ble_utils.h"
+#include "cbor.h"
 #include "config.h"
+#include "format.h"
 #include "gatt.h"
+#include "layout.h"
+#include "transform.h"
+#include <ctype.h>
+#include <freertos/FreeRTOS.h>
 #include <math.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 
 #define CASE_STR(x) case x: return #x
 char *gap_event_to_str(esp_gap_ble_cb_event_t event)
@@ -109,14 +117,18 @@ int atomac(const char *str, mac_addr_t mac)
 char *uuidtoa(ble_uuid_t uuid)
 {
     static char s[37];
+    char *p = s;
+    int i;
 
-    sprintf(s,
-        "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
-        uuid[15], uuid[14], uuid[13], uuid[12],
-        uuid[11], uuid[10],
-        uuid[9], uuid[8], 
-        uuid[7], uuid[6],
-        uuid[5], uuid[4], uuid[3], uuid[2], uuid[1], uuid[0]);
+    /* Looked up in the configuration for every value, so this avoids
+     * sprintf(). The UUID is stored with its least significant byte first */
+    for (i = 15; i >= 0; i--)
+    {
+        p = format_hex(p, &uuid[i], 1);
+        if (i == 12 || i == 10 || i == 8 || i == 6)
+            *p++ = '-';
+    }
+    *p = '\0';
 
     return s;
 }
@@ -133,43 +145,243 @@ int atouuid(const char *str, ble_uuid_t uuid)
         &uuid[5], &uuid[4], &uuid[3], &uuid[2], &uuid[1], &uuid[0]) != 16;
 }
 
-static service_desc_t *ble_get_sig_service(ble_uuid_t uuid)
+/* Returns the 16-bit SIG assigned number of a UUID based on the Bluetooth SIG
+ * Base UUID, or -1 if it's a vendor specific UUID */
+static int ble_uuid_to_sig(ble_uuid_t uuid)
 {
-    service_desc_t *p;
+    static const uint8_t base_uuid[12] = { 0xFB, 0x34, 0x9B, 0x5F, 0x80, 0x00,
+        0x00, 0x80, 0x00, 0x10, 0x00, 0x00 };
 
-    for (p = services; p->name; p++)
-    {
-        if (memcmp(p->uuid, uuid, sizeof(ble_uuid_t)))
-            continue;
+    if (memcmp(uuid, base_uuid, sizeof(base_uuid)) || uuid[14] || uuid[15])
+        return -1;
+
+    return uuid[12] | (uuid[13] << 8);
+}
+
+static int ble_sig_desc_cmp(const void *key, const void *desc)
+{
+    /* Both service_desc_t and characteristic_desc_t start with the UUID */
+    return (int)*(const uint16_t *)key - (int)*(const uint16_t *)desc;
+}
+
+static const service_desc_t *ble_get_sig_service(ble_uuid_t uuid)
+{
+    int sig = ble_uuid_to_sig(uuid);
+    uint16_t key = sig;
+
+    if (sig < 0)
+        return NULL;
+
+    return bsearch(&key, services, services_count, sizeof(services[0]),
+        ble_sig_desc_cmp);
+}
+
+static const characteristic_desc_t *ble_get_sig_characteristic(ble_uuid_t uuid)
+{
+    int sig = ble_uuid_to_sig(uuid);
+    uint16_t key = sig;
+
+    if (sig < 0)
+        return NULL;
+
+    return bsearch(&key, characteristics, characteristics_count,
+        sizeof(characteristics[0]), ble_sig_desc_cmp);
+}
+
+static const uint8_t *ble_get_sig_characteristic_types(ble_uuid_t uuid)
+{
+    const characteristic_desc_t *c = ble_get_sig_characteristic(uuid);
+    return c ? gatt_types + c->types : NULL;
+}
+
+static characteristic_decoder_t ble_get_characteristic_decoder(ble_uuid_t uuid)
+{
+    const characteristic_desc_t *c;
+
+    /* Configured types take precedence over the SIG definitions */
+    if (config_ble_characteristic_types_get(uuidtoa(uuid)))
+        return NULL;
+
+    c = ble_get_sig_characteristic(uuid);
+    return c ? characteristic_decoders[c - characteristics] : NULL;
+}
 
-        return p;
+/* Values of characteristics without a known definition are decoded according
+ * to their Presentation Format descriptor (0x2904) and named after their User
+ * Description descriptor (0x2901), both read during discovery. Devices may use
+ * the same UUID differently, so they're kept per device and characteristic.
+ * The list is updated by the BLE task and read from others, e.g. when parsing
+ * /Set requests, so it's only accessed under descriptors_mux and readers get
+ * a copy of the entry */
+#define DESCRIPTION_MAX 64
+#define UNIT_UNITLESS 0x2700
+
+typedef struct ble_descriptors_t {
+    struct ble_descriptors_t *next;
+    mac_addr_t mac;
+    ble_uuid_t uuid;
+    uint8_t types[2]; /* CHAR_TYPES_END terminated, as gatt_types */
+    int8_t exponent;
+    uint16_t unit;
+    char name[DESCRIPTION_MAX + 1];
+} ble_descriptors_t;
+
+static portMUX_TYPE descriptors_mux = portMUX_INITIALIZER_UNLOCKED;
+static ble_descriptors_t *descriptors = NULL;
+
+/* Must be called with descriptors_mux held */
+static ble_descriptors_t *ble_descriptors_find(mac_addr_t mac, ble_uuid_t uuid)
+{
+    ble_descriptors_t *d;
+
+    for (d = descriptors; d; d = d->next)
+    {
+        if (!memcmp(d->mac, mac, sizeof(mac_addr_t)) &&
+            !memcmp(d->uuid, uuid, sizeof(ble_uuid_t)))
+        {
+            return d;
+        }
     }
 
     return NULL;
 }
 
-static characteristic_desc_t *ble_get_sig_characteristic(ble_uuid_t uuid)
+/* Copies the descriptors of a device's characteristic to ret */
+static int ble_descriptors_get(mac_addr_t mac, ble_uuid_t uuid,
+    ble_descriptors_t *ret)
+{
+    ble_descriptors_t *d;
+
+    portENTER_CRITICAL(&descriptors_mux);
+    if ((d = ble_descriptors_find(mac, uuid)))
+        *ret = *d;
+    portEXIT_CRITICAL(&descriptors_mux);
+
+    return d ? 0 : -1;
+}
+
+/* Sets either the format or the name of an entry, new entries are complete
+ * before they're added to the list */
+static int ble_descriptors_update(const ble_descriptors_t *update,
+    uint8_t is_format)
 {
-    characteristic_desc_t *p;
+    ble_descriptors_t *d, *new = malloc(sizeof(*new));
+
+    if (!new)
+        return -1;
+    *new = *update;
 
-    for (p = characteristics; p->name; p++)
+    portENTER_CRITICAL(&descriptors_mux);
+    if ((d = ble_descriptors_find(new->mac, new->uuid)))
     {
-        if (memcmp(p->uuid, uuid, sizeof(ble_uuid_t)))
-            continue;
+        if (is_format)
+        {
+            memcpy(d->types, update->types, sizeof(d->types));
+            d->exponent = update->exponent;
+            d->unit = update->unit;
+        }
+        else
+            memcpy(d->name, update->name, sizeof(d->name));
+    }
+    else
+    {
+        new->next = descriptors;
+        descriptors = new;
+        new = NULL;
+    }
+    portEXIT_CRITICAL(&descriptors_mux);
+
+    free(new);
+    return 0;
+}
+
+static void ble_descriptors_init(ble_descriptors_t *d, mac_addr_t mac,
+    ble_uuid_t uuid)
+{
+    memset(d, 0, sizeof(*d));
+    memcpy(d->mac, mac, sizeof(mac_addr_t));
+    memcpy(d->uuid, uuid, sizeof(ble_uuid_t));
+    d->types[0] = CHAR_TYPES_END;
+    d->types[1] = CHAR_TYPES_END;
+}
+
+uint8_t ble_characteristic_descriptors_are_known(mac_addr_t mac,
+    ble_uuid_t uuid)
+{
+    ble_descriptors_t d;
+
+    return !ble_descriptors_get(mac, uuid, &d);
+}
+
+int ble_characteristic_presentation_format_set(mac_addr_t mac,
+    ble_uuid_t uuid, const uint8_t *value, size_t len)
+{
+    /* Format types, as defined by the Bluetooth SIG, that have a matching
+     * characteristic type. The others are published as bytes */
+    static const uint8_t format_types[] = {
+        [0x01] = CHAR_TYPE_BOOLEAN,
+        [0x02] = CHAR_TYPE_2BIT,
+        [0x03] = CHAR_TYPE_NIBBLE,
+        [0x04] = CHAR_TYPE_UINT8,
+        [0x05] = CHAR_TYPE_UINT12,
+        [0x06] = CHAR_TYPE_UINT16,
+        [0x07] = CHAR_TYPE_UINT24,
+        [0x08] = CHAR_TYPE_UINT32,
+        [0x09] = CHAR_TYPE_UINT48,
+        [0x0C] = CHAR_TYPE_SINT8,
+        [0x0E] = CHAR_TYPE_SINT16,
+        [0x0F] = CHAR_TYPE_SINT24,
+        [0x10] = CHAR_TYPE_SINT32,
+        [0x15] = CHAR_TYPE_FLOAT64,
+        [0x16] = CHAR_TYPE_SFLOAT,
+        [0x17] = CHAR_TYPE_FLOAT,
+        [0x19] = CHAR_TYPE_UTF8S,
+    };
+    ble_descriptors_t d;
+
+    /* Format, exponent, unit, name space and description */
+    if (len < 7)
+        return -1;
+
+    ble_descriptors_init(&d, mac, uuid);
+    d.exponent = (int8_t)value[1];
+    d.unit = value[2] | (value[3] << 8);
+    if (value[0] < sizeof(format_types) && format_types[value[0]])
+        d.types[0] = format_types[value[0]];
+
+    return ble_descriptors_update(&d, 1);
+}
+
+int ble_characteristic_user_description_set(mac_addr_t mac,
+    ble_uuid_t uuid, const uint8_t *value, size_t len)
+{
+    ble_descriptors_t d;
+    size_t i;
+
+    if (!len)
+        return -1;
 
-        return p;
+    /* The name is used as an MQTT topic level */
+    ble_descriptors_init(&d, mac, uuid);
+    for (i = 0; i < len && i < DESCRIPTION_MAX && value[i]; i++)
+    {
+        d.name[i] = value[i] < 0x20 || value[i] == '/' || value[i] == '+' ||
+            value[i] == '#' ? '_' : value[i];
     }
+    d.name[i] = '\0';
 
-    return NULL;
+    return ble_descriptors_update(&d, 0);
 }
 
-static characteristic_type_t *ble_get_sig_characteristic_types(ble_uuid_t uuid)
+static const char *ble_get_unit_name(uint16_t unit)
 {
-    characteristic_desc_t *c = ble_get_sig_characteristic(uuid);
-    return c ? c->types : NULL;
+    const unit_desc_t *u = bsearch(&unit, units, units_count,
+        sizeof(units[0]), ble_sig_desc_cmp);
+
+    return u ? gatt_names + u->name : NULL;
 }
 
-static characteristic_type_t ble_atotype(const char *type)
+uint8_t ble_atotype(const char *type)
 {
     struct {
         const char *name;
@@ -213,29 +425,150 @@ static characteristic_type_t ble_atotype(const char *type)
     return p->type;
 }
 
-static characteristic_type_t *ble_get_characteristic_types(ble_uuid_t uuid)
+/* Descriptors only apply to characteristics without a known definition. They
+ * are copied to buf */
+static const ble_descriptors_t *ble_get_characteristic_descriptors(
+    mac_addr_t mac, ble_uuid_t uuid, ble_descriptors_t *buf)
+{
+    if (ble_descriptors_get(mac, uuid, buf) ||
+        buf->types[0] == CHAR_TYPES_END || ble_get_sig_characteristic(uuid))
+    {
+        return NULL;
+    }
+
+    if (config_ble_characteristic_types_get(uuidtoa(uuid)))
+        return NULL;
+
+    return buf;
+}
+
+/* Presentation Format descriptors define a single value */
+static const char *descriptor_names[] = { "value", NULL };
+
+/* Configured and descriptor types are copied into buf, which holds up to
+ * TYPES_MAX - 1 types */
+#define TYPES_MAX 32
+static const uint8_t *ble_get_characteristic_types(mac_addr_t mac,
+    ble_uuid_t uuid, uint8_t buf[TYPES_MAX])
 {
-    static characteristic_type_t ret[32];
     int i = 0;
     const char **iter, **conf_types =
         config_ble_characteristic_types_get(uuidtoa(uuid));
 
     if (!conf_types)
-        return ble_get_sig_characteristic_types(uuid);
+    {
+        ble_descriptors_t d;
 
-    for (iter = conf_types; *iter; iter++)
-        ret[i++] = ble_atotype(*iter);
-    ret[i] = -1;
+        if (!ble_get_characteristic_descriptors(mac, uuid, &d))
+            return ble_get_sig_characteristic_types(uuid);
 
-    return ret;
+        memcpy(buf, d.types, sizeof(d.types));
+        return buf;
+    }
+
+    for (iter = conf_types; *iter && i < TYPES_MAX - 1; iter++)
+        buf[i++] = ble_atotype(*iter);
+    buf[i] = CHAR_TYPES_END;
+
+    return buf;
 }
 
-char *chartoa(ble_uuid_t uuid, const uint8_t *data, size_t len)
+static const field_desc_t *ble_get_characteristic_fields(ble_uuid_t uuid)
 {
-    characteristic_type_t *types = ble_get_characteristic_types(uuid);
-    static char buf[1024];
-    char *p = buf;
-    int i = 0;
+    const characteristic_desc_t *c;
+
+    /* SIG field definitions don't apply to configured types */
+    if (config_ble_characteristic_types_get(uuidtoa(uuid)))
+        return NULL;
+
+    c = ble_get_sig_characteristic(uuid);
+    return c ? gatt_fields + c->fields : NULL;
+}
+
+static struct {
+    const char *name;
+    ble_payload_format_t format;
+} payload_formats[] = {
+    { "text", BLE_PAYLOAD_FORMAT_TEXT },
+    { "json", BLE_PAYLOAD_FORMAT_JSON },
+    { "raw", BLE_PAYLOAD_FORMAT_RAW },
+    { "hex", BLE_PAYLOAD_FORMAT_HEX },
+    { "base64", BLE_PAYLOAD_FORMAT_BASE64 },
+    { "cbor", BLE_PAYLOAD_FORMAT_CBOR },
+    { NULL, BLE_PAYLOAD_FORMAT_TEXT }
+};
+
+/* The characteristic's format takes precedence over its service's one */
+ble_payload_format_t ble_payload_format_get(ble_uuid_t service,
+    ble_uuid_t characteristic)
+{
+    const char *format =
+        config_ble_characteristic_format_get(uuidtoa(characteristic)) ? :
+        config_ble_service_format_get(uuidtoa(service));
+    int i;
+
+    for (i = 0; format && payload_formats[i].name; i++)
+    {
+        if (!strcmp(format, payload_formats[i].name))
+            return payload_formats[i].format;
+    }
+
+    return BLE_PAYLOAD_FORMAT_TEXT;
+}
+
+size_t ble_type_size(uint8_t type)
+{
+    switch (type)
+    {
+    case CHAR_TYPE_BOOLEAN:
+    case CHAR_TYPE_2BIT:
+    case CHAR_TYPE_4BIT:
+    case CHAR_TYPE_NIBBLE:
+    case CHAR_TYPE_8BIT:
+    case CHAR_TYPE_UINT8:
+    case CHAR_TYPE_SINT8:
+        return 1;
+    case CHAR_TYPE_UINT12:
+    case CHAR_TYPE_16BIT:
+    case CHAR_TYPE_UINT16:
+    case CHAR_TYPE_SINT16:
+    case CHAR_TYPE_SFLOAT:
+        return 2;
+    case CHAR_TYPE_24BIT:
+    case CHAR_TYPE_UINT24:
+    case CHAR_TYPE_SINT24:
+        return 3;
+    case CHAR_TYPE_32BIT:
+    case CHAR_TYPE_UINT32:
+    case CHAR_TYPE_SINT32:
+    case CHAR_TYPE_FLOAT:
+        return 4;
+    case CHAR_TYPE_UINT40:
+        return 5;
+    case CHAR_TYPE_UINT48:
+        return 6;
+    case CHAR_TYPE_FLOAT64:
+        return 8;
+    }
+
+    return 0;
+}
+
+static uint64_t read_le(const uint8_t *p, size_t size)
+{
+    uint64_t value = 0;
+
+    while (size--)
+        value = (value << 8) | p[size];
+
+    return value;
+}
+
+/* Formats a single fixed size field */
+static char *ble_field_format(char *p, uint8_t type, const uint8_t *data)
+{
+    size_t size = ble_type_size(type);
+    uint64_t value = read_le(data, size);
 
     /* A note from the Bluetooth specification:
      * If a format is not a whole number of octets, then the data shall be
@@ -244,375 +577,1441 @@ char *chartoa(ble_uuid_t uuid, const uint8_t *data, size_t len)
      * the Characteristic Value is less than an octet, it occupies an entire
      * octet.
      */
-    for (; types && *types != -1; types++)
+    switch (type)
     {
-        switch (*types)
-        {
-        case CHAR_TYPE_BOOLEAN:
-            p += sprintf(p, "%s,", data[i] & 0x01 ? "true" : "false");
-            i += 1;
-            break;
-        case CHAR_TYPE_2BIT:
-            p += sprintf(p, "%hhu,", data[i] & 0x03);
-            i += 1;
-            break;
-        case CHAR_TYPE_4BIT:
-        case CHAR_TYPE_NIBBLE:
-            p += sprintf(p, "%hhu,", data[i] & 0x0F);
-            i += 1;
-            break;
-        case CHAR_TYPE_8BIT:
-        case CHAR_TYPE_UINT8:
-        case CHAR_TYPE_SINT8:
-            if (*types == CHAR_TYPE_SINT8)
-                p += sprintf(p, "%hhd,", data[i]);
-            else
-                p += sprintf(p, "%hhu,", data[i]);
-            i += 1;
-            break;
-        case CHAR_TYPE_UINT12:
-        {
-            uint16_t tmp = (data[i + 1] << 8) | data[i];
+    case CHAR_TYPE_BOOLEAN:
+        return format_bool(p, value);
+    case CHAR_TYPE_2BIT:
+        return format_uint32(p, value & 0x03);
+    case CHAR_TYPE_4BIT:
+    case CHAR_TYPE_NIBBLE:
+        return format_uint32(p, value & 0x0F);
+    case CHAR_TYPE_UINT12:
+        return format_uint32(p, value & 0x0FFF);
+    case CHAR_TYPE_SINT8:
+    case CHAR_TYPE_SINT16:
+    case CHAR_TYPE_SINT24:
+    case CHAR_TYPE_SINT32:
+        /* Sign extend */
+        return format_int32(p, (int64_t)(value << (64 - 8 * size)) >>
+            (64 - 8 * size));
+    /* IEEE-11073 floating point format */
+    case CHAR_TYPE_SFLOAT:
+        return format_sfloat(p, value);
+    case CHAR_TYPE_FLOAT:
+        return format_float(p, value);
+    /* IEEE-754 floating point format */
+    case CHAR_TYPE_FLOAT64:
+        return format_float64(p, data);
+    }
 
-            p += sprintf(p, "%hu,", tmp & 0x0FFF);
-            i += 2;
-            break;
-        }
-        case CHAR_TYPE_16BIT:
-        case CHAR_TYPE_UINT16:
-        case CHAR_TYPE_SINT16:
-        {
-            uint16_t tmp = (data[i + 1] << 8) | data[i];
+    return format_uint64(p, value);
+}
 
-            if (*types == CHAR_TYPE_SINT16)
-                p += sprintf(p, "%hd,", tmp);
-            else
-                p += sprintf(p, "%hu,", tmp);
+/* Numeric value of a single fixed size field, for transforms */
+static double ble_field_value(uint8_t type, const uint8_t *data)
+{
+    size_t size = ble_type_size(type);
+    uint64_t value = read_le(data, size);
+    int32_t mantissa;
+    int8_t exponent;
 
-            i += 2;
-            break;
-        }
-        case CHAR_TYPE_24BIT:
-        case CHAR_TYPE_UINT24:
-        case CHAR_TYPE_SINT24:
+    switch (type)
+    {
+    case CHAR_TYPE_BOOLEAN: return value & 0x01;
+    case CHAR_TYPE_2BIT: return value & 0x03;
+    case CHAR_TYPE_4BIT:
+    case CHAR_TYPE_NIBBLE: return value & 0x0F;
+    case CHAR_TYPE_UINT12: return value & 0x0FFF;
+    case CHAR_TYPE_SINT8:
+    case CHAR_TYPE_SINT16:
+    case CHAR_TYPE_SINT24:
+    case CHAR_TYPE_SINT32:
+        return (int64_t)(value << (64 - 8 * size)) >> (64 - 8 * size);
+    /* IEEE-11073 floating point format */
+    case CHAR_TYPE_SFLOAT:
+        switch (value)
         {
-            uint32_t tmp = (data[i + 2] << 16) | (data[i + 1] << 8) | data[i];
-
-            if (*types == CHAR_TYPE_SINT24)
-                p += sprintf(p, "%d,", (int32_t)tmp << 8 >> 8);
-            else
-                p += sprintf(p, "%u,", tmp);
-
-            i += 3;
-            break;
+        case 0x07FE: return INFINITY;
+        case 0x0802: return -INFINITY;
+        case 0x07FF: case 0x0800: case 0x0801: return NAN;
         }
-        case CHAR_TYPE_32BIT:
-        case CHAR_TYPE_UINT32:
-        case CHAR_TYPE_SINT32:
+        mantissa = (int16_t)(value << 4) >> 4;
+        exponent = (int16_t)value >> 12;
+        break;
+    case CHAR_TYPE_FLOAT:
+        switch (value)
         {
-            uint32_t tmp = (data[i + 3] << 24) | (data[i + 2] << 16) |
-                (data[i + 1] << 8) | data[i];
-
-            if (*types == CHAR_TYPE_SINT32)
-                p += sprintf(p, "%d,", tmp);
-            else
-                p += sprintf(p, "%u,", tmp);
-
-            i += 4;
-            break;
+        case 0x007FFFFE: return INFINITY;
+        case 0x00800002: return -INFINITY;
+        case 0x007FFFFF: case 0x00800000: case 0x00800001: return NAN;
         }
-        case CHAR_TYPE_UINT40:
-        {
-            uint64_t tmp = ((uint64_t)data[i + 4] << 32) | (data[i + 3] << 24) |
-                (data[i + 2] << 16) | (data[i + 1] << 8) | data[i];
-
-            p += sprintf(p, "%llu,", tmp);
+        mantissa = (int32_t)(value << 8) >> 8;
+        exponent = (int32_t)value >> 24;
+        break;
+    /* IEEE-754 floating point format */
+    case CHAR_TYPE_FLOAT64:
+    {
+        double d;
 
-            i += 5;
-            break;
-        }
-        case CHAR_TYPE_UINT48:
-        {
-            uint64_t tmp = ((uint64_t)data[i + 5] << 40) |
-                ((uint64_t)data[i + 4] << 32) | (data[i + 3] << 24) |
-                (data[i + 2] << 16) | (data[i + 1] << 8) | data[i];
+        memcpy(&d, data, sizeof(d));
+        return d;
+    }
+    default:
+        return value;
+    }
 
-            p += sprintf(p, "%llu,", tmp);
+    /* Dividing by an exact power of 10 keeps e.g. 365e-1 at 36.5 */
+    return exponent < 0 ? mantissa / pow(10, -exponent) :
+        mantissa * pow(10, exponent);
+}
 
-            i += 6;
-            break;
-        }
-        /* String values consume the rest of the buffer */
-        case CHAR_TYPE_UTF8S:
+/* Transformed values are written as integers when possible, and otherwise
+ * rounded to 15 significant digits to hide binary rounding errors, e.g.
+ * -212 * 0.1 is written as -21.2 rather than -21.200000000000003 */
+static char *ble_number_format(char *p, ble_payload_format_t format, double d)
+{
+    if (d > -9007199254740992.0 && d < 9007199254740992.0 && d == (int64_t)d)
+    {
+        if (format == BLE_PAYLOAD_FORMAT_CBOR)
+            return (char *)cbor_int((uint8_t *)p, d);
+        if (d < 0)
         {
-            int c = len - i;
-
-            memcpy(p, &data[i], c);
-
-            p += c;
-            i += c;
-            p += sprintf(p, ",");
-            break;
+            *p++ = '-';
+            d = -d;
         }
-        /* IEEE-754 floating point format */
-        /* Note, ESP-32 is little endian, as is the characteristic value */
-        case CHAR_TYPE_FLOAT64:
-        {
-            union {
-                double d;
-                uint8_t b[8];
-            } tmp;
-            memcpy(&tmp.b, &data[i], 8);
+        return format_uint64(p, d);
+    }
 
-            p += sprintf(p, "%f,", tmp.d);
+    if (format == BLE_PAYLOAD_FORMAT_CBOR)
+        return (char *)cbor_double((uint8_t *)p, d);
 
-            i += 8;
-            break;
-        }
-        /* IEEE-11073 floating point format */
-        case CHAR_TYPE_SFLOAT:
-        {
-            uint16_t tmp = (data[i + 1] << 8) | data[i];
-            int16_t mantissa = tmp & 0X0FFF;
-            int8_t exponent = (tmp >> 12) & 0x0F;
+    return p + sprintf(p, "%.15g", d);
+}
 
-            /* Fix sign */
-            if (exponent >= 0x0008)
-                exponent = -((0x000F + 1) - exponent);
-            if (mantissa >= 0x0800)
-                mantissa = -((0x0FFF + 1) - mantissa);
+/* Encodes a single fixed size field as a CBOR data item */
+static char *ble_field_cbor(char *p, uint8_t type, const uint8_t *data)
+{
+    size_t size = ble_type_size(type);
+    uint64_t value = read_le(data, size);
+    uint8_t *q = (uint8_t *)p;
 
-            p += sprintf(p, "%f,", mantissa * pow(10.0f, exponent));
+    switch (type)
+    {
+    case CHAR_TYPE_BOOLEAN:
+        return (char *)cbor_bool(q, value & 0x01);
+    case CHAR_TYPE_2BIT:
+        return (char *)cbor_uint(q, value & 0x03);
+    case CHAR_TYPE_4BIT:
+    case CHAR_TYPE_NIBBLE:
+        return (char *)cbor_uint(q, value & 0x0F);
+    case CHAR_TYPE_UINT12:
+        return (char *)cbor_uint(q, value & 0x0FFF);
+    case CHAR_TYPE_SINT8:
+    case CHAR_TYPE_SINT16:
+    case CHAR_TYPE_SINT24:
+    case CHAR_TYPE_SINT32:
+        return (char *)cbor_int(q, (int64_t)(value << (64 - 8 * size)) >>
+            (64 - 8 * size));
+    case CHAR_TYPE_SFLOAT:
+        return (char *)cbor_sfloat(q, value);
+    case CHAR_TYPE_FLOAT:
+        return (char *)cbor_float(q, value);
+    case CHAR_TYPE_FLOAT64:
+    {
+        double d;
 
-            i += 2;
-            break;
-        }
-        case CHAR_TYPE_FLOAT:
-        {
-            int8_t exponent = data[i + 3];
-            int32_t mantissa = ((data[i + 2] << 24) | (data[i + 1] << 16) |
-                 data[i] << 8) >> 8;
+        memcpy(&d, data, sizeof(d));
+        return (char *)cbor_double(q, d);
+    }
+    }
 
-            /* Fix sign */
-            if (mantissa >= 0x800000)
-                mantissa = -((0xFFFFFF + 1) - mantissa);
+    return (char *)cbor_uint(q, value);
+}
 
-            p += sprintf(p, "%f,", mantissa * pow(10.0f, exponent));
+/* Payload writer, shared by the textual payload formats so they only differ
+ * in how fields are delimited and named */
+#define WRITER_FIELD_MAX 192 /* Longest formatted fixed size field */
+
+typedef struct {
+    ble_payload_format_t format;
+    char *p;
+    char *end;
+    const char **names; /* Configured field names */
+    const field_desc_t *fields; /* SIG field definitions */
+    const transform_t *transforms;
+    int8_t exponent; /* Decimal exponent of the values */
+    size_t field;
+    uint8_t in_array; /* Fields are written without names */
+} payload_writer_t;
+
+static const field_desc_t *ble_field_desc(const field_desc_t *fields,
+    size_t field)
+{
+    size_t i;
 
-            i += 4;
-            break;
-        }
-        case CHAR_TYPE_REG_CERT_DATA_LIST:
-        case CHAR_TYPE_VARIABLE:
-        case CHAR_TYPE_GATT_UUID:
-        case CHAR_TYPE_UNKNOWN:
-            printf(">>>> Unhandled characteristic type %d <<<<\n", *types);
-        }
+    for (i = 0; fields && fields[i].type != CHAR_TYPES_END; i++)
+    {
+        if (i == field)
+            return &fields[i];
     }
 
-    for (; i < len; i++)
-        p += sprintf(p, "%u,", data[i]);
-
-    *(p - 1) = '\0';
-    return buf;
+    return NULL;
 }
 
-uint8_t *atochar(ble_uuid_t uuid, const char *data, size_t len, size_t *ret_len)
+/* Field names are taken from the configuration, the SIG definitions or are
+ * generated from the field's index into name */
+static const char *ble_field_name(const char **names,
+    const field_desc_t *fields, size_t field, char name[16])
 {
-    characteristic_type_t *types = ble_get_characteristic_types(uuid);
-    static uint8_t buf[512];
-    uint8_t *p = buf;
-    char *str = strdup(data);
-    char *val = strtok(str, ",");
+    const field_desc_t *desc;
+    size_t i;
 
-    for (; types && *types != -1 && val; types++)
+    for (i = 0; names && names[i]; i++)
     {
-        switch (*types)
-        {
-        case CHAR_TYPE_BOOLEAN:
-            *p = !strcmp(val, "true") ? 1 : 0;
-            p += 1;
-            break;
-        case CHAR_TYPE_2BIT:
-            *p = strtoul(val, NULL, 10) & 0x03;
-            p += 1;
-            break;
-        case CHAR_TYPE_4BIT:
-        case CHAR_TYPE_NIBBLE:
-            *p = strtoul(val, NULL, 10) & 0x0F;
-            p += 1;
-            break;
-        case CHAR_TYPE_8BIT:
-        case CHAR_TYPE_UINT8:
-        case CHAR_TYPE_SINT8:
-            if (*types == CHAR_TYPE_SINT8)
-                *p += strtol(val, NULL, 10);
-            else
-                *p += strtoul(val, NULL, 10);
-            p += 1;
-            break;
-        case CHAR_TYPE_UINT12:
-        {
-            uint16_t tmp = strtoul(val, NULL, 10) & 0x0FFF;
+        if (i == field)
+            return names[i];
+    }
 
-            *p = tmp & 0xFF;
-            *(p + 1) = (tmp >> 8) & 0xFF;
+    if ((desc = ble_field_desc(fields, field)))
+        return gatt_names + desc->name;
 
-            p += 2;
-            break;
-        }
-        case CHAR_TYPE_16BIT:
-        case CHAR_TYPE_UINT16:
-        {
-            uint16_t tmp = strtoul(val, NULL, 10) & 0xFFFF;
+    sprintf(name, "field%u", (unsigned)field);
+    return name;
+}
 
-            *p = tmp & 0xFF;
-            *(p + 1) = (tmp >> 8) & 0xFF;
+/* The unit of single valued SIG characteristics, 0 if not specified */
+static uint16_t ble_fields_unit(const field_desc_t *fields)
+{
+    if (!fields || fields[0].type == CHAR_TYPES_END ||
+        fields[1].type != CHAR_TYPES_END)
+    {
+        return 0;
+    }
 
-            p += 2;
-            break;
-        }
-        case CHAR_TYPE_SINT16:
-        {
-            uint16_t tmp = strtol(val, NULL, 10) & 0xFFFF;
+    return fields[0].unit;
+}
 
-            *p = tmp & 0xFF;
-            *(p + 1) = (tmp >> 8) & 0xFF;
+static int writer_json_string(payload_writer_t *w, const uint8_t *s,
+    size_t len)
+{
+    static const char hex[] = "0123456789abcdef";
+    const uint8_t *end = s + len;
 
-            p += 2;
-            break;
-        }
-        case CHAR_TYPE_24BIT:
-        case CHAR_TYPE_UINT24:
-        {
-            uint32_t tmp = strtoul(val, NULL, 10) & 0x00FFFFFF;
+    if (w->end - w->p < 2)
+        return -1;
 
-            *p = tmp & 0xFF;
-            *(p + 1) = (tmp >> 8) & 0xFF;
-            *(p + 2) = (tmp >> 16) & 0xFF;
+    *w->p++ = '"';
+    for (; s < end; s++)
+    {
+        if (w->end - w->p < 7)
+            return -1;
 
-            p += 3;
-            break;
+        if (*s == '"' || *s == '\\')
+        {
+            *w->p++ = '\\';
+            *w->p++ = *s;
         }
-        case CHAR_TYPE_SINT24:
+        else if (*s < 0x20)
         {
-            uint32_t tmp = strtol(val, NULL, 10) & 0x00FFFFFF;
+            memcpy(w->p, "\\u00", 4);
+            w->p[4] = hex[*s >> 4];
+            w->p[5] = hex[*s & 0x0F];
+            w->p += 6;
+        }
+        else
+            *w->p++ = *s;
+    }
+    *w->p++ = '"';
 
-            *p = tmp & 0xFF;
-            *(p + 1) = (tmp >> 8) & 0xFF;
-            *(p + 2) = (tmp >> 16) & 0xFF;
+    return 0;
+}
 
-            p += 3;
-            break;
-        }
-        case CHAR_TYPE_32BIT:
-        {
-            uint32_t tmp = strtol(val, NULL, 10);
+static int writer_begin(payload_writer_t *w)
+{
+    if (w->format == BLE_PAYLOAD_FORMAT_JSON)
+        *w->p++ = '{';
+    /* Map head, updated once the number of fields is known */
+    else if (w->format == BLE_PAYLOAD_FORMAT_CBOR)
+        w->p = (char *)cbor_head((uint8_t *)w->p, CBOR_MAJOR_MAP, 0);
 
-            *p = tmp & 0xFF;
-            *(p + 1) = (tmp >> 8) & 0xFF;
-            *(p + 2) = (tmp >> 16) & 0xFF;
-            *(p + 3) = (tmp >> 24) & 0xFF;
+    return 0;
+}
 
-            p += 4;
-            break;
-        }
-        case CHAR_TYPE_UINT32:
-        case CHAR_TYPE_SINT32:
+static int writer_field_begin(payload_writer_t *w, const char *name)
+{
+    if (w->format == BLE_PAYLOAD_FORMAT_JSON)
+    {
+        if (w->field && w->p < w->end)
+            *w->p++ = ',';
+        if (!w->in_array)
         {
-            uint32_t tmp = strtoul(val, NULL, 10);
+            if (writer_json_string(w, (const uint8_t *)name, strlen(name)) ||
+                w->p == w->end)
+            {
+                return -1;
+            }
+            *w->p++ = ':';
+        }
+    }
+    else if (w->format == BLE_PAYLOAD_FORMAT_CBOR && !w->in_array)
+    {
+        size_t len = strlen(name);
 
-            *p = tmp & 0xFF;
-            *(p + 1) = (tmp >> 8) & 0xFF;
-            *(p + 2) = (tmp >> 16) & 0xFF;
-            *(p + 3) = (tmp >> 24) & 0xFF;
+        if (w->end - w->p < CBOR_ITEM_MAX + len)
+            return -1;
+        w->p = (char *)cbor_text((uint8_t *)w->p, name, len);
+    }
 
-            p += 4;
-            break;
-        }
-        case CHAR_TYPE_UINT40:
-        {
-            uint64_t tmp = strtoul(val, NULL, 10);
+    return w->end - w->p < WRITER_FIELD_MAX ? -1 : 0;
+}
 
-            *p = tmp & 0xFF;
-            *(p + 1) = (tmp >> 8) & 0xFF;
-            *(p + 2) = (tmp >> 16) & 0xFF;
-            *(p + 3) = (tmp >> 24) & 0xFF;
-            *(p + 4) = (tmp >> 32) & 0xFF;
+static void writer_field_end(payload_writer_t *w, char *value)
+{
+    w->field++;
 
-            p += 5;
-            break;
-        }
-        case CHAR_TYPE_UINT48:
-        {
-            uint64_t tmp = strtoul(val, NULL, 10);
+    if (w->format == BLE_PAYLOAD_FORMAT_TEXT)
+    {
+        *w->p++ = ',';
+        return;
+    }
 
-            *p = tmp & 0xFF;
-            *(p + 1) = (tmp >> 8) & 0xFF;
-            *(p + 2) = (tmp >> 16) & 0xFF;
-            *(p + 3) = (tmp >> 24) & 0xFF;
-            *(p + 4) = (tmp >> 32) & 0xFF;
-            *(p + 5) = (tmp >> 40) & 0xFF;
+    /* JSON has no representation of NaN and infinity */
+    if (w->format == BLE_PAYLOAD_FORMAT_JSON && (value[0] == 'n' ||
+        value[0] == 'i' || (value[0] == '-' && value[1] == 'i')))
+    {
+        memcpy(value, "null", 4);
+        w->p = value + 4;
+    }
+}
 
-            p += 6;
-            break;
-        }
-        /* String values consume the rest of the buffer */
-        case CHAR_TYPE_UTF8S:
-        {
-            size_t len = strlen(val);
+static int writer_string(payload_writer_t *w, const uint8_t *s, size_t len)
+{
+    if (w->format == BLE_PAYLOAD_FORMAT_JSON)
+        return writer_json_string(w, s, len);
 
-            strcpy((char *)p, val);
+    if (w->format == BLE_PAYLOAD_FORMAT_CBOR)
+    {
+        if (w->end - w->p < CBOR_ITEM_MAX + len)
+            return -1;
+        w->p = (char *)cbor_text((uint8_t *)w->p, (const char *)s, len);
+        return 0;
+    }
 
-            p += len + 1;
-            break;
-        }
-        /* IEEE-754 floating point format */
-        /* Note, ESP-32 is little endian, as is the characteristic value */
-        case CHAR_TYPE_FLOAT64:
-        {
-            union {
-                double d;
-                uint8_t b[8];
-            } tmp;
-            tmp.d = strtod(val, NULL);
+    if (w->end - w->p < len + 1)
+        return -1;
 
-            memcpy(p, tmp.b, 8);
+    memcpy(w->p, s, len);
+    w->p += len;
+    return 0;
+}
 
-            p += 8;
-            break;
-        }
-        /* IEEE-11073 floating point format */
-        case CHAR_TYPE_SFLOAT:
-        case CHAR_TYPE_FLOAT:
-        case CHAR_TYPE_REG_CERT_DATA_LIST:
-        case CHAR_TYPE_VARIABLE:
-        case CHAR_TYPE_GATT_UUID:
-        case CHAR_TYPE_UNKNOWN:
-            printf(">>>> Unhandled characteristic type %d <<<<\n", *types);
+/* Values beyond the defined fields are written as a list of bytes */
+static int writer_bytes(payload_writer_t *w, const uint8_t *data, size_t len)
+{
+    size_t i;
+
+    if (!len)
+        return 0;
+
+    if (w->format == BLE_PAYLOAD_FORMAT_CBOR)
+    {
+        if (writer_field_begin(w, "data") ||
+            w->end - w->p < CBOR_ITEM_MAX + len)
+        {
+            return -1;
         }
+        w->p = (char *)cbor_bytes((uint8_t *)w->p, data, len);
+        w->field++;
+        return 0;
+    }
 
-        val = strtok(NULL, ",");
+    if (w->format == BLE_PAYLOAD_FORMAT_JSON)
+    {
+        if (writer_field_begin(w, "data"))
+            return -1;
+        *w->p++ = '[';
     }
 
-    while (val)
+    for (i = 0; i < len; i++)
     {
-        *p = strtoul(val, NULL, 10);
-        p += 1;
-        val = strtok(NULL, ",");
+        if (w->end - w->p < 5)
+            return -1;
+
+        if (i && w->format == BLE_PAYLOAD_FORMAT_JSON)
+            *w->p++ = ',';
+        w->p = format_uint32(w->p, data[i]);
+        if (w->format == BLE_PAYLOAD_FORMAT_TEXT)
+            *w->p++ = ',';
     }
 
-    free(str);
+    if (w->format == BLE_PAYLOAD_FORMAT_JSON)
+        *w->p++ = ']';
 
-    *ret_len = p - buf;
-    return buf;
+    return 0;
 }
 
-static const char *ble_get_sig_service_name(ble_uuid_t uuid)
+static int writer_end(payload_writer_t *w, char *start)
 {
-    service_desc_t *p = ble_get_sig_service(uuid);
+    /* Fix the map head written by writer_begin() */
+    if (w->format == BLE_PAYLOAD_FORMAT_CBOR)
+    {
+        size_t len = cbor_head_len(w->field);
+
+        if (w->end - w->p < len - 1)
+            return -1;
+        memmove(start + len, start + 1, w->p - start - 1);
+        cbor_head((uint8_t *)start, CBOR_MAJOR_MAP, w->field);
+        w->p += len - 1;
+    }
+    else if (w->format == BLE_PAYLOAD_FORMAT_JSON)
+    {
+        if (w->p == w->end)
+            return -1;
+        *w->p++ = '}';
+    }
+    /* Drop the delimiter following the last field */
+    else if (w->p > start)
+        w->p--;
 
-    return p ? p->name : NULL;
+    return 0;
+}
+
+/* Writes a single field's value. The whole characteristic value is passed for
+ * transforms referring to its bytes */
+static int writer_value(payload_writer_t *w, uint8_t type,
+    const transform_t *transform, const uint8_t *field, size_t size,
+    const uint8_t *data, size_t len)
+{
+    char *value = w->p;
+
+    if (type == CHAR_TYPE_UTF8S)
+    {
+        if (writer_string(w, field, size))
+            return -1;
+    }
+    else if (transform || w->exponent)
+    {
+        double d = ble_field_value(type, field);
+
+        if (w->exponent)
+        {
+            d = w->exponent < 0 ? d / pow(10, -w->exponent) :
+                d * pow(10, w->exponent);
+        }
+        if (transform)
+            d = transform_apply(transform, d, data, len);
+        w->p = ble_number_format(w->p, w->format, d);
+    }
+    else if (w->format == BLE_PAYLOAD_FORMAT_CBOR)
+        w->p = ble_field_cbor(w->p, type, field);
+    else
+        w->p = ble_field_format(w->p, type, field);
+    writer_field_end(w, value);
+
+    return 0;
+}
+
+/* Arrays and objects nested in the value, CBOR ones are of indefinite length.
+ * The textual format just lists their fields */
+static int writer_container_begin(payload_writer_t *w, uint8_t is_map)
+{
+    if (w->p == w->end)
+        return -1;
+
+    if (w->format == BLE_PAYLOAD_FORMAT_JSON)
+        *w->p++ = is_map ? '{' : '[';
+    else if (w->format == BLE_PAYLOAD_FORMAT_CBOR)
+    {
+        w->p = (char *)cbor_indefinite((uint8_t *)w->p,
+            is_map ? CBOR_MAJOR_MAP : CBOR_MAJOR_ARRAY);
+    }
+
+    return 0;
+}
+
+static int writer_container_end(payload_writer_t *w, uint8_t is_map)
+{
+    if (w->p == w->end)
+        return -1;
+
+    if (w->format == BLE_PAYLOAD_FORMAT_JSON)
+        *w->p++ = is_map ? '}' : ']';
+    else if (w->format == BLE_PAYLOAD_FORMAT_CBOR)
+        w->p = (char *)cbor_break((uint8_t *)w->p);
+
+    return 0;
+}
+
+/* Walks the value's fields per the characteristic types and returns the number
+ * of bytes consumed, or -1 if the output doesn't fit */
+static int chartoa_fields(payload_writer_t *w, const uint8_t *types,
+    const uint8_t *data, size_t len)
+{
+    const field_desc_t *desc;
+    size_t i = 0, size;
+    char name[16];
+
+    for (; types && *types != CHAR_TYPES_END; types++)
+    {
+        /* String values consume the rest of the buffer */
+        if (*types == CHAR_TYPE_UTF8S)
+            size = len - i;
+        else if (!(size = ble_type_size(*types)))
+        {
+            printf(">>>> Unhandled characteristic type %d <<<<\n", *types);
+            continue;
+        }
+
+        /* Value is too short, the rest is written as bytes */
+        if (size > len - i)
+            break;
+
+        /* SIG fields have their own decimal exponent */
+        if ((desc = ble_field_desc(w->fields, w->field)))
+            w->exponent = desc->exponent;
+
+        if (writer_field_begin(w, ble_field_name(w->names, w->fields,
+            w->field, name)))
+            return -1;
+
+        if (writer_value(w, *types, transform_get(w->transforms, w->field),
+            &data[i], size, data, len))
+        {
+            return -1;
+        }
+
+        i += size;
+    }
+
+    return i;
+}
+
+/* Layout driven decoding. Values of the fields read so far are kept for the
+ * conditions and counts of the following ones */
+typedef struct {
+    const layout_t *layout;
+    const uint8_t *data;
+    size_t len;
+    size_t i;
+    uint8_t is_short; /* The value ended in the middle of a field */
+    uint32_t values[LAYOUT_FIELDS_MAX];
+} layout_reader_t;
+
+static int chartoa_layout_fields(payload_writer_t *w, layout_reader_t *r,
+    uint8_t first, uint8_t count);
+
+static int layout_field_is_present(layout_reader_t *r,
+    const layout_field_t *field)
+{
+    uint32_t value = r->values[field->cond_field] & field->cond_mask;
+
+    switch (field->cond)
+    {
+    case LAYOUT_COND_ANY: return value != 0;
+    case LAYOUT_COND_EQUALS: return value == field->cond_value;
+    }
+
+    return 1;
+}
+
+static const char *layout_field_name(const layout_field_t *field,
+    uint8_t index)
+{
+    static char name[16];
+
+    if (field->name)
+        return field->name;
+
+    sprintf(name, "field%u", index);
+    return name;
+}
+
+/* Groups are written as an array of their repetitions, each an object unless
+ * the group has a single field */
+static int chartoa_layout_group(payload_writer_t *w, layout_reader_t *r,
+    uint8_t index)
+{
+    const layout_field_t *group = &r->layout->fields[index];
+    uint8_t is_map = group->group_size > 1, in_array = w->in_array;
+    uint8_t until_end = group->count_field == LAYOUT_NONE && !group->count;
+    uint32_t count = group->count_field == LAYOUT_NONE ? group->count :
+        r->values[group->count_field];
+    size_t field = w->field, n, start;
+
+    if (writer_field_begin(w, layout_field_name(group, index)) ||
+        writer_container_begin(w, 0))
+    {
+        return -1;
+    }
+
+    w->in_array = 1;
+    for (n = 0; !r->is_short &&
+        (until_end ? r->len - r->i >= group->min_size : n < count); n++)
+    {
+        w->field = n;
+        start = r->i;
+        if (is_map)
+        {
+            if (writer_field_begin(w, NULL) || writer_container_begin(w, 1))
+                return -1;
+            w->field = 0;
+            w->in_array = 0;
+        }
+
+        if (chartoa_layout_fields(w, r, index + 1, group->group_size))
+            return -1;
+
+        if (is_map)
+        {
+            if (writer_container_end(w, 1))
+                return -1;
+            w->field = n + 1;
+            w->in_array = 1;
+        }
+
+        /* Repetitions that consume nothing would all be the same */
+        if (r->i == start)
+            break;
+    }
+
+    w->field = field + 1;
+    w->in_array = in_array;
+
+    return writer_container_end(w, 0);
+}
+
+/* Decodes count layout entries starting at first, returns -1 if the output
+ * doesn't fit */
+static int chartoa_layout_fields(payload_writer_t *w, layout_reader_t *r,
+    uint8_t first, uint8_t count)
+{
+    const layout_field_t *field;
+    uint8_t index, buf[8];
+    const uint8_t *p;
+    size_t size, j;
+
+    for (index = first; index < first + count && !r->is_short;
+        index += field->type == LAYOUT_TYPE_GROUP ? field->group_size + 1 : 1)
+    {
+        field = &r->layout->fields[index];
+        if (!layout_field_is_present(r, field))
+            continue;
+
+        if (field->type == LAYOUT_TYPE_GROUP)
+        {
+            if (chartoa_layout_group(w, r, index))
+                return -1;
+            continue;
+        }
+
+        /* String values consume the rest of the buffer */
+        size = field->type == LAYOUT_TYPE_SKIP ? field->count :
+            field->type == CHAR_TYPE_UTF8S ? r->len - r->i :
+            ble_type_size(field->type);
+
+        if (size > r->len - r->i)
+        {
+            r->is_short = 1;
+            break;
+        }
+
+        p = &r->data[r->i];
+        r->i += size;
+        if (field->type == LAYOUT_TYPE_SKIP)
+            continue;
+
+        /* Fields are decoded as little endian */
+        if (field->is_big_endian && field->type != CHAR_TYPE_UTF8S)
+        {
+            for (j = 0; j < size; j++)
+                buf[j] = p[size - 1 - j];
+            p = buf;
+        }
+
+        if (field->type != CHAR_TYPE_UTF8S)
+            r->values[index] = read_le(p, size);
+
+        if (writer_field_begin(w, layout_field_name(field, index)) ||
+            writer_value(w, field->type, transform_get(w->transforms, index),
+            p, size, r->data, r->len))
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Walks the value's fields per the characteristic's layout and returns the
+ * number of bytes consumed, or -1 if the output doesn't fit */
+static int chartoa_layout(payload_writer_t *w, const layout_t *layout,
+    const uint8_t *data, size_t len)
+{
+    layout_reader_t r = { .layout = layout, .data = data, .len = len };
+
+    if (chartoa_layout_fields(w, &r, 0, layout->fields_count))
+        return -1;
+
+    return r.i;
+}
+
+char *chartoa(mac_addr_t mac, ble_uuid_t uuid, ble_payload_format_t format,
+    const uint8_t *data, size_t len, size_t *ret_len)
+{
+    /* Fits the longest attribute value, 512 bytes, written as a list of bytes */
+    static char buf[2112];
+    characteristic_decoder_t decoder;
+    const layout_t *layout;
+    const ble_descriptors_t *d = NULL;
+    ble_descriptors_t d_buf;
+    const char *unit;
+    uint16_t unit_uuid;
+    uint8_t types[TYPES_MAX];
+    /* Keep room for the NUL terminator */
+    payload_writer_t w = { .format = format, .p = buf,
+        .end = buf + sizeof(buf) - 1 };
+    int i = 0;
+
+    /* Passthrough formats don't depend on the characteristic's definition */
+    switch (format)
+    {
+    case BLE_PAYLOAD_FORMAT_RAW:
+        if (len >= sizeof(buf))
+            return NULL;
+        memcpy(buf, data, len);
+        w.p = buf + len;
+        goto done;
+    case BLE_PAYLOAD_FORMAT_HEX:
+        if (len * 2 >= sizeof(buf))
+            return NULL;
+        w.p = format_hex(buf, data, len);
+        goto done;
+    case BLE_PAYLOAD_FORMAT_BASE64:
+        if ((len + 2) / 3 * 4 >= sizeof(buf))
+            return NULL;
+        w.p = format_base64(buf, data, len);
+        goto done;
+    default:
+        break;
+    }
+
+    /* Configured layouts take precedence. Otherwise, characteristics with a
+     * known layout have a specialized decoder for the text format. It
+     * declines values too short for it, in which case the generic one, driven
+     * by the characteristic types, is used. It doesn't apply transforms, so
+     * it's skipped for characteristics that have any */
+    w.transforms = transform_find(uuid);
+    if ((layout = layout_find(uuid)))
+    {
+        if (writer_begin(&w) || (i = chartoa_layout(&w, layout, data, len)) < 0)
+            return NULL;
+    }
+    else if (format != BLE_PAYLOAD_FORMAT_TEXT || w.transforms ||
+        !(decoder = ble_get_characteristic_decoder(uuid)) ||
+        len + WRITER_FIELD_MAX > sizeof(buf) || !(i = decoder(data, len, &w.p)))
+    {
+        if (format == BLE_PAYLOAD_FORMAT_JSON ||
+            format == BLE_PAYLOAD_FORMAT_CBOR)
+        {
+            w.names = config_ble_characteristic_fields_get(uuidtoa(uuid));
+            w.fields = ble_get_characteristic_fields(uuid);
+        }
+
+        /* Presentation Format descriptors define a single value with its
+         * decimal exponent and unit */
+        if ((d = ble_get_characteristic_descriptors(mac, uuid, &d_buf)))
+        {
+            w.exponent = d->exponent;
+            if (!w.names)
+                w.names = descriptor_names;
+        }
+
+        if (writer_begin(&w) || (i = chartoa_fields(&w,
+            ble_get_characteristic_types(mac, uuid, types), data, len)) < 0)
+        {
+            return NULL;
+        }
+
+        /* The structured formats include the value's unit, if it has a
+         * single one */
+        unit_uuid = d ? d->unit : ble_fields_unit(w.fields);
+        if (unit_uuid && unit_uuid != UNIT_UNITLESS &&
+            format != BLE_PAYLOAD_FORMAT_TEXT &&
+            (unit = ble_get_unit_name(unit_uuid)))
+        {
+            if (writer_field_begin(&w, "unit") ||
+                writer_string(&w, (const uint8_t *)unit, strlen(unit)))
+            {
+                return NULL;
+            }
+            w.field++;
+        }
+    }
+
+    if (writer_bytes(&w, data + i, len - i) || writer_end(&w, buf))
+        return NULL;
+
+done:
+    *w.p = '\0';
+    if (ret_len)
+        *ret_len = w.p - buf;
+
+    return buf;
+}
+
+/* Single pass, length bounded parsing of textual values. Tokens are comma
+ * separated spans of the input, surrounding whitespace is ignored */
+typedef struct {
+    const char *s;
+    const char *end;
+} span_t;
+
+static void span_trim(span_t *span)
+{
+    while (span->s < span->end && isspace((unsigned char)*span->s))
+        span->s++;
+    while (span->end > span->s && isspace((unsigned char)span->end[-1]))
+        span->end--;
+}
+
+static int span_next_token(span_t *input, span_t *token)
+{
+    const char *comma;
+
+    if (input->s > input->end)
+        return -1;
+
+    if (!(comma = memchr(input->s, ',', input->end - input->s)))
+        comma = input->end;
+
+    token->s = input->s;
+    token->end = comma;
+    input->s = comma + 1;
+    span_trim(token);
+
+    return 0;
+}
+
+static int span_equals(span_t *span, const char *s)
+{
+    size_t len = strlen(s);
+
+    return span->end - span->s == len && !strncasecmp(span->s, s, len);
+}
+
+static int span_to_int64(span_t *span, int64_t min, int64_t max, int64_t *ret)
+{
+    const char *p = span->s;
+    uint64_t value = 0;
+    uint8_t is_negative = 0;
+
+    if (p < span->end && (*p == '-' || *p == '+'))
+        is_negative = *p++ == '-';
+
+    if (p == span->end)
+        return -1;
+
+    for (; p < span->end; p++)
+    {
+        if (*p < '0' || *p > '9' || value > (UINT64_MAX - 9) / 10)
+            return -1;
+        value = value * 10 + (*p - '0');
+    }
+
+    if (value > (uint64_t)INT64_MAX)
+        return -1;
+
+    *ret = is_negative ? -(int64_t)value : (int64_t)value;
+    return *ret < min || *ret > max ? -1 : 0;
+}
+
+/* Parses a decimal number to an exact mantissa * 10^exponent, digits beyond
+ * the mantissa's precision are dropped */
+static int span_to_decimal(span_t *span, int64_t *mantissa, int *exponent)
+{
+    const char *p = span->s;
+    uint8_t is_negative = 0, has_digits = 0, is_fraction = 0;
+    int64_t exp_value;
+    span_t exp_span;
+
+    *mantissa = 0;
+    *exponent = 0;
+
+    if (p < span->end && (*p == '-' || *p == '+'))
+        is_negative = *p++ == '-';
+
+    for (; p < span->end; p++)
+    {
+        if (*p == '.' && !is_fraction)
+        {
+            is_fraction = 1;
+            continue;
+        }
+        if (*p < '0' || *p > '9')
+            break;
+
+        has_digits = 1;
+        if (*mantissa < INT64_MAX / 10 - 9)
+        {
+            *mantissa = *mantissa * 10 + (*p - '0');
+            *exponent -= is_fraction;
+        }
+        else
+            *exponent += !is_fraction;
+    }
+
+    if (!has_digits)
+        return -1;
+
+    if (p < span->end && (*p == 'e' || *p == 'E'))
+    {
+        exp_span.s = p + 1;
+        exp_span.end = span->end;
+        if (span_to_int64(&exp_span, -1000, 1000, &exp_value))
+            return -1;
+        *exponent += exp_value;
+    }
+    else if (p != span->end)
+        return -1;
+
+    if (is_negative)
+        *mantissa = -*mantissa;
+
+    return 0;
+}
+
+/* Parses a decimal number and scales it by 10^shift, rounded to the nearest
+ * integer */
+static int span_to_scaled(span_t *span, int shift, int64_t min, int64_t max,
+    int64_t *ret)
+{
+    int64_t mantissa, divisor = 1;
+    int exponent;
+
+    if (span_to_decimal(span, &mantissa, &exponent))
+        return -1;
+
+    for (exponent += shift; exponent > 0 && mantissa; exponent--)
+    {
+        if (mantissa > INT64_MAX / 10 || mantissa < INT64_MIN / 10)
+            return -1;
+        mantissa *= 10;
+    }
+
+    for (; exponent < 0 && divisor <= INT64_MAX / 10; exponent++)
+        divisor *= 10;
+    if (exponent < 0)
+        mantissa = 0;
+    else if (divisor > 1)
+    {
+        mantissa = (mantissa + (mantissa < 0 ? -divisor : divisor) / 2) /
+            divisor;
+    }
+
+    *ret = mantissa;
+    return mantissa < min || mantissa > max ? -1 : 0;
+}
+
+/* Encodes an IEEE-11073 floating point value with the given mantissa and
+ * exponent ranges. Precision is kept when possible and rounded otherwise */
+static int span_to_ieee11073(span_t *span, int32_t mantissa_max,
+    int8_t exponent_min, int8_t exponent_max, uint32_t nan,
+    uint32_t positive_infinity, uint32_t negative_infinity,
+    uint8_t mantissa_bits, uint32_t *ret)
+{
+    int64_t mantissa;
+    int exponent;
+
+    if (span_equals(span, "nan"))
+        return *ret = nan, 0;
+    if (span_equals(span, "inf") || span_equals(span, "+inf"))
+        return *ret = positive_infinity, 0;
+    if (span_equals(span, "-inf"))
+        return *ret = negative_infinity, 0;
+
+    if (span_to_decimal(span, &mantissa, &exponent))
+        return -1;
+
+    /* Round off digits that don't fit in the mantissa or exponent */
+    while (mantissa > mantissa_max || mantissa < -mantissa_max ||
+        (exponent < exponent_min && mantissa))
+    {
+        mantissa = (mantissa + (mantissa < 0 ? -5 : 5)) / 10;
+        exponent++;
+    }
+
+    /* Scale large values down to the exponent range */
+    while (exponent > exponent_max && mantissa &&
+        mantissa * 10 <= mantissa_max && mantissa * 10 >= -mantissa_max)
+    {
+        mantissa *= 10;
+        exponent--;
+    }
+
+    if (!mantissa)
+        exponent = 0;
+    if (exponent > exponent_max || exponent < exponent_min)
+        return -1;
+
+    *ret = ((uint32_t)exponent << mantissa_bits) |
+        ((uint32_t)mantissa & ((1 << mantissa_bits) - 1));
+    return 0;
+}
+
+static void write_le(uint8_t *p, uint64_t value, size_t size)
+{
+    for (; size; size--, value >>= 8)
+        *p++ = value & 0xFF;
+}
+
+/* Parses a single fixed size field and writes it at *p. Integer fields with
+ * a decimal exponent are given in their scaled form, e.g. 21.5 for 2150 with
+ * an exponent of -2 */
+static int atochar_field(uint8_t type, int8_t exponent, span_t *token,
+    uint8_t **p, uint8_t *end)
+{
+    int64_t min = 0, max = 0, value = 0;
+    size_t bytes = ble_type_size(type);
+
+    if (!bytes || end - *p < bytes)
+        return -1;
+
+    switch (type)
+    {
+    case CHAR_TYPE_BOOLEAN:
+        if (span_equals(token, "true") || span_equals(token, "1"))
+            value = 1;
+        else if (span_equals(token, "false") || span_equals(token, "0"))
+            value = 0;
+        else
+            return -1;
+        break;
+    case CHAR_TYPE_2BIT: max = 0x03; break;
+    case CHAR_TYPE_4BIT:
+    case CHAR_TYPE_NIBBLE: max = 0x0F; break;
+    case CHAR_TYPE_8BIT:
+    case CHAR_TYPE_UINT8: max = UINT8_MAX; break;
+    case CHAR_TYPE_SINT8: min = INT8_MIN; max = INT8_MAX; break;
+    case CHAR_TYPE_UINT12: max = 0x0FFF; break;
+    case CHAR_TYPE_16BIT:
+    case CHAR_TYPE_UINT16: max = UINT16_MAX; break;
+    case CHAR_TYPE_SINT16: min = INT16_MIN; max = INT16_MAX; break;
+    case CHAR_TYPE_24BIT:
+    case CHAR_TYPE_UINT24: max = 0xFFFFFF; break;
+    case CHAR_TYPE_SINT24: min = -0x800000; max = 0x7FFFFF; break;
+    case CHAR_TYPE_32BIT:
+    case CHAR_TYPE_UINT32: max = UINT32_MAX; break;
+    case CHAR_TYPE_SINT32: min = INT32_MIN; max = INT32_MAX; break;
+    case CHAR_TYPE_UINT40: max = 0xFFFFFFFFFFLL; break;
+    case CHAR_TYPE_UINT48: max = 0xFFFFFFFFFFFFLL; break;
+    /* IEEE-754 floating point format */
+    /* Note, ESP-32 is little endian, as is the characteristic value */
+    case CHAR_TYPE_FLOAT64:
+    {
+        char tmp[32], *tmp_end;
+        double d;
+
+        if (token->end - token->s >= sizeof(tmp))
+            return -1;
+
+        memcpy(tmp, token->s, token->end - token->s);
+        tmp[token->end - token->s] = '\0';
+        d = strtod(tmp, &tmp_end);
+        if (tmp_end == tmp || *tmp_end)
+            return -1;
+
+        memcpy(*p, &d, sizeof(d));
+        *p += sizeof(d);
+        return 0;
+    }
+    /* IEEE-11073 floating point format */
+    case CHAR_TYPE_SFLOAT:
+    {
+        uint32_t tmp;
+
+        if (span_to_ieee11073(token, 2045, -8, 7, 0x07FF, 0x07FE, 0x0802, 12,
+            &tmp))
+        {
+            return -1;
+        }
+        value = tmp & 0xFFFF;
+        break;
+    }
+    case CHAR_TYPE_FLOAT:
+    {
+        uint32_t tmp;
+
+        if (span_to_ieee11073(token, 0x7FFFFD, -128, 127, 0x007FFFFF,
+            0x007FFFFE, 0x00800002, 24, &tmp))
+        {
+            return -1;
+        }
+        value = tmp;
+        break;
+    }
+    }
+
+    /* Integer types, range checked */
+    if (max && (exponent ? span_to_scaled(token, -exponent, min, max, &value) :
+        span_to_int64(token, min, max, &value)))
+    {
+        return -1;
+    }
+
+    write_le(*p, value, bytes);
+    *p += bytes;
+    return 0;
+}
+
+/* The fields share the decimal exponent of the characteristic's Presentation
+ * Format descriptor, if any */
+static int atochar_text(const uint8_t *types, int8_t exponent, span_t *input,
+    uint8_t **p, uint8_t *end, size_t *field)
+{
+    span_t token;
+
+    for (; types && *types != CHAR_TYPES_END; types++, (*field)++)
+    {
+        /* String values consume the rest of the input */
+        if (*types == CHAR_TYPE_UTF8S)
+        {
+            if (input->s > input->end)
+                break;
+            if (input->end - input->s > end - *p)
+                return -1;
+
+            memcpy(*p, input->s, input->end - input->s);
+            *p += input->end - input->s;
+            input->s = input->end + 1;
+            break;
+        }
+
+        if (span_next_token(input, &token))
+            break;
+
+        if (atochar_field(*types, exponent, &token, p, end))
+            return -1;
+    }
+
+    /* Any remaining values are written as raw bytes */
+    for (; !span_next_token(input, &token); (*field)++)
+    {
+        int64_t value;
+
+        if (*p == end || span_to_int64(&token, 0, UINT8_MAX, &value))
+            return -1;
+
+        *(*p)++ = value;
+    }
+
+    return 0;
+}
+
+/* Minimal JSON object reader for flat objects, as written by chartoa() */
+static int json_scan_string(span_t *input, span_t *str)
+{
+    const char *s = input->s;
+
+    if (s == input->end || *s++ != '"')
+        return -1;
+
+    str->s = s;
+    for (; s < input->end; s++)
+    {
+        if (*s == '\\')
+            s++;
+        else if (*s == '"')
+        {
+            str->end = s;
+            input->s = s + 1;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static int json_scan_value(span_t *input, span_t *value)
+{
+    span_t str;
+    const char *s;
+
+    value->s = input->s;
+    if (input->s < input->end && *input->s == '"')
+    {
+        if (json_scan_string(input, &str))
+            return -1;
+        value->end = input->s;
+        return 0;
+    }
+
+    s = memchr(input->s, input->s < input->end && *input->s == '[' ? ']' : ',',
+        input->end - input->s);
+    if (s && *s == ']')
+        s++;
+    input->s = value->end = s ? s : input->end;
+    span_trim(value);
+
+    return value->s == value->end ? -1 : 0;
+}
+
+static int json_object_get(span_t object, const char *key, span_t *value)
+{
+    span_t k;
+
+    for (span_trim(&object); object.s < object.end; span_trim(&object))
+    {
+        if (json_scan_string(&object, &k))
+            return -1;
+
+        span_trim(&object);
+        if (object.s == object.end || *object.s++ != ':')
+            return -1;
+
+        span_trim(&object);
+        if (json_scan_value(&object, value))
+            return -1;
+
+        if (k.end - k.s == strlen(key) && !memcmp(k.s, key, k.end - k.s))
+            return 0;
+
+        span_trim(&object);
+        if (object.s < object.end && *object.s++ != ',')
+            return -1;
+    }
+
+    return -1;
+}
+
+static int json_hex4(const char **s, const char *end, uint32_t *c)
+{
+    int i;
+
+    if (end - *s < 4)
+        return -1;
+
+    for (*c = 0, i = 0; i < 4; i++, (*s)++)
+    {
+        char h = **s;
+
+        *c <<= 4;
+        if (h >= '0' && h <= '9')
+            *c |= h - '0';
+        else if ((h | 0x20) >= 'a' && (h | 0x20) <= 'f')
+            *c |= (h | 0x20) - 'a' + 10;
+        else
+            return -1;
+    }
+
+    return 0;
+}
+
+/* Writes the UTF-8 encoding of a JSON string's content */
+static int json_unescape(span_t *str, uint8_t **p, uint8_t *end)
+{
+    const char *s = str->s;
+    uint32_t c, low;
+    size_t n;
+
+    while (s < str->end)
+    {
+        c = (uint8_t)*s++;
+        if (c == '\\')
+        {
+            if (s == str->end)
+                return -1;
+
+            switch (*s++)
+            {
+            case '"': case '\\': case '/': c = s[-1]; break;
+            case 'b': c = '\b'; break;
+            case 'f': c = '\f'; break;
+            case 'n': c = '\n'; break;
+            case 'r': c = '\r'; break;
+            case 't': c = '\t'; break;
+            case 'u':
+                if (json_hex4(&s, str->end, &c))
+                    return -1;
+                /* Surrogate pair */
+                if (c >= 0xD800 && c < 0xDC00)
+                {
+                    if (str->end - s < 2 || s[0] != '\\' || s[1] != 'u')
+                        return -1;
+                    s += 2;
+                    if (json_hex4(&s, str->end, &low) || low < 0xDC00 ||
+                        low > 0xDFFF)
+                    {
+                        return -1;
+                    }
+                    c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                }
+                break;
+            default:
+                return -1;
+            }
+        }
+        else
+        {
+            /* Copy as is, the input is already UTF-8 */
+            if (*p == end)
+                return -1;
+            *(*p)++ = c;
+            continue;
+        }
+
+        n = c < 0x80 ? 1 : c < 0x800 ? 2 : c < 0x10000 ? 3 : 4;
+        if (end - *p < n)
+            return -1;
+
+        switch (n)
+        {
+        case 1:
+            *(*p)++ = c;
+            break;
+        case 2:
+            *(*p)++ = 0xC0 | (c >> 6);
+            *(*p)++ = 0x80 | (c & 0x3F);
+            break;
+        case 3:
+            *(*p)++ = 0xE0 | (c >> 12);
+            *(*p)++ = 0x80 | ((c >> 6) & 0x3F);
+            *(*p)++ = 0x80 | (c & 0x3F);
+            break;
+        case 4:
+            *(*p)++ = 0xF0 | (c >> 18);
+            *(*p)++ = 0x80 | ((c >> 12) & 0x3F);
+            *(*p)++ = 0x80 | ((c >> 6) & 0x3F);
+            *(*p)++ = 0x80 | (c & 0x3F);
+            break;
+        }
+    }
+
+    return 0;
+}
+
+/* Fields are looked up by name and written in order, up to the first missing
+ * one. Bytes beyond the fields are taken from the "data" array. Values are
+ * expected as published, i.e. named and scaled per the SIG definitions or the
+ * characteristic's Presentation Format descriptor */
+static int atochar_json(ble_uuid_t uuid, const ble_descriptors_t *d,
+    const uint8_t *types, span_t *input, uint8_t **p, uint8_t *end,
+    size_t *field)
+{
+    const char **names = config_ble_characteristic_fields_get(uuidtoa(uuid));
+    const field_desc_t *fields = ble_get_characteristic_fields(uuid);
+    const field_desc_t *desc;
+    span_t object = *input, value, str;
+    char name[16];
+
+    if (d && !names)
+        names = descriptor_names;
+
+    span_trim(&object);
+    if (object.end - object.s < 2 || *object.s != '{' || object.end[-1] != '}')
+        return -1;
+    object.s++;
+    object.end--;
+
+    for (; types && *types != CHAR_TYPES_END; types++, (*field)++)
+    {
+        if (json_object_get(object, ble_field_name(names, fields, *field,
+            name), &value))
+        {
+            break;
+        }
+
+        if (*types == CHAR_TYPE_UTF8S)
+        {
+            if (json_scan_string(&value, &str) || json_unescape(&str, p, end))
+                return -1;
+            continue;
+        }
+
+        /* Numbers may also be quoted */
+        if (*value.s == '"')
+        {
+            value.s++;
+            value.end--;
+        }
+
+        desc = ble_field_desc(fields, *field);
+        if (atochar_field(*types, desc ? desc->exponent : d ? d->exponent : 0,
+            &value, p, end))
+            return -1;
+    }
+
+    if (json_object_get(object, "data", &value))
+        return 0;
+
+    if (value.end - value.s < 2 || *value.s != '[' || value.end[-1] != ']')
+        return -1;
+    value.s++;
+    value.end--;
+    span_trim(&value);
+
+    return value.s == value.end ? 0 :
+        atochar_text(NULL, 0, &value, p, end, field);
+}
+
+int atochar(mac_addr_t mac, ble_uuid_t uuid, ble_payload_format_t format,
+    const char *data, size_t len, uint8_t *buf, size_t size,
+    size_t *err_field)
+{
+    uint8_t types_buf[TYPES_MAX];
+    const uint8_t *types = ble_get_characteristic_types(mac, uuid, types_buf);
+    ble_descriptors_t d_buf;
+    const ble_descriptors_t *d = ble_get_characteristic_descriptors(mac, uuid,
+        &d_buf);
+    span_t input = { .s = data, .end = data + len };
+    uint8_t *p = buf;
+    size_t field = 0;
+    int ret;
+
+    if (!len)
+        return 0;
+
+    switch (format)
+    {
+    case BLE_PAYLOAD_FORMAT_RAW:
+        if (len > size)
+            goto error;
+        memcpy(buf, data, len);
+        return len;
+    case BLE_PAYLOAD_FORMAT_HEX:
+        if ((ret = parse_hex(data, len, buf, size)) < 0)
+            goto error;
+        return ret;
+    case BLE_PAYLOAD_FORMAT_BASE64:
+        if ((ret = parse_base64(data, len, buf, size)) < 0)
+            goto error;
+        return ret;
+    case BLE_PAYLOAD_FORMAT_JSON:
+        ret = atochar_json(uuid, d, types, &input, &p, buf + size, &field);
+        break;
+    /* CBOR is only used for publishing, write requests are in text */
+    default:
+        ret = atochar_text(types, d ? d->exponent : 0, &input, &p,
+            buf + size, &field);
+        break;
+    }
+
+    if (ret)
+        goto error;
+
+    return p - buf;
+
+error:
+    if (err_field)
+        *err_field = field;
+    return -1;
+}
+
+static const char *ble_get_sig_service_name(ble_uuid_t uuid)
+{
+    const service_desc_t *p = ble_get_sig_service(uuid);
+
+    return p ? gatt_names + p->name : NULL;
 }
 
 const char *ble_service_name_get(ble_uuid_t uuid)
@@ -627,19 +2026,31 @@ const char *ble_service_name_get(ble_uuid_t uuid)
 
 static const char *ble_get_sig_characteristic_name(ble_uuid_t uuid)
 {
-    characteristic_desc_t *p = ble_get_sig_characteristic(uuid);
+    const characteristic_desc_t *p = ble_get_sig_characteristic(uuid);
 
-    return p ? p->name : NULL;
+    return p ? gatt_names + p->name : NULL;
 }
 
-const char *ble_characteristic_name_get(ble_uuid_t uuid)
+const char *ble_characteristic_name_get(mac_addr_t mac, ble_uuid_t uuid)
 {
+    /* As uuidtoa(), the name is returned in a static buffer */
+    static char description[DESCRIPTION_MAX + 1];
     const char *name = config_ble_characteristic_name_get(uuidtoa(uuid));
+    ble_descriptors_t d;
 
     if (name)
         return name;
 
-    return ble_get_sig_characteristic_name(uuid) ? : uuidtoa(uuid);
+    if ((name = ble_get_sig_characteristic_name(uuid)))
+        return name;
+
+    if (!ble_descriptors_get(mac, uuid, &d) && *d.name)
+    {
+        memcpy(description, d.name, sizeof(description));
+        return description;
+    }
+
+    return uuidtoa(uuid);
 }
 
 ble_device_t *ble_device_add(ble_device_t **list, mac_addr_t mac,
@@ -803,6 +2214,8 @@ ble_characteristic_t *ble_device_characteristic_add(ble_service_t *service,
     characteristic->handle = handle;
     characteristic->properties = properties;
     characteristic->client_config_handle = 0;
+    characteristic->presentation_format_handle = 0;
+    characteristic->user_description_handle = 0;
 
     for (cur = &service->characteristics; *cur; cur = &(*cur)->next);
     *cur = characteristic;
@@ -8,12 +8,23 @@
 typedef uint8_t mac_addr_t[6];
 typedef uint8_t ble_uuid_t[16];
 
+typedef enum {
+    BLE_PAYLOAD_FORMAT_TEXT,
+    BLE_PAYLOAD_FORMAT_JSON,
+    BLE_PAYLOAD_FORMAT_RAW,
+    BLE_PAYLOAD_FORMAT_HEX,
+    BLE_PAYLOAD_FORMAT_BASE64,
+    BLE_PAYLOAD_FORMAT_CBOR,
+} ble_payload_format_t;
+
 typedef struct ble_characteristic_t {
     struct ble_characteristic_t *next;
     ble_uuid_t uuid;
     uint16_t handle;
     uint8_t properties;
     uint16_t client_config_handle;
+    uint16_t presentation_format_handle;
+    uint16_t user_description_handle;
 } ble_characteristic_t;
 
 typedef struct ble_service_t {
@@ -29,6 +40,10 @@ typedef struct ble_device_t {
     uint16_t conn_id;
     ble_service_t *services;
     uint8_t is_authenticating;
+    uint8_t is_authenticated;
+    uint8_t is_auth_failed; /* Operations aren't parked after a failure */
+    int64_t connected; /* Until the first authenticated value is received */
+    uint16_t pending_descriptors; /* Reads left before discovery completes */
 } ble_device_t;
 
 /* Callback functions */
@@ -43,12 +58,35 @@ char *mactoa(mac_addr_t mac);
 int atomac(const char *str, mac_addr_t mac);
 char *uuidtoa(ble_uuid_t uuid);
 int atouuid(const char *str, ble_uuid_t uuid);
-char *chartoa(ble_uuid_t uuid, const uint8_t *data, size_t len);
-uint8_t *atochar(ble_uuid_t uuid, const char *data, size_t len,
-    size_t *ret_len);
+/* Returns a NUL terminated payload, or NULL if it doesn't fit */
+char *chartoa(mac_addr_t mac, ble_uuid_t uuid, ble_payload_format_t format,
+    const uint8_t *data, size_t len, size_t *ret_len);
+/* Parses len bytes of data into buf, returns the number of bytes written or -1
+ * with the index of the offending field in err_field */
+int atochar(mac_addr_t mac, ble_uuid_t uuid, ble_payload_format_t format,
+    const char *data, size_t len, uint8_t *buf, size_t size,
+    size_t *err_field);
+
+/* Characteristic value types, see CHAR_TYPE_* in gatt.h. The size is 0 for
+ * variable length types */
+uint8_t ble_atotype(const char *type);
+size_t ble_type_size(uint8_t type);
+
+ble_payload_format_t ble_payload_format_get(ble_uuid_t service,
+    ble_uuid_t characteristic);
+
+/* Presentation Format (0x2904) and User Description (0x2901) descriptors of
+ * a device's characteristics, used to decode and name those without a
+ * definition */
+uint8_t ble_characteristic_descriptors_are_known(mac_addr_t mac,
+    ble_uuid_t uuid);
+int ble_characteristic_presentation_format_set(mac_addr_t mac,
+    ble_uuid_t uuid, const uint8_t *value, size_t len);
+int ble_characteristic_user_description_set(mac_addr_t mac,
+    ble_uuid_t uuid, const uint8_t *value, size_t len);
 
 const char *ble_service_name_get(ble_uuid_t uuid);
-const char *ble_characteristic_name_get(ble_uuid_t uuid);
+const char *ble_characteristic_name_get(mac_addr_t mac, ble_uuid_t uuid);
 
 /* Devices list */
 ble_device_t *ble_device_add(ble_device_t **list, mac_addr_t mac,
@@ -0,0 +1,513 @@
+#include "capture.h"
+#include <esp_gap_ble_api.h>
+#include <esp_gattc_api.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/ringbuf.h>
+#include <freertos/task.h>
+#include <string.h>
+
+/* Constants */
+#define CAPTURE_CHUNK_SIZE 768
+
+static const char *TAG = "Capture";
+
+/* Internal state */
+static RingbufHandle_t ringbuf = NULL;
+static uint8_t is_active = 0;
+/* Lower 32 bits of the time of the last record, enough for the deltas */
+static uint32_t last_event = 0;
+static uint32_t dropped = 0;
+/* Records are only written from the BT task, where the GAP and GATTC callbacks
+ * run, so they're assembled in a single buffer rather than on its stack */
+static uint8_t record_buf[sizeof(capture_record_t) + sizeof(capture_param_t) +
+    CAPTURE_VALUE_MAX];
+
+/* Callback functions */
+static capture_on_data_cb_t on_data_cb = NULL;
+
+void capture_set_on_data_cb(capture_on_data_cb_t cb)
+{
+    on_data_cb = cb;
+}
+
+/* Sends the record whose parameters and value were written after its header
+ * in record_buf */
+static void capture_record_send(capture_source_t source, int event,
+    uint8_t gattc_if, size_t param_len, size_t value_len)
+{
+    capture_record_t *record = (capture_record_t *)record_buf;
+    uint32_t now = esp_timer_get_time();
+    size_t len = sizeof(*record) + param_len + value_len;
+
+    record->delta_us = now - __atomic_load_n(&last_event, __ATOMIC_RELAXED);
+    record->source = source;
+    record->event = event;
+    record->gattc_if = gattc_if;
+    record->reserved = 0;
+    record->param_len = param_len;
+    record->value_len = value_len;
+
+    /* Never block the BT task, drop the record if the buffer is full */
+    if (xRingbufferSend(ringbuf, record_buf, len, 0) != pdTRUE)
+    {
+        __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    __atomic_store_n(&last_event, now, __ATOMIC_RELAXED);
+}
+
+static void capture_write(capture_source_t source, int event,
+    uint8_t gattc_if, const void *param, size_t param_len,
+    const void *value, size_t value_len)
+{
+    uint8_t *data = record_buf + sizeof(capture_record_t);
+
+    if (sizeof(capture_record_t) + param_len + value_len > sizeof(record_buf))
+    {
+        __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    memcpy(data, param, param_len);
+    if (value_len)
+        memcpy(data + param_len, value, value_len);
+    capture_record_send(source, event, gattc_if, param_len, value_len);
+}
+
+void capture_gap_event(esp_gap_ble_cb_event_t event,
+    const esp_ble_gap_cb_param_t *param)
+{
+    capture_param_t p = { 0 };
+    const uint8_t *value = NULL;
+    size_t value_len = 0;
+
+    if (!capture_is_active())
+        return;
+
+    switch (event)
+    {
+    case ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT:
+        p.status = param->scan_param_cmpl.status;
+        break;
+    case ESP_GAP_BLE_SCAN_START_COMPLETE_EVT:
+        p.status = param->scan_start_cmpl.status;
+        break;
+    case ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT:
+        p.status = param->scan_stop_cmpl.status;
+        break;
+    case ESP_GAP_BLE_SET_LOCAL_PRIVACY_COMPLETE_EVT:
+        p.status = param->local_privacy_cmpl.status;
+        break;
+    case ESP_GAP_BLE_ADD_WHITELIST_COMPLETE_EVT:
+        p.status = param->add_whitelist_cmpl.status;
+        p.flag = param->add_whitelist_cmpl.wl_opration;
+        break;
+    case ESP_GAP_BLE_SCAN_RESULT_EVT:
+        memcpy(p.addr, param->scan_rst.bda, sizeof(p.addr));
+        p.addr_type = param->scan_rst.ble_addr_type;
+        p.flag = param->scan_rst.search_evt;
+        p.rssi = param->scan_rst.rssi;
+        value = param->scan_rst.ble_adv;
+        value_len = param->scan_rst.adv_data_len +
+            param->scan_rst.scan_rsp_len;
+        if (value_len > sizeof(param->scan_rst.ble_adv))
+            value_len = sizeof(param->scan_rst.ble_adv);
+        break;
+    case ESP_GAP_BLE_PASSKEY_REQ_EVT:
+        memcpy(p.addr, param->ble_security.ble_req.bd_addr, sizeof(p.addr));
+        break;
+    case ESP_GAP_BLE_AUTH_CMPL_EVT:
+        memcpy(p.addr, param->ble_security.auth_cmpl.bd_addr, sizeof(p.addr));
+        p.flag = param->ble_security.auth_cmpl.success;
+        p.status = param->ble_security.auth_cmpl.fail_reason;
+        break;
+    case ESP_GAP_BLE_REMOVE_BOND_DEV_COMPLETE_EVT:
+        memcpy(p.addr, param->remove_bond_dev_cmpl.bd_addr, sizeof(p.addr));
+        p.status = param->remove_bond_dev_cmpl.status;
+        break;
+    default:
+        break;
+    }
+
+    capture_write(CAPTURE_SOURCE_GAP, event, 0, &p, sizeof(p), value,
+        value_len);
+}
+
+void capture_gattc_event(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if,
+    const esp_ble_gattc_cb_param_t *param)
+{
+    capture_param_t p = { 0 };
+    const uint8_t *value = NULL;
+    size_t value_len = 0;
+
+    if (!capture_is_active())
+        return;
+
+    switch (event)
+    {
+    case ESP_GATTC_REG_EVT:
+        p.status = param->reg.status;
+        p.handle = param->reg.app_id;
+        break;
+    case ESP_GATTC_OPEN_EVT:
+        p.status = param->open.status;
+        p.conn_id = param->open.conn_id;
+        memcpy(p.addr, param->open.remote_bda, sizeof(p.addr));
+        p.mtu = param->open.mtu;
+        break;
+    case ESP_GATTC_CLOSE_EVT:
+        p.status = param->close.reason;
+        p.conn_id = param->close.conn_id;
+        memcpy(p.addr, param->close.remote_bda, sizeof(p.addr));
+        break;
+    case ESP_GATTC_CFG_MTU_EVT:
+        p.status = param->cfg_mtu.status;
+        p.conn_id = param->cfg_mtu.conn_id;
+        p.mtu = param->cfg_mtu.mtu;
+        break;
+    case ESP_GATTC_SEARCH_CMPL_EVT:
+        p.status = param->search_cmpl.status;
+        p.conn_id = param->search_cmpl.conn_id;
+        break;
+    case ESP_GATTC_READ_CHAR_EVT:
+    case ESP_GATTC_READ_DESCR_EVT:
+        p.status = param->read.status;
+        p.conn_id = param->read.conn_id;
+        p.handle = param->read.handle;
+        if (param->read.value)
+        {
+            value = param->read.value;
+            value_len = param->read.value_len;
+        }
+        break;
+    case ESP_GATTC_WRITE_CHAR_EVT:
+    case ESP_GATTC_WRITE_DESCR_EVT:
+        p.status = param->write.status;
+        p.conn_id = param->write.conn_id;
+        p.handle = param->write.handle;
+        break;
+    case ESP_GATTC_REG_FOR_NOTIFY_EVT:
+        p.status = param->reg_for_notify.status;
+        p.handle = param->reg_for_notify.handle;
+        break;
+    case ESP_GATTC_UNREG_FOR_NOTIFY_EVT:
+        p.status = param->unreg_for_notify.status;
+        p.handle = param->unreg_for_notify.handle;
+        break;
+    case ESP_GATTC_NOTIFY_EVT:
+        p.conn_id = param->notify.conn_id;
+        memcpy(p.addr, param->notify.remote_bda, sizeof(p.addr));
+        p.handle = param->notify.handle;
+        p.flag = param->notify.is_notify;
+        value = param->notify.value;
+        value_len = param->notify.value_len;
+        break;
+    case ESP_GATTC_CONNECT_EVT:
+        p.conn_id = param->connect.conn_id;
+        memcpy(p.addr, param->connect.remote_bda, sizeof(p.addr));
+        break;
+    case ESP_GATTC_DISCONNECT_EVT:
+        p.conn_id = param->disconnect.conn_id;
+        memcpy(p.addr, param->disconnect.remote_bda, sizeof(p.addr));
+        break;
+    default:
+        break;
+    }
+
+    capture_write(CAPTURE_SOURCE_GATTC, event, gattc_if, &p, sizeof(p), value,
+        value_len);
+}
+
+void capture_gattc_db(uint16_t conn_id, const esp_gattc_db_elem_t *db,
+    uint16_t count)
+{
+    capture_db_t *info = (capture_db_t *)(record_buf +
+        sizeof(capture_record_t));
+    capture_db_elem_t *elems = (capture_db_elem_t *)(info + 1);
+    uint16_t index = 0, i;
+
+    if (!capture_is_active())
+        return;
+
+    /* The database is split across as many records as needed */
+    do
+    {
+        info->conn_id = conn_id;
+        info->index = index;
+        info->count = count;
+        for (i = 0; i < CAPTURE_VALUE_MAX / sizeof(*elems) &&
+            index + i < count; i++)
+        {
+            const esp_gattc_db_elem_t *elem = &db[index + i];
+
+            elems[i].type = elem->type;
+            elems[i].properties = elem->properties;
+            elems[i].attribute_handle = elem->attribute_handle;
+            elems[i].start_handle = elem->start_handle;
+            elems[i].end_handle = elem->end_handle;
+            elems[i].uuid_len = elem->uuid.len;
+            memset(elems[i].uuid, 0, sizeof(elems[i].uuid));
+            memcpy(elems[i].uuid, &elem->uuid.uuid, elem->uuid.len);
+        }
+
+        capture_record_send(CAPTURE_SOURCE_GATTC_DB, 0, 0, sizeof(*info),
+            i * sizeof(*elems));
+        index += i;
+    } while (index < count);
+}
+
+int capture_start(void)
+{
+    capture_header_t header = {
+        .magic = CAPTURE_MAGIC,
+        .version = CAPTURE_VERSION,
+    };
+
+    if (!ringbuf || capture_is_active())
+        return -1;
+
+    ESP_LOGI(TAG, "Starting capture");
+    if (xRingbufferSend(ringbuf, &header, sizeof(header), 0) != pdTRUE)
+        return -1;
+
+    __atomic_store_n(&dropped, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&last_event, (uint32_t)esp_timer_get_time(),
+        __ATOMIC_RELAXED);
+    __atomic_store_n(&is_active, 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+void capture_stop(void)
+{
+    if (!capture_is_active())
+        return;
+
+    __atomic_store_n(&is_active, 0, __ATOMIC_RELEASE);
+    ESP_LOGI(TAG, "Stopped capture, %u records were dropped",
+        __atomic_load_n(&dropped, __ATOMIC_RELAXED));
+}
+
+uint8_t capture_is_active(void)
+{
+    return __atomic_load_n(&is_active, __ATOMIC_ACQUIRE);
+}
+
+/* Replaying */
+int capture_gap_event_decode(const capture_record_t *record,
+    const uint8_t *data, esp_ble_gap_cb_param_t *param)
+{
+    const capture_param_t *p = (const capture_param_t *)data;
+
+    if (record->source != CAPTURE_SOURCE_GAP ||
+        record->param_len < sizeof(*p))
+    {
+        return -1;
+    }
+
+    memset(param, 0, sizeof(*param));
+    switch (record->event)
+    {
+    case ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT:
+        param->scan_param_cmpl.status = p->status;
+        break;
+    case ESP_GAP_BLE_SCAN_START_COMPLETE_EVT:
+        param->scan_start_cmpl.status = p->status;
+        break;
+    case ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT:
+        param->scan_stop_cmpl.status = p->status;
+        break;
+    case ESP_GAP_BLE_SET_LOCAL_PRIVACY_COMPLETE_EVT:
+        param->local_privacy_cmpl.status = p->status;
+        break;
+    case ESP_GAP_BLE_ADD_WHITELIST_COMPLETE_EVT:
+        param->add_whitelist_cmpl.status = p->status;
+        param->add_whitelist_cmpl.wl_opration = p->flag;
+        break;
+    case ESP_GAP_BLE_SCAN_RESULT_EVT:
+        memcpy(param->scan_rst.bda, p->addr, sizeof(p->addr));
+        param->scan_rst.ble_addr_type = p->addr_type;
+        param->scan_rst.search_evt = p->flag;
+        param->scan_rst.rssi = p->rssi;
+        if (record->value_len > sizeof(param->scan_rst.ble_adv))
+            return -1;
+        memcpy(param->scan_rst.ble_adv, data + record->param_len,
+            record->value_len);
+        param->scan_rst.adv_data_len = record->value_len;
+        break;
+    case ESP_GAP_BLE_PASSKEY_REQ_EVT:
+        memcpy(param->ble_security.ble_req.bd_addr, p->addr, sizeof(p->addr));
+        break;
+    case ESP_GAP_BLE_AUTH_CMPL_EVT:
+        memcpy(param->ble_security.auth_cmpl.bd_addr, p->addr,
+            sizeof(p->addr));
+        param->ble_security.auth_cmpl.success = p->flag;
+        param->ble_security.auth_cmpl.fail_reason = p->status;
+        break;
+    case ESP_GAP_BLE_REMOVE_BOND_DEV_COMPLETE_EVT:
+        memcpy(param->remove_bond_dev_cmpl.bd_addr, p->addr, sizeof(p->addr));
+        param->remove_bond_dev_cmpl.status = p->status;
+        break;
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+int capture_gattc_event_decode(const capture_record_t *record,
+    const uint8_t *data, esp_ble_gattc_cb_param_t *param)
+{
+    const capture_param_t *p = (const capture_param_t *)data;
+    uint8_t *value = (uint8_t *)data + record->param_len;
+
+    if (record->source != CAPTURE_SOURCE_GATTC ||
+        record->param_len < sizeof(*p))
+    {
+        return -1;
+    }
+
+    memset(param, 0, sizeof(*param));
+    switch (record->event)
+    {
+    case ESP_GATTC_REG_EVT:
+        param->reg.status = p->status;
+        param->reg.app_id = p->handle;
+        break;
+    case ESP_GATTC_OPEN_EVT:
+        param->open.status = p->status;
+        param->open.conn_id = p->conn_id;
+        memcpy(param->open.remote_bda, p->addr, sizeof(p->addr));
+        param->open.mtu = p->mtu;
+        break;
+    case ESP_GATTC_CLOSE_EVT:
+        param->close.reason = p->status;
+        param->close.conn_id = p->conn_id;
+        memcpy(param->close.remote_bda, p->addr, sizeof(p->addr));
+        break;
+    case ESP_GATTC_CFG_MTU_EVT:
+        param->cfg_mtu.status = p->status;
+        param->cfg_mtu.conn_id = p->conn_id;
+        param->cfg_mtu.mtu = p->mtu;
+        break;
+    case ESP_GATTC_SEARCH_CMPL_EVT:
+        param->search_cmpl.status = p->status;
+        param->search_cmpl.conn_id = p->conn_id;
+        break;
+    case ESP_GATTC_READ_CHAR_EVT:
+    case ESP_GATTC_READ_DESCR_EVT:
+        param->read.status = p->status;
+        param->read.conn_id = p->conn_id;
+        param->read.handle = p->handle;
+        param->read.value = record->value_len ? value : NULL;
+        param->read.value_len = record->value_len;
+        break;
+    case ESP_GATTC_WRITE_CHAR_EVT:
+    case ESP_GATTC_WRITE_DESCR_EVT:
+        param->write.status = p->status;
+        param->write.conn_id = p->conn_id;
+        param->write.handle = p->handle;
+        break;
+    case ESP_GATTC_REG_FOR_NOTIFY_EVT:
+        param->reg_for_notify.status = p->status;
+        param->reg_for_notify.handle = p->handle;
+        break;
+    case ESP_GATTC_UNREG_FOR_NOTIFY_EVT:
+        param->unreg_for_notify.status = p->status;
+        param->unreg_for_notify.handle = p->handle;
+        break;
+    case ESP_GATTC_NOTIFY_EVT:
+        param->notify.conn_id = p->conn_id;
+        memcpy(param->notify.remote_bda, p->addr, sizeof(p->addr));
+        param->notify.handle = p->handle;
+        param->notify.is_notify = p->flag;
+        param->notify.value = value;
+        param->notify.value_len = record->value_len;
+        break;
+    case ESP_GATTC_CONNECT_EVT:
+        param->connect.conn_id = p->conn_id;
+        memcpy(param->connect.remote_bda, p->addr, sizeof(p->addr));
+        break;
+    case ESP_GATTC_DISCONNECT_EVT:
+        param->disconnect.conn_id = p->conn_id;
+        memcpy(param->disconnect.remote_bda, p->addr, sizeof(p->addr));
+        break;
+    default:
+        break;
+    }
+
+    return 0;
+}
+
+int capture_gattc_db_decode(const capture_record_t *record,
+    const uint8_t *data, capture_db_t *info, esp_gattc_db_elem_t *db,
+    uint16_t size)
+{
+    const capture_db_elem_t *elems =
+        (const capture_db_elem_t *)(data + record->param_len);
+    uint16_t count = record->value_len / sizeof(*elems), i;
+
+    if (record->source != CAPTURE_SOURCE_GATTC_DB ||
+        record->param_len < sizeof(*info))
+    {
+        return -1;
+    }
+
+    memcpy(info, data, sizeof(*info));
+    if (info->count > size || info->index + count > info->count)
+        return -1;
+
+    for (i = 0; i < count; i++)
+    {
+        esp_gattc_db_elem_t *elem = &db[info->index + i];
+
+        if (elems[i].uuid_len > sizeof(elems[i].uuid))
+            return -1;
+
+        memset(elem, 0, sizeof(*elem));
+        elem->type = elems[i].type;
+        elem->properties = elems[i].properties;
+        elem->attribute_handle = elems[i].attribute_handle;
+        elem->start_handle = elems[i].start_handle;
+        elem->end_handle = elems[i].end_handle;
+        elem->uuid.len = elems[i].uuid_len;
+        memcpy(&elem->uuid.uuid, elems[i].uuid, elems[i].uuid_len);
+    }
+
+    return 0;
+}
+
+static void capture_task(void *pvParameter)
+{
+    uint8_t *data;
+    size_t len;
+
+    while (1)
+    {
+        data = xRingbufferReceiveUpTo(ringbuf, &len, portMAX_DELAY,
+            CAPTURE_CHUNK_SIZE);
+
+        if (!data)
+            continue;
+
+        if (on_data_cb)
+            on_data_cb(data, len);
+        vRingbufferReturnItem(ringbuf, data);
+    }
+}
+
+int capture_initialize(size_t size)
+{
+    ESP_LOGD(TAG, "Initializing event capture");
+
+    if (!(ringbuf = xRingbufferCreate(size, RINGBUF_TYPE_BYTEBUF)))
+        return -1;
+
+    xTaskCreatePinnedToCore(capture_task, "capture_task", 3072, NULL, 1, NULL,
+        1);
+
+    return 0;
+}
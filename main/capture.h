@@ -0,0 +1,101 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <esp_gap_ble_api.h>
+#include <esp_gattc_api.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Capture stream format. The stream starts with a capture_header_t followed by
+ * records. Each record is a capture_record_t followed by param_len bytes of
+ * parameters and value_len bytes of value. GAP and GATTC events have a
+ * capture_param_t with the fields of the callback parameters used by the
+ * bridge, and the value pointed to by the parameters or the advertisement
+ * data, if any. GATT database records have a capture_db_t and part of the
+ * database as capture_db_elem_t. All fields are little endian */
+#define CAPTURE_MAGIC 0x434D3242 /* "B2MC" */
+#define CAPTURE_VERSION 2
+#define CAPTURE_VALUE_MAX 512
+
+typedef enum {
+    CAPTURE_SOURCE_GAP,
+    CAPTURE_SOURCE_GATTC,
+    CAPTURE_SOURCE_GATTC_DB,
+} capture_source_t;
+
+typedef struct {
+    uint32_t magic;
+    uint8_t version;
+    uint8_t reserved[3];
+} __attribute__((packed)) capture_header_t;
+
+typedef struct {
+    uint32_t delta_us; /* Time since previous record */
+    uint8_t source;
+    uint8_t event;
+    uint8_t gattc_if;
+    uint8_t reserved;
+    uint16_t param_len;
+    uint16_t value_len;
+} __attribute__((packed)) capture_record_t;
+
+typedef struct {
+    uint8_t addr[6]; /* bda, remote_bda or bd_addr */
+    uint8_t addr_type;
+    uint8_t flag; /* search_evt, success or is_notify */
+    int8_t rssi;
+    uint8_t reserved;
+    uint16_t status; /* status, reason or fail_reason */
+    uint16_t conn_id;
+    uint16_t handle; /* handle or app_id */
+    uint16_t mtu;
+} __attribute__((packed)) capture_param_t;
+
+typedef struct {
+    uint16_t conn_id;
+    uint16_t index; /* Of the first element in the record */
+    uint16_t count; /* Of the whole database */
+} __attribute__((packed)) capture_db_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t properties;
+    uint16_t attribute_handle;
+    uint16_t start_handle;
+    uint16_t end_handle;
+    uint8_t uuid_len;
+    uint8_t uuid[16];
+} __attribute__((packed)) capture_db_elem_t;
+
+/* Event callback types */
+typedef void (*capture_on_data_cb_t)(const uint8_t *data, size_t len);
+
+/* Event handlers */
+void capture_set_on_data_cb(capture_on_data_cb_t cb);
+
+/* Recording, from the BT task only */
+void capture_gap_event(esp_gap_ble_cb_event_t event,
+    const esp_ble_gap_cb_param_t *param);
+void capture_gattc_event(esp_gattc_cb_event_t event, esp_gatt_if_t gattc_if,
+    const esp_ble_gattc_cb_param_t *param);
+void capture_gattc_db(uint16_t conn_id, const esp_gattc_db_elem_t *db,
+    uint16_t count);
+
+int capture_start(void);
+void capture_stop(void);
+uint8_t capture_is_active(void);
+
+/* Replaying, the parameters reference the value in data. Returns -1 if the
+ * record doesn't match the source */
+int capture_gap_event_decode(const capture_record_t *record,
+    const uint8_t *data, esp_ble_gap_cb_param_t *param);
+int capture_gattc_event_decode(const capture_record_t *record,
+    const uint8_t *data, esp_ble_gattc_cb_param_t *param);
+/* Decodes the elements of the record into db, indexed as in the database */
+int capture_gattc_db_decode(const capture_record_t *record,
+    const uint8_t *data, capture_db_t *info, esp_gattc_db_elem_t *db,
+    uint16_t size);
+
+int capture_initialize(size_t size);
+
+#endif
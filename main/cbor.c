@@ -0,0 +1,209 @@
+#include "cbor.h"
+#include <math.h>
+#include <string.h>
+
+/* Constants */
+#define CBOR_TAG_DECIMAL_FRACTION 4
+
+#define CBOR_FALSE 0xF4
+#define CBOR_TRUE 0xF5
+#define CBOR_FLOAT16 0xF9
+#define CBOR_FLOAT32 0xFA
+#define CBOR_FLOAT64 0xFB
+#define CBOR_BREAK 0xFF
+
+#define CBOR_INFO_INDEFINITE 31
+
+/* IEEE-11073 special values */
+#define SFLOAT_POSITIVE_INFINITY 0x07FE
+#define SFLOAT_NEGATIVE_INFINITY 0x0802
+#define SFLOAT_NAN 0x07FF
+#define SFLOAT_NRES 0x0800
+#define SFLOAT_RESERVED 0x0801
+
+#define FLOAT_POSITIVE_INFINITY 0x007FFFFE
+#define FLOAT_NEGATIVE_INFINITY 0x00800002
+#define FLOAT_NAN 0x007FFFFF
+#define FLOAT_NRES 0x00800000
+#define FLOAT_RESERVED 0x00800001
+
+static uint8_t *write_be(uint8_t *p, uint64_t value, size_t size)
+{
+    size_t i;
+
+    for (i = size; i; i--, value >>= 8)
+        p[i - 1] = value & 0xFF;
+
+    return p + size;
+}
+
+size_t cbor_head_len(uint64_t value)
+{
+    if (value < 24)
+        return 1;
+    if (value <= UINT8_MAX)
+        return 2;
+    if (value <= UINT16_MAX)
+        return 3;
+    if (value <= UINT32_MAX)
+        return 5;
+    return 9;
+}
+
+uint8_t *cbor_head(uint8_t *p, cbor_major_t major, uint64_t value)
+{
+    /* Additional information is either the value itself or the log2 of the
+     * number of bytes following it */
+    static const uint8_t info[] = { 0, 24, 25, 0, 26, 0, 0, 0, 27 };
+    size_t len = cbor_head_len(value);
+
+    if (len == 1)
+    {
+        *p++ = major << 5 | value;
+        return p;
+    }
+
+    *p++ = major << 5 | info[len - 1];
+    return write_be(p, value, len - 1);
+}
+
+uint8_t *cbor_indefinite(uint8_t *p, cbor_major_t major)
+{
+    *p++ = major << 5 | CBOR_INFO_INDEFINITE;
+    return p;
+}
+
+uint8_t *cbor_break(uint8_t *p)
+{
+    *p++ = CBOR_BREAK;
+    return p;
+}
+
+uint8_t *cbor_uint(uint8_t *p, uint64_t value)
+{
+    return cbor_head(p, CBOR_MAJOR_UINT, value);
+}
+
+uint8_t *cbor_int(uint8_t *p, int64_t value)
+{
+    /* Negative integers are encoded as -1 - n */
+    if (value < 0)
+        return cbor_head(p, CBOR_MAJOR_NEGATIVE_INT, -1 - value);
+
+    return cbor_head(p, CBOR_MAJOR_UINT, value);
+}
+
+uint8_t *cbor_bool(uint8_t *p, uint8_t value)
+{
+    *p++ = value ? CBOR_TRUE : CBOR_FALSE;
+    return p;
+}
+
+uint8_t *cbor_text(uint8_t *p, const char *s, size_t len)
+{
+    p = cbor_head(p, CBOR_MAJOR_TEXT, len);
+    memcpy(p, s, len);
+    return p + len;
+}
+
+uint8_t *cbor_bytes(uint8_t *p, const uint8_t *data, size_t len)
+{
+    p = cbor_head(p, CBOR_MAJOR_BYTES, len);
+    memcpy(p, data, len);
+    return p + len;
+}
+
+static uint8_t *cbor_float16(uint8_t *p, uint16_t value)
+{
+    *p++ = CBOR_FLOAT16;
+    return write_be(p, value, 2);
+}
+
+uint8_t *cbor_double(uint8_t *p, double value)
+{
+    float f = value;
+    uint64_t bits;
+    uint32_t bits32;
+
+    if (isnan(value))
+        return cbor_float16(p, 0x7E00);
+    if (isinf(value))
+        return cbor_float16(p, value > 0 ? 0x7C00 : 0xFC00);
+
+    if ((double)f != value)
+    {
+        memcpy(&bits, &value, sizeof(bits));
+        *p++ = CBOR_FLOAT64;
+        return write_be(p, bits, 8);
+    }
+
+    memcpy(&bits32, &f, sizeof(bits32));
+
+    /* Half precision if the exponent is in its normal range and the mantissa
+     * has no more than 10 significant bits */
+    if (!(bits32 & 0x1FFF))
+    {
+        int32_t exponent = ((bits32 >> 23) & 0xFF) - 127;
+
+        if (exponent >= -14 && exponent <= 15)
+        {
+            return cbor_float16(p, (bits32 >> 16 & 0x8000) |
+                (exponent + 15) << 10 | (bits32 >> 13 & 0x03FF));
+        }
+        if (!(bits32 & 0x7FFFFFFF))
+            return cbor_float16(p, bits32 >> 16);
+    }
+
+    *p++ = CBOR_FLOAT32;
+    return write_be(p, bits32, 4);
+}
+
+/* Integral values are written as is, others as [exponent, mantissa] */
+static uint8_t *cbor_decimal(uint8_t *p, int32_t mantissa, int8_t exponent)
+{
+    if (exponent == 0 || mantissa == 0)
+        return cbor_int(p, mantissa);
+
+    p = cbor_head(p, CBOR_MAJOR_TAG, CBOR_TAG_DECIMAL_FRACTION);
+    p = cbor_head(p, CBOR_MAJOR_ARRAY, 2);
+    p = cbor_int(p, exponent);
+    return cbor_int(p, mantissa);
+}
+
+uint8_t *cbor_sfloat(uint8_t *p, uint16_t value)
+{
+    /* 12-bit mantissa and 4-bit exponent, both signed */
+    int16_t mantissa = (int16_t)(value << 4) >> 4;
+    int8_t exponent = (int16_t)value >> 12;
+
+    switch (value)
+    {
+    case SFLOAT_POSITIVE_INFINITY: return cbor_double(p, INFINITY);
+    case SFLOAT_NEGATIVE_INFINITY: return cbor_double(p, -INFINITY);
+    case SFLOAT_NAN:
+    case SFLOAT_NRES:
+    case SFLOAT_RESERVED:
+        return cbor_double(p, NAN);
+    }
+
+    return cbor_decimal(p, mantissa, exponent);
+}
+
+uint8_t *cbor_float(uint8_t *p, uint32_t value)
+{
+    /* 24-bit mantissa and 8-bit exponent, both signed */
+    int32_t mantissa = (int32_t)(value << 8) >> 8;
+    int8_t exponent = value >> 24;
+
+    switch (value)
+    {
+    case FLOAT_POSITIVE_INFINITY: return cbor_double(p, INFINITY);
+    case FLOAT_NEGATIVE_INFINITY: return cbor_double(p, -INFINITY);
+    case FLOAT_NAN:
+    case FLOAT_NRES:
+    case FLOAT_RESERVED:
+        return cbor_double(p, NAN);
+    }
+
+    return cbor_decimal(p, mantissa, exponent);
+}
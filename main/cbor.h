@@ -0,0 +1,46 @@
+#ifndef CBOR_H
+#define CBOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Streaming CBOR (RFC 7049) encoder. Each function writes a single data item,
+ * or the head of one, at p and returns a pointer past the last written byte.
+ * The caller is responsible for having enough room, CBOR_ITEM_MAX bytes is
+ * enough for any item other than strings' contents */
+#define CBOR_ITEM_MAX 16
+
+typedef enum {
+    CBOR_MAJOR_UINT = 0,
+    CBOR_MAJOR_NEGATIVE_INT = 1,
+    CBOR_MAJOR_BYTES = 2,
+    CBOR_MAJOR_TEXT = 3,
+    CBOR_MAJOR_ARRAY = 4,
+    CBOR_MAJOR_MAP = 5,
+    CBOR_MAJOR_TAG = 6,
+    CBOR_MAJOR_SIMPLE = 7,
+} cbor_major_t;
+
+/* Length of the head encoding value */
+size_t cbor_head_len(uint64_t value);
+
+uint8_t *cbor_head(uint8_t *p, cbor_major_t major, uint64_t value);
+/* Indefinite length arrays and maps are terminated by a break */
+uint8_t *cbor_indefinite(uint8_t *p, cbor_major_t major);
+uint8_t *cbor_break(uint8_t *p);
+uint8_t *cbor_uint(uint8_t *p, uint64_t value);
+uint8_t *cbor_int(uint8_t *p, int64_t value);
+uint8_t *cbor_bool(uint8_t *p, uint8_t value);
+uint8_t *cbor_text(uint8_t *p, const char *s, size_t len);
+uint8_t *cbor_bytes(uint8_t *p, const uint8_t *data, size_t len);
+
+/* Floating point values are written in the shortest of the half, single or
+ * double precision formats that represent them exactly */
+uint8_t *cbor_double(uint8_t *p, double value);
+
+/* IEEE-11073 floating point formats, passed as raw little endian values, are
+ * written as decimal fractions (tag 4) to keep their exact value */
+uint8_t *cbor_sfloat(uint8_t *p, uint16_t value);
+uint8_t *cbor_float(uint8_t *p, uint32_t value);
+
+#endif
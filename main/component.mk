@@ -11,8 +11,12 @@ GATT_H := $(COMPONENT_PATH)/gatt.h
 COMPONENT_EXTRA_CLEAN := $(GATT_INC) $(GATT_H)
 
 ble_utils.o: $(GATT_H)
+layout.o: $(GATT_H)
 gatt.o: $(GATT_INC)
 
-$(GATT_INC) $(GATT_H): $(PROJECT_PATH)/get_gatt_assigned_numbers.py
+GATT_SNAPSHOT := $(wildcard $(PROJECT_PATH)/gatt/*.yaml)
+
+$(GATT_INC) $(GATT_H): $(PROJECT_PATH)/get_gatt_assigned_numbers.py \
+  $(GATT_SNAPSHOT)
 	$(CONFIG_PYTHON) $(PROJECT_PATH)/get_gatt_assigned_numbers.py \
-	  -H $(GATT_H) -C $(GATT_INC)
+	  -s $(PROJECT_PATH)/gatt -H $(GATT_H) -C $(GATT_INC)
@@ -14,9 +14,18 @@ static const char *TAG = "Config";
 static const char *config_file_name = "/spiffs/config.json";
 static const char *config_update_file_name = "/spiffs/config.json.update";
 static cJSON *config;
+static cJSON *updated_config;
+
+/* Types */
+typedef struct config_strings_t {
+    struct config_strings_t *next;
+    cJSON *array;
+    const char **strings;
+} config_strings_t;
 
 /* Internal variables */
 static char config_version[33];
+static config_strings_t *config_strings;
 
 /* BLE Configuration*/
 static cJSON *config_ble_get_name_by_uuid(uint8_t is_service,
@@ -44,6 +53,16 @@ const char *config_ble_service_name_get(const char *uuid)
     return NULL;
 }
 
+const char *config_ble_service_format_get(const char *uuid)
+{
+    cJSON *format = config_ble_get_name_by_uuid(1, uuid, "format");
+
+    if (cJSON_IsString(format))
+        return format->valuestring;
+
+    return NULL;
+}
+
 const char *config_ble_characteristic_name_get(const char *uuid)
 {
     cJSON *name = config_ble_get_name_by_uuid(0, uuid, "name");
@@ -54,31 +73,156 @@ const char *config_ble_characteristic_name_get(const char *uuid)
     return NULL;
 }
 
-const char **config_ble_characteristic_types_get(const char *uuid)
+/* String arrays, e.g. a characteristic's types, are returned as NULL
+ * terminated lists. These are built once when the configuration is loaded, so
+ * the getters don't allocate and may be called from any task */
+static int config_strings_add(cJSON *array)
 {
-    cJSON *types = config_ble_get_name_by_uuid(0, uuid, "types");
-    static char **ret = NULL;
-    int i, size;
+    config_strings_t *list;
+    cJSON *cur;
+    int i = 0;
 
-    if (ret)
+    if (!cJSON_IsArray(array))
+        return 0;
+
+    if (!(list = malloc(sizeof(*list))))
+        return -1;
+    list->strings = malloc(sizeof(char *) * (cJSON_GetArraySize(array) + 1));
+    if (!list->strings)
     {
-        free(ret);
-        ret = NULL;
+        free(list);
+        return -1;
     }
 
-    if (!cJSON_IsArray(types))
+    /* The list ends at the first entry that isn't a string */
+    for (cur = array->child; cJSON_IsString(cur); cur = cur->next)
+        list->strings[i++] = cur->valuestring;
+    list->strings[i] = NULL;
+
+    list->array = array;
+    list->next = config_strings;
+    config_strings = list;
+    return 0;
+}
+
+static const char **config_strings_get(cJSON *array)
+{
+    config_strings_t *cur;
+
+    if (!cJSON_IsArray(array))
         return NULL;
 
-    size = cJSON_GetArraySize(types);
-    ret = malloc(sizeof(char *) * (size + 1));
-    for (i = 0; i < size; i++)
+    for (cur = config_strings; cur; cur = cur->next)
+    {
+        if (cur->array == array)
+            return cur->strings;
+    }
+
+    return NULL;
+}
+
+static int config_ble_characteristic_strings_initialize(void)
+{
+    cJSON *ble = cJSON_GetObjectItemCaseSensitive(config, "ble");
+    cJSON *characteristics = cJSON_GetObjectItemCaseSensitive(ble,
+        "characteristics");
+    cJSON *list = cJSON_GetObjectItemCaseSensitive(characteristics,
+        "definitions");
+    cJSON *cur;
+
+    for (cur = list ? list->child : NULL; cur; cur = cur->next)
+    {
+        if (config_strings_add(cJSON_GetObjectItemCaseSensitive(cur,
+            "types")) || config_strings_add(
+            cJSON_GetObjectItemCaseSensitive(cur, "fields")))
+        {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+const char **config_ble_characteristic_types_get(const char *uuid)
+{
+    return config_strings_get(config_ble_get_name_by_uuid(0, uuid, "types"));
+}
+
+const char **config_ble_characteristic_fields_get(const char *uuid)
+{
+    return config_strings_get(config_ble_get_name_by_uuid(0, uuid, "fields"));
+}
+
+int config_ble_characteristic_priority_get(const char *uuid)
+{
+    cJSON *priority = config_ble_get_name_by_uuid(0, uuid, "priority");
+
+    if (cJSON_IsNumber(priority))
+        return priority->valuedouble;
+
+    return 0;
+}
+
+uint32_t config_ble_characteristic_batch_get(const char *uuid)
+{
+    cJSON *batch = config_ble_get_name_by_uuid(0, uuid, "batch");
+
+    if (cJSON_IsNumber(batch))
+        return batch->valuedouble;
+
+    return 0;
+}
+
+void config_ble_characteristic_transforms_foreach(config_on_transform_cb_t cb)
+{
+    cJSON *ble = cJSON_GetObjectItemCaseSensitive(config, "ble");
+    cJSON *characteristics = cJSON_GetObjectItemCaseSensitive(ble,
+        "characteristics");
+    cJSON *list = cJSON_GetObjectItemCaseSensitive(characteristics,
+        "definitions");
+    cJSON *cur, *transforms, *expression;
+    size_t i;
+
+    for (cur = list ? list->child : NULL; cur; cur = cur->next)
     {
-        cJSON *type = cJSON_GetArrayItem(types, i);
-        ret[i] = type->valuestring;
+        transforms = cJSON_GetObjectItemCaseSensitive(cur, "transforms");
+        if (!cJSON_IsArray(transforms))
+            continue;
+
+        /* A null entry leaves the field as is */
+        for (i = 0, expression = transforms->child; expression;
+            i++, expression = expression->next)
+        {
+            if (cJSON_IsString(expression))
+                cb(cur->string, i, expression->valuestring);
+        }
     }
-    ret[size] = NULL;
+}
 
-    return (const char **)ret;
+void config_ble_characteristic_layouts_foreach(config_on_layout_cb_t cb)
+{
+    cJSON *ble = cJSON_GetObjectItemCaseSensitive(config, "ble");
+    cJSON *characteristics = cJSON_GetObjectItemCaseSensitive(ble,
+        "characteristics");
+    cJSON *list = cJSON_GetObjectItemCaseSensitive(characteristics,
+        "definitions");
+    cJSON *cur, *layout;
+
+    for (cur = list ? list->child : NULL; cur; cur = cur->next)
+    {
+        if ((layout = cJSON_GetObjectItemCaseSensitive(cur, "layout")))
+            cb(cur->string, layout);
+    }
+}
+
+const char *config_ble_characteristic_format_get(const char *uuid)
+{
+    cJSON *format = config_ble_get_name_by_uuid(0, uuid, "format");
+
+    if (cJSON_IsString(format))
+        return format->valuestring;
+
+    return NULL;
 }
 
 cJSON *json_find_in_array(cJSON *arr, const char *item)
@@ -134,9 +278,22 @@ uint8_t config_ble_should_connect(const char *mac)
     return json_is_in_lists(ble, mac);
 }
 
-uint32_t config_ble_passkey_get(const char *mac)
+void config_ble_whitelist_foreach(config_on_mac_cb_t cb)
 {
     cJSON *ble = cJSON_GetObjectItemCaseSensitive(config, "ble");
+    cJSON *whitelist = cJSON_GetObjectItemCaseSensitive(ble, "whitelist");
+    cJSON *cur;
+
+    for (cur = whitelist ? whitelist->child : NULL; cur; cur = cur->next)
+    {
+        if (cJSON_IsString(cur))
+            cb(cur->valuestring);
+    }
+}
+
+static uint32_t json_ble_passkey_get(cJSON *json, const char *mac)
+{
+    cJSON *ble = cJSON_GetObjectItemCaseSensitive(json, "ble");
     cJSON *passkeys = cJSON_GetObjectItemCaseSensitive(ble, "passkeys");
     cJSON *key = cJSON_GetObjectItemCaseSensitive(passkeys, mac);
 
@@ -146,6 +303,46 @@ uint32_t config_ble_passkey_get(const char *mac)
     return 0;
 }
 
+uint32_t config_ble_passkey_get(const char *mac)
+{
+    return json_ble_passkey_get(config, mac);
+}
+
+uint8_t config_ble_device_changed(const char *mac)
+{
+    cJSON *ble = cJSON_GetObjectItemCaseSensitive(config, "ble");
+    cJSON *updated_ble = cJSON_GetObjectItemCaseSensitive(updated_config,
+        "ble");
+
+    /* The update couldn't be parsed, assume everything changed */
+    if (!updated_config)
+        return 1;
+
+    return json_is_in_lists(ble, mac) != json_is_in_lists(updated_ble, mac) ||
+        json_ble_passkey_get(config, mac) !=
+        json_ble_passkey_get(updated_config, mac);
+}
+
+uint32_t config_ble_poll_interval_get(void)
+{
+    cJSON *ble = cJSON_GetObjectItemCaseSensitive(config, "ble");
+    cJSON *interval = cJSON_GetObjectItemCaseSensitive(ble, "poll_interval");
+
+    if (cJSON_IsNumber(interval))
+        return interval->valuedouble;
+
+    return 60;
+}
+
+uint8_t config_ble_controller_whitelist_get(void)
+{
+    cJSON *ble = cJSON_GetObjectItemCaseSensitive(config, "ble");
+    cJSON *controller_whitelist = cJSON_GetObjectItemCaseSensitive(ble,
+        "controller_whitelist");
+
+    return cJSON_IsTrue(controller_whitelist);
+}
+
 /* MQTT Configuration*/
 const char *config_mqtt_server_get(const char *param_name)
 {
@@ -212,6 +409,44 @@ uint8_t config_mqtt_retained_get(void)
     return cJSON_IsTrue(retain);
 }
 
+const char *config_mqtt_dedup_get(void)
+{
+    cJSON *mqtt = cJSON_GetObjectItemCaseSensitive(config, "mqtt");
+    cJSON *publish = cJSON_GetObjectItemCaseSensitive(mqtt, "publish");
+    cJSON *dedup = cJSON_GetObjectItemCaseSensitive(publish, "dedup");
+
+    if (cJSON_IsString(dedup))
+        return dedup->valuestring;
+
+    return "off";
+}
+
+const char *config_mqtt_device_state_mode_get(void)
+{
+    cJSON *mqtt = cJSON_GetObjectItemCaseSensitive(config, "mqtt");
+    cJSON *publish = cJSON_GetObjectItemCaseSensitive(mqtt, "publish");
+    cJSON *state = cJSON_GetObjectItemCaseSensitive(publish, "device_state");
+    cJSON *mode = cJSON_GetObjectItemCaseSensitive(state, "mode");
+
+    if (cJSON_IsString(mode))
+        return mode->valuestring;
+
+    return "off";
+}
+
+uint32_t config_mqtt_device_state_debounce_get(void)
+{
+    cJSON *mqtt = cJSON_GetObjectItemCaseSensitive(config, "mqtt");
+    cJSON *publish = cJSON_GetObjectItemCaseSensitive(mqtt, "publish");
+    cJSON *state = cJSON_GetObjectItemCaseSensitive(publish, "device_state");
+    cJSON *debounce = cJSON_GetObjectItemCaseSensitive(state, "debounce");
+
+    if (cJSON_IsNumber(debounce))
+        return debounce->valuedouble;
+
+    return 100;
+}
+
 const char *config_mqtt_topics_get(const char *param_name, const char *def)
 {
     cJSON *mqtt = cJSON_GetObjectItemCaseSensitive(config, "mqtt");
@@ -234,6 +469,30 @@ const char *config_mqtt_set_suffix_get(void)
     return config_mqtt_topics_get("set_suffix", "/Set");
 }
 
+/* Metrics Configuration */
+uint32_t config_metrics_interval_get(void)
+{
+    cJSON *metrics = cJSON_GetObjectItemCaseSensitive(config, "metrics");
+    cJSON *interval = cJSON_GetObjectItemCaseSensitive(metrics, "interval");
+
+    if (cJSON_IsNumber(interval))
+        return interval->valuedouble;
+
+    return 60;
+}
+
+/* Trace Configuration */
+uint32_t config_trace_size_get(void)
+{
+    cJSON *trace = cJSON_GetObjectItemCaseSensitive(config, "trace");
+    cJSON *size = cJSON_GetObjectItemCaseSensitive(trace, "size");
+
+    if (cJSON_IsNumber(size))
+        return size->valuedouble;
+
+    return 64;
+}
+
 /* WiFi Configuration */
 const char *config_wifi_ssid_get(void)
 {
@@ -275,6 +534,8 @@ int config_update_write(config_update_handle_t handle, uint8_t *data,
     return write(handle, data, len) < 0;
 }
 
+static cJSON *load_json(const char *path);
+
 int config_update_end(config_update_handle_t handle)
 {
     struct stat st;
@@ -294,6 +555,10 @@ int config_update_end(config_update_handle_t handle)
     if (rename(config_update_file_name, config_file_name))
         return -1;
 
+    /* Kept aside to tell which devices are affected by the update */
+    cJSON_Delete(updated_config);
+    updated_config = load_json(config_file_name);
+
     return 0;
 }
 
@@ -367,6 +632,9 @@ int config_initialize(void)
     if (!(config = load_json(config_file_name)))
         return -1;
 
+    if (config_ble_characteristic_strings_initialize())
+        return -1;
+
     ESP_LOGI(TAG, "version: %s", config_version_get());
     return 0;
 }
@@ -6,15 +6,33 @@
 
 /* Types */
 typedef int config_update_handle_t;
+typedef void (*config_on_transform_cb_t)(const char *uuid, size_t field,
+    const char *expression);
+struct cJSON;
+typedef void (*config_on_layout_cb_t)(const char *uuid, struct cJSON *layout);
+typedef void (*config_on_mac_cb_t)(const char *mac);
 
 /* BLE Configuration*/
 const char *config_ble_service_name_get(const char *uuid);
+const char *config_ble_service_format_get(const char *uuid);
 const char *config_ble_characteristic_name_get(const char *uuid);
 const char **config_ble_characteristic_types_get(const char *uuid);
+const char **config_ble_characteristic_fields_get(const char *uuid);
+const char *config_ble_characteristic_format_get(const char *uuid);
+int config_ble_characteristic_priority_get(const char *uuid);
+uint32_t config_ble_characteristic_batch_get(const char *uuid);
+void config_ble_characteristic_transforms_foreach(config_on_transform_cb_t cb);
+void config_ble_characteristic_layouts_foreach(config_on_layout_cb_t cb);
 uint8_t config_ble_characteristic_should_include(const char *uuid);
 uint8_t config_ble_service_should_include(const char *uuid);
 uint8_t config_ble_should_connect(const char *mac);
+void config_ble_whitelist_foreach(config_on_mac_cb_t cb);
 uint32_t config_ble_passkey_get(const char *mac);
+/* Whether the updated configuration changes the device's passkey or whether
+ * it should be connected */
+uint8_t config_ble_device_changed(const char *mac);
+uint32_t config_ble_poll_interval_get(void);
+uint8_t config_ble_controller_whitelist_get(void);
 
 /* MQTT Configuration*/
 const char *config_mqtt_host_get(void);
@@ -24,9 +42,18 @@ const char *config_mqtt_username_get(void);
 const char *config_mqtt_password_get(void);
 uint8_t config_mqtt_qos_get(void);
 uint8_t config_mqtt_retained_get(void);
+const char *config_mqtt_dedup_get(void);
+const char *config_mqtt_device_state_mode_get(void);
+uint32_t config_mqtt_device_state_debounce_get(void);
 const char *config_mqtt_get_suffix_get(void);
 const char *config_mqtt_set_suffix_get(void);
 
+/* Metrics Configuration */
+uint32_t config_metrics_interval_get(void);
+
+/* Trace Configuration */
+uint32_t config_trace_size_get(void);
+
 /* WiFi Configuration*/
 const char *config_wifi_ssid_get(void);
 const char *config_wifi_password_get(void);
@@ -0,0 +1,207 @@
+#include "dedup.h"
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/timers.h>
+#include <nvs.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Constants */
+#define DEDUP_SLOTS 512 /* Must be a power of 2 */
+#define DEDUP_PROBES 16
+#define DEDUP_SAVE_DELAY_MS 60000
+/* NVS blobs are limited in size, the table is saved in chunks */
+#define DEDUP_NVS_CHUNK_SIZE 1024
+#define DEDUP_NVS_CHUNKS (sizeof(entries) / DEDUP_NVS_CHUNK_SIZE)
+
+static const char *TAG = "Dedup";
+static const char *nvs_namespace = "dedup";
+
+/* Types */
+typedef struct {
+    uint32_t topic; /* 0 for an empty slot */
+    uint32_t payload;
+} dedup_entry_t;
+
+/* Internal state */
+static dedup_entry_t entries[DEDUP_SLOTS];
+static SemaphoreHandle_t mutex = NULL;
+static TimerHandle_t save_timer = NULL;
+
+/* 32-bit FNV-1a */
+static uint32_t dedup_hash(const uint8_t *data, size_t len)
+{
+    uint32_t hash = 2166136261;
+
+    while (len--)
+    {
+        hash ^= *data++;
+        hash *= 16777619;
+    }
+
+    return hash;
+}
+
+static uint32_t dedup_topic_hash(const char *topic)
+{
+    uint32_t hash = dedup_hash((const uint8_t *)topic, strlen(topic));
+
+    return hash ? : 1;
+}
+
+/* Returns the topic's slot, or the one it should be stored in */
+static dedup_entry_t *dedup_entry_find(uint32_t topic)
+{
+    dedup_entry_t *entry, *empty = NULL;
+    int i;
+
+    for (i = 0; i < DEDUP_PROBES; i++)
+    {
+        entry = &entries[(topic + i) & (DEDUP_SLOTS - 1)];
+
+        if (entry->topic == topic)
+            return entry;
+        if (!entry->topic && !empty)
+            empty = entry;
+    }
+
+    /* When full, the topic's first slot is reused */
+    return empty ? : &entries[topic & (DEDUP_SLOTS - 1)];
+}
+
+uint8_t dedup_is_duplicate(const char *topic, const uint8_t *payload,
+    size_t len)
+{
+    uint32_t hash = dedup_topic_hash(topic);
+    dedup_entry_t *entry;
+    uint8_t ret;
+
+    if (!mutex)
+        return 0;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    entry = dedup_entry_find(hash);
+    ret = entry->topic == hash && entry->payload == dedup_hash(payload, len);
+    xSemaphoreGive(mutex);
+
+    return ret;
+}
+
+void dedup_update(const char *topic, const uint8_t *payload, size_t len)
+{
+    uint32_t hash = dedup_topic_hash(topic);
+    dedup_entry_t *entry;
+
+    if (!mutex)
+        return;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    entry = dedup_entry_find(hash);
+    entry->topic = hash;
+    entry->payload = dedup_hash(payload, len);
+    xSemaphoreGive(mutex);
+
+    /* Save once things settle down, to spare the flash */
+    if (save_timer && !xTimerIsTimerActive(save_timer))
+        xTimerStart(save_timer, 0);
+}
+
+void dedup_invalidate(const char *topic)
+{
+    uint32_t hash = dedup_topic_hash(topic);
+    dedup_entry_t *entry;
+
+    if (!mutex)
+        return;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    entry = dedup_entry_find(hash);
+    if (entry->topic == hash)
+        entry->topic = 0;
+    xSemaphoreGive(mutex);
+}
+
+static void dedup_save_timer_cb(TimerHandle_t xTimer)
+{
+    nvs_handle nvs;
+    esp_err_t err = ESP_OK;
+    char key[8];
+    int i;
+
+    if ((err = nvs_open(nvs_namespace, NVS_READWRITE, &nvs)) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed opening NVS: %d", err);
+        return;
+    }
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    for (i = 0; i < DEDUP_NVS_CHUNKS && err == ESP_OK; i++)
+    {
+        sprintf(key, "hash%d", i);
+        err = nvs_set_blob(nvs, key, (uint8_t *)entries +
+            i * DEDUP_NVS_CHUNK_SIZE, DEDUP_NVS_CHUNK_SIZE);
+    }
+    xSemaphoreGive(mutex);
+
+    if (err == ESP_OK)
+        err = nvs_commit(nvs);
+    nvs_close(nvs);
+
+    if (err != ESP_OK)
+        ESP_LOGE(TAG, "Failed saving hashes: %d", err);
+    else
+        ESP_LOGD(TAG, "Saved hashes");
+}
+
+static void dedup_load(void)
+{
+    nvs_handle nvs;
+    size_t len;
+    char key[8];
+    int i;
+
+    if (nvs_open(nvs_namespace, NVS_READONLY, &nvs) != ESP_OK)
+        return;
+
+    for (i = 0; i < DEDUP_NVS_CHUNKS; i++)
+    {
+        len = DEDUP_NVS_CHUNK_SIZE;
+        sprintf(key, "hash%d", i);
+        if (nvs_get_blob(nvs, key, (uint8_t *)entries +
+            i * DEDUP_NVS_CHUNK_SIZE, &len) != ESP_OK ||
+            len != DEDUP_NVS_CHUNK_SIZE)
+        {
+            break;
+        }
+    }
+
+    /* Partially saved tables are discarded */
+    if (i < DEDUP_NVS_CHUNKS)
+        memset(entries, 0, sizeof(entries));
+    else
+        ESP_LOGI(TAG, "Loaded saved hashes");
+
+    nvs_close(nvs);
+}
+
+int dedup_initialize(uint8_t is_persistent)
+{
+    ESP_LOGD(TAG, "Initializing deduplication, persistent: %d", is_persistent);
+
+    if (!(mutex = xSemaphoreCreateMutex()))
+        return -1;
+
+    if (!is_persistent)
+        return 0;
+
+    dedup_load();
+
+    if (!(save_timer = xTimerCreate("dedup", pdMS_TO_TICKS(DEDUP_SAVE_DELAY_MS),
+        pdFALSE, NULL, dedup_save_timer_cb)))
+    {
+        return -1;
+    }
+
+    return 0;
+}
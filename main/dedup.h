@@ -0,0 +1,18 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Retained publication deduplication. A hash of the last published payload of
+ * each retained topic is kept so publications that wouldn't change the
+ * broker's retained state can be skipped */
+uint8_t dedup_is_duplicate(const char *topic, const uint8_t *payload,
+    size_t len);
+void dedup_update(const char *topic, const uint8_t *payload, size_t len);
+void dedup_invalidate(const char *topic);
+
+/* If persistent, hashes are saved to NVS and survive reboots */
+int dedup_initialize(uint8_t is_persistent);
+
+#endif
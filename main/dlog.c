@@ -0,0 +1,554 @@
+#include "dlog.h"
+#include "metrics.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/ringbuf.h>
+#include <freertos/task.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Constants */
+#define DLOG_RECORD_MAX 256
+#define DLOG_LINE_MAX 512
+#define DLOG_TAGS_MAX 16
+/* Informational and debug messages are limited to this rate, in messages per
+ * second, with bursts of up to DLOG_RATE_BURST messages */
+#define DLOG_RATE 50
+#define DLOG_RATE_BURST 100
+
+static const char *TAG = "DLog";
+
+/* Types */
+typedef struct {
+    uint32_t timestamp;
+    const char *tag;
+    const char *format;
+    uint8_t level;
+    uint8_t args[];
+} dlog_record_t;
+
+typedef struct {
+    uint8_t width_star;
+    uint8_t precision_star;
+    uint8_t has_precision;
+    int precision;
+    char length; /* 'H' - hh, 'h', 'l', 'L' - ll, 'z' or 0 */
+    char conversion;
+} dlog_spec_t;
+
+typedef struct {
+    char *tag;
+    esp_log_level_t level;
+} dlog_tag_level_t;
+
+/* Internal state */
+static RingbufHandle_t ringbuf = NULL;
+static uint32_t dropped = 0;
+static dlog_tag_level_t tags[DLOG_TAGS_MAX];
+static esp_log_level_t default_level = ESP_LOG_INFO;
+static portMUX_TYPE rate_mux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t rate_tokens = DLOG_RATE_BURST;
+static uint32_t rate_timestamp = 0;
+
+static esp_log_level_t dlog_level_get(const char *tag)
+{
+    const char *cur;
+    int i;
+
+    for (i = 0; i < DLOG_TAGS_MAX; i++)
+    {
+        if (!(cur = __atomic_load_n(&tags[i].tag, __ATOMIC_ACQUIRE)))
+            break;
+
+        if (!strcmp(cur, tag))
+            return tags[i].level;
+    }
+
+    return default_level;
+}
+
+int dlog_level_set(const char *tag, esp_log_level_t level)
+{
+    int i;
+
+    /* Keep ESP_LOGx() in sync */
+    esp_log_level_set(tag, level);
+
+    if (!strcmp(tag, "*"))
+    {
+        default_level = level;
+        return 0;
+    }
+
+    for (i = 0; i < DLOG_TAGS_MAX && tags[i].tag; i++)
+    {
+        if (!strcmp(tags[i].tag, tag))
+            break;
+    }
+
+    if (i == DLOG_TAGS_MAX)
+        return -1;
+
+    /* Entries are only appended and the tag is published after its level is
+     * set, so writers don't need to block readers */
+    tags[i].level = level;
+    if (!tags[i].tag)
+        __atomic_store_n(&tags[i].tag, strdup(tag), __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+int dlog_atolevel(const char *str, esp_log_level_t *level)
+{
+    static const char *levels[] = {
+        [ESP_LOG_NONE] = "none",
+        [ESP_LOG_ERROR] = "error",
+        [ESP_LOG_WARN] = "warn",
+        [ESP_LOG_INFO] = "info",
+        [ESP_LOG_DEBUG] = "debug",
+        [ESP_LOG_VERBOSE] = "verbose",
+    };
+    int i;
+
+    for (i = ESP_LOG_NONE; i <= ESP_LOG_VERBOSE; i++)
+    {
+        if (!strcasecmp(levels[i], str))
+        {
+            *level = i;
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+uint32_t dlog_dropped_get(void)
+{
+    return __atomic_load_n(&dropped, __ATOMIC_RELAXED);
+}
+
+static void dlog_drop(void)
+{
+    __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+    metrics_counter_inc(METRICS_COUNTER_LOG_DROPPED);
+}
+
+/* A token bucket shared by all tags, so a burst of messages doesn't fill the
+ * ring buffer and crowd out the less frequent ones */
+static int dlog_rate_limit(uint32_t now)
+{
+    uint32_t added;
+    int ret = 0;
+
+    portENTER_CRITICAL(&rate_mux);
+    added = (uint64_t)(now - rate_timestamp) * DLOG_RATE / 1000;
+    if (added)
+    {
+        rate_tokens += added;
+        rate_timestamp += added * 1000 / DLOG_RATE;
+        if (rate_tokens >= DLOG_RATE_BURST)
+        {
+            rate_tokens = DLOG_RATE_BURST;
+            rate_timestamp = now;
+        }
+    }
+
+    if (rate_tokens)
+        rate_tokens--;
+    else
+        ret = -1;
+    portEXIT_CRITICAL(&rate_mux);
+
+    return ret;
+}
+
+static const char *dlog_spec_parse(const char *p, dlog_spec_t *spec)
+{
+    memset(spec, 0, sizeof(*spec));
+
+    /* Flags */
+    while (*p && strchr("-+ #0", *p))
+        p++;
+
+    /* Width */
+    if (*p == '*')
+    {
+        spec->width_star = 1;
+        p++;
+    }
+    while (*p >= '0' && *p <= '9')
+        p++;
+
+    /* Precision */
+    if (*p == '.')
+    {
+        spec->has_precision = 1;
+        p++;
+        if (*p == '*')
+        {
+            spec->precision_star = 1;
+            p++;
+        }
+        while (*p >= '0' && *p <= '9')
+            spec->precision = spec->precision * 10 + *p++ - '0';
+    }
+
+    /* Length modifier */
+    if (*p == 'h' || *p == 'l')
+    {
+        spec->length = *p++;
+        if (*p == spec->length)
+        {
+            spec->length = *p == 'h' ? 'H' : 'L';
+            p++;
+        }
+    }
+    else if (*p == 'z')
+        spec->length = *p++;
+
+    spec->conversion = *p;
+
+    return *p ? p + 1 : p;
+}
+
+static size_t dlog_int_size(dlog_spec_t *spec)
+{
+    switch (spec->length)
+    {
+    case 'l': return sizeof(long);
+    case 'L': return sizeof(long long);
+    case 'z': return sizeof(size_t);
+    default: return sizeof(int);
+    }
+}
+
+/* Serialize a single argument, returns the number of bytes used or 0 if there
+ * isn't enough room */
+static size_t dlog_arg_put(uint8_t *buf, size_t len, dlog_spec_t *spec,
+    va_list *args)
+{
+    switch (spec->conversion)
+    {
+    case 'd': case 'i': case 'c':
+    case 'u': case 'x': case 'X': case 'o':
+    {
+        size_t size = dlog_int_size(spec);
+
+        if (size > len)
+            return 0;
+
+        if (size == sizeof(long long))
+        {
+            long long v = va_arg(*args, long long);
+            memcpy(buf, &v, size);
+        }
+        else if (size == sizeof(long))
+        {
+            long v = va_arg(*args, long);
+            memcpy(buf, &v, size);
+        }
+        else
+        {
+            int v = va_arg(*args, int);
+            memcpy(buf, &v, size);
+        }
+
+        return size;
+    }
+    case 'p':
+    {
+        void *v = va_arg(*args, void *);
+
+        if (sizeof(v) > len)
+            return 0;
+
+        memcpy(buf, &v, sizeof(v));
+        return sizeof(v);
+    }
+    case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+    {
+        double v = va_arg(*args, double);
+
+        if (sizeof(v) > len)
+            return 0;
+
+        memcpy(buf, &v, sizeof(v));
+        return sizeof(v);
+    }
+    case 's':
+    {
+        const char *v = va_arg(*args, const char *);
+        uint16_t n;
+
+        if (len < sizeof(n) + 1)
+            return 0;
+
+        if (!v)
+            v = "(null)";
+
+        /* Strings are truncated to fit the record */
+        n = spec->has_precision ? strnlen(v, spec->precision) : strlen(v);
+        if (n > len - sizeof(n) - 1)
+            n = len - sizeof(n) - 1;
+
+        memcpy(buf, &n, sizeof(n));
+        memcpy(buf + sizeof(n), v, n);
+        buf[sizeof(n) + n] = '\0';
+
+        return sizeof(n) + n + 1;
+    }
+    }
+
+    return 0;
+}
+
+void dlog_write(esp_log_level_t level, const char *tag, const char *format,
+    ...)
+{
+    uint8_t buf[DLOG_RECORD_MAX] __attribute__((aligned(4)));
+    dlog_record_t *record = (dlog_record_t *)buf;
+    size_t len = offsetof(dlog_record_t, args), n;
+    dlog_spec_t spec;
+    const char *p;
+    va_list args;
+
+    if (level > dlog_level_get(tag))
+        return;
+
+    record->timestamp = esp_log_timestamp();
+    if (!ringbuf ||
+        (level >= ESP_LOG_INFO && dlog_rate_limit(record->timestamp)))
+    {
+        dlog_drop();
+        return;
+    }
+
+    record->tag = tag;
+    record->format = format;
+    record->level = level;
+
+    va_start(args, format);
+    for (p = format; *p; )
+    {
+        if (*p++ != '%')
+            continue;
+
+        if (*p == '%')
+        {
+            p++;
+            continue;
+        }
+
+        p = dlog_spec_parse(p, &spec);
+
+        if (spec.width_star)
+        {
+            int v = va_arg(args, int);
+
+            if (len + sizeof(v) > sizeof(buf))
+                break;
+            memcpy(buf + len, &v, sizeof(v));
+            len += sizeof(v);
+        }
+
+        if (spec.precision_star)
+        {
+            int v = va_arg(args, int);
+
+            if (len + sizeof(v) > sizeof(buf))
+                break;
+            memcpy(buf + len, &v, sizeof(v));
+            len += sizeof(v);
+            spec.precision = v < 0 ? 0 : v;
+        }
+
+        if (!(n = dlog_arg_put(buf + len, sizeof(buf) - len, &spec, &args)))
+            break;
+        len += n;
+    }
+    va_end(args);
+
+    if (xRingbufferSend(ringbuf, buf, len, 0) != pdTRUE)
+        dlog_drop();
+}
+
+/* Format a record, one conversion at a time */
+static void dlog_format(char *line, size_t size, dlog_record_t *record,
+    size_t len)
+{
+    const uint8_t *arg = record->args, *end = (uint8_t *)record + len;
+    const char *p = record->format, *start;
+    char spec_str[32];
+    dlog_spec_t spec;
+    size_t n = 0;
+    int star[2], nstars;
+
+#define ARG_GET(type, v) \
+    do { \
+        if (arg + sizeof(type) > end) goto truncated; \
+        memcpy(&v, arg, sizeof(type)); \
+        arg += sizeof(type); \
+    } while (0)
+#define APPEND(...) \
+    do { \
+        int ret = snprintf(line + n, size - n, __VA_ARGS__); \
+        if (ret < 0) goto truncated; \
+        n += ret; \
+        if (n >= size) return; \
+    } while (0)
+#define APPEND_SPEC(v) \
+    do { \
+        if (nstars == 2) APPEND(spec_str, star[0], star[1], v); \
+        else if (nstars == 1) APPEND(spec_str, star[0], v); \
+        else APPEND(spec_str, v); \
+    } while (0)
+
+    while (*p)
+    {
+        /* Copy literal text */
+        for (start = p; *p && *p != '%'; p++);
+        if (p != start)
+            APPEND("%.*s", (int)(p - start), start);
+
+        if (!*p)
+            break;
+
+        start = p++;
+        if (*p == '%')
+        {
+            APPEND("%%");
+            p++;
+            continue;
+        }
+
+        p = dlog_spec_parse(p, &spec);
+        if ((size_t)(p - start) >= sizeof(spec_str))
+            goto truncated;
+        memcpy(spec_str, start, p - start);
+        spec_str[p - start] = '\0';
+
+        nstars = 0;
+        if (spec.width_star)
+            ARG_GET(int, star[nstars++]);
+        if (spec.precision_star)
+            ARG_GET(int, star[nstars++]);
+
+        switch (spec.conversion)
+        {
+        case 'd': case 'i': case 'c':
+        case 'u': case 'x': case 'X': case 'o':
+        {
+            size_t int_size = dlog_int_size(&spec);
+
+            if (int_size == sizeof(long long))
+            {
+                long long v;
+                ARG_GET(long long, v);
+                APPEND_SPEC(v);
+            }
+            else if (int_size == sizeof(long))
+            {
+                long v;
+                ARG_GET(long, v);
+                APPEND_SPEC(v);
+            }
+            else
+            {
+                int v;
+                ARG_GET(int, v);
+                APPEND_SPEC(v);
+            }
+            break;
+        }
+        case 'p':
+        {
+            void *v;
+            ARG_GET(void *, v);
+            APPEND_SPEC(v);
+            break;
+        }
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+        {
+            double v;
+            ARG_GET(double, v);
+            APPEND_SPEC(v);
+            break;
+        }
+        case 's':
+        {
+            uint16_t v;
+            ARG_GET(uint16_t, v);
+            if (arg + v + 1 > end)
+                goto truncated;
+            APPEND_SPEC((const char *)arg);
+            arg += v + 1;
+            break;
+        }
+        default:
+            goto truncated;
+        }
+    }
+
+    return;
+
+truncated:
+    snprintf(line + n, size - n, "...");
+#undef APPEND_SPEC
+#undef APPEND
+#undef ARG_GET
+}
+
+static void dlog_print(dlog_record_t *record, size_t len)
+{
+    static const char letters[] = {
+        [ESP_LOG_NONE] = 'N',
+        [ESP_LOG_ERROR] = 'E',
+        [ESP_LOG_WARN] = 'W',
+        [ESP_LOG_INFO] = 'I',
+        [ESP_LOG_DEBUG] = 'D',
+        [ESP_LOG_VERBOSE] = 'V',
+    };
+    char line[DLOG_LINE_MAX];
+
+    dlog_format(line, sizeof(line), record, len);
+    esp_log_write(record->level, record->tag, "%c (%u) %s: %s\n",
+        letters[record->level], record->timestamp, record->tag, line);
+}
+
+static void dlog_task(void *pvParameter)
+{
+    uint32_t reported = 0, current;
+    dlog_record_t *record;
+    size_t len;
+
+    while (1)
+    {
+        record = xRingbufferReceive(ringbuf, &len, 1000 / portTICK_PERIOD_MS);
+
+        if (record)
+        {
+            dlog_print(record, len);
+            vRingbufferReturnItem(ringbuf, record);
+        }
+
+        if ((current = dlog_dropped_get()) != reported)
+        {
+            ESP_LOGW(TAG, "Dropped %u log messages", current - reported);
+            reported = current;
+        }
+    }
+}
+
+int dlog_initialize(size_t size)
+{
+    ESP_LOGD(TAG, "Initializing deferred logging");
+
+    if (!(ringbuf = xRingbufferCreate(size, RINGBUF_TYPE_NOSPLIT)))
+        return -1;
+
+    xTaskCreatePinnedToCore(dlog_task, "dlog_task", 3072, NULL, 1, NULL, 1);
+
+    return 0;
+}
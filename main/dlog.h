@@ -0,0 +1,34 @@
+#ifndef DLOG_H
+#define DLOG_H
+
+#include <esp_log.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Deferred logging. Only the format string pointer and the raw arguments are
+ * copied to a ring buffer, formatting and printing is done later by a low
+ * priority task. Both the tag and the format string must be static, e.g. string
+ * literals. Messages are dropped if the ring buffer is full, or if informational
+ * and debug messages are logged faster than the rate limit */
+#define DLOGE(tag, format, ...) \
+    dlog_write(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define DLOGW(tag, format, ...) \
+    dlog_write(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define DLOGI(tag, format, ...) \
+    dlog_write(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define DLOGD(tag, format, ...) \
+    dlog_write(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+#define DLOGV(tag, format, ...) \
+    dlog_write(ESP_LOG_VERBOSE, tag, format, ##__VA_ARGS__)
+
+void dlog_write(esp_log_level_t level, const char *tag, const char *format,
+    ...) __attribute__((format(printf, 3, 4)));
+
+/* Runtime log levels, tag "*" sets the default level */
+int dlog_level_set(const char *tag, esp_log_level_t level);
+int dlog_atolevel(const char *str, esp_log_level_t *level);
+uint32_t dlog_dropped_get(void);
+
+int dlog_initialize(size_t size);
+
+#endif
@@ -0,0 +1,628 @@
+#include "format.h"
+#include <string.h>
+
+/* Constants */
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const uint32_t powers_of_10[] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000,
+};
+
+/* IEEE-11073 special values */
+#define SFLOAT_NAN 0x07FF
+#define SFLOAT_NRES 0x0800
+#define SFLOAT_POSITIVE_INFINITY 0x07FE
+#define SFLOAT_NEGATIVE_INFINITY 0x0802
+#define SFLOAT_RESERVED 0x0801
+
+#define FLOAT_NAN 0x007FFFFF
+#define FLOAT_NRES 0x00800000
+#define FLOAT_POSITIVE_INFINITY 0x007FFFFE
+#define FLOAT_NEGATIVE_INFINITY 0x00800002
+#define FLOAT_RESERVED 0x00800001
+
+static const char hex_digits[16] = "0123456789abcdef";
+static const char base64_digits[64] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* Reverse lookup tables for the binary-to-text encodings, -1 for characters
+ * outside of the alphabet */
+static const int8_t hex_values[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+     0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+static const int8_t base64_values[256] = {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, -1, -1, 63,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+    -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, -1,
+    -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+static uint8_t digits_count(uint32_t value)
+{
+    /* Approximate log10 from log2 (1233 / 4096 ~= log10(2)), then correct it.
+     * Or'ing with 1 makes 0 a single digit without changing any other count */
+    uint32_t t = ((32 - __builtin_clz(value | 1)) * 1233) >> 12;
+
+    return t - ((value | 1) < powers_of_10[t]) + 1;
+}
+
+/* Writes exactly n digits of value, right aligned, ending at end */
+static void format_digits(char *end, uint32_t value, uint8_t n)
+{
+    while (n >= 2)
+    {
+        uint32_t r = value % 100;
+
+        value /= 100;
+        end -= 2;
+        memcpy(end, &digit_pairs[r * 2], 2);
+        n -= 2;
+    }
+
+    if (n)
+        *--end = '0' + value;
+}
+
+char *format_uint32(char *p, uint32_t value)
+{
+    uint8_t n = digits_count(value);
+
+    format_digits(p + n, value, n);
+    return p + n;
+}
+
+char *format_int32(char *p, int32_t value)
+{
+    /* Branchless sign handling, the minus sign is overwritten if positive */
+    uint32_t sign = (uint32_t)value >> 31;
+    uint32_t magnitude = ((uint32_t)value ^ -sign) + sign;
+
+    *p = '-';
+    return format_uint32(p + sign, magnitude);
+}
+
+char *format_uint64(char *p, uint64_t value)
+{
+    if (value <= UINT32_MAX)
+        return format_uint32(p, value);
+
+    /* Split to 9 digit groups, so each one fits in 32 bits */
+    p = format_uint64(p, value / 1000000000);
+    format_digits(p + 9, value % 1000000000, 9);
+    return p + 9;
+}
+
+char *format_bool(char *p, uint8_t value)
+{
+    if (value & 0x01)
+    {
+        memcpy(p, "true", 4);
+        return p + 4;
+    }
+
+    memcpy(p, "false", 5);
+    return p + 5;
+}
+
+static char *format_special(char *p, const char *s)
+{
+    size_t len = strlen(s);
+
+    memcpy(p, s, len);
+    return p + len;
+}
+
+/* Exact decimal representation of mantissa * 10^exponent, the decimal point is
+ * placed by shifting the mantissa digits. The number of fractional digits is
+ * kept as is since it reflects the resolution of the value */
+static char *format_decimal(char *p, int32_t mantissa, int8_t exponent)
+{
+    char digits[10];
+    uint32_t magnitude;
+    int n, point;
+
+    if (mantissa == 0)
+    {
+        *p++ = '0';
+        return p;
+    }
+
+    if (mantissa < 0)
+        *p++ = '-';
+    magnitude = mantissa < 0 ? -(uint32_t)mantissa : (uint32_t)mantissa;
+    n = format_uint32(digits, magnitude) - digits;
+
+    if (exponent >= 0)
+    {
+        memcpy(p, digits, n);
+        memset(p + n, '0', exponent);
+        return p + n + exponent;
+    }
+
+    /* Number of digits before the decimal point */
+    point = n + exponent;
+    if (point > 0)
+    {
+        memcpy(p, digits, point);
+        p += point;
+        *p++ = '.';
+        memcpy(p, digits + point, n - point);
+        return p + n - point;
+    }
+
+    *p++ = '0';
+    *p++ = '.';
+    memset(p, '0', -point);
+    p += -point;
+    memcpy(p, digits, n);
+    return p + n;
+}
+
+/* IEEE-11073 floating point format */
+char *format_sfloat(char *p, uint16_t value)
+{
+    /* 12-bit mantissa and 4-bit exponent, both signed */
+    int16_t mantissa = (int16_t)(value << 4) >> 4;
+    int8_t exponent = (int16_t)value >> 12;
+
+    switch (value)
+    {
+    case SFLOAT_POSITIVE_INFINITY: return format_special(p, "inf");
+    case SFLOAT_NEGATIVE_INFINITY: return format_special(p, "-inf");
+    case SFLOAT_NAN:
+    case SFLOAT_NRES:
+    case SFLOAT_RESERVED:
+        return format_special(p, "nan");
+    }
+
+    return format_decimal(p, mantissa, exponent);
+}
+
+char *format_float(char *p, uint32_t value)
+{
+    /* 24-bit mantissa and 8-bit exponent, both signed */
+    int32_t mantissa = (int32_t)(value << 8) >> 8;
+    int8_t exponent = value >> 24;
+
+    switch (value)
+    {
+    case FLOAT_POSITIVE_INFINITY: return format_special(p, "inf");
+    case FLOAT_NEGATIVE_INFINITY: return format_special(p, "-inf");
+    case FLOAT_NAN:
+    case FLOAT_NRES:
+    case FLOAT_RESERVED:
+        return format_special(p, "nan");
+    }
+
+    return format_decimal(p, mantissa, exponent);
+}
+
+/* IEEE-754 floating point format. Doubles are printed with Grisu2 (Florian
+ * Loitsch, "Printing Floating-Point Numbers Quickly and Accurately with
+ * Integers"), using only 64-bit integer math. The output always reads back as
+ * the same value and is the shortest one for all but a few values, where a
+ * digit more than needed may be printed */
+typedef struct {
+    uint64_t f;
+    int e;
+} diyfp_t;
+
+typedef struct {
+    uint64_t f;
+    int e;
+    int k;
+} cached_power_t;
+
+/* Normalized 10^k, for k = -300, -292, ..., 324 */
+#define CACHED_POWERS_MIN_K -300
+#define CACHED_POWERS_STEP 8
+static const cached_power_t cached_powers[] = {
+    { 0xAB70FE17C79AC6CAULL, -1060, -300 },
+    { 0xFF77B1FCBEBCDC4FULL, -1034, -292 },
+    { 0xBE5691EF416BD60CULL, -1007, -284 },
+    { 0x8DD01FAD907FFC3CULL, -980, -276 },
+    { 0xD3515C2831559A83ULL, -954, -268 },
+    { 0x9D71AC8FADA6C9B5ULL, -927, -260 },
+    { 0xEA9C227723EE8BCBULL, -901, -252 },
+    { 0xAECC49914078536DULL, -874, -244 },
+    { 0x823C12795DB6CE57ULL, -847, -236 },
+    { 0xC21094364DFB5637ULL, -821, -228 },
+    { 0x9096EA6F3848984FULL, -794, -220 },
+    { 0xD77485CB25823AC7ULL, -768, -212 },
+    { 0xA086CFCD97BF97F4ULL, -741, -204 },
+    { 0xEF340A98172AACE5ULL, -715, -196 },
+    { 0xB23867FB2A35B28EULL, -688, -188 },
+    { 0x84C8D4DFD2C63F3BULL, -661, -180 },
+    { 0xC5DD44271AD3CDBAULL, -635, -172 },
+    { 0x936B9FCEBB25C996ULL, -608, -164 },
+    { 0xDBAC6C247D62A584ULL, -582, -156 },
+    { 0xA3AB66580D5FDAF6ULL, -555, -148 },
+    { 0xF3E2F893DEC3F126ULL, -529, -140 },
+    { 0xB5B5ADA8AAFF80B8ULL, -502, -132 },
+    { 0x87625F056C7C4A8BULL, -475, -124 },
+    { 0xC9BCFF6034C13053ULL, -449, -116 },
+    { 0x964E858C91BA2655ULL, -422, -108 },
+    { 0xDFF9772470297EBDULL, -396, -100 },
+    { 0xA6DFBD9FB8E5B88FULL, -369, -92 },
+    { 0xF8A95FCF88747D94ULL, -343, -84 },
+    { 0xB94470938FA89BCFULL, -316, -76 },
+    { 0x8A08F0F8BF0F156BULL, -289, -68 },
+    { 0xCDB02555653131B6ULL, -263, -60 },
+    { 0x993FE2C6D07B7FACULL, -236, -52 },
+    { 0xE45C10C42A2B3B06ULL, -210, -44 },
+    { 0xAA242499697392D3ULL, -183, -36 },
+    { 0xFD87B5F28300CA0EULL, -157, -28 },
+    { 0xBCE5086492111AEBULL, -130, -20 },
+    { 0x8CBCCC096F5088CCULL, -103, -12 },
+    { 0xD1B71758E219652CULL, -77, -4 },
+    { 0x9C40000000000000ULL, -50, 4 },
+    { 0xE8D4A51000000000ULL, -24, 12 },
+    { 0xAD78EBC5AC620000ULL, 3, 20 },
+    { 0x813F3978F8940984ULL, 30, 28 },
+    { 0xC097CE7BC90715B3ULL, 56, 36 },
+    { 0x8F7E32CE7BEA5C70ULL, 83, 44 },
+    { 0xD5D238A4ABE98068ULL, 109, 52 },
+    { 0x9F4F2726179A2245ULL, 136, 60 },
+    { 0xED63A231D4C4FB27ULL, 162, 68 },
+    { 0xB0DE65388CC8ADA8ULL, 189, 76 },
+    { 0x83C7088E1AAB65DBULL, 216, 84 },
+    { 0xC45D1DF942711D9AULL, 242, 92 },
+    { 0x924D692CA61BE758ULL, 269, 100 },
+    { 0xDA01EE641A708DEAULL, 295, 108 },
+    { 0xA26DA3999AEF774AULL, 322, 116 },
+    { 0xF209787BB47D6B85ULL, 348, 124 },
+    { 0xB454E4A179DD1877ULL, 375, 132 },
+    { 0x865B86925B9BC5C2ULL, 402, 140 },
+    { 0xC83553C5C8965D3DULL, 428, 148 },
+    { 0x952AB45CFA97A0B3ULL, 455, 156 },
+    { 0xDE469FBD99A05FE3ULL, 481, 164 },
+    { 0xA59BC234DB398C25ULL, 508, 172 },
+    { 0xF6C69A72A3989F5CULL, 534, 180 },
+    { 0xB7DCBF5354E9BECEULL, 561, 188 },
+    { 0x88FCF317F22241E2ULL, 588, 196 },
+    { 0xCC20CE9BD35C78A5ULL, 614, 204 },
+    { 0x98165AF37B2153DFULL, 641, 212 },
+    { 0xE2A0B5DC971F303AULL, 667, 220 },
+    { 0xA8D9D1535CE3B396ULL, 694, 228 },
+    { 0xFB9B7CD9A4A7443CULL, 720, 236 },
+    { 0xBB764C4CA7A44410ULL, 747, 244 },
+    { 0x8BAB8EEFB6409C1AULL, 774, 252 },
+    { 0xD01FEF10A657842CULL, 800, 260 },
+    { 0x9B10A4E5E9913129ULL, 827, 268 },
+    { 0xE7109BFBA19C0C9DULL, 853, 276 },
+    { 0xAC2820D9623BF429ULL, 880, 284 },
+    { 0x80444B5E7AA7CF85ULL, 907, 292 },
+    { 0xBF21E44003ACDD2DULL, 933, 300 },
+    { 0x8E679C2F5E44FF8FULL, 960, 308 },
+    { 0xD433179D9C8CB841ULL, 986, 316 },
+    { 0x9E19DB92B4E31BA9ULL, 1013, 324 },
+};
+
+/* Range of the binary exponent of the scaled value, so the integral part of
+ * the digits fits in 32 bits */
+#define GRISU_ALPHA -60
+
+static diyfp_t diyfp_mul(diyfp_t x, diyfp_t y)
+{
+    /* Upper 64 bits of the 128-bit product, rounded, from 32-bit halves */
+    uint64_t x_lo = x.f & 0xFFFFFFFF, x_hi = x.f >> 32;
+    uint64_t y_lo = y.f & 0xFFFFFFFF, y_hi = y.f >> 32;
+    uint64_t p0 = x_lo * y_lo, p1 = x_lo * y_hi;
+    uint64_t p2 = x_hi * y_lo, p3 = x_hi * y_hi;
+    uint64_t q = (p0 >> 32) + (p1 & 0xFFFFFFFF) + (p2 & 0xFFFFFFFF) +
+        (1U << 31);
+    diyfp_t ret = { p3 + (p1 >> 32) + (p2 >> 32) + (q >> 32),
+        x.e + y.e + 64 };
+
+    return ret;
+}
+
+static diyfp_t diyfp_normalize(diyfp_t x, int e)
+{
+    diyfp_t ret = { x.f << (x.e - e), e };
+
+    return ret;
+}
+
+/* Removes the last digit while the result is still within the range of
+ * values reading back as the same double, and closer to the exact value */
+static void grisu2_round(char *digits, int len, uint64_t dist, uint64_t delta,
+    uint64_t rest, uint64_t ten_k)
+{
+    while (rest < dist && delta - rest >= ten_k &&
+        (rest + ten_k < dist || dist - rest > rest + ten_k - dist))
+    {
+        digits[len - 1]--;
+        rest += ten_k;
+    }
+}
+
+/* Generates the digits of w, as few as needed to stay within (low, high) */
+static int grisu2_digits(char *digits, int *exponent, diyfp_t low, diyfp_t w,
+    diyfp_t high)
+{
+    uint64_t delta = high.f - low.f, dist = high.f - w.f;
+    uint64_t one = 1ULL << -high.e, rest;
+    uint32_t integral = high.f >> -high.e;
+    uint64_t fraction = high.f & (one - 1);
+    int n = digits_count(integral), len = 0;
+
+    /* Digits of the integral part */
+    for (; n > 0; n--)
+    {
+        uint32_t pow10 = powers_of_10[n - 1];
+
+        digits[len++] = '0' + integral / pow10;
+        integral %= pow10;
+        rest = ((uint64_t)integral << -high.e) + fraction;
+        if (rest <= delta)
+        {
+            *exponent += n - 1;
+            grisu2_round(digits, len, dist, delta, rest,
+                (uint64_t)pow10 << -high.e);
+            return len;
+        }
+    }
+
+    /* Digits of the fractional part */
+    do
+    {
+        fraction *= 10;
+        delta *= 10;
+        dist *= 10;
+        digits[len++] = '0' + (fraction >> -high.e);
+        fraction &= one - 1;
+        (*exponent)--;
+    } while (fraction > delta);
+
+    grisu2_round(digits, len, dist, delta, fraction, one);
+    return len;
+}
+
+/* Writes the digits of a positive, finite value and returns their count, the
+ * value being digits * 10^exponent */
+static int grisu2(char *digits, int *exponent, uint64_t bits)
+{
+    uint64_t f = bits & 0xFFFFFFFFFFFFFULL;
+    int e = (bits >> 52) & 0x7FF;
+    diyfp_t v = { e ? f | 0x10000000000000ULL : f, e ? e - 1075 : -1074 };
+    diyfp_t high = { v.f * 2 + 1, v.e - 1 }, low;
+    const cached_power_t *cached;
+    diyfp_t c;
+    int k, shift;
+
+    /* Boundaries of the values rounding to v, halfway to its neighbours. The
+     * lower one is closer if v is a power of two */
+    if (f == 0 && e > 1)
+    {
+        low.f = v.f * 4 - 1;
+        low.e = v.e - 2;
+    }
+    else
+    {
+        low.f = v.f * 2 - 1;
+        low.e = v.e - 1;
+    }
+    shift = __builtin_clzll(high.f);
+    high.f <<= shift;
+    high.e -= shift;
+    low = diyfp_normalize(low, high.e);
+    v = diyfp_normalize(v, high.e);
+
+    /* Scale by a cached power of ten, so the exponent is in range */
+    k = GRISU_ALPHA - high.e - 1;
+    k = k * 78913 / (1 << 18) + (k > 0);
+    cached = &cached_powers[(k - CACHED_POWERS_MIN_K + CACHED_POWERS_STEP - 1) /
+        CACHED_POWERS_STEP];
+    c.f = cached->f;
+    c.e = cached->e;
+
+    v = diyfp_mul(v, c);
+    low = diyfp_mul(low, c);
+    high = diyfp_mul(high, c);
+    /* Stay clear of the boundaries, the products may be off by one */
+    low.f++;
+    high.f--;
+
+    *exponent = -cached->k;
+    return grisu2_digits(digits, exponent, low, v, high);
+}
+
+/* Note, ESP-32 is little endian, as is the characteristic value */
+char *format_float64(char *p, const uint8_t *value)
+{
+    char digits[17];
+    uint64_t bits;
+    int len, exponent, point;
+
+    memcpy(&bits, value, sizeof(bits));
+    if (bits >> 63)
+        *p++ = '-';
+    bits &= ~(1ULL << 63);
+
+    if (bits >= 0x7FF0000000000000ULL)
+        return format_special(p, bits == 0x7FF0000000000000ULL ? "inf" : "nan");
+    if (!bits)
+    {
+        *p++ = '0';
+        return p;
+    }
+
+    len = grisu2(digits, &exponent, bits);
+
+    /* Written like %g would, in positional notation unless the decimal
+     * exponent is out of the -4..14 range */
+    point = len + exponent;
+    if (point > 15 || point < -3)
+    {
+        *p++ = digits[0];
+        if (len > 1)
+        {
+            *p++ = '.';
+            memcpy(p, digits + 1, len - 1);
+            p += len - 1;
+        }
+        *p++ = 'e';
+        point--;
+        *p++ = point < 0 ? '-' : '+';
+        point = point < 0 ? -point : point;
+        if (point < 10)
+            *p++ = '0';
+        return format_uint32(p, point);
+    }
+
+    if (point <= 0)
+    {
+        *p++ = '0';
+        *p++ = '.';
+        memset(p, '0', -point);
+        p += -point;
+        memcpy(p, digits, len);
+        return p + len;
+    }
+
+    if (point >= len)
+    {
+        memcpy(p, digits, len);
+        memset(p + len, '0', point - len);
+        return p + point;
+    }
+
+    memcpy(p, digits, point);
+    p += point;
+    *p++ = '.';
+    memcpy(p, digits + point, len - point);
+    return p + len - point;
+}
+
+/* Binary-to-text encodings */
+char *format_hex(char *p, const uint8_t *data, size_t len)
+{
+    const uint8_t *end = data + len;
+
+    for (; data < end; data++)
+    {
+        *p++ = hex_digits[*data >> 4];
+        *p++ = hex_digits[*data & 0x0F];
+    }
+
+    return p;
+}
+
+char *format_base64(char *p, const uint8_t *data, size_t len)
+{
+    uint32_t v;
+
+    /* Every 3 bytes are encoded as 4 characters */
+    for (; len >= 3; data += 3, len -= 3)
+    {
+        v = data[0] << 16 | data[1] << 8 | data[2];
+        *p++ = base64_digits[v >> 18];
+        *p++ = base64_digits[(v >> 12) & 0x3F];
+        *p++ = base64_digits[(v >> 6) & 0x3F];
+        *p++ = base64_digits[v & 0x3F];
+    }
+
+    if (!len)
+        return p;
+
+    /* Remaining 1 or 2 bytes are padded */
+    v = data[0] << 16 | (len == 2 ? data[1] << 8 : 0);
+    *p++ = base64_digits[v >> 18];
+    *p++ = base64_digits[(v >> 12) & 0x3F];
+    *p++ = len == 2 ? base64_digits[(v >> 6) & 0x3F] : '=';
+    *p++ = '=';
+
+    return p;
+}
+
+int parse_hex(const char *s, size_t len, uint8_t *buf, size_t size)
+{
+    const uint8_t *in = (const uint8_t *)s;
+    size_t i;
+
+    if (len % 2 || len / 2 > size)
+        return -1;
+
+    for (i = 0; i < len / 2; i++, in += 2)
+    {
+        int8_t high = hex_values[in[0]], low = hex_values[in[1]];
+
+        if ((high | low) < 0)
+            return -1;
+
+        buf[i] = high << 4 | low;
+    }
+
+    return i;
+}
+
+int parse_base64(const char *s, size_t len, uint8_t *buf, size_t size)
+{
+    const uint8_t *in = (const uint8_t *)s;
+    uint32_t v = 0;
+    size_t i, n = 0, bits = 0;
+
+    /* Padding is optional */
+    while (len && in[len - 1] == '=')
+        len--;
+
+    if (len % 4 == 1 || len * 3 / 4 > size)
+        return -1;
+
+    for (i = 0; i < len; i++)
+    {
+        int8_t c = base64_values[in[i]];
+
+        if (c < 0)
+            return -1;
+
+        v = v << 6 | c;
+        bits += 6;
+        if (bits >= 8)
+        {
+            bits -= 8;
+            buf[n++] = v >> bits;
+        }
+    }
+
+    return n;
+}
@@ -0,0 +1,28 @@
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Value formatters used by the characteristic decoders. Each one writes the
+ * textual representation at p, without a terminating NUL, and returns a
+ * pointer past the last written character */
+char *format_uint32(char *p, uint32_t value);
+char *format_int32(char *p, int32_t value);
+char *format_uint64(char *p, uint64_t value);
+char *format_bool(char *p, uint8_t value);
+
+/* Floating point formats, passed as raw little endian values */
+char *format_sfloat(char *p, uint16_t value);
+char *format_float(char *p, uint32_t value);
+char *format_float64(char *p, const uint8_t *value);
+
+/* Binary-to-text encodings of len bytes of data, hex uses lowercase digits and
+ * base64 the standard, padded, alphabet. The parsers accept either case and
+ * unpadded input, and return the number of bytes written to buf or -1 */
+char *format_hex(char *p, const uint8_t *data, size_t len);
+char *format_base64(char *p, const uint8_t *data, size_t len);
+int parse_hex(const char *s, size_t len, uint8_t *buf, size_t size);
+int parse_base64(const char *s, size_t len, uint8_t *buf, size_t size);
+
+#endif
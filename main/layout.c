@@ -0,0 +1,264 @@
+#include "layout.h"
+#include "gatt.h"
+#include "transform.h"
+#include <cJSON.h>
+#include <esp_log.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Constants */
+static const char *TAG = "Layout";
+
+/* Types */
+typedef struct {
+    layout_t *layout;
+    /* Index of each field's enclosing group, LAYOUT_NONE at the top level */
+    uint8_t parents[LAYOUT_FIELDS_MAX];
+    /* Transforms are only added once the whole layout compiled */
+    const char *transforms[LAYOUT_FIELDS_MAX];
+} layout_compiler_t;
+
+/* Internal state */
+static layout_t *layouts = NULL;
+
+static int compile_fields(layout_compiler_t *c, cJSON *fields, uint8_t parent,
+    uint8_t is_big_endian);
+
+/* Conditions and counts may only refer to preceding fields in the same group,
+ * or in one of the groups enclosing it, so their values are always known */
+static int find_field(layout_compiler_t *c, const char *name, uint8_t index)
+{
+    layout_field_t *fields = c->layout->fields;
+    uint8_t ancestor, parent = c->parents[index];
+    int i;
+
+    for (i = index - 1; i >= 0; i--)
+    {
+        if (!fields[i].name || strcmp(fields[i].name, name))
+            continue;
+
+        for (ancestor = parent; ancestor != c->parents[i] &&
+            ancestor != LAYOUT_NONE; ancestor = c->parents[ancestor]);
+
+        if (ancestor != c->parents[i])
+            continue;
+
+        /* Only integers can be tested or counted */
+        if (fields[i].type == LAYOUT_TYPE_GROUP ||
+            fields[i].type == LAYOUT_TYPE_SKIP ||
+            fields[i].type == CHAR_TYPE_SFLOAT ||
+            fields[i].type == CHAR_TYPE_FLOAT ||
+            fields[i].type == CHAR_TYPE_FLOAT64 ||
+            ble_type_size(fields[i].type) > sizeof(uint32_t) ||
+            !ble_type_size(fields[i].type))
+        {
+            return -1;
+        }
+
+        return i;
+    }
+
+    return -1;
+}
+
+static int compile_condition(layout_compiler_t *c, uint8_t index, cJSON *cond)
+{
+    layout_field_t *field = &c->layout->fields[index];
+    cJSON *name = cJSON_GetObjectItemCaseSensitive(cond, "field");
+    cJSON *mask = cJSON_GetObjectItemCaseSensitive(cond, "mask");
+    cJSON *value = cJSON_GetObjectItemCaseSensitive(cond, "value");
+    int i;
+
+    if (!cJSON_IsString(name) || !cJSON_IsNumber(mask) ||
+        (value && !cJSON_IsNumber(value)) ||
+        (i = find_field(c, name->valuestring, index)) < 0)
+    {
+        return -1;
+    }
+
+    field->cond = value ? LAYOUT_COND_EQUALS : LAYOUT_COND_ANY;
+    field->cond_field = i;
+    field->cond_mask = mask->valuedouble;
+    field->cond_value = value ? value->valuedouble : 0;
+
+    return 0;
+}
+
+static int compile_field(layout_compiler_t *c, cJSON *json, uint8_t parent,
+    uint8_t is_big_endian)
+{
+    layout_t *layout = c->layout;
+    cJSON *name = cJSON_GetObjectItemCaseSensitive(json, "name");
+    cJSON *type = cJSON_GetObjectItemCaseSensitive(json, "type");
+    cJSON *endian = cJSON_GetObjectItemCaseSensitive(json, "endian");
+    cJSON *cond = cJSON_GetObjectItemCaseSensitive(json, "if");
+    cJSON *group = cJSON_GetObjectItemCaseSensitive(json, "group");
+    cJSON *count = cJSON_GetObjectItemCaseSensitive(json, "count");
+    cJSON *skip = cJSON_GetObjectItemCaseSensitive(json, "skip");
+    cJSON *transform = cJSON_GetObjectItemCaseSensitive(json, "transform");
+    uint8_t index = layout->fields_count;
+    layout_field_t *field;
+    int i;
+
+    if (index == LAYOUT_FIELDS_MAX)
+        return -1;
+
+    field = &layout->fields[index];
+    layout->fields_count++;
+    c->parents[index] = parent;
+    field->count_field = LAYOUT_NONE;
+
+    if (cJSON_IsString(endian))
+    {
+        if (!strcmp(endian->valuestring, "big"))
+            is_big_endian = 1;
+        else if (!strcmp(endian->valuestring, "little"))
+            is_big_endian = 0;
+        else
+            return -1;
+    }
+    field->is_big_endian = is_big_endian;
+
+    if (cond && compile_condition(c, index, cond))
+        return -1;
+
+    if (cJSON_IsString(name) && !(field->name = strdup(name->valuestring)))
+        return -1;
+
+    if (cJSON_IsNumber(skip))
+    {
+        if (skip->valuedouble < 1 || skip->valuedouble > UINT16_MAX)
+            return -1;
+        field->type = LAYOUT_TYPE_SKIP;
+        field->count = skip->valuedouble;
+        return 0;
+    }
+
+    if (cJSON_IsArray(group))
+    {
+        field->type = LAYOUT_TYPE_GROUP;
+        if (cJSON_IsString(count))
+        {
+            if ((i = find_field(c, count->valuestring, index)) < 0)
+                return -1;
+            field->count_field = i;
+        }
+        else if (cJSON_IsNumber(count))
+        {
+            if (count->valuedouble < 1 || count->valuedouble > UINT16_MAX)
+                return -1;
+            field->count = count->valuedouble;
+        }
+        else if (count)
+            return -1;
+
+        if (compile_fields(c, group, index, is_big_endian))
+            return -1;
+        field->group_size = layout->fields_count - index - 1;
+
+        /* A group repeated until the value ends must consume something */
+        return !field->group_size || (!count && !field->min_size) ? -1 : 0;
+    }
+
+    if (!cJSON_IsString(type))
+        return -1;
+
+    field->type = ble_atotype(type->valuestring);
+    if (field->type != CHAR_TYPE_UTF8S && !ble_type_size(field->type))
+        return -1;
+
+    if (cJSON_IsString(transform))
+        c->transforms[index] = transform->valuestring;
+
+    return 0;
+}
+
+static int compile_fields(layout_compiler_t *c, cJSON *fields, uint8_t parent,
+    uint8_t is_big_endian)
+{
+    layout_field_t *field, *group = parent == LAYOUT_NONE ? NULL :
+        &c->layout->fields[parent];
+    cJSON *cur;
+
+    for (cur = fields->child; cur; cur = cur->next)
+    {
+        field = &c->layout->fields[c->layout->fields_count];
+        if (!cJSON_IsObject(cur) || compile_field(c, cur, parent,
+            is_big_endian))
+        {
+            return -1;
+        }
+
+        /* Unconditional fixed size fields count toward the group's smallest
+         * repetition, which bounds groups repeated until the value ends */
+        if (!group || field->cond != LAYOUT_COND_NONE)
+            continue;
+
+        if (field->type == LAYOUT_TYPE_SKIP)
+            group->min_size += field->count;
+        else if (field->type == LAYOUT_TYPE_GROUP)
+            group->min_size += field->count * field->min_size;
+        else
+            group->min_size += ble_type_size(field->type);
+    }
+
+    return 0;
+}
+
+static void layout_free(layout_t *layout)
+{
+    uint8_t i;
+
+    for (i = 0; i < layout->fields_count; i++)
+        free((char *)layout->fields[i].name);
+    free(layout);
+}
+
+int layout_add(ble_uuid_t uuid, cJSON *json)
+{
+    layout_t *layout = calloc(1, sizeof(*layout));
+    layout_compiler_t c = { .layout = layout };
+    uint8_t i;
+
+    if (!layout)
+        return -1;
+
+    memcpy(layout->uuid, uuid, sizeof(ble_uuid_t));
+    if (!cJSON_IsArray(json) || compile_fields(&c, json, LAYOUT_NONE, 0))
+    {
+        ESP_LOGE(TAG, "Failed compiling layout of %s", uuidtoa(uuid));
+        layout_free(layout);
+        return -1;
+    }
+
+    ESP_LOGD(TAG, "Compiled layout of %s to %u fields", uuidtoa(uuid),
+        layout->fields_count);
+
+    /* Transforms apply to fields by their index in the layout */
+    for (i = 0; i < layout->fields_count; i++)
+    {
+        if (c.transforms[i] && transform_add(uuid, i, c.transforms[i]))
+        {
+            ESP_LOGE(TAG, "Ignoring transform of field %u of %s: %s", i,
+                uuidtoa(uuid), c.transforms[i]);
+        }
+    }
+
+    layout->next = layouts;
+    layouts = layout;
+
+    return 0;
+}
+
+const layout_t *layout_find(ble_uuid_t uuid)
+{
+    layout_t *layout;
+
+    for (layout = layouts; layout; layout = layout->next)
+    {
+        if (!memcmp(layout->uuid, uuid, sizeof(ble_uuid_t)))
+            return layout;
+    }
+
+    return NULL;
+}
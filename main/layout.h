@@ -0,0 +1,58 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include "ble_utils.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* Constants */
+#define LAYOUT_FIELDS_MAX 32
+#define LAYOUT_NONE 0xFF
+
+/* Types */
+typedef enum {
+    LAYOUT_COND_NONE,
+    LAYOUT_COND_ANY, /* Present if any of the mask's bits are set */
+    LAYOUT_COND_EQUALS, /* Present if the masked bits equal the value */
+} layout_cond_t;
+
+/* Entries of a compiled layout. A group is followed by its members, which may
+ * be groups themselves, and is repeated a fixed number of times, the number
+ * of times given by a previous field or until the value ends */
+typedef struct {
+    const char *name;
+    uint8_t type; /* CHAR_TYPE_*, LAYOUT_TYPE_GROUP or LAYOUT_TYPE_SKIP */
+    uint8_t is_big_endian;
+    uint8_t cond; /* layout_cond_t */
+    uint8_t cond_field; /* Index of the field the condition tests */
+    uint32_t cond_mask;
+    uint32_t cond_value;
+    uint8_t group_size; /* Number of entries following a group */
+    uint8_t count_field; /* Index of the field holding the count */
+    uint16_t count; /* Repetitions or bytes to skip, 0 until the value ends */
+    uint16_t min_size; /* Smallest size of a group's repetition */
+} layout_field_t;
+
+#define LAYOUT_TYPE_GROUP 0xF0
+#define LAYOUT_TYPE_SKIP 0xF1
+
+typedef struct layout_t {
+    struct layout_t *next;
+    ble_uuid_t uuid;
+    uint8_t fields_count;
+    layout_field_t fields[LAYOUT_FIELDS_MAX];
+} layout_t;
+
+struct cJSON;
+
+/* Declarative value layouts, an array of fields such as:
+ * { "name": "flags", "type": "uint8" }
+ * { "name": "energy", "type": "uint16", "if": { "field": "flags", "mask": 8 } }
+ * { "name": "rr", "group": [ ... ], "count": "rr_count" }
+ * { "skip": 2 }
+ * compiled once to a table ble_utils.c walks while decoding values */
+int layout_add(ble_uuid_t uuid, struct cJSON *layout);
+/* Returns the characteristic's layout, or NULL if it has none */
+const layout_t *layout_find(ble_uuid_t uuid);
+
+#endif
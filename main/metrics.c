@@ -0,0 +1,394 @@
+#include "metrics.h"
+#include <cJSON.h>
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <string.h>
+
+/* Constants */
+#define METRICS_BLE_EVENTS_MAX 64
+#define METRICS_DEVICES_MAX 8
+#define METRICS_HISTOGRAM_BUCKETS 14
+
+static const char *TAG = "Metrics";
+
+/* Upper bounds (inclusive, in microseconds) of the histogram buckets. The last
+ * bucket holds everything above the last bound */
+static const uint32_t histogram_bounds[METRICS_HISTOGRAM_BUCKETS - 1] = {
+    100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000,
+    500000, 1000000,
+};
+
+static const char *counter_names[METRICS_COUNTER_MAX] = {
+    [METRICS_COUNTER_BLE_CONNECTS] = "ble_connects",
+    [METRICS_COUNTER_BLE_DISCONNECTS] = "ble_disconnects",
+    [METRICS_COUNTER_MQTT_RECONNECTS] = "mqtt_reconnects",
+    [METRICS_COUNTER_WIFI_RECONNECTS] = "wifi_reconnects",
+    [METRICS_COUNTER_MQTT_PUBLISHED] = "published",
+    [METRICS_COUNTER_MQTT_PUBLISH_FAILED] = "publish_failed",
+    [METRICS_COUNTER_LOG_DROPPED] = "log_dropped",
+    [METRICS_COUNTER_BLE_VALUES_DROPPED] = "values_dropped",
+    [METRICS_COUNTER_BLE_INDICATIONS] = "indications",
+};
+
+static const char *gauge_names[METRICS_GAUGE_MAX] = {
+    [METRICS_GAUGE_QUEUE_DEPTH] = "queue_depth",
+    [METRICS_GAUGE_OFFLINE_QUEUE_SIZE] = "offline_queue",
+    [METRICS_GAUGE_NOTIFY_SLOTS] = "notify_slots",
+    [METRICS_GAUGE_NOTIFY_SLOTS_FREE] = "notify_slots_free",
+    [METRICS_GAUGE_NOTIFY_POLLED] = "notify_polled",
+};
+
+static const char *histogram_names[METRICS_HISTOGRAM_MAX] = {
+    [METRICS_HISTOGRAM_QUEUE_WAIT] = "queue_wait",
+    [METRICS_HISTOGRAM_PUBLISH_LATENCY] = "publish_latency",
+    [METRICS_HISTOGRAM_FIRST_SECURE_VALUE] = "first_secure_value",
+};
+
+/* Types */
+typedef struct {
+    uint32_t count;
+    uint32_t max;
+    uint32_t buckets[METRICS_HISTOGRAM_BUCKETS];
+} metrics_histogram_data_t;
+
+typedef struct {
+    uint32_t state; /* 0 - free, 1 - being claimed, 2 - in use */
+    mac_addr_t mac;
+    uint32_t notifications;
+} metrics_device_t;
+
+/* Internal state */
+static uint32_t counters[METRICS_COUNTER_MAX];
+static int32_t gauges[METRICS_GAUGE_MAX];
+static metrics_histogram_data_t histograms[METRICS_HISTOGRAM_MAX];
+static uint32_t gap_events[METRICS_BLE_EVENTS_MAX];
+static uint32_t gattc_events[METRICS_BLE_EVENTS_MAX];
+static metrics_device_t devices[METRICS_DEVICES_MAX];
+static uint32_t report_interval = 0;
+static uint8_t is_started = 0;
+
+/* Callback functions */
+static metrics_on_report_cb_t on_report_cb = NULL;
+
+void metrics_set_on_report_cb(metrics_on_report_cb_t cb)
+{
+    on_report_cb = cb;
+}
+
+/* All updates are done with relaxed atomic operations so they can be called
+ * from the BT, MQTT and timer tasks on both cores without locking */
+static inline void metrics_atomic_inc(uint32_t *p)
+{
+    __atomic_fetch_add(p, 1, __ATOMIC_RELAXED);
+}
+
+static inline uint32_t metrics_atomic_get(uint32_t *p)
+{
+    return __atomic_load_n(p, __ATOMIC_RELAXED);
+}
+
+void metrics_counter_inc(metrics_counter_t counter)
+{
+    metrics_atomic_inc(&counters[counter]);
+}
+
+uint32_t metrics_counter_get(metrics_counter_t counter)
+{
+    return metrics_atomic_get(&counters[counter]);
+}
+
+void metrics_gauge_add(metrics_gauge_t gauge, int32_t delta)
+{
+    __atomic_fetch_add(&gauges[gauge], delta, __ATOMIC_RELAXED);
+}
+
+void metrics_gauge_set(metrics_gauge_t gauge, int32_t value)
+{
+    __atomic_store_n(&gauges[gauge], value, __ATOMIC_RELAXED);
+}
+
+int32_t metrics_gauge_get(metrics_gauge_t gauge)
+{
+    return __atomic_load_n(&gauges[gauge], __ATOMIC_RELAXED);
+}
+
+static uint8_t metrics_histogram_bucket(uint32_t value)
+{
+    uint8_t lo = 0, hi = METRICS_HISTOGRAM_BUCKETS - 1;
+
+    /* Binary search for the first bound the value fits in */
+    while (lo < hi)
+    {
+        uint8_t mid = (lo + hi) / 2;
+
+        if (value <= histogram_bounds[mid])
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    return lo;
+}
+
+void metrics_histogram_record(metrics_histogram_t histogram, uint32_t value)
+{
+    metrics_histogram_data_t *h = &histograms[histogram];
+    uint32_t max = metrics_atomic_get(&h->max);
+
+    metrics_atomic_inc(&h->count);
+    metrics_atomic_inc(&h->buckets[metrics_histogram_bucket(value)]);
+
+    while (value > max && !__atomic_compare_exchange_n(&h->max, &max, value, 1,
+        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void metrics_ble_gap_event(int event)
+{
+    if (event >= 0 && event < METRICS_BLE_EVENTS_MAX)
+        metrics_atomic_inc(&gap_events[event]);
+}
+
+void metrics_ble_gattc_event(int event)
+{
+    if (event >= 0 && event < METRICS_BLE_EVENTS_MAX)
+        metrics_atomic_inc(&gattc_events[event]);
+}
+
+static metrics_device_t *metrics_device_get(mac_addr_t mac)
+{
+    metrics_device_t *dev;
+    uint32_t state;
+
+    for (dev = devices; dev < devices + METRICS_DEVICES_MAX; dev++)
+    {
+        state = __atomic_load_n(&dev->state, __ATOMIC_ACQUIRE);
+
+        if (state == 2 && !memcmp(dev->mac, mac, sizeof(mac_addr_t)))
+            return dev;
+
+        /* Claim an empty slot for this device */
+        if (state == 0 && __atomic_compare_exchange_n(&dev->state, &state, 1,
+            0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            memcpy(dev->mac, mac, sizeof(mac_addr_t));
+            __atomic_store_n(&dev->state, 2, __ATOMIC_RELEASE);
+            return dev;
+        }
+    }
+
+    return NULL;
+}
+
+void metrics_ble_notification(mac_addr_t mac)
+{
+    metrics_device_t *dev = metrics_device_get(mac);
+
+    if (dev)
+        metrics_atomic_inc(&dev->notifications);
+}
+
+/* Slots of disconnected devices are reused, the device's count starts over if
+ * it reconnects */
+void metrics_ble_disconnected(mac_addr_t mac)
+{
+    metrics_device_t *dev;
+    uint32_t state;
+
+    for (dev = devices; dev < devices + METRICS_DEVICES_MAX; dev++)
+    {
+        state = 2;
+        if (memcmp(dev->mac, mac, sizeof(mac_addr_t)) ||
+            !__atomic_compare_exchange_n(&dev->state, &state, 1, 0,
+            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+        {
+            continue;
+        }
+
+        __atomic_store_n(&dev->notifications, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&dev->state, 0, __ATOMIC_RELEASE);
+        return;
+    }
+}
+
+/* Estimate a percentile as the upper bound of the bucket it falls in. Values
+ * in the last bucket are estimated as the maximal value */
+uint32_t metrics_histogram_percentile(metrics_histogram_t histogram,
+    uint8_t percentile)
+{
+    metrics_histogram_data_t *h = &histograms[histogram];
+    uint32_t buckets[METRICS_HISTOGRAM_BUCKETS], count = 0, target, sum = 0;
+    int i;
+
+    for (i = 0; i < METRICS_HISTOGRAM_BUCKETS; i++)
+    {
+        buckets[i] = metrics_atomic_get(&h->buckets[i]);
+        count += buckets[i];
+    }
+
+    if (!count)
+        return 0;
+
+    target = ((uint64_t)count * percentile + 99) / 100;
+    for (i = 0; i < METRICS_HISTOGRAM_BUCKETS - 1; i++)
+    {
+        if ((sum += buckets[i]) >= target)
+            return histogram_bounds[i];
+    }
+
+    return metrics_atomic_get(&h->max);
+}
+
+/* Reporting */
+static cJSON *metrics_events_to_json(uint32_t *events)
+{
+    cJSON *obj = cJSON_CreateObject();
+    char key[12];
+    int i;
+
+    for (i = 0; i < METRICS_BLE_EVENTS_MAX; i++)
+    {
+        uint32_t count = metrics_atomic_get(&events[i]);
+
+        if (!count)
+            continue;
+
+        sprintf(key, "%d", i);
+        cJSON_AddNumberToObject(obj, key, count);
+    }
+
+    return obj;
+}
+
+static cJSON *metrics_histogram_to_json(metrics_histogram_t histogram)
+{
+    metrics_histogram_data_t *h = &histograms[histogram];
+    cJSON *obj = cJSON_CreateObject();
+    cJSON *buckets = cJSON_CreateArray();
+    int i;
+
+    cJSON_AddNumberToObject(obj, "n", metrics_atomic_get(&h->count));
+    cJSON_AddNumberToObject(obj, "max", metrics_atomic_get(&h->max));
+    cJSON_AddNumberToObject(obj, "p50",
+        metrics_histogram_percentile(histogram, 50));
+    cJSON_AddNumberToObject(obj, "p99",
+        metrics_histogram_percentile(histogram, 99));
+    for (i = 0; i < METRICS_HISTOGRAM_BUCKETS; i++)
+    {
+        cJSON_AddItemToArray(buckets,
+            cJSON_CreateNumber(metrics_atomic_get(&h->buckets[i])));
+    }
+    cJSON_AddItemToObject(obj, "b", buckets);
+
+    return obj;
+}
+
+char *metrics_to_json(void)
+{
+    static int64_t last_time = 0;
+    static uint32_t last_published = 0;
+    int64_t now = esp_timer_get_time();
+    uint32_t published = metrics_counter_get(METRICS_COUNTER_MQTT_PUBLISHED);
+    cJSON *root = cJSON_CreateObject();
+    cJSON *obj;
+    metrics_device_t *dev;
+    char *ret;
+    int i;
+
+    cJSON_AddNumberToObject(root, "uptime", now / 1000000);
+
+    /* Sustained throughput since the previous report, in messages/sec */
+    if (last_time && now > last_time)
+    {
+        cJSON_AddNumberToObject(root, "publish_rate",
+            (published - last_published) * 1000000.0 / (now - last_time));
+    }
+    last_time = now;
+    last_published = published;
+
+    obj = cJSON_CreateObject();
+    cJSON_AddNumberToObject(obj, "free", esp_get_free_heap_size());
+    cJSON_AddNumberToObject(obj, "min",
+        heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT));
+    cJSON_AddNumberToObject(obj, "largest",
+        heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+    cJSON_AddItemToObject(root, "heap", obj);
+
+    for (i = 0; i < METRICS_COUNTER_MAX; i++)
+        cJSON_AddNumberToObject(root, counter_names[i], metrics_counter_get(i));
+
+    for (i = 0; i < METRICS_GAUGE_MAX; i++)
+        cJSON_AddNumberToObject(root, gauge_names[i], metrics_gauge_get(i));
+
+    for (i = 0; i < METRICS_HISTOGRAM_MAX; i++)
+    {
+        cJSON_AddItemToObject(root, histogram_names[i],
+            metrics_histogram_to_json(i));
+    }
+
+    cJSON_AddItemToObject(root, "gap", metrics_events_to_json(gap_events));
+    cJSON_AddItemToObject(root, "gattc", metrics_events_to_json(gattc_events));
+
+    obj = cJSON_CreateObject();
+    for (dev = devices; dev < devices + METRICS_DEVICES_MAX; dev++)
+    {
+        if (__atomic_load_n(&dev->state, __ATOMIC_ACQUIRE) != 2)
+            continue;
+
+        cJSON_AddNumberToObject(obj, mactoa(dev->mac),
+            metrics_atomic_get(&dev->notifications));
+    }
+    cJSON_AddItemToObject(root, "notifications", obj);
+
+    ret = cJSON_PrintUnformatted(root);
+    cJSON_Delete(root);
+
+    return ret;
+}
+
+void metrics_start(void)
+{
+    is_started = 1;
+}
+
+void metrics_stop(void)
+{
+    is_started = 0;
+}
+
+static void metrics_task(void *pvParameter)
+{
+    char *json;
+
+    while (1)
+    {
+        vTaskDelay(report_interval * 1000 / portTICK_PERIOD_MS);
+
+        if (!is_started || !on_report_cb)
+            continue;
+
+        if (!(json = metrics_to_json()))
+            continue;
+
+        on_report_cb(json, strlen(json));
+        free(json);
+    }
+}
+
+int metrics_initialize(uint32_t interval)
+{
+    ESP_LOGD(TAG, "Initializing metrics, reporting every %u seconds",
+        interval);
+
+    /* Metrics are always collected, reporting is optional */
+    if (!(report_interval = interval))
+        return 0;
+
+    xTaskCreatePinnedToCore(metrics_task, "metrics_task", 4096, NULL, 1, NULL,
+        1);
+
+    return 0;
+}
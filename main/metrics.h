@@ -0,0 +1,67 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "ble_utils.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* Types */
+typedef enum {
+    METRICS_COUNTER_BLE_CONNECTS,
+    METRICS_COUNTER_BLE_DISCONNECTS,
+    METRICS_COUNTER_MQTT_RECONNECTS,
+    METRICS_COUNTER_WIFI_RECONNECTS,
+    METRICS_COUNTER_MQTT_PUBLISHED,
+    METRICS_COUNTER_MQTT_PUBLISH_FAILED,
+    METRICS_COUNTER_LOG_DROPPED,
+    METRICS_COUNTER_BLE_VALUES_DROPPED,
+    METRICS_COUNTER_BLE_INDICATIONS,
+    METRICS_COUNTER_MAX,
+} metrics_counter_t;
+
+typedef enum {
+    METRICS_GAUGE_QUEUE_DEPTH,
+    METRICS_GAUGE_OFFLINE_QUEUE_SIZE,
+    METRICS_GAUGE_NOTIFY_SLOTS,
+    METRICS_GAUGE_NOTIFY_SLOTS_FREE,
+    METRICS_GAUGE_NOTIFY_POLLED,
+    METRICS_GAUGE_MAX,
+} metrics_gauge_t;
+
+typedef enum {
+    METRICS_HISTOGRAM_QUEUE_WAIT,
+    METRICS_HISTOGRAM_PUBLISH_LATENCY,
+    METRICS_HISTOGRAM_FIRST_SECURE_VALUE,
+    METRICS_HISTOGRAM_MAX,
+} metrics_histogram_t;
+
+/* Event callback types */
+typedef void (*metrics_on_report_cb_t)(const char *json, size_t len);
+
+/* Event handlers */
+void metrics_set_on_report_cb(metrics_on_report_cb_t cb);
+
+/* Counters, gauges and histograms. Safe to call from any task */
+void metrics_counter_inc(metrics_counter_t counter);
+uint32_t metrics_counter_get(metrics_counter_t counter);
+void metrics_gauge_add(metrics_gauge_t gauge, int32_t delta);
+void metrics_gauge_set(metrics_gauge_t gauge, int32_t value);
+int32_t metrics_gauge_get(metrics_gauge_t gauge);
+/* Values are in microseconds */
+void metrics_histogram_record(metrics_histogram_t histogram, uint32_t value);
+uint32_t metrics_histogram_percentile(metrics_histogram_t histogram,
+    uint8_t percentile);
+
+void metrics_ble_gap_event(int event);
+void metrics_ble_gattc_event(int event);
+void metrics_ble_notification(mac_addr_t mac);
+void metrics_ble_disconnected(mac_addr_t mac);
+
+/* Reporting */
+char *metrics_to_json(void);
+void metrics_start(void);
+void metrics_stop(void);
+
+int metrics_initialize(uint32_t interval);
+
+#endif
@@ -1,10 +1,16 @@
 #include "mqtt.h"
+#include "dedup.h"
+#include "dlog.h"
+#include "metrics.h"
 #include <esp_err.h>
 #include <esp_log.h>
 #include <esp_mqtt.h>
+#include <esp_timer.h>
 #include <string.h>
 
 /* Constants */
+#define MQTT_BUFFER_SIZE 1024
+
 static const char *TAG = "MQTT";
 
 /* Types */
@@ -107,8 +113,9 @@ static void mqtt_subscription_remove(mqtt_subscription_t **list,
 static mqtt_publications_t *mqtt_publication_add(mqtt_publications_t **list,
     const char *topic, uint8_t *payload, size_t len, int qos, uint8_t retained)
 {
-    mqtt_publications_t *pub = malloc(sizeof(*pub));
+    mqtt_publications_t *pub = malloc(sizeof(*pub)), **cur;
 
+    pub->next = NULL;
     pub->topic = strdup(topic);
     pub->payload = malloc(len);
     memcpy(pub->payload, payload, len);
@@ -116,8 +123,10 @@ static mqtt_publications_t *mqtt_publication_add(mqtt_publications_t **list,
     pub->qos = qos;
     pub->retained = retained;
 
-    pub->next = *list;
-    *list = pub;
+    /* Published in order once connected */
+    for (cur = list; *cur; cur = &(*cur)->next);
+    *cur = pub;
+    metrics_gauge_add(METRICS_GAUGE_OFFLINE_QUEUE_SIZE, 1);
 
     return pub;
 }
@@ -140,14 +149,15 @@ static void mqtt_publications_free(mqtt_publications_t **list)
         mqtt_publication_free(cur);
     }
     *head = NULL;
+    metrics_gauge_set(METRICS_GAUGE_OFFLINE_QUEUE_SIZE, 0);
 }
 
 static void mqtt_publications_publish(mqtt_publications_t *list)
 {
     for (; list; list = list->next)
     {
-        ESP_LOGI(TAG, "Publishing from queue: %s = %.*s", list->topic,
-            list->len, list->payload);
+        DLOGI(TAG, "Publishing from queue: %s = %.*s", list->topic,
+            (int)list->len, list->payload);
 
         mqtt_publish(list->topic, list->payload, list->len, list->qos,
             list->retained);
@@ -163,7 +173,7 @@ int mqtt_subscribe(const char *topic, int qos, mqtt_on_message_received_cb_t cb,
         return -1;
 
     ESP_LOGD(TAG, "Subscribing to %s", topic);
-    while ((esp_mqtt_subscribe(topic, qos) != true) && retries < 3)
+    while (retries < 3 && esp_mqtt_subscribe(topic, qos) != true)
     {
         ESP_LOGI(TAG, "Failed subscribing to %s (retries: %u), trying again...",
             topic, retries);
@@ -188,14 +198,36 @@ int mqtt_unsubscribe(const char *topic)
     if (!is_connected)
         return 0;
 
-    return esp_mqtt_unsubscribe(topic);
+    return esp_mqtt_unsubscribe(topic) ? 0 : -1;
 }
 
 int mqtt_publish(const char *topic, uint8_t *payload, size_t len, int qos,
     uint8_t retained)
 {
     if (is_connected)
-        return esp_mqtt_publish(topic, payload, len, qos, retained) != true;
+    {
+        int64_t start;
+        int ret;
+
+        /* The broker already retains this exact payload */
+        if (retained && dedup_is_duplicate(topic, payload, len))
+        {
+            ESP_LOGD(TAG, "Skipping unchanged retained publication: %s", topic);
+            return 0;
+        }
+
+        start = esp_timer_get_time();
+        ret = esp_mqtt_publish(topic, payload, len, qos, retained) != true;
+        if (retained && !ret)
+            dedup_update(topic, payload, len);
+
+        metrics_histogram_record(METRICS_HISTOGRAM_PUBLISH_LATENCY,
+            esp_timer_get_time() - start);
+        metrics_counter_inc(ret ? METRICS_COUNTER_MQTT_PUBLISH_FAILED :
+            METRICS_COUNTER_MQTT_PUBLISHED);
+
+        return ret;
+    }
 
     /* If we're currently not connected, queue publication */
     ESP_LOGD(TAG, "MQTT is disconnected, adding publication to queue...");
@@ -219,6 +251,7 @@ static void mqtt_status_cb(esp_mqtt_status_t status)
     case ESP_MQTT_STATUS_DISCONNECTED:
         ESP_LOGI(TAG, "MQTT client disconnected");
         is_connected = 0;
+        metrics_counter_inc(METRICS_COUNTER_MQTT_RECONNECTS);
         mqtt_subscriptions_free(&subscription_list);
         if (on_disconnected_cb)
             on_disconnected_cb();
@@ -226,16 +259,51 @@ static void mqtt_status_cb(esp_mqtt_status_t status)
     }
 }
 
+static uint8_t mqtt_topic_matches(const char *filter, const char *topic)
+{
+    /* Topics starting with '$' aren't matched by wildcards at the first
+     * level */
+    if (*topic == '$' && (*filter == '+' || *filter == '#'))
+        return 0;
+
+    while (*filter)
+    {
+        /* Multi-level wildcard matches the rest of the topic, including the
+         * parent level, i.e. "a/#" matches "a" */
+        if (*filter == '#')
+            return 1;
+
+        if (*filter == '+')
+        {
+            /* Single-level wildcard matches up to the next separator */
+            for (; *topic && *topic != '/'; topic++);
+            filter++;
+        }
+        else
+        {
+            if (*filter != *topic)
+                return *topic == '\0' && !strcmp(filter, "/#");
+            filter++;
+            topic++;
+        }
+    }
+
+    return *topic == '\0';
+}
+
 static void mqtt_message_cb(const char *topic, uint8_t *payload, size_t len)
 {
     mqtt_subscription_t *cur;
 
     ESP_LOGD(TAG, "Recevied: %s => %s (%d)\n", topic, payload, (int)len);
 
+    /* Someone else published to this topic, the retained payload may have
+     * changed */
+    dedup_invalidate(topic);
+
     for (cur = subscription_list; cur; cur = cur->next)
     {
-        /* TODO: Correctly match MQTT topics (i.e. support wildcards) */
-        if (strcmp(cur->topic, topic))
+        if (!mqtt_topic_matches(cur->topic, topic))
             continue;
 
         cur->cb(topic, payload, len, cur->ctx);
@@ -261,6 +329,6 @@ int mqtt_disconnect(void)
 int mqtt_initialize(void)
 {
     ESP_LOGD(TAG, "Initializing MQTT client");
-    esp_mqtt_init(mqtt_status_cb, mqtt_message_cb, 256, 2000);
+    esp_mqtt_init(mqtt_status_cb, mqtt_message_cb, MQTT_BUFFER_SIZE, 2000);
     return 0;
 }
@@ -0,0 +1,240 @@
+#include "notify.h"
+#include "ble.h"
+#include "metrics.h"
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/timers.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Constants */
+#ifdef BTA_GATTC_NOTIF_REG_MAX
+#define NOTIFY_SLOTS_MAX BTA_GATTC_NOTIF_REG_MAX
+#else
+#define NOTIFY_SLOTS_MAX 15 /* Bluedroid's default */
+#endif
+
+static const char *TAG = "Notify";
+
+/* Types */
+typedef struct notify_entry_t {
+    struct notify_entry_t *next;
+    mac_addr_t mac;
+    ble_uuid_t service;
+    ble_uuid_t characteristic;
+    int priority;
+    uint8_t is_readable;
+    uint8_t is_registered;
+    uint8_t is_failed; /* Registering failed, e.g. there's no CCCD */
+} notify_entry_t;
+
+/* Internal state */
+static notify_entry_t *entries = NULL;
+static uint8_t slots_used = 0;
+static SemaphoreHandle_t mutex = NULL;
+static TimerHandle_t timer = NULL;
+
+static void notify_metrics_update(void)
+{
+    notify_entry_t *entry;
+    int32_t polled = 0;
+
+    for (entry = entries; entry; entry = entry->next)
+        polled += !entry->is_registered && entry->is_readable;
+
+    metrics_gauge_set(METRICS_GAUGE_NOTIFY_SLOTS, slots_used);
+    metrics_gauge_set(METRICS_GAUGE_NOTIFY_SLOTS_FREE,
+        NOTIFY_SLOTS_MAX - slots_used);
+    metrics_gauge_set(METRICS_GAUGE_NOTIFY_POLLED, polled);
+}
+
+static int notify_register(notify_entry_t *entry)
+{
+    if (ble_characteristic_notify_register(entry->mac, entry->service,
+        entry->characteristic))
+    {
+        entry->is_failed = 1;
+        return -1;
+    }
+
+    entry->is_registered = 1;
+    slots_used++;
+
+    return 0;
+}
+
+static void notify_unregister(notify_entry_t *entry)
+{
+    ble_characteristic_notify_unregister(entry->mac, entry->service,
+        entry->characteristic);
+    entry->is_registered = 0;
+    slots_used--;
+}
+
+/* Returns the registered entry with the lowest priority, the latest one
+ * added among equals */
+static notify_entry_t *notify_lowest_registered(void)
+{
+    notify_entry_t *entry, *lowest = NULL;
+
+    for (entry = entries; entry; entry = entry->next)
+    {
+        if (entry->is_registered &&
+            (!lowest || entry->priority <= lowest->priority))
+        {
+            lowest = entry;
+        }
+    }
+
+    return lowest;
+}
+
+/* Returns the polled entry with the highest priority, the earliest one added
+ * among equals */
+static notify_entry_t *notify_highest_polled(void)
+{
+    notify_entry_t *entry, *highest = NULL;
+
+    for (entry = entries; entry; entry = entry->next)
+    {
+        if (!entry->is_registered && !entry->is_failed &&
+            (!highest || entry->priority > highest->priority))
+        {
+            highest = entry;
+        }
+    }
+
+    return highest;
+}
+
+int notify_add(mac_addr_t mac, ble_uuid_t service, ble_uuid_t characteristic,
+    uint8_t is_readable, int priority)
+{
+    notify_entry_t *entry = calloc(1, sizeof(*entry)), **iter, *lowest;
+
+    if (!entry)
+        return -1;
+
+    memcpy(entry->mac, mac, sizeof(mac_addr_t));
+    memcpy(entry->service, service, sizeof(ble_uuid_t));
+    memcpy(entry->characteristic, characteristic, sizeof(ble_uuid_t));
+    entry->priority = priority;
+    entry->is_readable = is_readable;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+
+    /* Entries are kept in the order they were added */
+    for (iter = &entries; *iter; iter = &(*iter)->next);
+    *iter = entry;
+
+    /* Take the slot of a lower priority characteristic, which is given back
+     * if registering fails */
+    if (slots_used == NOTIFY_SLOTS_MAX &&
+        (lowest = notify_lowest_registered()) && lowest->priority < priority)
+    {
+        notify_unregister(lowest);
+    }
+    else
+        lowest = NULL;
+
+    if (slots_used < NOTIFY_SLOTS_MAX)
+        notify_register(entry);
+
+    if (lowest && !entry->is_registered)
+        notify_register(lowest);
+    else if (lowest)
+    {
+        ESP_LOGI(TAG, "Polling %s of %s instead of registering for "
+            "notifications", uuidtoa(lowest->characteristic),
+            mactoa(lowest->mac));
+    }
+
+    if (!entry->is_registered)
+    {
+        ESP_LOGW(TAG, "Failed registering for notifications of %s of %s, %s",
+            uuidtoa(characteristic), mactoa(mac),
+            is_readable ? "polling it instead" : "it can't be polled");
+    }
+
+    notify_metrics_update();
+    xSemaphoreGive(mutex);
+
+    return entry->is_registered || is_readable ? 0 : -1;
+}
+
+void notify_remove(mac_addr_t mac)
+{
+    notify_entry_t **iter, *entry;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+
+    for (iter = &entries; *iter;)
+    {
+        entry = *iter;
+        if (memcmp(entry->mac, mac, sizeof(mac_addr_t)))
+        {
+            iter = &entry->next;
+            continue;
+        }
+
+        if (entry->is_registered)
+            notify_unregister(entry);
+        *iter = entry->next;
+        free(entry);
+    }
+
+    /* Hand the freed slots over to polled characteristics. Ones that fail
+     * registering aren't tried again, so the loop ends */
+    while (slots_used < NOTIFY_SLOTS_MAX && (entry = notify_highest_polled()))
+    {
+        if (!notify_register(entry))
+        {
+            ESP_LOGI(TAG, "Registered for notifications of %s of %s",
+                uuidtoa(entry->characteristic), mactoa(entry->mac));
+        }
+    }
+
+    notify_metrics_update();
+    xSemaphoreGive(mutex);
+}
+
+static void notify_timer_cb(TimerHandle_t xTimer)
+{
+    notify_entry_t *entry;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+
+    for (entry = entries; entry; entry = entry->next)
+    {
+        if (!entry->is_registered && entry->is_readable)
+        {
+            ble_characteristic_read(entry->mac, entry->service,
+                entry->characteristic);
+        }
+    }
+
+    xSemaphoreGive(mutex);
+}
+
+int notify_initialize(uint32_t poll_interval)
+{
+    ESP_LOGD(TAG, "Initializing notification registrations, %u slots",
+        NOTIFY_SLOTS_MAX);
+
+    if (!(mutex = xSemaphoreCreateMutex()))
+        return -1;
+
+    notify_metrics_update();
+
+    if (!poll_interval)
+        return 0;
+
+    if (!(timer = xTimerCreate("notify", pdMS_TO_TICKS(poll_interval * 1000),
+        pdTRUE, NULL, notify_timer_cb)) || xTimerStart(timer, 0) != pdPASS)
+    {
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,21 @@
+#ifndef NOTIFY_H
+#define NOTIFY_H
+
+#include "ble_utils.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* Notification registrations. The BLE stack supports up to
+ * BTA_GATTC_NOTIF_REG_MAX registrations for all connected devices together.
+ * Once they're all used, a characteristic with a higher priority takes the
+ * slot of the lowest priority one and the other is read periodically instead.
+ * Slots freed by disconnected devices go to the highest priority polled
+ * characteristics */
+int notify_add(mac_addr_t mac, ble_uuid_t service, ble_uuid_t characteristic,
+    uint8_t is_readable, int priority);
+/* Releases all registrations of a device */
+void notify_remove(mac_addr_t mac);
+
+int notify_initialize(uint32_t poll_interval);
+
+#endif
@@ -187,7 +187,8 @@ static int download_callback(request_t *req, char *data, int len)
         return OTA_ERR_FAILED_WRITE;
     }
     ota_ctx.bytes_written += len;
-    ESP_LOGI(TAG, "Wrote %d bytes (total: %d)", len, ota_ctx.bytes_written);
+    ESP_LOGI(TAG, "Wrote %d bytes (total: %d)", (int)len,
+        (int)ota_ctx.bytes_written);
 
     return 0;
 }
@@ -212,7 +213,7 @@ static void ota_task(void *pvParameter)
     /* Start HTTP request */
     http_status = req_perform(req);
     ESP_LOGI(TAG, "HTTP request response: %d, read %d (%d) bytes", http_status,
-        req->buffer->bytes_total, ota_ctx.bytes_written);
+        req->buffer->bytes_total, (int)ota_ctx.bytes_written);
 
     /* Call ops->end() only if we actually downloaded something */
     if (http_status == 200 && ota_ctx.bytes_written > 0)
@@ -0,0 +1,312 @@
+#include "state.h"
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/timers.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "State";
+
+/* Types */
+typedef struct state_value_t {
+    struct state_value_t *next;
+    ble_uuid_t service;
+    ble_uuid_t characteristic;
+    /* Names are resolved when the value is added, as quoted JSON strings */
+    char *service_name;
+    char *name;
+    char *value;
+    size_t len;
+} state_value_t;
+
+typedef struct state_device_t {
+    struct state_device_t *next;
+    mac_addr_t mac;
+    state_value_t *values;
+    uint8_t is_dirty;
+} state_device_t;
+
+/* Internal state */
+static state_device_t *devices = NULL;
+static SemaphoreHandle_t mutex = NULL;
+static TimerHandle_t timer = NULL;
+
+/* Callback functions */
+static state_on_publish_cb_t on_publish_cb = NULL;
+
+void state_set_on_publish_cb(state_on_publish_cb_t cb)
+{
+    on_publish_cb = cb;
+}
+
+static state_device_t *state_device_get(mac_addr_t mac)
+{
+    state_device_t *device;
+
+    for (device = devices; device; device = device->next)
+    {
+        if (!memcmp(device->mac, mac, sizeof(mac_addr_t)))
+            return device;
+    }
+
+    if (!(device = calloc(1, sizeof(*device))))
+        return NULL;
+
+    memcpy(device->mac, mac, sizeof(mac_addr_t));
+    device->next = devices;
+    devices = device;
+
+    return device;
+}
+
+/* Returns the name as a quoted and escaped JSON string */
+static char *state_json_string(const char *name)
+{
+    static const char hex[] = "0123456789abcdef";
+    const uint8_t *s;
+    char *ret, *p;
+
+    /* Control characters take the most room, as \u00XX */
+    if (!(ret = malloc(strlen(name) * 6 + 3)))
+        return NULL;
+
+    p = ret;
+    *p++ = '"';
+    for (s = (const uint8_t *)name; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+        {
+            *p++ = '\\';
+            *p++ = *s;
+        }
+        else if (*s < 0x20)
+        {
+            memcpy(p, "\\u00", 4);
+            p[4] = hex[*s >> 4];
+            p[5] = hex[*s & 0x0F];
+            p += 6;
+        }
+        else
+            *p++ = *s;
+    }
+    *p++ = '"';
+    *p = '\0';
+
+    return ret;
+}
+
+static void state_value_free(state_value_t *value)
+{
+    free(value->service_name);
+    free(value->name);
+    free(value->value);
+    free(value);
+}
+
+/* Values are kept grouped by service, in the order they were first seen */
+static state_value_t *state_value_get(state_device_t *device,
+    ble_uuid_t service, ble_uuid_t characteristic)
+{
+    state_value_t **iter, **last = NULL, *value;
+
+    for (iter = &device->values; *iter; iter = &(*iter)->next)
+    {
+        if (memcmp((*iter)->service, service, sizeof(ble_uuid_t)))
+            continue;
+
+        if (!memcmp((*iter)->characteristic, characteristic,
+            sizeof(ble_uuid_t)))
+        {
+            return *iter;
+        }
+        last = &(*iter)->next;
+    }
+
+    if (!(value = calloc(1, sizeof(*value))))
+        return NULL;
+
+    /* The names are looked up here, on the BLE task, as the lookups aren't
+     * safe to use from the timer task */
+    if (!(value->service_name =
+        state_json_string(ble_service_name_get(service))) ||
+        !(value->name =
+        state_json_string(ble_characteristic_name_get(device->mac,
+        characteristic))))
+    {
+        state_value_free(value);
+        return NULL;
+    }
+
+    memcpy(value->service, service, sizeof(ble_uuid_t));
+    memcpy(value->characteristic, characteristic, sizeof(ble_uuid_t));
+    if (!last)
+        last = iter;
+    value->next = *last;
+    *last = value;
+
+    return value;
+}
+
+static void state_device_free(state_device_t *device)
+{
+    state_value_t *value;
+
+    while ((value = device->values))
+    {
+        device->values = value->next;
+        state_value_free(value);
+    }
+    free(device);
+}
+
+static char *state_append(char *p, const char *s)
+{
+    size_t len = strlen(s);
+
+    memcpy(p, s, len);
+    return p + len;
+}
+
+static void state_publish(state_device_t *device)
+{
+    state_value_t *value, *prev = NULL;
+    size_t size = 3;
+    char *doc, *p;
+
+    /* Colons, braces and commas around each name and value */
+    for (value = device->values; value; value = value->next)
+    {
+        size += strlen(value->service_name) + strlen(value->name) +
+            value->len + 5;
+    }
+
+    if (!(doc = malloc(size)))
+    {
+        ESP_LOGE(TAG, "Failed allocating state document");
+        return;
+    }
+
+    p = doc;
+    *p++ = '{';
+    for (value = device->values; value; prev = value, value = value->next)
+    {
+        if (!prev || memcmp(prev->service, value->service, sizeof(ble_uuid_t)))
+        {
+            if (prev)
+            {
+                *p++ = '}';
+                *p++ = ',';
+            }
+            p = state_append(p, value->service_name);
+            *p++ = ':';
+            *p++ = '{';
+        }
+        else
+            *p++ = ',';
+
+        p = state_append(p, value->name);
+        *p++ = ':';
+        memcpy(p, value->value, value->len);
+        p += value->len;
+    }
+    if (prev)
+        *p++ = '}';
+    *p++ = '}';
+
+    device->is_dirty = 0;
+    if (on_publish_cb)
+        on_publish_cb(device->mac, doc, p - doc);
+    free(doc);
+}
+
+static void state_timer_cb(TimerHandle_t xTimer)
+{
+    state_device_t *device;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    for (device = devices; device; device = device->next)
+    {
+        if (device->is_dirty)
+            state_publish(device);
+    }
+    xSemaphoreGive(mutex);
+}
+
+int state_update(mac_addr_t mac, ble_uuid_t service,
+    ble_uuid_t characteristic, const char *value, size_t len)
+{
+    state_device_t *device;
+    state_value_t *entry;
+    int ret = -1;
+
+    if (!mutex)
+        return -1;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+
+    if (!(device = state_device_get(mac)) ||
+        !(entry = state_value_get(device, service, characteristic)))
+    {
+        goto out;
+    }
+
+    if (entry->len != len)
+    {
+        char *tmp = realloc(entry->value, len);
+
+        if (!tmp)
+            goto out;
+        entry->value = tmp;
+        entry->len = len;
+    }
+    memcpy(entry->value, value, len);
+    device->is_dirty = 1;
+
+    /* The debounce window starts with the first pending update, later ones
+     * don't postpone the publication */
+    if (!xTimerIsTimerActive(timer))
+        xTimerStart(timer, 0);
+    ret = 0;
+
+out:
+    xSemaphoreGive(mutex);
+    return ret;
+}
+
+void state_remove(mac_addr_t mac)
+{
+    state_device_t **cur, *device;
+
+    if (!mutex)
+        return;
+
+    xSemaphoreTake(mutex, portMAX_DELAY);
+    for (cur = &devices; *cur; cur = &(*cur)->next)
+    {
+        if (memcmp((*cur)->mac, mac, sizeof(mac_addr_t)))
+            continue;
+
+        device = *cur;
+        *cur = device->next;
+        state_device_free(device);
+        break;
+    }
+    xSemaphoreGive(mutex);
+}
+
+int state_initialize(uint32_t debounce_ms)
+{
+    ESP_LOGD(TAG, "Initializing device state, debounce: %ums", debounce_ms);
+
+    if (!(mutex = xSemaphoreCreateMutex()))
+        return -1;
+
+    if (!(timer = xTimerCreate("state", pdMS_TO_TICKS(debounce_ms ? : 1),
+        pdFALSE, NULL, state_timer_cb)))
+    {
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,26 @@
+#ifndef STATE_H
+#define STATE_H
+
+#include "ble_utils.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* Event callback types */
+typedef void (*state_on_publish_cb_t)(mac_addr_t mac, const char *json,
+    size_t len);
+
+/* Callback registration */
+void state_set_on_publish_cb(state_on_publish_cb_t cb);
+
+/* Aggregated device state. The latest value of each characteristic, as a JSON
+ * value, is kept per device. Updates are collected for the debounce interval,
+ * starting with the first one since the previous publication, after which
+ * the whole document is published:
+ * {"<service>":{"<characteristic>":<value>,...},...} */
+int state_update(mac_addr_t mac, ble_uuid_t service,
+    ble_uuid_t characteristic, const char *value, size_t len);
+void state_remove(mac_addr_t mac);
+
+int state_initialize(uint32_t debounce_ms);
+
+#endif
@@ -0,0 +1,171 @@
+#include "trace.h"
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Constants */
+#define TRACE_CHUNK_SIZE 768
+
+static const char *TAG = "Trace";
+
+static const char *stage_names[TRACE_STAGE_MAX] = {
+    [TRACE_STAGE_BLE_NOTIFY] = "ble_notify",
+    [TRACE_STAGE_BLE_READ] = "ble_read",
+    [TRACE_STAGE_DECODE] = "decode",
+    [TRACE_STAGE_TOPIC] = "topic",
+    [TRACE_STAGE_PUBLISH] = "publish",
+};
+
+/* Types */
+typedef struct {
+    int64_t ts;
+    uint32_t dur;
+    uint16_t id;
+    uint8_t stage;
+} trace_event_t;
+
+/* Internal state */
+static portMUX_TYPE trace_mux = portMUX_INITIALIZER_UNLOCKED;
+static trace_event_t *events = NULL;
+static size_t events_size = 0;
+static size_t events_head = 0;
+static size_t events_count = 0;
+static uint16_t current_id = 0;
+static TaskHandle_t current_task = NULL;
+
+static void trace_add(trace_stage_t stage, int64_t ts, uint32_t dur)
+{
+    trace_event_t *event;
+
+    portENTER_CRITICAL(&trace_mux);
+    event = &events[events_head];
+    event->ts = ts;
+    event->dur = dur;
+    event->id = current_id;
+    event->stage = stage;
+    events_head = (events_head + 1) % events_size;
+    if (events_count < events_size)
+        events_count++;
+    portEXIT_CRITICAL(&trace_mux);
+}
+
+void trace_begin(trace_stage_t stage)
+{
+    if (!events)
+        return;
+
+    /* ID 0 is reserved for "no active trace" */
+    if (!++current_id)
+        current_id++;
+    current_task = xTaskGetCurrentTaskHandle();
+    trace_add(stage, esp_timer_get_time(), 0);
+}
+
+void trace_end(void)
+{
+    current_task = NULL;
+}
+
+int64_t trace_now(void)
+{
+    /* Only time stages of the task that started the trace */
+    if (!current_task || current_task != xTaskGetCurrentTaskHandle())
+        return 0;
+
+    return esp_timer_get_time();
+}
+
+void trace_record(trace_stage_t stage, int64_t start)
+{
+    if (!start)
+        return;
+
+    trace_add(stage, start, esp_timer_get_time() - start);
+}
+
+static int trace_event_to_json(char *buf, size_t len, trace_event_t *event)
+{
+    /* The BLE events are instant events, the rest are complete events */
+    if (event->stage == TRACE_STAGE_BLE_NOTIFY ||
+        event->stage == TRACE_STAGE_BLE_READ)
+    {
+        return snprintf(buf, len, "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"t\","
+            "\"ts\":%lld,\"pid\":1,\"tid\":1,\"args\":{\"id\":%u}}",
+            stage_names[event->stage], (long long)event->ts, event->id);
+    }
+
+    return snprintf(buf, len, "{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%lld,"
+        "\"dur\":%u,\"pid\":1,\"tid\":1,\"args\":{\"id\":%u}}",
+        stage_names[event->stage], (long long)event->ts, event->dur,
+        event->id);
+}
+
+int trace_dump(trace_on_dump_chunk_cb_t cb)
+{
+    trace_event_t *snapshot;
+    size_t i, count, first;
+    char chunk[TRACE_CHUNK_SIZE], event[160];
+    int len = 0, event_len;
+
+    if (!events)
+        return -1;
+
+    if (!(snapshot = malloc(sizeof(*snapshot) * events_size)))
+        return -1;
+
+    /* Copy the ring buffer so we don't block writers while formatting */
+    portENTER_CRITICAL(&trace_mux);
+    count = events_count;
+    first = (events_head + events_size - count) % events_size;
+    for (i = 0; i < count; i++)
+        snapshot[i] = events[(first + i) % events_size];
+    portEXIT_CRITICAL(&trace_mux);
+
+    ESP_LOGD(TAG, "Dumping %u trace events", (unsigned)count);
+
+    /* Each chunk is a complete JSON array so it can be loaded on its own or
+     * concatenated with the rest of the chunks */
+    for (i = 0; i < count; i++)
+    {
+        event_len = trace_event_to_json(event, sizeof(event), &snapshot[i]);
+
+        if (len && len + event_len + 2 > sizeof(chunk))
+        {
+            chunk[len++] = ']';
+            cb(chunk, len);
+            len = 0;
+        }
+
+        chunk[len] = len ? ',' : '[';
+        len++;
+        memcpy(chunk + len, event, event_len);
+        len += event_len;
+    }
+
+    if (len)
+    {
+        chunk[len++] = ']';
+        cb(chunk, len);
+    }
+
+    free(snapshot);
+    return 0;
+}
+
+int trace_initialize(size_t size)
+{
+    ESP_LOGD(TAG, "Initializing tracing with %u events", (unsigned)size);
+
+    if (!size)
+        return 0;
+
+    if (!(events = calloc(size, sizeof(*events))))
+        return -1;
+
+    events_size = size;
+    return 0;
+}
@@ -0,0 +1,33 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Types */
+typedef enum {
+    TRACE_STAGE_BLE_NOTIFY,
+    TRACE_STAGE_BLE_READ,
+    TRACE_STAGE_DECODE,
+    TRACE_STAGE_TOPIC,
+    TRACE_STAGE_PUBLISH,
+    TRACE_STAGE_MAX,
+} trace_stage_t;
+
+/* Event callback types */
+typedef void (*trace_on_dump_chunk_cb_t)(const char *json, size_t len);
+
+/* Tracing a value through the pipeline. A trace is started when a value is
+ * received from the BLE stack and ended once it was handled. Stages recorded
+ * in between, from the same task, are attributed to it */
+void trace_begin(trace_stage_t stage);
+void trace_end(void);
+int64_t trace_now(void);
+void trace_record(trace_stage_t stage, int64_t start);
+
+/* Dump the trace buffer as Chrome trace-event JSON arrays, split to chunks */
+int trace_dump(trace_on_dump_chunk_cb_t cb);
+
+int trace_initialize(size_t size);
+
+#endif
@@ -0,0 +1,406 @@
+#include "transform.h"
+#include <ctype.h>
+#include <esp_log.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Constants */
+#define TRANSFORM_CODE_MAX 64
+#define TRANSFORM_CONSTS_MAX 16
+#define TRANSFORM_STACK_MAX 16
+
+static const char *TAG = "Transform";
+
+/* Types */
+typedef enum {
+    OP_CONST, /* Followed by the constant's index */
+    OP_VALUE,
+    OP_BYTE, /* Followed by the byte's index */
+    OP_NEG,
+    OP_NOT,
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_MOD,
+    OP_AND,
+    OP_OR,
+    OP_XOR,
+    OP_SHL,
+    OP_SHR,
+} transform_op_t;
+
+struct transform_t {
+    struct transform_t *next;
+    ble_uuid_t uuid;
+    size_t field;
+    uint8_t code_len;
+    uint8_t code[TRANSFORM_CODE_MAX];
+    double consts[TRANSFORM_CONSTS_MAX];
+};
+
+typedef struct {
+    const char *s;
+    transform_t *transform;
+    uint8_t consts_count;
+    uint8_t depth;
+    /* Offsets of the emitted instructions, for constant folding */
+    uint8_t ops[TRANSFORM_CODE_MAX];
+    uint8_t ops_count;
+} transform_compiler_t;
+
+/* Internal state */
+static transform_t *transforms = NULL;
+
+static int compile_expression(transform_compiler_t *c, int precedence);
+
+static int emit(transform_compiler_t *c, uint8_t byte)
+{
+    if (c->transform->code_len == TRANSFORM_CODE_MAX)
+        return -1;
+
+    c->transform->code[c->transform->code_len++] = byte;
+    return 0;
+}
+
+static int emit_instruction(transform_compiler_t *c, uint8_t op)
+{
+    if (c->ops_count == TRANSFORM_CODE_MAX)
+        return -1;
+
+    c->ops[c->ops_count++] = c->transform->code_len;
+    return emit(c, op);
+}
+
+/* Returns the constant pushed by the instruction n places from the end */
+static int last_const(transform_compiler_t *c, int n, double *value)
+{
+    uint8_t *code;
+
+    if (c->ops_count < n)
+        return 0;
+
+    code = c->transform->code + c->ops[c->ops_count - n];
+    if (*code != OP_CONST)
+        return 0;
+
+    *value = c->transform->consts[code[1]];
+    return 1;
+}
+
+/* Drops unreferenced constants from the end of the pool */
+static void consts_trim(transform_compiler_t *c)
+{
+    uint8_t *code = c->transform->code;
+    int i;
+
+    while (c->consts_count)
+    {
+        for (i = 0; i < c->ops_count; i++)
+        {
+            if (code[c->ops[i]] == OP_CONST &&
+                code[c->ops[i] + 1] == c->consts_count - 1)
+            {
+                return;
+            }
+        }
+        c->consts_count--;
+    }
+}
+
+static int emit_push(transform_compiler_t *c, uint8_t op, uint8_t arg)
+{
+    /* Stack usage is checked here so evaluation doesn't need to */
+    if (++c->depth > TRANSFORM_STACK_MAX || emit_instruction(c, op))
+        return -1;
+
+    return op == OP_VALUE ? 0 : emit(c, arg);
+}
+
+static int emit_const(transform_compiler_t *c, double value)
+{
+    uint8_t i;
+
+    /* Reuse identical constants */
+    for (i = 0; i < c->consts_count; i++)
+    {
+        if (c->transform->consts[i] == value)
+            break;
+    }
+
+    if (i == c->consts_count)
+    {
+        if (c->consts_count == TRANSFORM_CONSTS_MAX)
+            return -1;
+        c->transform->consts[c->consts_count++] = value;
+    }
+
+    return emit_push(c, OP_CONST, i);
+}
+
+/* Bitwise operators work on integers, out of range values are taken as 0 */
+static int64_t to_int(double d)
+{
+    return d > -9.2e18 && d < 9.2e18 ? (int64_t)d : 0;
+}
+
+static double apply_op(uint8_t op, double a, double b)
+{
+    switch (op)
+    {
+    case OP_NEG: return -a;
+    case OP_NOT: return ~to_int(a);
+    case OP_ADD: return a + b;
+    case OP_SUB: return a - b;
+    case OP_MUL: return a * b;
+    case OP_DIV: return a / b;
+    case OP_MOD: return fmod(a, b);
+    case OP_AND: return to_int(a) & to_int(b);
+    case OP_OR: return to_int(a) | to_int(b);
+    case OP_XOR: return to_int(a) ^ to_int(b);
+    case OP_SHL:
+        return (int64_t)((uint64_t)to_int(a) << (to_int(b) & 63));
+    case OP_SHR: return to_int(a) >> (to_int(b) & 63);
+    }
+
+    return NAN;
+}
+
+/* Emits an operator, folding it if all of its operands are constants */
+static int emit_op(transform_compiler_t *c, uint8_t op, int operands)
+{
+    double a = 0, b = 0;
+
+    if ((operands == 1 && last_const(c, 1, &a)) ||
+        (operands == 2 && last_const(c, 2, &a) && last_const(c, 1, &b)))
+    {
+        /* Replace the operands with the result, which is pushed back */
+        c->ops_count -= operands;
+        c->transform->code_len = c->ops[c->ops_count];
+        c->depth -= operands;
+        consts_trim(c);
+        return emit_const(c, apply_op(op, a, b));
+    }
+
+    c->depth -= operands - 1;
+    return emit_instruction(c, op);
+}
+
+static void skip_spaces(transform_compiler_t *c)
+{
+    while (isspace((unsigned char)*c->s))
+        c->s++;
+}
+
+static int compile_primary(transform_compiler_t *c)
+{
+    char *end;
+    double d;
+
+    skip_spaces(c);
+
+    if (*c->s == '(')
+    {
+        c->s++;
+        if (compile_expression(c, 0))
+            return -1;
+        skip_spaces(c);
+        return *c->s == ')' ? (c->s++, 0) : -1;
+    }
+
+    if (*c->s == '-' || *c->s == '~' || *c->s == '+')
+    {
+        char op = *c->s++;
+
+        if (compile_primary(c))
+            return -1;
+        if (op == '+')
+            return 0;
+        return emit_op(c, op == '-' ? OP_NEG : OP_NOT, 1);
+    }
+
+    if (!strncmp(c->s, "value", 5) && !isalnum((unsigned char)c->s[5]))
+    {
+        c->s += 5;
+        return emit_push(c, OP_VALUE, 0);
+    }
+
+    if (!strncmp(c->s, "data", 4))
+    {
+        long i;
+
+        c->s += 4;
+        skip_spaces(c);
+        if (*c->s != '[')
+            return -1;
+        c->s++;
+        i = strtol(c->s, &end, 0);
+        if (end == c->s || i < 0 || i > UINT8_MAX)
+            return -1;
+        c->s = end;
+        skip_spaces(c);
+        if (*c->s != ']')
+            return -1;
+        c->s++;
+        return emit_push(c, OP_BYTE, i);
+    }
+
+    /* Hexadecimal integers or decimal numbers */
+    if (c->s[0] == '0' && (c->s[1] == 'x' || c->s[1] == 'X'))
+        d = strtoll(c->s, &end, 16);
+    else
+        d = strtod(c->s, &end);
+    if (end == c->s)
+        return -1;
+    c->s = end;
+
+    return emit_const(c, d);
+}
+
+/* Binary operators and their precedence, higher binds tighter */
+static const struct {
+    const char *s;
+    uint8_t op;
+    uint8_t precedence;
+} binary_ops[] = {
+    { "<<", OP_SHL, 4 },
+    { ">>", OP_SHR, 4 },
+    { "|", OP_OR, 1 },
+    { "^", OP_XOR, 2 },
+    { "&", OP_AND, 3 },
+    { "+", OP_ADD, 5 },
+    { "-", OP_SUB, 5 },
+    { "*", OP_MUL, 6 },
+    { "/", OP_DIV, 6 },
+    { "%", OP_MOD, 6 },
+    { NULL }
+};
+
+/* Precedence climbing, all binary operators are left associative */
+static int compile_expression(transform_compiler_t *c, int precedence)
+{
+    int i;
+
+    if (compile_primary(c))
+        return -1;
+
+    while (1)
+    {
+        skip_spaces(c);
+        for (i = 0; binary_ops[i].s; i++)
+        {
+            if (!strncmp(c->s, binary_ops[i].s, strlen(binary_ops[i].s)))
+                break;
+        }
+
+        if (!binary_ops[i].s || binary_ops[i].precedence <= precedence)
+            return 0;
+
+        c->s += strlen(binary_ops[i].s);
+        if (compile_expression(c, binary_ops[i].precedence) ||
+            emit_op(c, binary_ops[i].op, 2))
+        {
+            return -1;
+        }
+    }
+}
+
+int transform_add(ble_uuid_t uuid, size_t field, const char *expression)
+{
+    transform_t *t = calloc(1, sizeof(*t)), **iter;
+    transform_compiler_t c = { .s = expression, .transform = t };
+
+    if (!t)
+        return -1;
+
+    if (compile_expression(&c, 0) || (skip_spaces(&c), *c.s))
+    {
+        ESP_LOGE(TAG, "Failed compiling \"%s\" at offset %u", expression,
+            (unsigned)(c.s - expression));
+        free(t);
+        return -1;
+    }
+
+    ESP_LOGD(TAG, "Compiled \"%s\" to %u bytes, %u constants", expression,
+        t->code_len, c.consts_count);
+
+    memcpy(t->uuid, uuid, sizeof(ble_uuid_t));
+    t->field = field;
+
+    /* Transforms of the same characteristic are kept together */
+    for (iter = &transforms; *iter; iter = &(*iter)->next)
+    {
+        if (!memcmp((*iter)->uuid, uuid, sizeof(ble_uuid_t)))
+            break;
+    }
+    t->next = *iter;
+    *iter = t;
+
+    return 0;
+}
+
+const transform_t *transform_find(ble_uuid_t uuid)
+{
+    transform_t *t;
+
+    for (t = transforms; t; t = t->next)
+    {
+        if (!memcmp(t->uuid, uuid, sizeof(ble_uuid_t)))
+            return t;
+    }
+
+    return NULL;
+}
+
+const transform_t *transform_get(const transform_t *list, size_t field)
+{
+    const transform_t *t;
+
+    for (t = list; t && !memcmp(t->uuid, list->uuid, sizeof(ble_uuid_t));
+        t = t->next)
+    {
+        if (t->field == field)
+            return t;
+    }
+
+    return NULL;
+}
+
+double transform_apply(const transform_t *transform, double value,
+    const uint8_t *data, size_t len)
+{
+    double stack[TRANSFORM_STACK_MAX], *sp = stack;
+    const uint8_t *pc = transform->code;
+    const uint8_t *end = pc + transform->code_len;
+
+    while (pc < end)
+    {
+        uint8_t op = *pc++;
+
+        switch (op)
+        {
+        case OP_CONST:
+            *sp++ = transform->consts[*pc++];
+            break;
+        case OP_VALUE:
+            *sp++ = value;
+            break;
+        case OP_BYTE:
+            /* Bytes beyond the value read as NaN */
+            *sp++ = *pc < len ? data[*pc] : NAN;
+            pc++;
+            break;
+        case OP_NEG:
+        case OP_NOT:
+            sp[-1] = apply_op(op, sp[-1], 0);
+            break;
+        default:
+            sp--;
+            sp[-1] = apply_op(op, sp[-1], sp[0]);
+            break;
+        }
+    }
+
+    return stack[0];
+}
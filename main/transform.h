@@ -0,0 +1,24 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "ble_utils.h"
+#include <stddef.h>
+#include <stdint.h>
+
+/* Types */
+typedef struct transform_t transform_t;
+
+/* Value transforms, e.g. "value * 0.01 - 40" or "(data[1] >> 4) & 0x0F".
+ * Expressions are made of numbers, the field's value, the characteristic
+ * value's raw bytes (data[n]), parentheses and the C arithmetic (+ - * / %)
+ * and bitwise (& | ^ ~ << >>) operators with the same precedence. They are
+ * compiled once to bytecode for a small stack machine */
+int transform_add(ble_uuid_t uuid, size_t field, const char *expression);
+/* Returns the transforms of a characteristic, or NULL if it has none */
+const transform_t *transform_find(ble_uuid_t uuid);
+/* Returns the field's transform from the list returned by transform_find() */
+const transform_t *transform_get(const transform_t *list, size_t field);
+double transform_apply(const transform_t *transform, double value,
+    const uint8_t *data, size_t len);
+
+#endif
@@ -1,4 +1,5 @@
 #include "wifi.h"
+#include "metrics.h"
 #include <esp_err.h>
 #include <esp_event_loop.h>
 #include <esp_log.h>
@@ -61,6 +62,7 @@ static esp_err_t event_handler(void *ctx, system_event_t *event)
         break;
     case SYSTEM_EVENT_STA_DISCONNECTED:
         ESP_LOGI(TAG, "Disconnected");
+        metrics_counter_inc(METRICS_COUNTER_WIFI_RECONNECTS);
         if (on_disconnected_cb)
             on_disconnected_cb();
         /* This is a workaround as ESP32 WiFi libs don't currently
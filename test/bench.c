@@ -0,0 +1,376 @@
+#include <ble_utils.h>
+#include <config.h>
+#include <format.h>
+#include <transform.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Benchmarks of the firmware kernels on the host, against the code they
+ * replaced. Timings only compare implementations, the ESP32 is much slower,
+ * especially with floating point math done in software */
+
+/* Constants */
+#define VALUES_COUNT 4096
+
+/* Internal state */
+static uint64_t random_state = 0x2545F4914F6CDD1DULL;
+static volatile size_t sink;
+static mac_addr_t mac = { 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0x01 };
+
+/* Helpers */
+static uint64_t random64(void)
+{
+    /* xorshift64 */
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Runs body over all values, enough times for a stable time per value */
+#define BENCH(ns, rounds, body) do { \
+    double __start = now_ns(); \
+    int __round; \
+    size_t i; \
+    for (__round = 0; __round < (rounds); __round++) \
+    { \
+        for (i = 0; i < VALUES_COUNT; i++) \
+        { \
+            body; \
+        } \
+    } \
+    ns = (now_ns() - __start) / ((double)(rounds) * VALUES_COUNT); \
+} while (0)
+
+static void bench_header(const char *title)
+{
+    printf("\n%-32s %13s %13s %9s\n", title, "Before", "After", "Speedup");
+}
+
+static void bench_report(const char *name, double before, double after)
+{
+    printf("%-32s %10.1f ns %10.1f ns %8.1fx\n", name, before, after,
+        before / after);
+}
+
+/* The formatting replaced by the kernels */
+static char *old_format_uint32(char *p, uint32_t value)
+{
+    char tmp[10], *t = tmp + sizeof(tmp);
+
+    do
+    {
+        *--t = '0' + value % 10;
+        value /= 10;
+    } while (value);
+
+    memcpy(p, t, tmp + sizeof(tmp) - t);
+    return p + (tmp + sizeof(tmp) - t);
+}
+
+static char *old_format_sfloat(char *p, uint16_t value)
+{
+    int16_t mantissa = (int16_t)(value << 4) >> 4;
+    int8_t exponent = (int16_t)value >> 12;
+
+    return p + sprintf(p, "%f", mantissa * pow(10.0f, exponent));
+}
+
+static char *old_format_float(char *p, uint32_t value)
+{
+    int32_t mantissa = (int32_t)(value << 8) >> 8;
+    int8_t exponent = value >> 24;
+
+    return p + sprintf(p, "%f", mantissa * pow(10.0f, exponent));
+}
+
+static char *old_format_float64(char *p, const uint8_t *value)
+{
+    double d;
+
+    memcpy(&d, value, sizeof(d));
+    return p + sprintf(p, "%.17g", d);
+}
+
+/* The /Set parsing replaced by atochar(), for the uint16 and uint8 fields of
+ * Date Time. The types were looked up in the configuration first */
+static int old_atochar(ble_uuid_t uuid, const char *data, size_t len,
+    uint8_t *buf)
+{
+    static const uint8_t sizes[] = { 2, 1, 1, 1, 1, 1 };
+    uint8_t *p = buf;
+    char *str = strdup(data);
+    char *val = strtok(str, ",");
+    char s[37];
+    size_t i;
+
+    sprintf(s,
+        "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+        uuid[15], uuid[14], uuid[13], uuid[12], uuid[11], uuid[10], uuid[9],
+        uuid[8], uuid[7], uuid[6], uuid[5], uuid[4], uuid[3], uuid[2], uuid[1],
+        uuid[0]);
+    sink += !config_ble_characteristic_types_get(s);
+
+    for (i = 0; i < sizeof(sizes) && val; i++)
+    {
+        uint32_t tmp = strtoul(val, NULL, 10);
+
+        *p++ = tmp & 0xFF;
+        if (sizes[i] == 2)
+            *p++ = (tmp >> 8) & 0xFF;
+        val = strtok(NULL, ",");
+    }
+
+    free(str);
+    return p - buf;
+}
+
+/* The fallback for characteristics without type definitions, replaced by the
+ * passthrough payload modes */
+static char *old_chartoa(const uint8_t *data, size_t len)
+{
+    static char buf[2048];
+    char *p = buf;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+        p += sprintf(p, "%u,", data[i]);
+    *(p - 1) = '\0';
+
+    return buf;
+}
+
+/* Benchmarks */
+static void bench_format(void)
+{
+    static uint32_t integers[VALUES_COUNT];
+    static uint16_t sfloats[VALUES_COUNT];
+    static uint32_t floats[VALUES_COUNT];
+    static double doubles[VALUES_COUNT];
+    char buf[512];
+    double before, after;
+    size_t j;
+
+    for (j = 0; j < VALUES_COUNT; j++)
+    {
+        /* Sensor-like values, with a few digits and a small exponent */
+        integers[j] = random64() >> (32 + j % 32);
+        sfloats[j] = (random64() & 0x0FFF) | (0xE + j % 3) << 12;
+        floats[j] = (random64() & 0xFFFFFF) | (uint32_t)(0xFE + j % 3) << 24;
+        doubles[j] = (double)(random64() % 100000) / 100;
+    }
+
+    bench_header("Formatting");
+    BENCH(before, 200, sink += old_format_uint32(buf, integers[i]) - buf);
+    BENCH(after, 200, sink += format_uint32(buf, integers[i]) - buf);
+    bench_report("uint32", before, after);
+    BENCH(before, 20, sink += sprintf(buf, "%u", integers[i]));
+    bench_report("uint32 (sprintf)", before, after);
+    BENCH(before, 20, sink += old_format_sfloat(buf, sfloats[i]) - buf);
+    BENCH(after, 200, sink += format_sfloat(buf, sfloats[i]) - buf);
+    bench_report("sfloat", before, after);
+    BENCH(before, 20, sink += old_format_float(buf, floats[i]) - buf);
+    BENCH(after, 200, sink += format_float(buf, floats[i]) - buf);
+    bench_report("float", before, after);
+    BENCH(before, 20, sink += old_format_float64(buf,
+        (uint8_t *)&doubles[i]) - buf);
+    BENCH(after, 20, sink += format_float64(buf, (uint8_t *)&doubles[i]) -
+        buf);
+    bench_report("float64 (vs %.17g)", before, after);
+}
+
+static void bench_set(void)
+{
+    static char payloads[VALUES_COUNT][32];
+    static size_t lens[VALUES_COUNT];
+    ble_uuid_t date_time;
+    uint8_t buf[16];
+    double before, after;
+    size_t j;
+
+    atouuid("00002a08-0000-1000-8000-00805f9b34fb", date_time);
+    for (j = 0; j < VALUES_COUNT; j++)
+    {
+        lens[j] = sprintf(payloads[j], "%u,%u,%u,%u,%u,%u",
+            (unsigned)(2000 + random64() % 100),
+            (unsigned)(random64() % 12 + 1), (unsigned)(random64() % 28 + 1),
+            (unsigned)(random64() % 24),
+            (unsigned)(random64() % 60), (unsigned)(random64() % 60));
+    }
+
+    bench_header("Parsing /Set");
+    BENCH(before, 50, sink += old_atochar(date_time, payloads[i], lens[i],
+        buf));
+    BENCH(after, 50, sink += atochar(mac, date_time,
+        BLE_PAYLOAD_FORMAT_TEXT, payloads[i], lens[i], buf, sizeof(buf),
+        NULL));
+    bench_report("Date Time (text)", before, after);
+}
+
+static void bench_passthrough(void)
+{
+    static const struct {
+        const char *name;
+        ble_payload_format_t format;
+    } formats[] = {
+        { "text", BLE_PAYLOAD_FORMAT_TEXT },
+        { "hex", BLE_PAYLOAD_FORMAT_HEX },
+        { "base64", BLE_PAYLOAD_FORMAT_BASE64 },
+        { "raw", BLE_PAYLOAD_FORMAT_RAW },
+    };
+    static uint8_t values[VALUES_COUNT][20];
+    ble_uuid_t vendor;
+    char name[32];
+    size_t j, len;
+    double before, after;
+
+    atouuid("12345678-1234-1234-1234-123456789abc", vendor);
+    for (j = 0; j < VALUES_COUNT; j++)
+    {
+        for (len = 0; len < sizeof(values[j]); len++)
+            values[j][len] = random64();
+    }
+
+    /* The payload size of each mode is given for the first value */
+    bench_header("20 byte values");
+    BENCH(before, 50, sink += strlen(old_chartoa(values[i],
+        sizeof(values[i]))));
+    sprintf(name, "%%u list, %zu bytes",
+        strlen(old_chartoa(values[0], sizeof(values[0]))));
+    printf("%-32s %10.1f ns\n", name, before);
+    for (j = 0; j < sizeof(formats) / sizeof(formats[0]); j++)
+    {
+        BENCH(after, 50, sink += !chartoa(mac, vendor, formats[j].format,
+            values[i], sizeof(values[i]), NULL));
+        chartoa(mac, vendor, formats[j].format, values[0], sizeof(values[0]),
+            &len);
+        sprintf(name, "%s, %zu bytes", formats[j].name, len);
+        bench_report(name, before, after);
+    }
+}
+
+static void bench_cbor(void)
+{
+    static const struct {
+        const char *name;
+        const char *uuid;
+        size_t len;
+    } characteristics[] = {
+        { "Temperature", "00002a6e-0000-1000-8000-00805f9b34fb", 2 },
+        { "Date Time", "00002a08-0000-1000-8000-00805f9b34fb", 7 },
+        { "Magnetic Flux Density", "00002aa1-0000-1000-8000-00805f9b34fb", 6 },
+    };
+    static uint8_t values[VALUES_COUNT][16];
+    ble_uuid_t uuid;
+    char name[48];
+    size_t j, k, json_len, cbor_len;
+    double before, after;
+
+    for (j = 0; j < VALUES_COUNT; j++)
+    {
+        for (k = 0; k < sizeof(values[j]); k++)
+            values[j][k] = random64();
+    }
+
+    /* CBOR against JSON, the other format that carries the field names. The
+     * payload sizes are given for the first value */
+    bench_header("JSON to CBOR");
+    for (j = 0; j < sizeof(characteristics) / sizeof(characteristics[0]); j++)
+    {
+        atouuid(characteristics[j].uuid, uuid);
+        BENCH(before, 50, sink += !chartoa(mac, uuid, BLE_PAYLOAD_FORMAT_JSON,
+            values[i], characteristics[j].len, NULL));
+        BENCH(after, 50, sink += !chartoa(mac, uuid, BLE_PAYLOAD_FORMAT_CBOR,
+            values[i], characteristics[j].len, NULL));
+        chartoa(mac, uuid, BLE_PAYLOAD_FORMAT_JSON, values[0],
+            characteristics[j].len, &json_len);
+        chartoa(mac, uuid, BLE_PAYLOAD_FORMAT_CBOR, values[0],
+            characteristics[j].len, &cbor_len);
+        sprintf(name, "%s, %zu/%zu bytes", characteristics[j].name, json_len,
+            cbor_len);
+        bench_report(name, before, after);
+    }
+}
+
+/* The transform expressions, written in C */
+static double native_scale(double value, const uint8_t *data)
+{
+    return value * 0.01 - 40;
+}
+
+static double native_bits(double value, const uint8_t *data)
+{
+    return (data[1] >> 4) & 0x0F;
+}
+
+static double native_le16(double value, const uint8_t *data)
+{
+    return ((data[1] << 8) | data[0]) * 0.01;
+}
+
+static void bench_transform(void)
+{
+    static const struct {
+        const char *expression;
+        double (*native)(double value, const uint8_t *data);
+    } expressions[] = {
+        { "value * 0.01 - 40", native_scale },
+        { "(data[1] >> 4) & 0x0F", native_bits },
+        { "((data[1] << 8) | data[0]) * 0.01", native_le16 },
+    };
+    static uint8_t values[VALUES_COUNT][2];
+    const transform_t *transform;
+    ble_uuid_t temperature;
+    size_t j;
+    double native, bytecode, before, after;
+
+    atouuid("00002a6e-0000-1000-8000-00805f9b34fb", temperature);
+    for (j = 0; j < VALUES_COUNT; j++)
+    {
+        values[j][0] = random64();
+        values[j][1] = random64();
+    }
+
+    BENCH(before, 50, sink += !chartoa(mac, temperature,
+        BLE_PAYLOAD_FORMAT_JSON, values[i], sizeof(values[i]), NULL));
+
+    /* Transforms on their own, against the same expressions in C */
+    printf("\n%-32s %13s %13s\n", "Transforms", "C", "Bytecode");
+    for (j = 0; j < sizeof(expressions) / sizeof(expressions[0]); j++)
+    {
+        transform_add(temperature, 0, expressions[j].expression);
+        transform = transform_get(transform_find(temperature), 0);
+        BENCH(native, 200, sink += expressions[j].native(i, values[i]));
+        BENCH(bytecode, 200, sink += transform_apply(transform, i, values[i],
+            sizeof(values[i])));
+        printf("%-32s %10.1f ns %10.1f ns\n", expressions[j].expression,
+            native, bytecode);
+    }
+
+    /* And when publishing a value, with the last expression */
+    BENCH(after, 50, sink += !chartoa(mac, temperature,
+        BLE_PAYLOAD_FORMAT_JSON, values[i], sizeof(values[i]), NULL));
+    printf("%-32s %10.1f ns %10.1f ns\n", "Temperature (JSON)", before, after);
+}
+
+int main(void)
+{
+    bench_format();
+    bench_set();
+    bench_passthrough();
+    bench_cbor();
+    bench_transform();
+
+    return 0;
+}
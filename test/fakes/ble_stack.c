@@ -0,0 +1,1228 @@
+#define _GNU_SOURCE
+#include "fake_ble.h"
+#include "fakes.h"
+#include <esp_bt.h>
+#include <esp_bt_main.h>
+#include <esp_gatt_common_api.h>
+#include <freertos/timers.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Constants */
+#define FAKE_GATTC_IF 3
+#define FAKE_MTU 200
+#define FAKE_ATTRIBUTES_MAX 32
+#define FAKE_VALUE_MAX 64
+#define FAKE_PERIPHERALS_MAX 16
+#define FAKE_BONDS_MAX 16
+#define FAKE_WHITELIST_MAX 12
+#define FAKE_CCCD_NOTIFY 0x0001
+#define FAKE_CCCD_INDICATE 0x0002
+#define FAKE_REPLAY_DBS_MAX 16
+
+/* Types */
+typedef struct {
+    esp_gattc_db_elem_t elem;
+    uint16_t client_config_handle;
+    uint8_t value[FAKE_VALUE_MAX];
+    size_t len;
+    uint8_t is_secure;
+    uint8_t is_refused;
+} fake_attribute_t;
+
+struct fake_ble_peripheral_t {
+    esp_bd_addr_t mac;
+    esp_ble_addr_type_t addr_type;
+    fake_attribute_t attributes[FAKE_ATTRIBUTES_MAX];
+    uint16_t attributes_count;
+    uint16_t service;
+    uint16_t characteristic;
+    uint32_t passkey;
+    uint8_t is_pairing_failing;
+    uint8_t is_connected;
+    uint8_t is_encrypted;
+    uint8_t is_reported;
+    uint16_t conn_id;
+    int in_flight;
+};
+
+typedef struct fake_event_t {
+    struct fake_event_t *next;
+    uint8_t is_gap;
+    int event;
+    union {
+        esp_ble_gap_cb_param_t gap;
+        esp_ble_gattc_cb_param_t gattc;
+    } param;
+    uint8_t value[FAKE_VALUE_MAX];
+    /* The GATT request completed by this event */
+    fake_ble_peripheral_t *completes;
+} fake_event_t;
+
+typedef struct {
+    esp_bd_addr_t mac;
+    esp_ble_addr_type_t addr_type;
+} fake_whitelist_entry_t;
+
+typedef struct {
+    uint16_t conn_id;
+    esp_gattc_db_elem_t *db;
+    uint16_t count;
+} fake_replay_db_t;
+
+typedef struct fake_notifier_t {
+    struct fake_notifier_t *next;
+    fake_ble_peripheral_t *peripheral;
+    uint16_t handle;
+    uint32_t per_period; /* Above 1 kHz, several are sent each millisecond */
+    fake_ble_value_cb_t cb;
+    TimerHandle_t timer;
+} fake_notifier_t;
+
+/* Internal state */
+static esp_gap_ble_cb_t gap_cb = NULL;
+static esp_gattc_cb_t gattc_cb = NULL;
+static fake_event_t *events = NULL;
+static size_t events_count = 0;
+static size_t events_limit = 0;
+static fake_ble_peripheral_t *peripherals[FAKE_PERIPHERALS_MAX];
+static int peripherals_count = 0;
+static uint16_t next_conn_id = 0;
+static esp_bd_addr_t bonds[FAKE_BONDS_MAX];
+static int bonds_count = 0;
+static uint8_t is_bond_removal_hanging = 0;
+static fake_whitelist_entry_t whitelist[FAKE_WHITELIST_MAX];
+static int whitelist_count = 0;
+static esp_ble_scan_params_t scan_params;
+static uint8_t is_scanning = 0;
+static uint8_t is_replaying = 0;
+static fake_replay_db_t replay_dbs[FAKE_REPLAY_DBS_MAX];
+static int replay_dbs_count = 0;
+static fake_notifier_t *notifiers = NULL;
+
+/* All of the above, events are delivered without it */
+static pthread_mutex_t lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+static pthread_cond_t events_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t idle_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t btc_thread;
+static uint8_t is_btc_running = 0;
+static uint8_t is_delivering = 0;
+
+int fake_ble_requests = 0;
+int fake_ble_max_in_flight = 0;
+int fake_ble_notifications = 0;
+int fake_ble_notifications_dropped = 0;
+
+/* Events */
+static fake_event_t *fake_event_new(uint8_t is_gap, int event)
+{
+    fake_event_t *e = calloc(1, sizeof(*e)), **iter;
+
+    e->is_gap = is_gap;
+    e->event = event;
+    for (iter = &events; *iter; iter = &(*iter)->next);
+    *iter = e;
+    events_count++;
+    pthread_cond_signal(&events_cond);
+
+    return e;
+}
+
+#define fake_gap_event(event) fake_event_new(1, event)
+#define fake_gattc_event(event) fake_event_new(0, event)
+
+static void fake_event_remove(fake_event_t **iter)
+{
+    fake_event_t *e = *iter;
+
+    *iter = e->next;
+    events_count--;
+    if (!events_count)
+        pthread_cond_broadcast(&idle_cond);
+}
+
+/* Returns the next event, completing its request */
+static fake_event_t *fake_event_next(void)
+{
+    fake_event_t *e = events;
+
+    if (!e)
+        return NULL;
+
+    fake_event_remove(&events);
+    if (e->completes)
+        e->completes->in_flight--;
+
+    return e;
+}
+
+/* Called without the lock, callbacks make requests */
+static void fake_event_deliver(fake_event_t *e)
+{
+    /* Requests raise no events when replaying, the captured ones are
+     * delivered instead */
+    if (!is_replaying && e->is_gap && gap_cb)
+        gap_cb(e->event, &e->param.gap);
+    else if (!is_replaying && !e->is_gap && gattc_cb)
+        gattc_cb(e->event, FAKE_GATTC_IF, &e->param.gattc);
+    free(e);
+}
+
+void fake_ble_run(void)
+{
+    fake_event_t *e;
+
+    pthread_mutex_lock(&lock);
+
+    /* The BTC thread delivers them, wait until it's done */
+    while (is_btc_running && (events || is_delivering))
+        pthread_cond_wait(&idle_cond, &lock);
+
+    while ((e = fake_event_next()))
+    {
+        pthread_mutex_unlock(&lock);
+        fake_event_deliver(e);
+        pthread_mutex_lock(&lock);
+    }
+
+    pthread_mutex_unlock(&lock);
+}
+
+static void *fake_btc_thread(void *arg)
+{
+    fake_event_t *e;
+
+    pthread_mutex_lock(&lock);
+    while (is_btc_running || events)
+    {
+        if (!(e = fake_event_next()))
+        {
+            pthread_cond_wait(&events_cond, &lock);
+            continue;
+        }
+
+        is_delivering = 1;
+        pthread_mutex_unlock(&lock);
+        fake_event_deliver(e);
+        pthread_mutex_lock(&lock);
+        is_delivering = 0;
+        if (!events)
+            pthread_cond_broadcast(&idle_cond);
+    }
+    pthread_mutex_unlock(&lock);
+
+    return NULL;
+}
+
+void fake_ble_btc_thread_start(void)
+{
+    FAKE_LOCKED(&lock);
+
+    if (is_btc_running)
+        return;
+
+    is_btc_running = 1;
+    pthread_create(&btc_thread, NULL, fake_btc_thread, NULL);
+}
+
+void fake_ble_btc_thread_stop(void)
+{
+    pthread_mutex_lock(&lock);
+    if (!is_btc_running)
+    {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+
+    is_btc_running = 0;
+    pthread_cond_broadcast(&events_cond);
+    pthread_mutex_unlock(&lock);
+    pthread_join(btc_thread, NULL);
+}
+
+void fake_ble_queue_limit_set(size_t limit)
+{
+    FAKE_LOCKED(&lock);
+
+    events_limit = limit;
+}
+
+/* A request on the connection, completed by the returned event */
+static fake_event_t *fake_request(fake_ble_peripheral_t *peripheral,
+    esp_gattc_cb_event_t event)
+{
+    fake_event_t *e = fake_gattc_event(event);
+
+    e->completes = peripheral;
+    fake_ble_requests++;
+    if (++peripheral->in_flight > fake_ble_max_in_flight)
+        fake_ble_max_in_flight = peripheral->in_flight;
+
+    return e;
+}
+
+/* Peripherals */
+fake_ble_peripheral_t *fake_ble_peripheral_add(const char *mac,
+    esp_ble_addr_type_t addr_type)
+{
+    fake_ble_peripheral_t *peripheral = calloc(1, sizeof(*peripheral));
+    unsigned int b[6];
+    int i;
+
+    sscanf(mac, "%x:%x:%x:%x:%x:%x", &b[0], &b[1], &b[2], &b[3], &b[4],
+        &b[5]);
+    for (i = 0; i < 6; i++)
+        peripheral->mac[i] = b[i];
+    peripheral->addr_type = addr_type;
+    peripherals[peripherals_count++] = peripheral;
+
+    return peripheral;
+}
+
+uint8_t *fake_ble_peripheral_mac(fake_ble_peripheral_t *peripheral)
+{
+    return peripheral->mac;
+}
+
+int fake_ble_peripheral_is_connected(fake_ble_peripheral_t *peripheral)
+{
+    return peripheral->is_connected;
+}
+
+int fake_ble_peripheral_is_encrypted(fake_ble_peripheral_t *peripheral)
+{
+    return peripheral->is_encrypted;
+}
+
+void fake_ble_peripheral_passkey_set(fake_ble_peripheral_t *peripheral,
+    uint32_t passkey)
+{
+    peripheral->passkey = passkey;
+}
+
+void fake_ble_peripheral_pairing_fail(fake_ble_peripheral_t *peripheral)
+{
+    peripheral->is_pairing_failing = 1;
+}
+
+static fake_ble_peripheral_t *fake_peripheral_find_by_mac(
+    const esp_bd_addr_t mac)
+{
+    int i;
+
+    for (i = 0; i < peripherals_count; i++)
+    {
+        if (!memcmp(peripherals[i]->mac, mac, sizeof(esp_bd_addr_t)))
+            return peripherals[i];
+    }
+
+    return NULL;
+}
+
+static fake_ble_peripheral_t *fake_peripheral_find_by_conn_id(
+    uint16_t conn_id)
+{
+    int i;
+
+    for (i = 0; i < peripherals_count; i++)
+    {
+        if (peripherals[i]->is_connected && peripherals[i]->conn_id == conn_id)
+            return peripherals[i];
+    }
+
+    return NULL;
+}
+
+/* GATT database */
+static fake_attribute_t *fake_attribute_add(fake_ble_peripheral_t *peripheral,
+    esp_gatt_db_attr_type_t type, uint16_t uuid, const void *value,
+    size_t len)
+{
+    fake_attribute_t *attribute =
+        &peripheral->attributes[peripheral->attributes_count++];
+
+    attribute->elem.type = type;
+    attribute->elem.attribute_handle = peripheral->attributes_count;
+    attribute->elem.uuid.len = ESP_UUID_LEN_16;
+    attribute->elem.uuid.uuid.uuid16 = uuid;
+    attribute->len = len;
+    if (len)
+        memcpy(attribute->value, value, len);
+
+    /* Services span up to their last attribute */
+    if (peripheral->service)
+    {
+        peripheral->attributes[peripheral->service - 1].elem.end_handle =
+            attribute->elem.attribute_handle;
+    }
+
+    return attribute;
+}
+
+static fake_attribute_t *fake_attribute_find(
+    fake_ble_peripheral_t *peripheral, uint16_t handle)
+{
+    if (handle == 0 || handle > peripheral->attributes_count)
+        return NULL;
+
+    return &peripheral->attributes[handle - 1];
+}
+
+uint16_t fake_ble_service_add(fake_ble_peripheral_t *peripheral,
+    uint16_t uuid)
+{
+    fake_attribute_t *attribute = fake_attribute_add(peripheral,
+        ESP_GATT_DB_PRIMARY_SERVICE, uuid, NULL, 0);
+
+    attribute->elem.start_handle = attribute->elem.attribute_handle;
+    peripheral->service = attribute->elem.attribute_handle;
+
+    return peripheral->service;
+}
+
+uint16_t fake_ble_characteristic_add(fake_ble_peripheral_t *peripheral,
+    uint16_t uuid, uint8_t properties, const void *value, size_t len)
+{
+    fake_attribute_t *attribute = fake_attribute_add(peripheral,
+        ESP_GATT_DB_CHARACTERISTIC, uuid, value, len);
+    uint16_t handle = attribute->elem.attribute_handle;
+
+    attribute->elem.properties = properties;
+    peripheral->characteristic = handle;
+    if (properties & (ESP_GATT_CHAR_PROP_BIT_NOTIFY |
+        ESP_GATT_CHAR_PROP_BIT_INDICATE))
+    {
+        attribute->client_config_handle = fake_ble_descriptor_add(peripheral,
+            ESP_GATT_UUID_CHAR_CLIENT_CONFIG, "\0\0", 2);
+    }
+
+    return handle;
+}
+
+uint16_t fake_ble_descriptor_add(fake_ble_peripheral_t *peripheral,
+    uint16_t uuid, const void *value, size_t len)
+{
+    return fake_attribute_add(peripheral, ESP_GATT_DB_DESCRIPTOR, uuid, value,
+        len)->elem.attribute_handle;
+}
+
+const uint8_t *fake_ble_attribute_get(fake_ble_peripheral_t *peripheral,
+    uint16_t handle, size_t *len)
+{
+    fake_attribute_t *attribute = fake_attribute_find(peripheral, handle);
+
+    *len = attribute->len;
+    return attribute->value;
+}
+
+void fake_ble_attribute_secure(fake_ble_peripheral_t *peripheral,
+    uint16_t handle)
+{
+    fake_attribute_find(peripheral, handle)->is_secure = 1;
+}
+
+void fake_ble_attribute_refuse(fake_ble_peripheral_t *peripheral,
+    uint16_t handle)
+{
+    fake_attribute_find(peripheral, handle)->is_refused = 1;
+}
+
+/* Peripheral actions */
+static int fake_whitelist_match(fake_ble_peripheral_t *peripheral)
+{
+    int i;
+
+    for (i = 0; i < whitelist_count; i++)
+    {
+        if (!memcmp(whitelist[i].mac, peripheral->mac,
+            sizeof(esp_bd_addr_t)) &&
+            whitelist[i].addr_type == peripheral->addr_type)
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+void fake_ble_advertise(fake_ble_peripheral_t *peripheral)
+{
+    FAKE_LOCKED(&lock);
+    fake_event_t *e;
+
+    if (!is_scanning || peripheral->is_connected)
+        return;
+
+    if (scan_params.scan_filter_policy == BLE_SCAN_FILTER_ALLOW_ONLY_WLST &&
+        !fake_whitelist_match(peripheral))
+    {
+        return;
+    }
+
+    if (scan_params.scan_duplicate == BLE_SCAN_DUPLICATE_ENABLE &&
+        peripheral->is_reported)
+    {
+        return;
+    }
+    peripheral->is_reported = 1;
+
+    e = fake_gap_event(ESP_GAP_BLE_SCAN_RESULT_EVT);
+    e->param.gap.scan_rst.search_evt = ESP_GAP_SEARCH_INQ_RES_EVT;
+    memcpy(e->param.gap.scan_rst.bda, peripheral->mac, sizeof(esp_bd_addr_t));
+    e->param.gap.scan_rst.ble_addr_type = peripheral->addr_type;
+    e->param.gap.scan_rst.rssi = -60;
+}
+
+static int fake_value_send(fake_ble_peripheral_t *peripheral, uint16_t handle,
+    const void *value, size_t len, uint16_t client_config)
+{
+    fake_attribute_t *attribute = fake_attribute_find(peripheral, handle);
+    fake_attribute_t *cccd;
+    fake_event_t *e;
+
+    if (!peripheral->is_connected || !attribute ||
+        !(cccd = fake_attribute_find(peripheral,
+        attribute->client_config_handle)) ||
+        !(cccd->value[0] & client_config))
+    {
+        return -1;
+    }
+
+    /* The host's buffers are full */
+    fake_ble_notifications++;
+    if (events_limit && events_count >= events_limit)
+    {
+        fake_ble_notifications_dropped++;
+        return 0;
+    }
+
+    e = fake_gattc_event(ESP_GATTC_NOTIFY_EVT);
+    e->param.gattc.notify.conn_id = peripheral->conn_id;
+    memcpy(e->param.gattc.notify.remote_bda, peripheral->mac,
+        sizeof(esp_bd_addr_t));
+    e->param.gattc.notify.handle = handle;
+    e->param.gattc.notify.is_notify = client_config == FAKE_CCCD_NOTIFY;
+    memcpy(e->value, value, len);
+    e->param.gattc.notify.value = e->value;
+    e->param.gattc.notify.value_len = len;
+
+    return 0;
+}
+
+int fake_ble_notify(fake_ble_peripheral_t *peripheral, uint16_t handle,
+    const void *value, size_t len)
+{
+    FAKE_LOCKED(&lock);
+
+    return fake_value_send(peripheral, handle, value, len, FAKE_CCCD_NOTIFY);
+}
+
+int fake_ble_indicate(fake_ble_peripheral_t *peripheral, uint16_t handle,
+    const void *value, size_t len)
+{
+    FAKE_LOCKED(&lock);
+
+    return fake_value_send(peripheral, handle, value, len,
+        FAKE_CCCD_INDICATE);
+}
+
+static void fake_notifier_timer_cb(TimerHandle_t timer)
+{
+    FAKE_LOCKED(&lock);
+    fake_notifier_t *notifier = pvTimerGetTimerID(timer);
+    fake_attribute_t *attribute = fake_attribute_find(notifier->peripheral,
+        notifier->handle);
+    uint8_t value[FAKE_VALUE_MAX];
+    size_t len;
+    uint32_t i;
+
+    for (i = 0; i < notifier->per_period; i++)
+    {
+        if (!notifier->cb)
+        {
+            fake_value_send(notifier->peripheral, notifier->handle,
+                attribute->value, attribute->len, FAKE_CCCD_NOTIFY);
+            continue;
+        }
+
+        len = notifier->cb(notifier->peripheral, notifier->handle, value,
+            sizeof(value));
+        fake_value_send(notifier->peripheral, notifier->handle, value, len,
+            FAKE_CCCD_NOTIFY);
+    }
+}
+
+void fake_ble_notify_rate_set(fake_ble_peripheral_t *peripheral,
+    uint16_t handle, uint32_t rate, fake_ble_value_cb_t cb)
+{
+    FAKE_LOCKED(&lock);
+    fake_notifier_t *notifier;
+
+    for (notifier = notifiers; notifier; notifier = notifier->next)
+    {
+        if (notifier->peripheral == peripheral && notifier->handle == handle)
+            break;
+    }
+
+    if (!notifier)
+    {
+        if (!rate)
+            return;
+
+        notifier = calloc(1, sizeof(*notifier));
+        notifier->peripheral = peripheral;
+        notifier->handle = handle;
+        notifier->timer = xTimerCreate("fake_notify", 1, pdTRUE, notifier,
+            fake_notifier_timer_cb);
+        notifier->next = notifiers;
+        notifiers = notifier;
+    }
+
+    if (!rate)
+    {
+        xTimerStop(notifier->timer, 0);
+        return;
+    }
+
+    /* Rounded to whole milliseconds of the fake clock */
+    notifier->per_period = rate > 1000 ? rate / 1000 : 1;
+    notifier->cb = cb;
+    xTimerChangePeriod(notifier->timer, rate > 1000 ? 1 : 1000 / rate, 0);
+}
+
+void fake_ble_disconnect(fake_ble_peripheral_t *peripheral)
+{
+    FAKE_LOCKED(&lock);
+    fake_event_t **iter, *e;
+    int i;
+
+    if (!peripheral->is_connected)
+        return;
+
+    /* Requests in flight are never completed */
+    for (iter = &events; *iter;)
+    {
+        e = *iter;
+        if (e->completes != peripheral)
+        {
+            iter = &e->next;
+            continue;
+        }
+
+        fake_event_remove(iter);
+        free(e);
+    }
+
+    /* Subscriptions of unbonded clients don't persist */
+    for (i = 0; i < peripheral->attributes_count; i++)
+    {
+        if (peripheral->attributes[i].elem.uuid.uuid.uuid16 ==
+            ESP_GATT_UUID_CHAR_CLIENT_CONFIG && !fake_ble_is_bonded(peripheral))
+        {
+            memset(peripheral->attributes[i].value, 0, 2);
+        }
+    }
+
+    peripheral->is_connected = 0;
+    peripheral->is_encrypted = 0;
+    peripheral->in_flight = 0;
+
+    e = fake_gattc_event(ESP_GATTC_CLOSE_EVT);
+    e->param.gattc.close.conn_id = peripheral->conn_id;
+    memcpy(e->param.gattc.close.remote_bda, peripheral->mac,
+        sizeof(esp_bd_addr_t));
+    e->param.gattc.close.reason = 0x13;
+}
+
+/* Bonds */
+static int fake_bond_find(const esp_bd_addr_t mac)
+{
+    int i;
+
+    for (i = 0; i < bonds_count; i++)
+    {
+        if (!memcmp(bonds[i], mac, sizeof(esp_bd_addr_t)))
+            return i;
+    }
+
+    return -1;
+}
+
+void fake_ble_bond_add(fake_ble_peripheral_t *peripheral)
+{
+    FAKE_LOCKED(&lock);
+
+    if (fake_bond_find(peripheral->mac) < 0)
+        memcpy(bonds[bonds_count++], peripheral->mac, sizeof(esp_bd_addr_t));
+}
+
+int fake_ble_is_bonded(fake_ble_peripheral_t *peripheral)
+{
+    FAKE_LOCKED(&lock);
+
+    return fake_bond_find(peripheral->mac) >= 0;
+}
+
+void fake_ble_bond_removal_hang(void)
+{
+    is_bond_removal_hanging = 1;
+}
+
+/* Controller state */
+int fake_ble_is_scanning(void)
+{
+    return is_scanning;
+}
+
+const esp_ble_scan_params_t *fake_ble_scan_params(void)
+{
+    return &scan_params;
+}
+
+int fake_ble_whitelist_size(void)
+{
+    return whitelist_count;
+}
+
+/* Initialization */
+esp_err_t esp_bt_controller_init(esp_bt_controller_config_t *cfg)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_bt_controller_enable(esp_bt_mode_t mode)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_bluedroid_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_bluedroid_enable(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gatt_set_local_mtu(uint16_t mtu)
+{
+    return ESP_OK;
+}
+
+/* GAP */
+esp_err_t esp_ble_gap_register_callback(esp_gap_ble_cb_t callback)
+{
+    gap_cb = callback;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_config_local_privacy(bool privacy_enable)
+{
+    FAKE_LOCKED(&lock);
+
+    fake_gap_event(ESP_GAP_BLE_SET_LOCAL_PRIVACY_COMPLETE_EVT)->
+        param.gap.local_privacy_cmpl.status = ESP_BT_STATUS_SUCCESS;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_set_scan_params(esp_ble_scan_params_t *params)
+{
+    FAKE_LOCKED(&lock);
+
+    scan_params = *params;
+    fake_gap_event(ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT)->
+        param.gap.scan_param_cmpl.status = ESP_BT_STATUS_SUCCESS;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_start_scanning(uint32_t duration)
+{
+    FAKE_LOCKED(&lock);
+    int i;
+
+    /* The duplicate filter is reset on each scan */
+    for (i = 0; i < peripherals_count; i++)
+        peripherals[i]->is_reported = 0;
+
+    is_scanning = 1;
+    fake_gap_event(ESP_GAP_BLE_SCAN_START_COMPLETE_EVT)->
+        param.gap.scan_start_cmpl.status = ESP_BT_STATUS_SUCCESS;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_stop_scanning(void)
+{
+    FAKE_LOCKED(&lock);
+
+    is_scanning = 0;
+    fake_gap_event(ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT)->
+        param.gap.scan_stop_cmpl.status = ESP_BT_STATUS_SUCCESS;
+    return ESP_OK;
+}
+
+/* The address type isn't part of the request, Bluedroid adds the entry as a
+ * public address unless the device was seen before */
+esp_err_t esp_ble_gap_update_whitelist(bool add_remove,
+    esp_bd_addr_t remote_bda)
+{
+    FAKE_LOCKED(&lock);
+    fake_whitelist_entry_t *entry;
+    fake_event_t *e;
+
+    if (!add_remove || whitelist_count == FAKE_WHITELIST_MAX)
+        return ESP_FAIL;
+
+    entry = &whitelist[whitelist_count++];
+    memcpy(entry->mac, remote_bda, sizeof(esp_bd_addr_t));
+    entry->addr_type = BLE_ADDR_TYPE_PUBLIC;
+
+    e = fake_gap_event(ESP_GAP_BLE_ADD_WHITELIST_COMPLETE_EVT);
+    e->param.gap.add_whitelist_cmpl.status = ESP_BT_STATUS_SUCCESS;
+    e->param.gap.add_whitelist_cmpl.wl_opration = ESP_BLE_WHITELIST_ADD;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_get_whitelist_size(uint16_t *length)
+{
+    *length = FAKE_WHITELIST_MAX;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gap_set_security_param(esp_ble_sm_param_t param_type,
+    void *value, uint8_t len)
+{
+    return ESP_OK;
+}
+
+static void fake_auth_complete(fake_ble_peripheral_t *peripheral,
+    uint8_t success)
+{
+    fake_event_t *e = fake_gap_event(ESP_GAP_BLE_AUTH_CMPL_EVT);
+
+    memcpy(e->param.gap.ble_security.auth_cmpl.bd_addr, peripheral->mac,
+        sizeof(esp_bd_addr_t));
+    e->param.gap.ble_security.auth_cmpl.success = success;
+    e->param.gap.ble_security.auth_cmpl.fail_reason = success ? 0 : 0x51;
+
+    peripheral->is_encrypted = success;
+    if (success)
+        fake_ble_bond_add(peripheral);
+}
+
+esp_err_t esp_ble_set_encryption(esp_bd_addr_t bd_addr,
+    esp_ble_sec_act_t sec_act)
+{
+    FAKE_LOCKED(&lock);
+    fake_ble_peripheral_t *peripheral = fake_peripheral_find_by_mac(bd_addr);
+    fake_event_t *e;
+
+    if (is_replaying)
+        return ESP_OK;
+    if (!peripheral || !peripheral->is_connected)
+        return ESP_FAIL;
+
+    /* Bonded peripherals reuse their keys */
+    if (peripheral->is_pairing_failing || fake_ble_is_bonded(peripheral) ||
+        !peripheral->passkey)
+    {
+        fake_auth_complete(peripheral, !peripheral->is_pairing_failing);
+        return ESP_OK;
+    }
+
+    e = fake_gap_event(ESP_GAP_BLE_PASSKEY_REQ_EVT);
+    memcpy(e->param.gap.ble_security.ble_req.bd_addr, bd_addr,
+        sizeof(esp_bd_addr_t));
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_passkey_reply(esp_bd_addr_t bd_addr, bool accept,
+    uint32_t passkey)
+{
+    FAKE_LOCKED(&lock);
+    fake_ble_peripheral_t *peripheral = fake_peripheral_find_by_mac(bd_addr);
+
+    if (is_replaying)
+        return ESP_OK;
+    if (!peripheral || !peripheral->is_connected)
+        return ESP_FAIL;
+
+    fake_auth_complete(peripheral, accept && passkey == peripheral->passkey);
+    return ESP_OK;
+}
+
+int esp_ble_get_bond_device_num(void)
+{
+    FAKE_LOCKED(&lock);
+
+    return bonds_count;
+}
+
+esp_err_t esp_ble_get_bond_device_list(int *dev_num,
+    esp_ble_bond_dev_t *dev_list)
+{
+    FAKE_LOCKED(&lock);
+    int i;
+
+    if (*dev_num > bonds_count)
+        *dev_num = bonds_count;
+
+    for (i = 0; i < *dev_num; i++)
+        memcpy(dev_list[i].bd_addr, bonds[i], sizeof(esp_bd_addr_t));
+
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_remove_bond_device(esp_bd_addr_t bd_addr)
+{
+    FAKE_LOCKED(&lock);
+    int i = fake_bond_find(bd_addr);
+    fake_event_t *e;
+
+    if (i < 0)
+        return ESP_FAIL;
+
+    memmove(bonds[i], bonds[i + 1], sizeof(bonds[0]) * (bonds_count - i - 1));
+    bonds_count--;
+
+    if (is_bond_removal_hanging)
+        return ESP_OK;
+
+    e = fake_gap_event(ESP_GAP_BLE_REMOVE_BOND_DEV_COMPLETE_EVT);
+    e->param.gap.remove_bond_dev_cmpl.status = ESP_BT_STATUS_SUCCESS;
+    memcpy(e->param.gap.remove_bond_dev_cmpl.bd_addr, bd_addr,
+        sizeof(esp_bd_addr_t));
+    return ESP_OK;
+}
+
+/* GATT client */
+static fake_replay_db_t *fake_replay_db_find(uint16_t conn_id)
+{
+    int i;
+
+    for (i = 0; i < replay_dbs_count; i++)
+    {
+        if (replay_dbs[i].conn_id == conn_id)
+            return &replay_dbs[i];
+    }
+
+    return NULL;
+}
+
+esp_err_t esp_ble_gattc_register_callback(esp_gattc_cb_t callback)
+{
+    gattc_cb = callback;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_app_register(uint16_t app_id)
+{
+    FAKE_LOCKED(&lock);
+    fake_event_t *e = fake_gattc_event(ESP_GATTC_REG_EVT);
+
+    e->param.gattc.reg.status = ESP_GATT_OK;
+    e->param.gattc.reg.app_id = app_id;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_open(esp_gatt_if_t gattc_if, esp_bd_addr_t remote_bda,
+    esp_ble_addr_type_t remote_addr_type, bool is_direct)
+{
+    FAKE_LOCKED(&lock);
+    fake_ble_peripheral_t *peripheral = fake_peripheral_find_by_mac(
+        remote_bda);
+    fake_event_t *e = fake_gattc_event(ESP_GATTC_OPEN_EVT);
+
+    memcpy(e->param.gattc.open.remote_bda, remote_bda, sizeof(esp_bd_addr_t));
+    if (!peripheral || peripheral->is_connected ||
+        remote_addr_type != peripheral->addr_type)
+    {
+        e->param.gattc.open.status = ESP_GATT_ERROR;
+        return ESP_OK;
+    }
+
+    peripheral->is_connected = 1;
+    peripheral->conn_id = next_conn_id++;
+    e->param.gattc.open.status = ESP_GATT_OK;
+    e->param.gattc.open.conn_id = peripheral->conn_id;
+    e->param.gattc.open.mtu = 23;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_close(esp_gatt_if_t gattc_if, uint16_t conn_id)
+{
+    FAKE_LOCKED(&lock);
+    fake_ble_peripheral_t *peripheral = fake_peripheral_find_by_conn_id(
+        conn_id);
+
+    if (is_replaying)
+        return ESP_OK;
+    if (!peripheral)
+        return ESP_FAIL;
+
+    fake_ble_disconnect(peripheral);
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_send_mtu_req(esp_gatt_if_t gattc_if, uint16_t conn_id)
+{
+    FAKE_LOCKED(&lock);
+    fake_event_t *e;
+
+    if (is_replaying)
+        return ESP_OK;
+    if (!fake_peripheral_find_by_conn_id(conn_id))
+        return ESP_FAIL;
+
+    e = fake_gattc_event(ESP_GATTC_CFG_MTU_EVT);
+    e->param.gattc.cfg_mtu.status = ESP_GATT_OK;
+    e->param.gattc.cfg_mtu.conn_id = conn_id;
+    e->param.gattc.cfg_mtu.mtu = FAKE_MTU;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_search_service(esp_gatt_if_t gattc_if,
+    uint16_t conn_id, esp_bt_uuid_t *filter_uuid)
+{
+    FAKE_LOCKED(&lock);
+    fake_event_t *e;
+
+    if (is_replaying)
+        return ESP_OK;
+    if (!fake_peripheral_find_by_conn_id(conn_id))
+        return ESP_FAIL;
+
+    e = fake_gattc_event(ESP_GATTC_SEARCH_CMPL_EVT);
+    e->param.gattc.search_cmpl.status = ESP_GATT_OK;
+    e->param.gattc.search_cmpl.conn_id = conn_id;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_get_attr_count(esp_gatt_if_t gattc_if,
+    uint16_t conn_id, esp_gatt_db_attr_type_t type, uint16_t start_handle,
+    uint16_t end_handle, uint16_t char_handle, uint16_t *count)
+{
+    FAKE_LOCKED(&lock);
+    fake_ble_peripheral_t *peripheral = fake_peripheral_find_by_conn_id(
+        conn_id);
+    fake_replay_db_t *replay_db = fake_replay_db_find(conn_id);
+
+    if (is_replaying && replay_db && type == ESP_GATT_DB_ALL)
+    {
+        *count = replay_db->count;
+        return ESP_OK;
+    }
+    if (!peripheral || type != ESP_GATT_DB_ALL)
+        return ESP_FAIL;
+
+    *count = peripheral->attributes_count;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_get_db(esp_gatt_if_t gattc_if, uint16_t conn_id,
+    uint16_t start_handle, uint16_t end_handle, esp_gattc_db_elem_t *db,
+    uint16_t *count)
+{
+    FAKE_LOCKED(&lock);
+    fake_ble_peripheral_t *peripheral = fake_peripheral_find_by_conn_id(
+        conn_id);
+    fake_replay_db_t *replay_db = fake_replay_db_find(conn_id);
+    uint16_t i;
+
+    if (is_replaying && replay_db)
+    {
+        if (*count > replay_db->count)
+            *count = replay_db->count;
+        memcpy(db, replay_db->db, sizeof(*db) * *count);
+        return ESP_OK;
+    }
+    if (!peripheral)
+        return ESP_FAIL;
+
+    if (*count > peripheral->attributes_count)
+        *count = peripheral->attributes_count;
+
+    for (i = 0; i < *count; i++)
+        db[i] = peripheral->attributes[i].elem;
+
+    return ESP_OK;
+}
+
+/* Reads and writes complete with an error status unless the link is secure
+ * enough */
+static fake_attribute_t *fake_access(uint16_t conn_id, uint16_t handle,
+    fake_ble_peripheral_t **peripheral, esp_gatt_status_t *status)
+{
+    fake_attribute_t *attribute;
+
+    if (!(*peripheral = fake_peripheral_find_by_conn_id(conn_id)) ||
+        !(attribute = fake_attribute_find(*peripheral, handle)) ||
+        attribute->is_refused)
+    {
+        return NULL;
+    }
+
+    *status = attribute->is_secure && !(*peripheral)->is_encrypted ?
+        ESP_GATT_INSUF_AUTHENTICATION : ESP_GATT_OK;
+    return attribute;
+}
+
+static esp_err_t fake_read(uint16_t conn_id, uint16_t handle,
+    esp_gattc_cb_event_t event)
+{
+    fake_ble_peripheral_t *peripheral;
+    fake_attribute_t *attribute;
+    esp_gatt_status_t status;
+    fake_event_t *e;
+
+    if (is_replaying)
+        return ESP_OK;
+    if (!(attribute = fake_access(conn_id, handle, &peripheral, &status)))
+        return ESP_FAIL;
+
+    e = fake_request(peripheral, event);
+    e->param.gattc.read.status = status;
+    e->param.gattc.read.conn_id = conn_id;
+    e->param.gattc.read.handle = handle;
+    if (status == ESP_GATT_OK)
+    {
+        memcpy(e->value, attribute->value, attribute->len);
+        e->param.gattc.read.value = e->value;
+        e->param.gattc.read.value_len = attribute->len;
+    }
+
+    return ESP_OK;
+}
+
+static esp_err_t fake_write(uint16_t conn_id, uint16_t handle,
+    esp_gattc_cb_event_t event, uint16_t value_len, const uint8_t *value)
+{
+    fake_ble_peripheral_t *peripheral;
+    fake_attribute_t *attribute;
+    esp_gatt_status_t status;
+    fake_event_t *e;
+
+    if (is_replaying)
+        return ESP_OK;
+    if (value_len > FAKE_VALUE_MAX ||
+        !(attribute = fake_access(conn_id, handle, &peripheral, &status)))
+    {
+        return ESP_FAIL;
+    }
+
+    e = fake_request(peripheral, event);
+    e->param.gattc.write.status = status;
+    e->param.gattc.write.conn_id = conn_id;
+    e->param.gattc.write.handle = handle;
+    if (status == ESP_GATT_OK)
+    {
+        memcpy(attribute->value, value, value_len);
+        attribute->len = value_len;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_read_char(esp_gatt_if_t gattc_if, uint16_t conn_id,
+    uint16_t handle, esp_gatt_auth_req_t auth_req)
+{
+    FAKE_LOCKED(&lock);
+
+    return fake_read(conn_id, handle, ESP_GATTC_READ_CHAR_EVT);
+}
+
+esp_err_t esp_ble_gattc_read_char_descr(esp_gatt_if_t gattc_if,
+    uint16_t conn_id, uint16_t handle, esp_gatt_auth_req_t auth_req)
+{
+    FAKE_LOCKED(&lock);
+
+    return fake_read(conn_id, handle, ESP_GATTC_READ_DESCR_EVT);
+}
+
+esp_err_t esp_ble_gattc_write_char(esp_gatt_if_t gattc_if, uint16_t conn_id,
+    uint16_t handle, uint16_t value_len, uint8_t *value,
+    esp_gatt_write_type_t write_type, esp_gatt_auth_req_t auth_req)
+{
+    FAKE_LOCKED(&lock);
+
+    return fake_write(conn_id, handle, ESP_GATTC_WRITE_CHAR_EVT, value_len,
+        value);
+}
+
+esp_err_t esp_ble_gattc_write_char_descr(esp_gatt_if_t gattc_if,
+    uint16_t conn_id, uint16_t handle, uint16_t value_len, uint8_t *value,
+    esp_gatt_write_type_t write_type, esp_gatt_auth_req_t auth_req)
+{
+    FAKE_LOCKED(&lock);
+
+    return fake_write(conn_id, handle, ESP_GATTC_WRITE_DESCR_EVT, value_len,
+        value);
+}
+
+esp_err_t esp_ble_gattc_register_for_notify(esp_gatt_if_t gattc_if,
+    esp_bd_addr_t server_bda, uint16_t handle)
+{
+    FAKE_LOCKED(&lock);
+    fake_event_t *e = fake_gattc_event(ESP_GATTC_REG_FOR_NOTIFY_EVT);
+
+    e->param.gattc.reg_for_notify.status = ESP_GATT_OK;
+    e->param.gattc.reg_for_notify.handle = handle;
+    return ESP_OK;
+}
+
+esp_err_t esp_ble_gattc_unregister_for_notify(esp_gatt_if_t gattc_if,
+    esp_bd_addr_t server_bda, uint16_t handle)
+{
+    FAKE_LOCKED(&lock);
+    fake_event_t *e = fake_gattc_event(ESP_GATTC_UNREG_FOR_NOTIFY_EVT);
+
+    e->param.gattc.unreg_for_notify.status = ESP_GATT_OK;
+    e->param.gattc.unreg_for_notify.handle = handle;
+    return ESP_OK;
+}
+
+/* Replay */
+void fake_ble_replay_start(void)
+{
+    FAKE_LOCKED(&lock);
+
+    is_replaying = 1;
+}
+
+void fake_ble_replay_db_set(uint16_t conn_id, const esp_gattc_db_elem_t *db,
+    uint16_t count)
+{
+    FAKE_LOCKED(&lock);
+    fake_replay_db_t *replay_db = fake_replay_db_find(conn_id);
+
+    if (!replay_db)
+    {
+        if (replay_dbs_count == FAKE_REPLAY_DBS_MAX)
+            return;
+        replay_db = &replay_dbs[replay_dbs_count++];
+        replay_db->conn_id = conn_id;
+        replay_db->db = NULL;
+    }
+
+    /* Connection IDs are reused, the latest database wins */
+    free(replay_db->db);
+    replay_db->db = malloc(sizeof(*db) * count);
+    memcpy(replay_db->db, db, sizeof(*db) * count);
+    replay_db->count = count;
+}
+
+void fake_ble_replay_gap_event(esp_gap_ble_cb_event_t event,
+    esp_ble_gap_cb_param_t *param)
+{
+    if (gap_cb)
+        gap_cb(event, param);
+}
+
+void fake_ble_replay_gattc_event(esp_gattc_cb_event_t event,
+    esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param)
+{
+    if (gattc_cb)
+        gattc_cb(event, gattc_if, param);
+}
@@ -0,0 +1,259 @@
+#include <cJSON.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Types */
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t size;
+} printbuf_t;
+
+static cJSON *cJSON_New(int type)
+{
+    cJSON *item = calloc(1, sizeof(*item));
+
+    item->type = type;
+    return item;
+}
+
+void cJSON_Delete(cJSON *item)
+{
+    cJSON *next;
+
+    for (; item; item = next)
+    {
+        next = item->next;
+        cJSON_Delete(item->child);
+        free(item->valuestring);
+        free(item->string);
+        free(item);
+    }
+}
+
+/* Accessors */
+cJSON *cJSON_GetObjectItemCaseSensitive(const cJSON *object,
+    const char *string)
+{
+    cJSON *item;
+
+    if (!object || !string)
+        return NULL;
+
+    for (item = object->child; item; item = item->next)
+    {
+        if (item->string && !strcmp(item->string, string))
+            return item;
+    }
+
+    return NULL;
+}
+
+int cJSON_IsFalse(const cJSON *item)
+{
+    return item && item->type == cJSON_False;
+}
+
+int cJSON_IsTrue(const cJSON *item)
+{
+    return item && item->type == cJSON_True;
+}
+
+int cJSON_IsBool(const cJSON *item)
+{
+    return cJSON_IsFalse(item) || cJSON_IsTrue(item);
+}
+
+int cJSON_IsNull(const cJSON *item)
+{
+    return item && item->type == cJSON_NULL;
+}
+
+int cJSON_IsNumber(const cJSON *item)
+{
+    return item && item->type == cJSON_Number;
+}
+
+int cJSON_IsString(const cJSON *item)
+{
+    return item && item->type == cJSON_String;
+}
+
+int cJSON_IsArray(const cJSON *item)
+{
+    return item && item->type == cJSON_Array;
+}
+
+int cJSON_IsObject(const cJSON *item)
+{
+    return item && item->type == cJSON_Object;
+}
+
+/* Construction */
+cJSON *cJSON_CreateNull(void)
+{
+    return cJSON_New(cJSON_NULL);
+}
+
+cJSON *cJSON_CreateBool(int boolean)
+{
+    return cJSON_New(boolean ? cJSON_True : cJSON_False);
+}
+
+cJSON *cJSON_CreateNumber(double num)
+{
+    cJSON *item = cJSON_New(cJSON_Number);
+
+    item->valuedouble = num;
+    item->valueint = num >= INT32_MAX ? INT32_MAX :
+        num <= INT32_MIN ? INT32_MIN : (int)num;
+    return item;
+}
+
+cJSON *cJSON_CreateString(const char *string)
+{
+    cJSON *item = cJSON_New(cJSON_String);
+
+    item->valuestring = strdup(string);
+    return item;
+}
+
+cJSON *cJSON_CreateArray(void)
+{
+    return cJSON_New(cJSON_Array);
+}
+
+cJSON *cJSON_CreateObject(void)
+{
+    return cJSON_New(cJSON_Object);
+}
+
+void cJSON_AddItemToArray(cJSON *array, cJSON *item)
+{
+    cJSON **iter, *prev = NULL;
+
+    if (!array || !item)
+        return;
+
+    for (iter = &array->child; *iter; iter = &(*iter)->next)
+        prev = *iter;
+    item->prev = prev;
+    *iter = item;
+}
+
+void cJSON_AddItemToObject(cJSON *object, const char *string, cJSON *item)
+{
+    if (!item)
+        return;
+
+    free(item->string);
+    item->string = strdup(string);
+    cJSON_AddItemToArray(object, item);
+}
+
+/* Printing */
+static void print_append(printbuf_t *p, const char *str, size_t len)
+{
+    if (p->len + len + 1 > p->size)
+    {
+        p->size = (p->len + len + 1) * 2;
+        p->buf = realloc(p->buf, p->size);
+    }
+
+    memcpy(p->buf + p->len, str, len);
+    p->len += len;
+    p->buf[p->len] = '\0';
+}
+
+static void print_string(printbuf_t *p, const char *str)
+{
+    char escaped[8];
+
+    print_append(p, "\"", 1);
+    for (; *str; str++)
+    {
+        switch (*str)
+        {
+        case '"': print_append(p, "\\\"", 2); break;
+        case '\\': print_append(p, "\\\\", 2); break;
+        case '\b': print_append(p, "\\b", 2); break;
+        case '\f': print_append(p, "\\f", 2); break;
+        case '\n': print_append(p, "\\n", 2); break;
+        case '\r': print_append(p, "\\r", 2); break;
+        case '\t': print_append(p, "\\t", 2); break;
+        default:
+            if ((unsigned char)*str < ' ')
+            {
+                sprintf(escaped, "\\u%04x", *str);
+                print_append(p, escaped, 6);
+            }
+            else
+                print_append(p, str, 1);
+        }
+    }
+    print_append(p, "\"", 1);
+}
+
+/* Numbers are printed the way cJSON does */
+static void print_number(printbuf_t *p, double num)
+{
+    char buf[32];
+    double test;
+
+    if (isnan(num) || isinf(num))
+        strcpy(buf, "null");
+    else if (num == (int)num)
+        sprintf(buf, "%d", (int)num);
+    else
+    {
+        sprintf(buf, "%1.15g", num);
+        if (sscanf(buf, "%lg", &test) != 1 || test != num)
+            sprintf(buf, "%1.17g", num);
+    }
+
+    print_append(p, buf, strlen(buf));
+}
+
+static void print_value(printbuf_t *p, const cJSON *item)
+{
+    const cJSON *child;
+
+    switch (item->type)
+    {
+    case cJSON_False: print_append(p, "false", 5); break;
+    case cJSON_True: print_append(p, "true", 4); break;
+    case cJSON_NULL: print_append(p, "null", 4); break;
+    case cJSON_Number: print_number(p, item->valuedouble); break;
+    case cJSON_String: print_string(p, item->valuestring); break;
+    case cJSON_Array:
+    case cJSON_Object:
+        print_append(p, item->type == cJSON_Array ? "[" : "{", 1);
+        for (child = item->child; child; child = child->next)
+        {
+            if (item->type == cJSON_Object)
+            {
+                print_string(p, child->string);
+                print_append(p, ":", 1);
+            }
+            print_value(p, child);
+            if (child->next)
+                print_append(p, ",", 1);
+        }
+        print_append(p, item->type == cJSON_Array ? "]" : "}", 1);
+        break;
+    }
+}
+
+char *cJSON_PrintUnformatted(const cJSON *item)
+{
+    printbuf_t p = { NULL, 0, 0 };
+
+    if (!item)
+        return NULL;
+
+    print_value(&p, item);
+    return p.buf;
+}
@@ -0,0 +1,189 @@
+#include "fakes.h"
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Only the getters used by the modules under test are faked. Unless set by
+ * the test, they return the defaults of an empty config.json */
+
+/* Constants */
+#define FAKE_CONFIG_MAX 16
+
+/* Types */
+typedef struct {
+    const char *key;
+    const void *value;
+} fake_config_entry_t;
+
+/* Internal state */
+static fake_config_entry_t service_names[FAKE_CONFIG_MAX];
+static fake_config_entry_t characteristic_names[FAKE_CONFIG_MAX];
+static fake_config_entry_t characteristic_types[FAKE_CONFIG_MAX];
+static fake_config_entry_t characteristic_fields[FAKE_CONFIG_MAX];
+static const char *whitelist[FAKE_CONFIG_MAX];
+
+static void fake_config_set(fake_config_entry_t *entries, const char *key,
+    const void *value)
+{
+    int i;
+
+    for (i = 0; i < FAKE_CONFIG_MAX - 1 && entries[i].key &&
+        strcmp(entries[i].key, key); i++);
+
+    entries[i].key = key;
+    entries[i].value = value;
+}
+
+static const void *fake_config_get(fake_config_entry_t *entries,
+    const char *key)
+{
+    int i;
+
+    for (i = 0; i < FAKE_CONFIG_MAX && entries[i].key; i++)
+    {
+        if (!strcmp(entries[i].key, key))
+            return entries[i].value;
+    }
+
+    return NULL;
+}
+
+void fake_config_service_name_set(const char *uuid, const char *name)
+{
+    fake_config_set(service_names, uuid, name);
+}
+
+void fake_config_characteristic_name_set(const char *uuid, const char *name)
+{
+    fake_config_set(characteristic_names, uuid, name);
+}
+
+void fake_config_characteristic_types_set(const char *uuid,
+    const char **types)
+{
+    fake_config_set(characteristic_types, uuid, types);
+}
+
+void fake_config_characteristic_fields_set(const char *uuid,
+    const char **fields)
+{
+    fake_config_set(characteristic_fields, uuid, fields);
+}
+
+void fake_config_whitelist_add(const char *mac)
+{
+    int i;
+
+    for (i = 0; i < FAKE_CONFIG_MAX - 1 && whitelist[i]; i++);
+    whitelist[i] = mac;
+}
+
+/* BLE Configuration */
+const char *config_ble_service_name_get(const char *uuid)
+{
+    return fake_config_get(service_names, uuid);
+}
+
+const char *config_ble_service_format_get(const char *uuid)
+{
+    return NULL;
+}
+
+const char *config_ble_characteristic_name_get(const char *uuid)
+{
+    return fake_config_get(characteristic_names, uuid);
+}
+
+const char **config_ble_characteristic_types_get(const char *uuid)
+{
+    return (const char **)fake_config_get(characteristic_types, uuid);
+}
+
+const char **config_ble_characteristic_fields_get(const char *uuid)
+{
+    return (const char **)fake_config_get(characteristic_fields, uuid);
+}
+
+const char *config_ble_characteristic_format_get(const char *uuid)
+{
+    return NULL;
+}
+
+int config_ble_characteristic_priority_get(const char *uuid)
+{
+    return 0;
+}
+
+uint32_t config_ble_characteristic_batch_get(const char *uuid)
+{
+    return 0;
+}
+
+void config_ble_characteristic_transforms_foreach(config_on_transform_cb_t cb)
+{
+}
+
+void config_ble_characteristic_layouts_foreach(config_on_layout_cb_t cb)
+{
+}
+
+uint8_t config_ble_characteristic_should_include(const char *uuid)
+{
+    return 1;
+}
+
+uint8_t config_ble_service_should_include(const char *uuid)
+{
+    return 1;
+}
+
+uint8_t config_ble_should_connect(const char *mac)
+{
+    int i;
+
+    if (!whitelist[0])
+        return 1;
+
+    for (i = 0; i < FAKE_CONFIG_MAX && whitelist[i]; i++)
+    {
+        if (!strcmp(whitelist[i], mac))
+            return 1;
+    }
+
+    return 0;
+}
+
+void config_ble_whitelist_foreach(config_on_mac_cb_t cb)
+{
+    int i;
+
+    for (i = 0; i < FAKE_CONFIG_MAX && whitelist[i]; i++)
+        cb(whitelist[i]);
+}
+
+uint32_t config_ble_passkey_get(const char *mac)
+{
+    return 0;
+}
+
+uint8_t config_ble_device_changed(const char *mac)
+{
+    return 1;
+}
+
+uint32_t config_ble_poll_interval_get(void)
+{
+    return 60;
+}
+
+/* Metrics Configuration */
+uint32_t config_metrics_interval_get(void)
+{
+    return 60;
+}
+
+/* Trace Configuration */
+uint32_t config_trace_size_get(void)
+{
+    return 64;
+}
@@ -0,0 +1,82 @@
+#include "fakes.h"
+#include <esp_heap_caps.h>
+#include <esp_log.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Constants */
+#define FAKE_HEAP_SIZE (160 * 1024)
+
+/* Internal state */
+int fake_restarts = 0;
+int fake_logs[ESP_LOG_VERBOSE + 1];
+static int log_level = -1;
+
+/* Logging */
+void fake_log_level_set(esp_log_level_t level)
+{
+    log_level = level;
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format,
+    ...)
+{
+    static const char letters[] = "NEWIDV";
+    const char *env;
+    va_list args;
+
+    if (log_level < 0)
+    {
+        env = getenv("FAKE_LOG_LEVEL");
+        log_level = env ? atoi(env) : ESP_LOG_NONE;
+    }
+
+    __atomic_fetch_add(&fake_logs[level], 1, __ATOMIC_RELAXED);
+    if (level > log_level)
+        return;
+
+    fprintf(stderr, "%c (%u) %s: ", letters[level], esp_log_timestamp(), tag);
+    va_start(args, format);
+    vfprintf(stderr, format, args);
+    va_end(args);
+    fputc('\n', stderr);
+}
+
+uint32_t esp_log_timestamp(void)
+{
+    return esp_timer_get_time() / 1000;
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+}
+
+/* System */
+uint32_t esp_get_free_heap_size(void)
+{
+    return FAKE_HEAP_SIZE;
+}
+
+void esp_restart(void)
+{
+    fake_restarts++;
+}
+
+/* Heap */
+size_t heap_caps_get_free_size(uint32_t caps)
+{
+    return FAKE_HEAP_SIZE;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps)
+{
+    return FAKE_HEAP_SIZE / 2;
+}
+
+size_t heap_caps_get_largest_free_block(uint32_t caps)
+{
+    return FAKE_HEAP_SIZE / 4;
+}
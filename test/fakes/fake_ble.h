@@ -0,0 +1,116 @@
+#ifndef FAKE_BLE_H
+#define FAKE_BLE_H
+
+#include <esp_gap_ble_api.h>
+#include <esp_gattc_api.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* A fake Bluedroid stack and controller. Requests made through the esp_*
+ * API raise their events asynchronously, as on the device: they are queued
+ * and delivered to the registered callbacks by fake_ble_run(). Peripherals in
+ * range are defined by the test and keep their GATT database, security
+ * requirements and subscriptions */
+
+/* Types */
+typedef struct fake_ble_peripheral_t fake_ble_peripheral_t;
+
+/* Fills in the value of a notification, returns its length */
+typedef size_t (*fake_ble_value_cb_t)(fake_ble_peripheral_t *peripheral,
+    uint16_t handle, uint8_t *value, size_t size);
+
+/* Peripherals */
+fake_ble_peripheral_t *fake_ble_peripheral_add(const char *mac,
+    esp_ble_addr_type_t addr_type);
+uint8_t *fake_ble_peripheral_mac(fake_ble_peripheral_t *peripheral);
+int fake_ble_peripheral_is_connected(fake_ble_peripheral_t *peripheral);
+int fake_ble_peripheral_is_encrypted(fake_ble_peripheral_t *peripheral);
+/* Pairing requires entering this passkey, 0 for Just Works */
+void fake_ble_peripheral_passkey_set(fake_ble_peripheral_t *peripheral,
+    uint32_t passkey);
+/* Pairing with the peripheral fails */
+void fake_ble_peripheral_pairing_fail(fake_ble_peripheral_t *peripheral);
+
+/* GATT database, attributes are numbered in the order they're added. Returns
+ * the handle of the attribute */
+uint16_t fake_ble_service_add(fake_ble_peripheral_t *peripheral,
+    uint16_t uuid);
+/* Adds the Client Characteristic Configuration descriptor as well if the
+ * characteristic notifies or indicates. Returns the handle of the value */
+uint16_t fake_ble_characteristic_add(fake_ble_peripheral_t *peripheral,
+    uint16_t uuid, uint8_t properties, const void *value, size_t len);
+/* Adds a descriptor to the last characteristic */
+uint16_t fake_ble_descriptor_add(fake_ble_peripheral_t *peripheral,
+    uint16_t uuid, const void *value, size_t len);
+const uint8_t *fake_ble_attribute_get(fake_ble_peripheral_t *peripheral,
+    uint16_t handle, size_t *len);
+/* Accessing the attribute requires an encrypted link */
+void fake_ble_attribute_secure(fake_ble_peripheral_t *peripheral,
+    uint16_t handle);
+/* Requests to access the attribute are refused by the stack, no event
+ * follows */
+void fake_ble_attribute_refuse(fake_ble_peripheral_t *peripheral,
+    uint16_t handle);
+
+/* Peripheral actions */
+/* Reported if scanning and not filtered out by the controller */
+void fake_ble_advertise(fake_ble_peripheral_t *peripheral);
+/* Returns -1 if the client isn't subscribed */
+int fake_ble_notify(fake_ble_peripheral_t *peripheral, uint16_t handle,
+    const void *value, size_t len);
+int fake_ble_indicate(fake_ble_peripheral_t *peripheral, uint16_t handle,
+    const void *value, size_t len);
+void fake_ble_disconnect(fake_ble_peripheral_t *peripheral);
+/* The characteristic notifies this many times per second of the fake clock
+ * while the client is subscribed, 0 stops it. Notifications carry the value
+ * of the characteristic unless the callback fills them in */
+void fake_ble_notify_rate_set(fake_ble_peripheral_t *peripheral,
+    uint16_t handle, uint32_t rate, fake_ble_value_cb_t cb);
+
+/* Bonds */
+void fake_ble_bond_add(fake_ble_peripheral_t *peripheral);
+int fake_ble_is_bonded(fake_ble_peripheral_t *peripheral);
+/* The completion of bond removals is never raised */
+void fake_ble_bond_removal_hang(void);
+
+/* Controller state */
+int fake_ble_is_scanning(void);
+const esp_ble_scan_params_t *fake_ble_scan_params(void);
+int fake_ble_whitelist_size(void);
+
+/* Delivers the queued events, including those raised meanwhile */
+void fake_ble_run(void);
+
+/* Events are delivered from a separate thread as soon as they're raised, as
+ * from Bluedroid's BTC task, and fake_ble_run() waits until they all are. The
+ * test thread acts as the other tasks: the fake clock, its timers and the
+ * requests it makes race with the callbacks. Peripherals are defined before
+ * starting it. Stopping delivers the events left first */
+void fake_ble_btc_thread_start(void);
+void fake_ble_btc_thread_stop(void);
+/* Notifications raised while this many events are queued are dropped, as
+ * when the host's buffers are full. 0, the default, for no limit */
+void fake_ble_queue_limit_set(size_t limit);
+
+/* Replay of captured events, see replay.c. Once started, requests are accepted
+ * but their events are discarded, the captured ones are delivered instead.
+ * The GATT database of a connection is the one captured for it */
+void fake_ble_replay_start(void);
+void fake_ble_replay_db_set(uint16_t conn_id, const esp_gattc_db_elem_t *db,
+    uint16_t count);
+void fake_ble_replay_gap_event(esp_gap_ble_cb_event_t event,
+    esp_ble_gap_cb_param_t *param);
+void fake_ble_replay_gattc_event(esp_gattc_cb_event_t event,
+    esp_gatt_if_t gattc_if, esp_ble_gattc_cb_param_t *param);
+
+/* Statistics */
+/* GATT requests accepted by the stack */
+extern int fake_ble_requests;
+/* Highest number of GATT requests in flight on a connection */
+extern int fake_ble_max_in_flight;
+/* Notifications and indications sent by peripherals, and those of them
+ * dropped by the host */
+extern int fake_ble_notifications;
+extern int fake_ble_notifications_dropped;
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef FAKE_MQTT_H
+#define FAKE_MQTT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* An in-process MQTT broker behind the esp_mqtt API. The bridge is its only
+ * connected client, the test publishes as the other ones. Retained messages,
+ * wildcard subscriptions and QoS 0 and 1 are supported, higher QoS are
+ * downgraded to 1. Sessions are clean, subscriptions are dropped with the
+ * connection. As esp_mqtt calls back from its own task, status changes and
+ * messages are queued and delivered by fake_mqtt_run() */
+
+/* Types */
+typedef struct {
+    const char *topic;
+    const uint8_t *payload;
+    size_t len;
+    int qos;
+    uint8_t retained;
+} fake_mqtt_message_t;
+
+/* Other clients */
+/* An empty retained payload clears the topic's retained message */
+void fake_mqtt_publish(const char *topic, const void *payload, size_t len,
+    uint8_t retained);
+
+/* Broker state */
+/* NULL if the topic has no retained message */
+const uint8_t *fake_mqtt_retained_get(const char *topic, size_t *len);
+int fake_mqtt_is_subscribed(const char *filter);
+/* Publications of the bridge received by the broker, in order */
+int fake_mqtt_publications(void);
+const fake_mqtt_message_t *fake_mqtt_publication_get(int index);
+
+/* Network */
+/* QoS 1 publications and subscriptions wait for the broker's acknowledgment,
+ * the clock moves this much meanwhile */
+void fake_mqtt_latency_set(uint32_t ms);
+/* The connection drops, and esp_mqtt can't reconnect until the outage ends */
+void fake_mqtt_outage_start(void);
+void fake_mqtt_outage_end(void);
+/* The next requests time out, after the command timeout */
+void fake_mqtt_fail_next(int count);
+int fake_mqtt_is_connected(void);
+
+/* Delivers the queued status changes and messages, including those raised
+ * meanwhile */
+void fake_mqtt_run(void);
+
+#endif
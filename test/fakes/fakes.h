@@ -0,0 +1,54 @@
+#ifndef FAKES_H
+#define FAKES_H
+
+#include <esp_log.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/ringbuf.h>
+#include <pthread.h>
+#include <stdint.h>
+
+/* Threads */
+/* Fakes shared with the BTC thread, see fake_ble.h, hold their recursive lock
+ * until the end of the scope */
+static inline pthread_mutex_t *fake_lock(pthread_mutex_t *lock)
+{
+    pthread_mutex_lock(lock);
+    return lock;
+}
+
+static inline void fake_unlock(pthread_mutex_t **lock)
+{
+    pthread_mutex_unlock(*lock);
+}
+
+#define FAKE_LOCKED(lock) pthread_mutex_t *__locked \
+    __attribute__((cleanup(fake_unlock))) = fake_lock(lock)
+
+/* Clock */
+/* Moves the clock forward, firing the timers expiring meanwhile in order */
+void fake_clock_advance(uint32_t ms);
+
+/* System */
+/* Number of esp_restart() calls */
+extern int fake_restarts;
+/* Number of messages logged per level */
+extern int fake_logs[ESP_LOG_VERBOSE + 1];
+/* Messages up to this level are printed, defaults to FAKE_LOG_LEVEL from the
+ * environment, if set, or ESP_LOG_NONE */
+void fake_log_level_set(esp_log_level_t level);
+
+/* Ring buffers */
+/* The last one created, tasks never run so tests read what was sent to it */
+RingbufHandle_t fake_ringbuf_last(void);
+
+/* Configuration, everything else has the config.json defaults */
+void fake_config_service_name_set(const char *uuid, const char *name);
+void fake_config_characteristic_name_set(const char *uuid, const char *name);
+/* Types and field names are NULL terminated lists */
+void fake_config_characteristic_types_set(const char *uuid,
+    const char **types);
+void fake_config_characteristic_fields_set(const char *uuid,
+    const char **fields);
+void fake_config_whitelist_add(const char *mac);
+
+#endif
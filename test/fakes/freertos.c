@@ -0,0 +1,225 @@
+#define _GNU_SOURCE
+#include "fakes.h"
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <freertos/timers.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Types */
+struct fake_timer_t {
+    struct fake_timer_t *next;
+    TimerCallbackFunction_t callback;
+    void *id;
+    int64_t period;
+    int64_t expiry;
+    uint8_t auto_reload;
+    uint8_t is_active;
+};
+
+struct fake_semaphore_t {
+    uint8_t is_taken;
+};
+
+/* Internal state */
+static int64_t now = 0;
+static struct fake_timer_t *timers = NULL;
+/* Timers may be started by the BTC thread while the clock moves */
+static pthread_mutex_t timers_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+/* Clock */
+int64_t esp_timer_get_time(void)
+{
+    return __atomic_load_n(&now, __ATOMIC_SEQ_CST);
+}
+
+static struct fake_timer_t *fake_timer_next(int64_t until)
+{
+    struct fake_timer_t *timer, *next = NULL;
+
+    for (timer = timers; timer; timer = timer->next)
+    {
+        if (timer->is_active && timer->expiry <= until &&
+            (!next || timer->expiry < next->expiry))
+        {
+            next = timer;
+        }
+    }
+
+    return next;
+}
+
+void fake_clock_advance(uint32_t ms)
+{
+    struct fake_timer_t *timer;
+    int64_t until;
+
+    pthread_mutex_lock(&timers_lock);
+    until = now + (int64_t)ms * 1000;
+    while ((timer = fake_timer_next(until)))
+    {
+        __atomic_store_n(&now, timer->expiry, __ATOMIC_SEQ_CST);
+        if (timer->auto_reload)
+            timer->expiry += timer->period;
+        else
+            timer->is_active = 0;
+
+        /* Callbacks may take the locks of other fakes */
+        pthread_mutex_unlock(&timers_lock);
+        timer->callback(timer);
+        pthread_mutex_lock(&timers_lock);
+    }
+
+    __atomic_store_n(&now, until, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&timers_lock);
+}
+
+/* Tasks */
+BaseType_t xTaskCreate(TaskFunction_t task, const char *name,
+    uint32_t stack_depth, void *parameters, UBaseType_t priority,
+    TaskHandle_t *created_task)
+{
+    return xTaskCreatePinnedToCore(task, name, stack_depth, parameters,
+        priority, created_task, 0);
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name,
+    uint32_t stack_depth, void *parameters, UBaseType_t priority,
+    TaskHandle_t *created_task, BaseType_t core_id)
+{
+    if (created_task)
+        *created_task = (TaskHandle_t)name;
+
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    fake_clock_advance(ticks * portTICK_PERIOD_MS);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return esp_timer_get_time() / 1000 / portTICK_PERIOD_MS;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    /* Each thread, e.g. the BTC one, is a task */
+    static __thread int task;
+
+    return &task;
+}
+
+/* Timers */
+TimerHandle_t xTimerCreate(const char *name, TickType_t period,
+    UBaseType_t auto_reload, void *timer_id, TimerCallbackFunction_t callback)
+{
+    struct fake_timer_t *timer = calloc(1, sizeof(*timer));
+    FAKE_LOCKED(&timers_lock);
+
+    timer->callback = callback;
+    timer->id = timer_id;
+    timer->period = (int64_t)period * portTICK_PERIOD_MS * 1000;
+    timer->auto_reload = auto_reload;
+    timer->next = timers;
+    timers = timer;
+
+    return timer;
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t ticks_to_wait)
+{
+    FAKE_LOCKED(&timers_lock);
+
+    timer->expiry = now + timer->period;
+    timer->is_active = 1;
+    return pdPASS;
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t ticks_to_wait)
+{
+    FAKE_LOCKED(&timers_lock);
+
+    timer->is_active = 0;
+    return pdPASS;
+}
+
+BaseType_t xTimerReset(TimerHandle_t timer, TickType_t ticks_to_wait)
+{
+    return xTimerStart(timer, ticks_to_wait);
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period,
+    TickType_t ticks_to_wait)
+{
+    FAKE_LOCKED(&timers_lock);
+
+    timer->period = (int64_t)period * portTICK_PERIOD_MS * 1000;
+    return xTimerStart(timer, ticks_to_wait);
+}
+
+BaseType_t xTimerIsTimerActive(TimerHandle_t timer)
+{
+    FAKE_LOCKED(&timers_lock);
+
+    return timer->is_active;
+}
+
+BaseType_t xTimerDelete(TimerHandle_t timer, TickType_t ticks_to_wait)
+{
+    struct fake_timer_t **iter;
+    FAKE_LOCKED(&timers_lock);
+
+    for (iter = &timers; *iter && *iter != timer; iter = &(*iter)->next);
+    if (*iter)
+        *iter = timer->next;
+    free(timer);
+
+    return pdPASS;
+}
+
+void *pvTimerGetTimerID(TimerHandle_t timer)
+{
+    return timer->id;
+}
+
+/* Semaphores */
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return calloc(1, sizeof(struct fake_semaphore_t));
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks)
+{
+    /* There's no other task to give it back */
+    if (semaphore->is_taken)
+    {
+        fprintf(stderr, "Mutex %p taken twice, this would deadlock\n",
+            (void *)semaphore);
+        abort();
+    }
+
+    semaphore->is_taken = 1;
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    if (!semaphore->is_taken)
+        return pdFALSE;
+
+    semaphore->is_taken = 0;
+    return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t semaphore)
+{
+    free(semaphore);
+}
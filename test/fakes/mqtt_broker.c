@@ -0,0 +1,445 @@
+#define _GNU_SOURCE
+#include "fake_mqtt.h"
+#include "fakes.h"
+#include <esp_mqtt.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Constants */
+#define FAKE_SUBSCRIPTIONS_MAX 64
+#define FAKE_PUBLICATIONS_MAX 256
+
+/* Types */
+typedef struct fake_retained_t {
+    struct fake_retained_t *next;
+    char *topic;
+    size_t len;
+    uint8_t payload[];
+} fake_retained_t;
+
+typedef struct fake_mqtt_event_t {
+    struct fake_mqtt_event_t *next;
+    uint8_t is_status;
+    esp_mqtt_status_t status;
+    char *topic;
+    size_t len;
+    uint8_t payload[];
+} fake_mqtt_event_t;
+
+/* Internal state */
+static esp_mqtt_status_callback_t status_cb = NULL;
+static esp_mqtt_message_callback_t message_cb = NULL;
+static int command_timeout = 0;
+static fake_mqtt_event_t *events = NULL;
+static fake_retained_t *retained = NULL;
+static char *subscriptions[FAKE_SUBSCRIPTIONS_MAX];
+static int subscriptions_count = 0;
+static fake_mqtt_message_t publications[FAKE_PUBLICATIONS_MAX];
+static int publications_count = 0;
+static uint32_t latency = 0;
+static int failing = 0;
+static uint8_t is_started = 0;
+static uint8_t is_connected = 0;
+static uint8_t is_out = 0;
+/* All of the above, callbacks are called without it */
+static pthread_mutex_t lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+
+/* Topics, matched level by level independently of the firmware's matcher */
+static const char *fake_level_end(const char *level)
+{
+    for (; *level && *level != '/'; level++);
+    return level;
+}
+
+static int fake_topic_matches(const char *filter, const char *topic)
+{
+    const char *filter_end, *topic_end;
+
+    /* Wildcards at the first level don't match topics starting with '$' */
+    if (*topic == '$' && (*filter == '+' || *filter == '#'))
+        return 0;
+
+    for (;;)
+    {
+        filter_end = fake_level_end(filter);
+        topic_end = fake_level_end(topic);
+
+        if (!strcmp(filter, "#"))
+            return 1;
+        if ((filter_end - filter != 1 || *filter != '+') &&
+            (filter_end - filter != topic_end - topic ||
+            strncmp(filter, topic, topic_end - topic)))
+        {
+            return 0;
+        }
+
+        if (!*topic_end)
+        {
+            /* "a/#" matches its parent level "a" */
+            return !*filter_end || !strcmp(filter_end, "/#");
+        }
+        if (!*filter_end)
+            return 0;
+
+        filter = filter_end + 1;
+        topic = topic_end + 1;
+    }
+}
+
+/* Events */
+static fake_mqtt_event_t *fake_event_new(size_t len)
+{
+    fake_mqtt_event_t *e = calloc(1, sizeof(*e) + len + 1), **iter;
+
+    for (iter = &events; *iter; iter = &(*iter)->next);
+    *iter = e;
+
+    return e;
+}
+
+static void fake_status_event(esp_mqtt_status_t status)
+{
+    fake_mqtt_event_t *e = fake_event_new(0);
+
+    e->is_status = 1;
+    e->status = status;
+}
+
+static void fake_events_free(void)
+{
+    fake_mqtt_event_t *e;
+
+    while ((e = events))
+    {
+        events = e->next;
+        free(e->topic);
+        free(e);
+    }
+}
+
+void fake_mqtt_run(void)
+{
+    fake_mqtt_event_t *e;
+
+    pthread_mutex_lock(&lock);
+    while ((e = events))
+    {
+        events = e->next;
+        pthread_mutex_unlock(&lock);
+
+        if (e->is_status && status_cb)
+            status_cb(e->status);
+        else if (!e->is_status && message_cb)
+            message_cb(e->topic, e->payload, e->len);
+        free(e->topic);
+        free(e);
+
+        pthread_mutex_lock(&lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/* Broker */
+static void fake_subscriptions_free(void)
+{
+    while (subscriptions_count)
+        free(subscriptions[--subscriptions_count]);
+}
+
+static int fake_subscription_find(const char *filter)
+{
+    int i;
+
+    for (i = 0; i < subscriptions_count; i++)
+    {
+        if (!strcmp(subscriptions[i], filter))
+            return i;
+    }
+
+    return -1;
+}
+
+static void fake_deliver(const char *topic, const uint8_t *payload, size_t len)
+{
+    fake_mqtt_event_t *e;
+
+    e = fake_event_new(len);
+    e->topic = strdup(topic);
+    e->len = len;
+    memcpy(e->payload, payload, len);
+}
+
+/* Overlapping subscriptions get a single copy of the message */
+static void fake_route(const char *topic, const uint8_t *payload, size_t len)
+{
+    int i;
+
+    if (!is_connected)
+        return;
+
+    for (i = 0; i < subscriptions_count; i++)
+    {
+        if (fake_topic_matches(subscriptions[i], topic))
+        {
+            fake_deliver(topic, payload, len);
+            return;
+        }
+    }
+}
+
+static void fake_retain(const char *topic, const uint8_t *payload, size_t len)
+{
+    fake_retained_t **cur, *tmp;
+
+    for (cur = &retained; *cur; cur = &(*cur)->next)
+    {
+        if (!strcmp((*cur)->topic, topic))
+            break;
+    }
+
+    if (*cur)
+    {
+        tmp = *cur;
+        *cur = tmp->next;
+        free(tmp->topic);
+        free(tmp);
+    }
+
+    if (!len)
+        return;
+
+    tmp = malloc(sizeof(*tmp) + len);
+    tmp->next = retained;
+    tmp->topic = strdup(topic);
+    tmp->len = len;
+    memcpy(tmp->payload, payload, len);
+    retained = tmp;
+}
+
+void fake_mqtt_publish(const char *topic, const void *payload, size_t len,
+    uint8_t retain)
+{
+    FAKE_LOCKED(&lock);
+
+    if (retain)
+        fake_retain(topic, payload, len);
+    fake_route(topic, payload, len);
+}
+
+const uint8_t *fake_mqtt_retained_get(const char *topic, size_t *len)
+{
+    FAKE_LOCKED(&lock);
+    fake_retained_t *cur;
+
+    for (cur = retained; cur; cur = cur->next)
+    {
+        if (!strcmp(cur->topic, topic))
+        {
+            *len = cur->len;
+            return cur->payload;
+        }
+    }
+
+    return NULL;
+}
+
+int fake_mqtt_is_subscribed(const char *filter)
+{
+    FAKE_LOCKED(&lock);
+
+    return fake_subscription_find(filter) >= 0;
+}
+
+int fake_mqtt_publications(void)
+{
+    FAKE_LOCKED(&lock);
+
+    return publications_count;
+}
+
+const fake_mqtt_message_t *fake_mqtt_publication_get(int index)
+{
+    FAKE_LOCKED(&lock);
+
+    return index < publications_count ? &publications[index] : NULL;
+}
+
+/* Network */
+void fake_mqtt_latency_set(uint32_t ms)
+{
+    FAKE_LOCKED(&lock);
+
+    latency = ms;
+}
+
+static void fake_connection_drop(void)
+{
+    is_connected = 0;
+    fake_subscriptions_free();
+    fake_events_free();
+}
+
+void fake_mqtt_outage_start(void)
+{
+    FAKE_LOCKED(&lock);
+    uint8_t was_connected = is_connected;
+
+    is_out = 1;
+    fake_connection_drop();
+    if (was_connected)
+        fake_status_event(ESP_MQTT_STATUS_DISCONNECTED);
+}
+
+void fake_mqtt_outage_end(void)
+{
+    FAKE_LOCKED(&lock);
+
+    is_out = 0;
+
+    /* esp_mqtt keeps trying to reconnect while started */
+    if (is_started && !is_connected)
+    {
+        is_connected = 1;
+        fake_status_event(ESP_MQTT_STATUS_CONNECTED);
+    }
+}
+
+void fake_mqtt_fail_next(int count)
+{
+    FAKE_LOCKED(&lock);
+
+    failing = count;
+}
+
+int fake_mqtt_is_connected(void)
+{
+    FAKE_LOCKED(&lock);
+
+    return is_connected;
+}
+
+/* Returns 0 if the request times out */
+static int fake_request(int qos)
+{
+    if (!is_connected)
+        return 0;
+
+    if (failing)
+    {
+        failing--;
+        fake_clock_advance(command_timeout);
+        return 0;
+    }
+
+    if (qos && latency)
+        fake_clock_advance(latency);
+
+    return 1;
+}
+
+/* esp_mqtt API */
+void esp_mqtt_init(esp_mqtt_status_callback_t scb,
+    esp_mqtt_message_callback_t mcb, size_t buffer_size, int timeout)
+{
+    FAKE_LOCKED(&lock);
+
+    status_cb = scb;
+    message_cb = mcb;
+    command_timeout = timeout;
+}
+
+bool esp_mqtt_start(const char *host, int port, const char *client_id,
+    const char *username, const char *password)
+{
+    FAKE_LOCKED(&lock);
+
+    if (is_started)
+        return false;
+
+    is_started = 1;
+    if (!is_out)
+    {
+        is_connected = 1;
+        fake_status_event(ESP_MQTT_STATUS_CONNECTED);
+    }
+
+    return true;
+}
+
+bool esp_mqtt_subscribe(const char *topic, int qos)
+{
+    FAKE_LOCKED(&lock);
+    fake_retained_t *cur;
+
+    if (!fake_request(1))
+        return false;
+
+    if (fake_subscription_find(topic) < 0 &&
+        subscriptions_count < FAKE_SUBSCRIPTIONS_MAX)
+    {
+        subscriptions[subscriptions_count++] = strdup(topic);
+    }
+
+    for (cur = retained; cur; cur = cur->next)
+    {
+        if (fake_topic_matches(topic, cur->topic))
+            fake_deliver(cur->topic, cur->payload, cur->len);
+    }
+
+    return true;
+}
+
+bool esp_mqtt_unsubscribe(const char *topic)
+{
+    FAKE_LOCKED(&lock);
+    int i;
+
+    if (!fake_request(1))
+        return false;
+
+    if ((i = fake_subscription_find(topic)) >= 0)
+    {
+        free(subscriptions[i]);
+        subscriptions[i] = subscriptions[--subscriptions_count];
+    }
+
+    return true;
+}
+
+bool esp_mqtt_publish(const char *topic, uint8_t *payload, size_t len,
+    int qos, bool retain)
+{
+    FAKE_LOCKED(&lock);
+    fake_mqtt_message_t *pub;
+    uint8_t *copy;
+
+    qos = qos > 1 ? 1 : qos;
+    if (!fake_request(qos))
+        return false;
+
+    if (publications_count < FAKE_PUBLICATIONS_MAX)
+    {
+        copy = malloc(len + 1);
+        memcpy(copy, payload, len);
+        copy[len] = '\0';
+
+        pub = &publications[publications_count++];
+        pub->topic = strdup(topic);
+        pub->payload = copy;
+        pub->len = len;
+        pub->qos = qos;
+        pub->retained = retain;
+    }
+
+    fake_mqtt_publish(topic, payload, len, retain);
+    return true;
+}
+
+void esp_mqtt_stop(void)
+{
+    FAKE_LOCKED(&lock);
+
+    is_started = 0;
+    fake_connection_drop();
+}
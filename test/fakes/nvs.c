@@ -0,0 +1,121 @@
+#include "fakes.h"
+#include <nvs.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Blobs are kept in memory, committed or not, and handles are the index of
+ * their namespace */
+
+/* Constants */
+#define FAKE_NVS_NAMESPACES_MAX 8
+
+/* Types */
+typedef struct fake_blob_t {
+    struct fake_blob_t *next;
+    char *key;
+    size_t len;
+    uint8_t data[];
+} fake_blob_t;
+
+typedef struct {
+    char *name;
+    fake_blob_t *blobs;
+} fake_namespace_t;
+
+/* Internal state */
+static fake_namespace_t namespaces[FAKE_NVS_NAMESPACES_MAX];
+
+static fake_blob_t **fake_blob_find(nvs_handle handle, const char *key)
+{
+    fake_blob_t **cur;
+
+    for (cur = &namespaces[handle].blobs; *cur; cur = &(*cur)->next)
+    {
+        if (!strcmp((*cur)->key, key))
+            break;
+    }
+
+    return cur;
+}
+
+esp_err_t nvs_open(const char *name, nvs_open_mode open_mode,
+    nvs_handle *out_handle)
+{
+    nvs_handle i;
+
+    for (i = 0; i < FAKE_NVS_NAMESPACES_MAX && namespaces[i].name; i++)
+    {
+        if (!strcmp(namespaces[i].name, name))
+            break;
+    }
+
+    if (i == FAKE_NVS_NAMESPACES_MAX)
+        return ESP_FAIL;
+
+    /* As on the device, namespaces are created when first opened for
+     * writing */
+    if (!namespaces[i].name)
+    {
+        if (open_mode == NVS_READONLY)
+            return ESP_ERR_NVS_NOT_FOUND;
+        namespaces[i].name = strdup(name);
+    }
+
+    *out_handle = i;
+    return ESP_OK;
+}
+
+esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *value,
+    size_t length)
+{
+    fake_blob_t **cur = fake_blob_find(handle, key), *blob;
+
+    blob = malloc(sizeof(*blob) + length);
+    blob->key = strdup(key);
+    blob->len = length;
+    memcpy(blob->data, value, length);
+
+    if (*cur)
+    {
+        blob->next = (*cur)->next;
+        free((*cur)->key);
+        free(*cur);
+    }
+    else
+        blob->next = NULL;
+    *cur = blob;
+
+    return ESP_OK;
+}
+
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *out_value,
+    size_t *length)
+{
+    fake_blob_t *blob = *fake_blob_find(handle, key);
+
+    if (!blob)
+        return ESP_ERR_NVS_NOT_FOUND;
+
+    /* Only the length is requested */
+    if (!out_value)
+    {
+        *length = blob->len;
+        return ESP_OK;
+    }
+
+    if (*length < blob->len)
+        return ESP_FAIL;
+
+    memcpy(out_value, blob->data, blob->len);
+    *length = blob->len;
+    return ESP_OK;
+}
+
+esp_err_t nvs_commit(nvs_handle handle)
+{
+    return ESP_OK;
+}
+
+void nvs_close(nvs_handle handle)
+{
+}
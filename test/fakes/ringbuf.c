@@ -0,0 +1,118 @@
+#include "fakes.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/ringbuf.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Items are never split, byte buffers hand out their content as one item */
+
+/* Types */
+typedef struct fake_item_t {
+    struct fake_item_t *next;
+    size_t size;
+    uint8_t data[];
+} fake_item_t;
+
+struct fake_ringbuf_t {
+    ringbuf_type_t type;
+    size_t size;
+    size_t used;
+    fake_item_t *items;
+};
+
+/* Internal state */
+static RingbufHandle_t last_ringbuf = NULL;
+
+RingbufHandle_t fake_ringbuf_last(void)
+{
+    return last_ringbuf;
+}
+
+RingbufHandle_t xRingbufferCreate(size_t buf_length, ringbuf_type_t type)
+{
+    RingbufHandle_t ringbuf = calloc(1, sizeof(*ringbuf));
+
+    ringbuf->type = type;
+    ringbuf->size = buf_length;
+    last_ringbuf = ringbuf;
+
+    return ringbuf;
+}
+
+BaseType_t xRingbufferSend(RingbufHandle_t ringbuf, const void *data,
+    size_t data_size, TickType_t ticks_to_wait)
+{
+    fake_item_t **iter, *item;
+
+    /* Nothing would make room while waiting */
+    if (ringbuf->used + data_size > ringbuf->size)
+        return pdFALSE;
+
+    item = malloc(sizeof(*item) + data_size);
+    item->next = NULL;
+    item->size = data_size;
+    memcpy(item->data, data, data_size);
+
+    for (iter = &ringbuf->items; *iter; iter = &(*iter)->next);
+    *iter = item;
+    ringbuf->used += data_size;
+
+    return pdTRUE;
+}
+
+void *xRingbufferReceiveUpTo(RingbufHandle_t ringbuf, size_t *item_size,
+    TickType_t ticks_to_wait, size_t wanted_size)
+{
+    fake_item_t *item;
+    uint8_t *data;
+    size_t size = 0;
+
+    if (!ringbuf->items)
+        return NULL;
+
+    if (ringbuf->type != RINGBUF_TYPE_BYTEBUF)
+    {
+        item = ringbuf->items;
+        ringbuf->items = item->next;
+        ringbuf->used -= item->size;
+        *item_size = item->size;
+        data = malloc(item->size);
+        memcpy(data, item->data, item->size);
+        free(item);
+        return data;
+    }
+
+    /* Bytes are received across the items they were sent in */
+    data = malloc(ringbuf->used < wanted_size ? ringbuf->used : wanted_size);
+    while ((item = ringbuf->items) && size < wanted_size)
+    {
+        size_t len = item->size < wanted_size - size ?
+            item->size : wanted_size - size;
+
+        memcpy(data + size, item->data, len);
+        size += len;
+        item->size -= len;
+        memmove(item->data, item->data + len, item->size);
+        if (!item->size)
+        {
+            ringbuf->items = item->next;
+            free(item);
+        }
+    }
+    ringbuf->used -= size;
+    *item_size = size;
+
+    return data;
+}
+
+void *xRingbufferReceive(RingbufHandle_t ringbuf, size_t *item_size,
+    TickType_t ticks_to_wait)
+{
+    return xRingbufferReceiveUpTo(ringbuf, item_size, ticks_to_wait,
+        ringbuf->size);
+}
+
+void vRingbufferReturnItem(RingbufHandle_t ringbuf, void *item)
+{
+    free(item);
+}
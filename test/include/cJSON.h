@@ -0,0 +1,63 @@
+#ifndef CJSON_H
+#define CJSON_H
+
+/* Host stand-in for the cJSON header shipped with ESP-IDF, see
+ * test/README.md. Only the subset used by the firmware is implemented by
+ * fakes/cJSON.c */
+#include <stddef.h>
+
+#define cJSON_Invalid (0)
+#define cJSON_False (1 << 0)
+#define cJSON_True (1 << 1)
+#define cJSON_NULL (1 << 2)
+#define cJSON_Number (1 << 3)
+#define cJSON_String (1 << 4)
+#define cJSON_Array (1 << 5)
+#define cJSON_Object (1 << 6)
+
+typedef struct cJSON {
+    struct cJSON *next;
+    struct cJSON *prev;
+    struct cJSON *child;
+    int type;
+    char *valuestring;
+    int valueint;
+    double valuedouble;
+    char *string;
+} cJSON;
+
+char *cJSON_PrintUnformatted(const cJSON *item);
+void cJSON_Delete(cJSON *item);
+
+cJSON *cJSON_GetObjectItemCaseSensitive(const cJSON *object,
+    const char *string);
+
+int cJSON_IsFalse(const cJSON *item);
+int cJSON_IsTrue(const cJSON *item);
+int cJSON_IsBool(const cJSON *item);
+int cJSON_IsNull(const cJSON *item);
+int cJSON_IsNumber(const cJSON *item);
+int cJSON_IsString(const cJSON *item);
+int cJSON_IsArray(const cJSON *item);
+int cJSON_IsObject(const cJSON *item);
+
+cJSON *cJSON_CreateNull(void);
+cJSON *cJSON_CreateBool(int boolean);
+cJSON *cJSON_CreateNumber(double num);
+cJSON *cJSON_CreateString(const char *string);
+cJSON *cJSON_CreateArray(void);
+cJSON *cJSON_CreateObject(void);
+
+void cJSON_AddItemToArray(cJSON *array, cJSON *item);
+void cJSON_AddItemToObject(cJSON *object, const char *string, cJSON *item);
+
+#define cJSON_AddNumberToObject(object, name, n) \
+    cJSON_AddItemToObject(object, name, cJSON_CreateNumber(n))
+#define cJSON_AddStringToObject(object, name, s) \
+    cJSON_AddItemToObject(object, name, cJSON_CreateString(s))
+
+#define cJSON_ArrayForEach(element, array) \
+    for (element = (array != NULL) ? (array)->child : NULL; element != NULL; \
+        element = element->next)
+
+#endif
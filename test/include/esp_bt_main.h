@@ -0,0 +1,10 @@
+#ifndef ESP_BT_MAIN_H
+#define ESP_BT_MAIN_H
+
+/* Host stand-in for the ESP-IDF header, see test/README.md */
+#include "esp_err.h"
+
+esp_err_t esp_bluedroid_init(void);
+esp_err_t esp_bluedroid_enable(void);
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef ESP_ERR_H
+#define ESP_ERR_H
+
+/* Host stand-in for the ESP-IDF header, see test/README.md */
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_FAIL -1
+
+#define ESP_ERROR_CHECK(x) do { \
+    esp_err_t __err_rc = (x); \
+    if (__err_rc != ESP_OK) \
+    { \
+        fprintf(stderr, "%s:%d: %s failed: %d\n", __FILE__, __LINE__, #x, \
+            __err_rc); \
+        abort(); \
+    } \
+} while (0);
+
+#endif
@@ -0,0 +1,182 @@
+#ifndef ESP_GAP_BLE_API_H
+#define ESP_GAP_BLE_API_H
+
+/* Host stand-in for the ESP-IDF header, see test/README.md. Only the subset
+ * used by the firmware is declared, implemented by fakes/ble_stack.c */
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef uint8_t esp_bd_addr_t[6];
+
+typedef enum {
+    BLE_ADDR_TYPE_PUBLIC,
+    BLE_ADDR_TYPE_RANDOM,
+    BLE_ADDR_TYPE_RPA_PUBLIC,
+    BLE_ADDR_TYPE_RPA_RANDOM,
+} esp_ble_addr_type_t;
+
+typedef enum {
+    ESP_GAP_BLE_ADV_DATA_SET_COMPLETE_EVT = 0,
+    ESP_GAP_BLE_SCAN_RSP_DATA_SET_COMPLETE_EVT,
+    ESP_GAP_BLE_SCAN_PARAM_SET_COMPLETE_EVT,
+    ESP_GAP_BLE_SCAN_RESULT_EVT,
+    ESP_GAP_BLE_ADV_DATA_RAW_SET_COMPLETE_EVT,
+    ESP_GAP_BLE_SCAN_RSP_DATA_RAW_SET_COMPLETE_EVT,
+    ESP_GAP_BLE_ADV_START_COMPLETE_EVT,
+    ESP_GAP_BLE_SCAN_START_COMPLETE_EVT,
+    ESP_GAP_BLE_AUTH_CMPL_EVT,
+    ESP_GAP_BLE_KEY_EVT,
+    ESP_GAP_BLE_SEC_REQ_EVT,
+    ESP_GAP_BLE_PASSKEY_NOTIF_EVT,
+    ESP_GAP_BLE_PASSKEY_REQ_EVT,
+    ESP_GAP_BLE_OOB_REQ_EVT,
+    ESP_GAP_BLE_LOCAL_IR_EVT,
+    ESP_GAP_BLE_LOCAL_ER_EVT,
+    ESP_GAP_BLE_NC_REQ_EVT,
+    ESP_GAP_BLE_ADV_STOP_COMPLETE_EVT,
+    ESP_GAP_BLE_SCAN_STOP_COMPLETE_EVT,
+    ESP_GAP_BLE_SET_STATIC_RAND_ADDR_EVT,
+    ESP_GAP_BLE_UPDATE_CONN_PARAMS_EVT,
+    ESP_GAP_BLE_SET_PKT_LENGTH_COMPLETE_EVT,
+    ESP_GAP_BLE_SET_LOCAL_PRIVACY_COMPLETE_EVT,
+    ESP_GAP_BLE_REMOVE_BOND_DEV_COMPLETE_EVT,
+    ESP_GAP_BLE_CLEAR_BOND_DEV_COMPLETE_EVT,
+    ESP_GAP_BLE_GET_BOND_DEV_COMPLETE_EVT,
+    ESP_GAP_BLE_READ_RSSI_COMPLETE_EVT,
+    ESP_GAP_BLE_ADD_WHITELIST_COMPLETE_EVT,
+    ESP_GAP_BLE_EVT_MAX,
+} esp_gap_ble_cb_event_t;
+
+typedef enum {
+    ESP_GAP_SEARCH_INQ_RES_EVT = 0,
+    ESP_GAP_SEARCH_INQ_CMPL_EVT,
+} esp_gap_search_evt_t;
+
+typedef enum {
+    ESP_BT_STATUS_SUCCESS = 0,
+    ESP_BT_STATUS_FAIL,
+} esp_bt_status_t;
+
+typedef enum {
+    BLE_SCAN_TYPE_PASSIVE,
+    BLE_SCAN_TYPE_ACTIVE,
+} esp_ble_scan_type_t;
+
+typedef enum {
+    BLE_SCAN_FILTER_ALLOW_ALL,
+    BLE_SCAN_FILTER_ALLOW_ONLY_WLST,
+    BLE_SCAN_FILTER_ALLOW_UND_RPA_DIR,
+    BLE_SCAN_FILTER_ALLOW_WLIST_PRA_DIR,
+} esp_ble_scan_filter_t;
+
+typedef enum {
+    BLE_SCAN_DUPLICATE_DISABLE,
+    BLE_SCAN_DUPLICATE_ENABLE,
+} esp_ble_scan_duplicate_t;
+
+typedef struct {
+    esp_ble_scan_type_t scan_type;
+    esp_ble_addr_type_t own_addr_type;
+    esp_ble_scan_filter_t scan_filter_policy;
+    uint16_t scan_interval;
+    uint16_t scan_window;
+    esp_ble_scan_duplicate_t scan_duplicate;
+} esp_ble_scan_params_t;
+
+typedef enum {
+    ESP_BLE_SEC_ENCRYPT = 1,
+    ESP_BLE_SEC_ENCRYPT_NO_MITM,
+    ESP_BLE_SEC_ENCRYPT_MITM,
+} esp_ble_sec_act_t;
+
+typedef enum {
+    ESP_BLE_SM_PASSKEY,
+    ESP_BLE_SM_AUTHEN_REQ_MODE,
+    ESP_BLE_SM_IOCAP_MODE,
+} esp_ble_sm_param_t;
+
+typedef uint8_t esp_ble_io_cap_t;
+#define ESP_IO_CAP_OUT 0
+#define ESP_IO_CAP_IO 1
+#define ESP_IO_CAP_IN 2
+#define ESP_IO_CAP_NONE 3
+
+typedef struct {
+    esp_bd_addr_t bd_addr;
+} esp_ble_sec_req_t;
+
+typedef struct {
+    esp_bd_addr_t bd_addr;
+    bool key_present;
+    uint8_t key_type;
+    bool success;
+    uint8_t fail_reason;
+    esp_ble_addr_type_t addr_type;
+    uint8_t dev_type;
+} esp_ble_auth_cmpl_t;
+
+typedef union {
+    esp_ble_sec_req_t ble_req;
+    esp_ble_auth_cmpl_t auth_cmpl;
+} esp_ble_sec_t;
+
+typedef struct {
+    esp_bd_addr_t bd_addr;
+} esp_ble_bond_dev_t;
+
+typedef enum {
+    ESP_BLE_WHITELIST_REMOVE,
+    ESP_BLE_WHITELIST_ADD,
+} esp_ble_wl_opration_t;
+
+typedef union {
+    struct {
+        esp_bt_status_t status;
+    } scan_param_cmpl, scan_start_cmpl, scan_stop_cmpl, local_privacy_cmpl;
+    struct {
+        esp_gap_search_evt_t search_evt;
+        esp_bd_addr_t bda;
+        uint8_t dev_type;
+        esp_ble_addr_type_t ble_addr_type;
+        int rssi;
+        uint8_t ble_adv[62];
+        int flag;
+        int num_resps;
+        uint8_t adv_data_len;
+        uint8_t scan_rsp_len;
+    } scan_rst;
+    esp_ble_sec_t ble_security;
+    struct {
+        esp_bt_status_t status;
+        esp_bd_addr_t bd_addr;
+    } remove_bond_dev_cmpl;
+    struct {
+        esp_bt_status_t status;
+        esp_ble_wl_opration_t wl_opration;
+    } add_whitelist_cmpl;
+} esp_ble_gap_cb_param_t;
+
+typedef void (*esp_gap_ble_cb_t)(esp_gap_ble_cb_event_t event,
+    esp_ble_gap_cb_param_t *param);
+
+esp_err_t esp_ble_gap_register_callback(esp_gap_ble_cb_t callback);
+esp_err_t esp_ble_gap_config_local_privacy(bool privacy_enable);
+esp_err_t esp_ble_gap_set_scan_params(esp_ble_scan_params_t *scan_params);
+esp_err_t esp_ble_gap_start_scanning(uint32_t duration);
+esp_err_t esp_ble_gap_stop_scanning(void);
+esp_err_t esp_ble_gap_update_whitelist(bool add_remove,
+    esp_bd_addr_t remote_bda);
+esp_err_t esp_ble_gap_get_whitelist_size(uint16_t *length);
+esp_err_t esp_ble_gap_set_security_param(esp_ble_sm_param_t param_type,
+    void *value, uint8_t len);
+esp_err_t esp_ble_set_encryption(esp_bd_addr_t bd_addr,
+    esp_ble_sec_act_t sec_act);
+esp_err_t esp_ble_passkey_reply(esp_bd_addr_t bd_addr, bool accept,
+    uint32_t passkey);
+int esp_ble_get_bond_device_num(void);
+esp_err_t esp_ble_get_bond_device_list(int *dev_num,
+    esp_ble_bond_dev_t *dev_list);
+esp_err_t esp_ble_remove_bond_device(esp_bd_addr_t bd_addr);
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef ESP_GATT_COMMON_API_H
+#define ESP_GATT_COMMON_API_H
+
+/* Host stand-in for the ESP-IDF header, see test/README.md */
+#include "esp_err.h"
+#include <stdint.h>
+
+esp_err_t esp_ble_gatt_set_local_mtu(uint16_t mtu);
+
+#endif
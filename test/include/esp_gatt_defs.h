@@ -0,0 +1,74 @@
+#ifndef ESP_GATT_DEFS_H
+#define ESP_GATT_DEFS_H
+
+/* Host stand-in for the ESP-IDF header, see test/README.md */
+#include <stdint.h>
+
+typedef uint8_t esp_gatt_if_t;
+#define ESP_GATT_IF_NONE 0xFF
+
+#define ESP_UUID_LEN_16 2
+#define ESP_UUID_LEN_32 4
+#define ESP_UUID_LEN_128 16
+
+typedef struct {
+    uint16_t len;
+    union {
+        uint16_t uuid16;
+        uint32_t uuid32;
+        uint8_t uuid128[ESP_UUID_LEN_128];
+    } uuid;
+} __attribute__((packed)) esp_bt_uuid_t;
+
+typedef enum {
+    ESP_GATT_OK = 0x00,
+    ESP_GATT_INVALID_HANDLE = 0x01,
+    ESP_GATT_READ_NOT_PERMIT = 0x02,
+    ESP_GATT_WRITE_NOT_PERMIT = 0x03,
+    ESP_GATT_INVALID_PDU = 0x04,
+    ESP_GATT_INSUF_AUTHENTICATION = 0x05,
+    ESP_GATT_INSUF_ENCRYPTION = 0x0F,
+    ESP_GATT_ERROR = 0x85,
+} esp_gatt_status_t;
+
+typedef enum {
+    ESP_GATT_AUTH_REQ_NONE = 0,
+} esp_gatt_auth_req_t;
+
+typedef enum {
+    ESP_GATT_WRITE_TYPE_NO_RSP = 1,
+    ESP_GATT_WRITE_TYPE_RSP,
+} esp_gatt_write_type_t;
+
+#define ESP_GATT_CHAR_PROP_BIT_BROADCAST (1 << 0)
+#define ESP_GATT_CHAR_PROP_BIT_READ (1 << 1)
+#define ESP_GATT_CHAR_PROP_BIT_WRITE_NR (1 << 2)
+#define ESP_GATT_CHAR_PROP_BIT_WRITE (1 << 3)
+#define ESP_GATT_CHAR_PROP_BIT_NOTIFY (1 << 4)
+#define ESP_GATT_CHAR_PROP_BIT_INDICATE (1 << 5)
+#define ESP_GATT_CHAR_PROP_BIT_AUTH (1 << 6)
+#define ESP_GATT_CHAR_PROP_BIT_EXT_PROP (1 << 7)
+
+#define ESP_GATT_UUID_CHAR_DESCRIPTION 0x2901
+#define ESP_GATT_UUID_CHAR_CLIENT_CONFIG 0x2902
+#define ESP_GATT_UUID_CHAR_PRESENT_FORMAT 0x2904
+
+typedef enum {
+    ESP_GATT_DB_PRIMARY_SERVICE,
+    ESP_GATT_DB_SECONDARY_SERVICE,
+    ESP_GATT_DB_CHARACTERISTIC,
+    ESP_GATT_DB_DESCRIPTOR,
+    ESP_GATT_DB_INCLUDED_SERVICE,
+    ESP_GATT_DB_ALL,
+} esp_gatt_db_attr_type_t;
+
+typedef struct {
+    esp_gatt_db_attr_type_t type;
+    uint16_t attribute_handle;
+    uint16_t start_handle;
+    uint16_t end_handle;
+    uint8_t properties;
+    esp_bt_uuid_t uuid;
+} esp_gattc_db_elem_t;
+
+#endif
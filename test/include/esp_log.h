@@ -0,0 +1,34 @@
+#ifndef ESP_LOG_H
+#define ESP_LOG_H
+
+/* Host stand-in for the ESP-IDF header, see test/README.md */
+#include <stdint.h>
+
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE,
+} esp_log_level_t;
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format,
+    ...) __attribute__((format(printf, 3, 4)));
+uint32_t esp_log_timestamp(void);
+void esp_log_level_set(const char *tag, esp_log_level_t level);
+
+#define ESP_LOGE(tag, format, ...) \
+    esp_log_write(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) \
+    esp_log_write(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) \
+    esp_log_write(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) \
+    esp_log_write(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) \
+    esp_log_write(ESP_LOG_VERBOSE, tag, format, ##__VA_ARGS__)
+
+#define LOG_FORMAT(letter, format) #letter " (%d) %s: " format "\n"
+
+#endif
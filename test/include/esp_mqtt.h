@@ -0,0 +1,29 @@
+#ifndef ESP_MQTT_H
+#define ESP_MQTT_H
+
+/* Host stand-in for the esp-mqtt component header, see test/README.md.
+ * Implemented by fakes/mqtt_broker.c */
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+typedef enum {
+    ESP_MQTT_STATUS_DISCONNECTED,
+    ESP_MQTT_STATUS_CONNECTED,
+} esp_mqtt_status_t;
+
+typedef void (*esp_mqtt_status_callback_t)(esp_mqtt_status_t status);
+typedef void (*esp_mqtt_message_callback_t)(const char *topic,
+    uint8_t *payload, size_t len);
+
+void esp_mqtt_init(esp_mqtt_status_callback_t scb,
+    esp_mqtt_message_callback_t mcb, size_t buffer_size, int command_timeout);
+bool esp_mqtt_start(const char *host, int port, const char *client_id,
+    const char *username, const char *password);
+bool esp_mqtt_subscribe(const char *topic, int qos);
+bool esp_mqtt_unsubscribe(const char *topic);
+bool esp_mqtt_publish(const char *topic, uint8_t *payload, size_t len,
+    int qos, bool retained);
+void esp_mqtt_stop(void);
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef ESP_SYSTEM_H
+#define ESP_SYSTEM_H
+
+/* Host stand-in for the ESP-IDF header, see test/README.md */
+#include <stdint.h>
+
+uint32_t esp_get_free_heap_size(void);
+/* Only records the restart, see fake_restarts */
+void esp_restart(void);
+
+#endif
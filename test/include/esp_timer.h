@@ -0,0 +1,10 @@
+#ifndef ESP_TIMER_H
+#define ESP_TIMER_H
+
+/* Host stand-in for the ESP-IDF header, see test/README.md. Time only moves
+ * when the test advances the fake clock */
+#include <stdint.h>
+
+int64_t esp_timer_get_time(void);
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+/* Host stand-in for the ESP-IDF header, see test/README.md. Ticks are
+ * milliseconds of the fake clock, see fakes/freertos.c */
+#include <stdint.h>
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS pdTRUE
+#define pdFAIL pdFALSE
+
+#define portTICK_PERIOD_MS 1
+#define portMAX_DELAY ((TickType_t)0xffffffff)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+
+/* Spinlocks, as callbacks may come from the BTC thread. Unlike on the device,
+ * they aren't recursive */
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) \
+    while (__atomic_exchange_n((mux), 1, __ATOMIC_ACQUIRE))
+#define portEXIT_CRITICAL(mux) __atomic_store_n((mux), 0, __ATOMIC_RELEASE)
+
+#endif
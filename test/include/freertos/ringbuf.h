@@ -0,0 +1,26 @@
+#ifndef RINGBUF_H
+#define RINGBUF_H
+
+/* Host stand-in for the ESP-IDF header, see test/README.md. Items are kept
+ * in a FIFO bounded by the buffer size */
+#include "FreeRTOS.h"
+#include <stddef.h>
+
+typedef struct fake_ringbuf_t *RingbufHandle_t;
+
+typedef enum {
+    RINGBUF_TYPE_NOSPLIT = 0,
+    RINGBUF_TYPE_ALLOWSPLIT,
+    RINGBUF_TYPE_BYTEBUF,
+} ringbuf_type_t;
+
+RingbufHandle_t xRingbufferCreate(size_t buf_length, ringbuf_type_t type);
+BaseType_t xRingbufferSend(RingbufHandle_t ringbuf, const void *data,
+    size_t data_size, TickType_t ticks_to_wait);
+void *xRingbufferReceive(RingbufHandle_t ringbuf, size_t *item_size,
+    TickType_t ticks_to_wait);
+void *xRingbufferReceiveUpTo(RingbufHandle_t ringbuf, size_t *item_size,
+    TickType_t ticks_to_wait, size_t wanted_size);
+void vRingbufferReturnItem(RingbufHandle_t ringbuf, void *item);
+
+#endif
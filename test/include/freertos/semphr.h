@@ -0,0 +1,15 @@
+#ifndef SEMPHR_H
+#define SEMPHR_H
+
+/* Host stand-in for the ESP-IDF header, see test/README.md. Taking a mutex
+ * that is already held fails the test, as it would deadlock the firmware */
+#include "FreeRTOS.h"
+
+typedef struct fake_semaphore_t *SemaphoreHandle_t;
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+void vSemaphoreDelete(SemaphoreHandle_t semaphore);
+
+#endif
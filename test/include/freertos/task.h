@@ -0,0 +1,23 @@
+#ifndef TASK_H
+#define TASK_H
+
+/* Host stand-in for the ESP-IDF header, see test/README.md. Tasks are never
+ * started, the tests call the module functions directly */
+#include "FreeRTOS.h"
+
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+BaseType_t xTaskCreate(TaskFunction_t task, const char *name,
+    uint32_t stack_depth, void *parameters, UBaseType_t priority,
+    TaskHandle_t *created_task);
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t task, const char *name,
+    uint32_t stack_depth, void *parameters, UBaseType_t priority,
+    TaskHandle_t *created_task, BaseType_t core_id);
+void vTaskDelete(TaskHandle_t task);
+/* Advances the fake clock */
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+
+#endif
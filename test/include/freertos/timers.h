@@ -0,0 +1,22 @@
+#ifndef TIMERS_H
+#define TIMERS_H
+
+/* Host stand-in for the ESP-IDF header, see test/README.md. Timers expire as
+ * the fake clock is advanced */
+#include "FreeRTOS.h"
+
+typedef struct fake_timer_t *TimerHandle_t;
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t timer);
+
+TimerHandle_t xTimerCreate(const char *name, TickType_t period,
+    UBaseType_t auto_reload, void *timer_id, TimerCallbackFunction_t callback);
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t ticks_to_wait);
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t ticks_to_wait);
+BaseType_t xTimerReset(TimerHandle_t timer, TickType_t ticks_to_wait);
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period,
+    TickType_t ticks_to_wait);
+BaseType_t xTimerIsTimerActive(TimerHandle_t timer);
+BaseType_t xTimerDelete(TimerHandle_t timer, TickType_t ticks_to_wait);
+void *pvTimerGetTimerID(TimerHandle_t timer);
+
+#endif
@@ -0,0 +1,28 @@
+#ifndef NVS_H
+#define NVS_H
+
+/* Host stand-in for the ESP-IDF header, see test/README.md. Implemented by
+ * fakes/nvs.c */
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define ESP_ERR_NVS_NOT_FOUND 0x1102
+
+typedef uint32_t nvs_handle;
+
+typedef enum {
+    NVS_READONLY,
+    NVS_READWRITE,
+} nvs_open_mode;
+
+esp_err_t nvs_open(const char *name, nvs_open_mode open_mode,
+    nvs_handle *out_handle);
+esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *value,
+    size_t length);
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *out_value,
+    size_t *length);
+esp_err_t nvs_commit(nvs_handle handle);
+void nvs_close(nvs_handle handle);
+
+#endif
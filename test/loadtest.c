@@ -0,0 +1,410 @@
+#include "fake_ble.h"
+#include "fake_mqtt.h"
+#include "fakes.h"
+#include <ble.h>
+#include <ble_utils.h>
+#include <dedup.h>
+#include <malloc.h>
+#include <metrics.h>
+#include <mqtt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Load test of the BLE layer, the value formatting and the MQTT client. The
+ * bridge is mimicked as in replay.c: each scenario has peripherals notifying
+ * at a set rate of the fake clock, which follows the real one. Events are
+ * delivered from the fake stack's BTC thread and values are published to the
+ * fake broker, as by ble2mqtt.c. The latency from each notification to its
+ * publication and the notifications dropped on the way are reported.
+ *
+ * Usage: loadtest [-s speed] [scenarios]
+ * Scenarios are read one per line, blank lines and those starting with '#'
+ * are ignored:
+ *   name devices characteristics rate seconds [outage_ms] [queue_limit]
+ * with the rate in notifications per second per characteristic. An MQTT outage
+ * of outage_ms starts halfway, publications are queued meanwhile. At most
+ * queue_limit events are queued by the fake stack, 64 by default, others are
+ * dropped. Without a file, the scenarios below are run. With a speed, time
+ * moves that much faster than real time, e.g. 10 */
+
+/* Constants */
+#define DEVICES_MAX 16
+#define CHARACTERISTICS_MAX 8
+#define STEP_MS 10
+#define QUEUE_LIMIT 64
+#define UUID_VENDOR_SERVICE 0xFFF0
+#define UUID_VENDOR_CHARACTERISTIC 0xFFF1
+
+/* Types */
+typedef struct {
+    char name[32];
+    int devices;
+    int characteristics;
+    uint32_t rate;
+    uint32_t seconds;
+    uint32_t outage_ms;
+    uint32_t queue_limit;
+} scenario_t;
+
+static const scenario_t default_scenarios[] = {
+    { "idle", 1, 1, 1, 2, 0, QUEUE_LIMIT },
+    { "sensors", 8, 3, 2, 2, 0, QUEUE_LIMIT },
+    { "busy", 4, 2, 100, 2, 0, QUEUE_LIMIT },
+    { "saturated", 16, 4, 250, 2, 0, QUEUE_LIMIT },
+    { "outage", 8, 3, 10, 2, 500, QUEUE_LIMIT },
+};
+
+/* Internal state */
+static double speed = 1;
+static double *latencies;
+static size_t latencies_count, latencies_size;
+static size_t heap_peak;
+static int32_t offline_peak;
+
+/* Helpers */
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int latency_cmp(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void latency_add(double ns)
+{
+    if (latencies_count == latencies_size)
+    {
+        latencies_size = latencies_size ? latencies_size * 2 : 4096;
+        latencies = realloc(latencies, sizeof(*latencies) * latencies_size);
+    }
+
+    latencies[latencies_count++] = ns;
+}
+
+static void peaks_sample(void)
+{
+    struct mallinfo2 info = mallinfo2();
+    int32_t offline = metrics_gauge_get(METRICS_GAUGE_OFFLINE_QUEUE_SIZE);
+
+    if (info.uordblks > heap_peak)
+        heap_peak = info.uordblks;
+    if (offline > offline_peak)
+        offline_peak = offline;
+}
+
+/* Notifications carry the real time they were raised at */
+static size_t value_fill(fake_ble_peripheral_t *peripheral, uint16_t handle,
+    uint8_t *value, size_t size)
+{
+    double raised = now_ns();
+
+    memcpy(value, &raised, sizeof(raised));
+    return sizeof(raised);
+}
+
+/* Callback functions */
+static void on_device_discovered(mac_addr_t mac)
+{
+    ble_connect(mac);
+}
+
+static void on_device_connected(mac_addr_t mac)
+{
+    ble_services_scan(mac);
+}
+
+static void on_characteristic_found(mac_addr_t mac, ble_uuid_t service_uuid,
+    ble_uuid_t characteristic_uuid, uint8_t properties)
+{
+    if (properties & CHAR_PROP_NOTIFY)
+    {
+        ble_characteristic_notify_register(mac, service_uuid,
+            characteristic_uuid);
+    }
+}
+
+static void on_device_services_discovered(mac_addr_t mac)
+{
+    ble_foreach_characteristic(mac, on_characteristic_found);
+}
+
+/* Called from the BTC thread, as in the bridge */
+static void on_device_characteristic_value(mac_addr_t mac,
+    ble_uuid_t service, ble_uuid_t characteristic, uint8_t *value,
+    size_t value_len)
+{
+    char topic[128], *payload;
+    size_t payload_len;
+    double raised;
+
+    /* MQTT status changes are delivered on this thread as well, the client
+     * isn't meant to race with its own callbacks */
+    fake_mqtt_run();
+
+    if (value_len != sizeof(raised))
+        return;
+    memcpy(&raised, value, sizeof(raised));
+
+    if (!(payload = chartoa(mac, characteristic, BLE_PAYLOAD_FORMAT_JSON,
+        value, value_len, &payload_len)))
+    {
+        metrics_counter_inc(METRICS_COUNTER_BLE_VALUES_DROPPED);
+        return;
+    }
+
+    snprintf(topic, sizeof(topic), "%s/%s/%s", mactoa(mac), uuidtoa(service),
+        uuidtoa(characteristic));
+    /* The defaults of config.json, QoS 0 and retained */
+    mqtt_publish(topic, (uint8_t *)payload, payload_len, 0, 1);
+    latency_add(now_ns() - raised);
+}
+
+/* Connects to the peripherals and subscribes to their characteristics */
+static void scenario_setup(const scenario_t *scenario,
+    fake_ble_peripheral_t **peripherals,
+    uint16_t handles[][CHARACTERISTICS_MAX])
+{
+    char mac[18];
+    int i, j;
+
+    ble_set_on_device_discovered_cb(on_device_discovered);
+    ble_set_on_device_connected_cb(on_device_connected);
+    ble_set_on_device_services_discovered_cb(on_device_services_discovered);
+    ble_set_on_device_characteristic_value_cb(on_device_characteristic_value);
+    ble_initialize();
+    dedup_initialize(0);
+    mqtt_initialize();
+    mqtt_connect("broker", 1883, "loadtest", NULL, NULL);
+    fake_mqtt_run();
+
+    for (i = 0; i < scenario->devices; i++)
+    {
+        sprintf(mac, "aa:bb:cc:dd:ee:%02x", i & 0xff);
+        peripherals[i] = fake_ble_peripheral_add(mac, BLE_ADDR_TYPE_PUBLIC);
+        fake_ble_service_add(peripherals[i], UUID_VENDOR_SERVICE);
+        for (j = 0; j < scenario->characteristics; j++)
+        {
+            handles[i][j] = fake_ble_characteristic_add(peripherals[i],
+                UUID_VENDOR_CHARACTERISTIC + j, CHAR_PROP_NOTIFY, NULL, 0);
+        }
+    }
+
+    ble_scan_start();
+    fake_ble_run();
+    for (i = 0; i < scenario->devices; i++)
+    {
+        fake_ble_advertise(peripherals[i]);
+        fake_ble_run();
+    }
+
+    /* Lets the operation queue drain, subscriptions are written in turn */
+    for (i = 0; i < scenario->devices * scenario->characteristics + 2; i++)
+    {
+        fake_clock_advance(1000);
+        fake_ble_run();
+    }
+}
+
+static int scenario_run(const scenario_t *scenario)
+{
+    fake_ble_peripheral_t *peripherals[DEVICES_MAX];
+    uint16_t handles[DEVICES_MAX][CHARACTERISTICS_MAX];
+    uint32_t elapsed, outage_start = 0, outage_end = 0, dropped_host;
+    uint32_t dropped_bridge, failed;
+    size_t published;
+    double start, wall;
+    int i, j;
+
+    scenario_setup(scenario, peripherals, handles);
+
+    fake_ble_queue_limit_set(scenario->queue_limit);
+    fake_ble_notifications = 0;
+    fake_ble_btc_thread_start();
+    for (i = 0; i < scenario->devices; i++)
+    {
+        for (j = 0; j < scenario->characteristics; j++)
+        {
+            fake_ble_notify_rate_set(peripherals[i], handles[i][j],
+                scenario->rate, value_fill);
+        }
+    }
+
+    if (scenario->outage_ms)
+    {
+        outage_start = scenario->seconds * 1000 / 2;
+        outage_end = outage_start + scenario->outage_ms;
+    }
+
+    start = now_ns();
+    for (elapsed = 0; elapsed < scenario->seconds * 1000; elapsed += STEP_MS)
+    {
+        if (scenario->outage_ms && elapsed == outage_start)
+            fake_mqtt_outage_start();
+        if (scenario->outage_ms && elapsed == outage_end)
+            fake_mqtt_outage_end();
+
+        fake_clock_advance(STEP_MS);
+        peaks_sample();
+
+        /* Paced to follow the real time */
+        wall = (now_ns() - start) / 1e6;
+        if (wall < (elapsed + STEP_MS) / speed)
+            usleep(((elapsed + STEP_MS) / speed - wall) * 1000);
+    }
+
+    for (i = 0; i < scenario->devices; i++)
+    {
+        for (j = 0; j < scenario->characteristics; j++)
+        {
+            fake_ble_notify_rate_set(peripherals[i], handles[i][j], 0,
+                NULL);
+        }
+    }
+    fake_ble_btc_thread_stop();
+
+    /* Flushes what was queued during an outage ending last */
+    if (scenario->outage_ms)
+        fake_mqtt_outage_end();
+    fake_mqtt_run();
+    peaks_sample();
+
+    published = metrics_counter_get(METRICS_COUNTER_MQTT_PUBLISHED);
+    dropped_host = fake_ble_notifications_dropped;
+    dropped_bridge = metrics_counter_get(METRICS_COUNTER_BLE_VALUES_DROPPED);
+    failed = metrics_counter_get(METRICS_COUNTER_MQTT_PUBLISH_FAILED);
+
+    printf("%s: %d devices x %d characteristics at %u Hz for %u s",
+        scenario->name, scenario->devices, scenario->characteristics,
+        scenario->rate, scenario->seconds);
+    if (scenario->outage_ms)
+        printf(", %u ms MQTT outage", scenario->outage_ms);
+    printf("\n  notifications %d, published %zu, %.1f/s\n",
+        fake_ble_notifications, published,
+        published / (double)scenario->seconds);
+    printf("  dropped %u: stack queue %u, bridge %u, MQTT %u\n",
+        dropped_host + dropped_bridge + failed, dropped_host, dropped_bridge,
+        failed);
+    if (latencies_count)
+    {
+        qsort(latencies, latencies_count, sizeof(*latencies), latency_cmp);
+        printf("  latency p50 %.1f us, p99 %.1f us, max %.1f us\n",
+            latencies[latencies_count / 2] / 1e3,
+            latencies[latencies_count * 99 / 100] / 1e3,
+            latencies[latencies_count - 1] / 1e3);
+    }
+    printf("  heap peak %zu KiB, offline queue peak %d\n", heap_peak / 1024,
+        offline_peak);
+
+    return 0;
+}
+
+/* Each scenario runs in its own process, from the initial state of the
+ * modules */
+static int scenario_fork(const scenario_t *scenario)
+{
+    int status;
+    pid_t pid;
+
+    fflush(stdout);
+    /* Without exit(), which would rewind the parent's scenarios file */
+    if (!(pid = fork()))
+    {
+        status = scenario_run(scenario);
+        fflush(stdout);
+        _exit(status);
+    }
+
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) && !WEXITSTATUS(status) ? 0 : -1;
+}
+
+static int scenario_parse(const char *line, scenario_t *scenario)
+{
+    int n;
+
+    scenario->outage_ms = 0;
+    scenario->queue_limit = QUEUE_LIMIT;
+    n = sscanf(line, "%31s %d %d %u %u %u %u", scenario->name,
+        &scenario->devices, &scenario->characteristics, &scenario->rate,
+        &scenario->seconds, &scenario->outage_ms, &scenario->queue_limit);
+
+    if (n < 5 || scenario->devices < 1 || scenario->devices > DEVICES_MAX ||
+        scenario->characteristics < 1 ||
+        scenario->characteristics > CHARACTERISTICS_MAX || !scenario->rate ||
+        !scenario->seconds)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    scenario_t scenario;
+    char line[256];
+    int opt, ret = 0;
+    size_t i;
+    FILE *f;
+
+    while ((opt = getopt(argc, argv, "s:")) != -1)
+    {
+        if (opt != 's' || (speed = atof(optarg)) <= 0)
+        {
+            fprintf(stderr, "Usage: %s [-s speed] [scenarios]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind < argc - 1)
+    {
+        fprintf(stderr, "Usage: %s [-s speed] [scenarios]\n", argv[0]);
+        return 1;
+    }
+
+    if (optind == argc)
+    {
+        for (i = 0; i < sizeof(default_scenarios) /
+            sizeof(default_scenarios[0]); i++)
+        {
+            ret |= scenario_fork(&default_scenarios[i]);
+        }
+        return !!ret;
+    }
+
+    if (!(f = fopen(argv[optind], "r")))
+    {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    for (i = 1; fgets(line, sizeof(line), f); i++)
+    {
+        if (line[strspn(line, " \t\n")] == '\0' ||
+            line[strspn(line, " \t")] == '#')
+        {
+            continue;
+        }
+
+        if (scenario_parse(line, &scenario))
+        {
+            fprintf(stderr, "%s:%zu: invalid scenario\n", argv[optind], i);
+            ret = 1;
+            continue;
+        }
+        ret |= scenario_fork(&scenario);
+    }
+
+    fclose(f);
+    return !!ret;
+}
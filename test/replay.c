@@ -0,0 +1,275 @@
+#include "fake_ble.h"
+#include "fakes.h"
+#include <ble.h>
+#include <ble_utils.h>
+#include <capture.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Replays a capture published by the bridge, see capture.h, into the BLE layer
+ * on the host. The bridge is mimicked: discovered devices are connected, their
+ * characteristics are read and subscribed to and values are formatted as
+ * JSON. The fake clock follows the captured times, so timers fire as they did
+ * on the device, and the time spent handling each event is reported.
+ *
+ * Usage: replay [-s speed] capture.bin
+ * With a speed, records are also paced in real time, e.g. 2 for twice as fast
+ * as captured. Otherwise they're replayed as fast as possible */
+
+/* Constants */
+#define DB_MAX 256
+
+/* Internal state */
+static int devices, values;
+static double *timings;
+static size_t timings_count, timings_size;
+static esp_gattc_db_elem_t db[DB_MAX];
+
+/* Callback functions */
+static void on_device_discovered(mac_addr_t mac)
+{
+    devices++;
+    ble_connect(mac);
+}
+
+static void on_device_connected(mac_addr_t mac)
+{
+    ble_services_scan(mac);
+}
+
+static void on_characteristic_found(mac_addr_t mac, ble_uuid_t service_uuid,
+    ble_uuid_t characteristic_uuid, uint8_t properties)
+{
+    if (properties & CHAR_PROP_READ)
+        ble_characteristic_read(mac, service_uuid, characteristic_uuid);
+    if (properties & (CHAR_PROP_NOTIFY | CHAR_PROP_INDICATE))
+    {
+        ble_characteristic_notify_register(mac, service_uuid,
+            characteristic_uuid);
+    }
+}
+
+static void on_device_services_discovered(mac_addr_t mac)
+{
+    ble_foreach_characteristic(mac, on_characteristic_found);
+}
+
+static void on_device_characteristic_value(mac_addr_t mac,
+    ble_uuid_t service, ble_uuid_t characteristic, uint8_t *value,
+    size_t value_len)
+{
+    if (chartoa(mac, characteristic, BLE_PAYLOAD_FORMAT_JSON, value,
+        value_len, NULL))
+    {
+        values++;
+    }
+}
+
+/* Helpers */
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int timing_cmp(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void timing_add(double ns)
+{
+    if (timings_count == timings_size)
+    {
+        timings_size = timings_size ? timings_size * 2 : 1024;
+        timings = realloc(timings, sizeof(*timings) * timings_size);
+    }
+
+    timings[timings_count++] = ns;
+}
+
+static uint8_t *file_read(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    uint8_t *data = NULL;
+    size_t size = 0;
+
+    if (!f)
+        return NULL;
+
+    *len = 0;
+    do
+    {
+        size += 65536;
+        data = realloc(data, size);
+        *len += fread(data + *len, 1, size - *len, f);
+    } while (*len == size);
+
+    fclose(f);
+    return data;
+}
+
+/* Sets the databases of the records following p, up to the first record of
+ * another kind */
+static void replay_dbs(const uint8_t *p, const uint8_t *end)
+{
+    const capture_record_t *record = (const capture_record_t *)p;
+    capture_db_t info;
+
+    for (; p + sizeof(*record) <= end &&
+        p + sizeof(*record) + record->param_len + record->value_len <= end &&
+        record->source == CAPTURE_SOURCE_GATTC_DB;
+        p += sizeof(*record) + record->param_len + record->value_len,
+        record = (const capture_record_t *)p)
+    {
+        if (capture_gattc_db_decode(record, p + sizeof(*record), &info, db,
+            DB_MAX))
+        {
+            return;
+        }
+
+        if (info.index + record->value_len / sizeof(capture_db_elem_t) ==
+            info.count)
+        {
+            fake_ble_replay_db_set(info.conn_id, db, info.count);
+        }
+    }
+}
+
+/* Delivers a record to the BLE layer, returns -1 if it's malformed */
+static int replay_record(const capture_record_t *record, const uint8_t *end)
+{
+    const uint8_t *data = (const uint8_t *)(record + 1);
+    esp_ble_gap_cb_param_t gap;
+    esp_ble_gattc_cb_param_t gattc;
+
+    switch (record->source)
+    {
+    case CAPTURE_SOURCE_GAP:
+        if (capture_gap_event_decode(record, data, &gap))
+            return -1;
+        fake_ble_replay_gap_event(record->event, &gap);
+        break;
+    case CAPTURE_SOURCE_GATTC:
+        if (capture_gattc_event_decode(record, data, &gattc))
+            return -1;
+        /* The database is captured while handling the search completion, so
+         * it follows the event */
+        if (record->event == ESP_GATTC_SEARCH_CMPL_EVT)
+            replay_dbs(data + record->param_len + record->value_len, end);
+        fake_ble_replay_gattc_event(record->event, record->gattc_if, &gattc);
+        break;
+    case CAPTURE_SOURCE_GATTC_DB:
+        break;
+    default:
+        return -1;
+    }
+
+    /* Requests raise no events, only timers are left to fire */
+    fake_ble_run();
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const capture_header_t *header;
+    const capture_record_t *record;
+    uint64_t elapsed_us = 0, clock_us = 0;
+    double speed = 0, start, total = 0;
+    size_t len, offset, records = 0;
+    uint8_t *data;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:")) != -1)
+    {
+        if (opt != 's' || (speed = atof(optarg)) <= 0)
+        {
+            fprintf(stderr, "Usage: %s [-s speed] capture.bin\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1)
+    {
+        fprintf(stderr, "Usage: %s [-s speed] capture.bin\n", argv[0]);
+        return 1;
+    }
+
+    if (!(data = file_read(argv[optind], &len)))
+    {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    header = (const capture_header_t *)data;
+    if (len < sizeof(*header) || header->magic != CAPTURE_MAGIC ||
+        header->version != CAPTURE_VERSION)
+    {
+        fprintf(stderr, "%s isn't a version %d capture\n", argv[optind],
+            CAPTURE_VERSION);
+        return 1;
+    }
+
+    ble_set_on_device_discovered_cb(on_device_discovered);
+    ble_set_on_device_connected_cb(on_device_connected);
+    ble_set_on_device_services_discovered_cb(on_device_services_discovered);
+    ble_set_on_device_characteristic_value_cb(on_device_characteristic_value);
+    ble_initialize();
+    fake_ble_run();
+    fake_ble_replay_start();
+    ble_scan_start();
+
+    for (offset = sizeof(*header); offset + sizeof(*record) <= len;
+        offset += sizeof(*record) + record->param_len + record->value_len)
+    {
+        record = (const capture_record_t *)(data + offset);
+        if (offset + sizeof(*record) + record->param_len + record->value_len >
+            len)
+        {
+            break;
+        }
+
+        /* The clock only moves in milliseconds */
+        elapsed_us += record->delta_us;
+        if (elapsed_us / 1000 > clock_us / 1000)
+            fake_clock_advance(elapsed_us / 1000 - clock_us / 1000);
+        clock_us = elapsed_us;
+        if (speed)
+            usleep(record->delta_us / speed);
+
+        start = now_ns();
+        if (replay_record(record, data + len))
+        {
+            fprintf(stderr, "Malformed record at offset %zu\n", offset);
+            break;
+        }
+        timing_add(now_ns() - start);
+        total += timings[timings_count - 1];
+        records++;
+    }
+
+    if (offset != len)
+        fprintf(stderr, "Stopped at offset %zu of %zu\n", offset, len);
+
+    printf("Replayed %zu records, %.1f s captured\n", records,
+        elapsed_us / 1e6);
+    printf("Devices discovered: %d, values decoded: %d\n", devices, values);
+    if (timings_count)
+    {
+        qsort(timings, timings_count, sizeof(*timings), timing_cmp);
+        printf("Handling time per record: mean %.1f ns, p50 %.1f ns, "
+            "p99 %.1f ns, max %.1f ns\n", total / timings_count,
+            timings[timings_count / 2], timings[timings_count * 99 / 100],
+            timings[timings_count - 1]);
+    }
+
+    free(timings);
+    free(data);
+    return offset != len;
+}
@@ -0,0 +1,42 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/* Each test runs in its own process, so it starts from the initial state of
+ * the firmware modules and fakes */
+
+#define TEST_ASSERT(cond) do { \
+    if (!(cond)) \
+    { \
+        fprintf(stderr, "%s:%d: %s: assertion failed: %s\n", __FILE__, \
+            __LINE__, __func__, #cond); \
+        exit(1); \
+    } \
+} while (0)
+
+#define TEST_RUN(test) do { \
+    int __status; \
+    pid_t __pid; \
+    fflush(stdout); \
+    if (!(__pid = fork())) \
+    { \
+        test(); \
+        exit(0); \
+    } \
+    waitpid(__pid, &__status, 0); \
+    if (WIFEXITED(__status) && !WEXITSTATUS(__status)) \
+        printf("PASS %s\n", #test); \
+    else \
+    { \
+        printf("FAIL %s\n", #test); \
+        test_failures++; \
+    } \
+} while (0)
+
+static int test_failures = 0;
+
+#endif
@@ -0,0 +1,541 @@
+#include "test.h"
+#include "fake_ble.h"
+#include "fakes.h"
+#include <ble.h>
+#include <string.h>
+
+/* Constants */
+#define SENSOR_MAC "aa:bb:cc:dd:ee:01"
+#define OTHER_MAC "aa:bb:cc:dd:ee:02"
+#define UUID_ENVIRONMENTAL_SENSING 0x181A
+#define UUID_TEMPERATURE 0x2A6E
+#define UUID_HUMIDITY 0x2A6F
+#define UUID_PRESSURE 0x2A6D
+#define UUID_VENDOR_SERVICE 0xFFF0
+#define UUID_VENDOR_LEVEL 0xFFF1
+#define UUID_VENDOR_TILT 0xFFF2
+#define UUID_PRESENTATION_FORMAT 0x2904
+#define UUID_USER_DESCRIPTION 0x2901
+
+/* Internal state */
+static int discovered, connected, disconnected, services_discovered, values;
+static int bonds_removed;
+static uint8_t last_value[16];
+static size_t last_value_len;
+static pthread_t value_thread;
+
+/* Callback functions */
+static void on_device_discovered(mac_addr_t mac)
+{
+    discovered++;
+}
+
+static void on_device_connected(mac_addr_t mac)
+{
+    connected++;
+}
+
+static void on_device_disconnected(mac_addr_t mac)
+{
+    disconnected++;
+}
+
+static void on_device_services_discovered(mac_addr_t mac)
+{
+    services_discovered++;
+}
+
+static void on_device_characteristic_value(mac_addr_t mac,
+    ble_uuid_t service, ble_uuid_t characteristic, uint8_t *value,
+    size_t value_len)
+{
+    values++;
+    memcpy(last_value, value, value_len);
+    last_value_len = value_len;
+    value_thread = pthread_self();
+}
+
+static void on_bonds_removed(void)
+{
+    bonds_removed++;
+}
+
+static uint8_t should_remove_bond(mac_addr_t mac)
+{
+    return strcmp(mactoa(mac), OTHER_MAC);
+}
+
+/* Helpers */
+static uint8_t *uuid16(uint16_t uuid)
+{
+    static ble_uuid_t uuids[4];
+    static int i;
+    uint8_t *ret = uuids[i++ % 4];
+    char str[37];
+
+    sprintf(str, "0000%04x-0000-1000-8000-00805f9b34fb", uuid);
+    atouuid(str, ret);
+    return ret;
+}
+
+static void ble_start(void)
+{
+    ble_set_on_device_discovered_cb(on_device_discovered);
+    ble_set_on_device_connected_cb(on_device_connected);
+    ble_set_on_device_disconnected_cb(on_device_disconnected);
+    ble_set_on_device_services_discovered_cb(on_device_services_discovered);
+    ble_set_on_device_characteristic_value_cb(on_device_characteristic_value);
+    ble_set_on_bonds_removed_cb(on_bonds_removed);
+    TEST_ASSERT(!ble_initialize());
+    fake_ble_run();
+}
+
+/* An environmental sensor with a temperature characteristic */
+static fake_ble_peripheral_t *sensor_add(const char *mac,
+    esp_ble_addr_type_t addr_type, uint16_t *temperature)
+{
+    fake_ble_peripheral_t *sensor = fake_ble_peripheral_add(mac, addr_type);
+
+    fake_ble_service_add(sensor, UUID_ENVIRONMENTAL_SENSING);
+    *temperature = fake_ble_characteristic_add(sensor, UUID_TEMPERATURE,
+        CHAR_PROP_READ | CHAR_PROP_NOTIFY, "\x34\x08", 2);
+
+    return sensor;
+}
+
+/* Scans, connects and discovers the services of the peripheral */
+static void sensor_connect(fake_ble_peripheral_t *sensor)
+{
+    uint8_t *mac = fake_ble_peripheral_mac(sensor);
+
+    ble_scan_start();
+    fake_ble_run();
+    fake_ble_advertise(sensor);
+    fake_ble_run();
+    TEST_ASSERT(!ble_connect(mac));
+    fake_ble_run();
+    TEST_ASSERT(fake_ble_peripheral_is_connected(sensor));
+    TEST_ASSERT(!ble_services_scan(mac));
+    fake_ble_run();
+}
+
+/* Notifications numbered from 1 */
+static size_t counter_fill(fake_ble_peripheral_t *peripheral, uint16_t handle,
+    uint8_t *value, size_t size)
+{
+    static uint16_t counter;
+
+    counter++;
+    memcpy(value, &counter, sizeof(counter));
+    return sizeof(counter);
+}
+
+static uint16_t last_counter(void)
+{
+    uint16_t counter;
+
+    memcpy(&counter, last_value, sizeof(counter));
+    return counter;
+}
+
+/* Lets the operation queue timer expire and delivers the events raised */
+static void ble_settle(void)
+{
+    fake_clock_advance(1000);
+    fake_ble_run();
+}
+
+/* Tests */
+static void test_scan_and_connect(void)
+{
+    uint16_t temperature;
+    fake_ble_peripheral_t *sensor = sensor_add(SENSOR_MAC,
+        BLE_ADDR_TYPE_PUBLIC, &temperature);
+
+    ble_start();
+    sensor_connect(sensor);
+    TEST_ASSERT(discovered == 1);
+    TEST_ASSERT(connected == 1);
+    TEST_ASSERT(services_discovered == 1);
+    /* Scanning resumes once connected */
+    TEST_ASSERT(fake_ble_is_scanning());
+
+    TEST_ASSERT(!ble_characteristic_read(fake_ble_peripheral_mac(sensor),
+        uuid16(UUID_ENVIRONMENTAL_SENSING), uuid16(UUID_TEMPERATURE)));
+    ble_settle();
+    TEST_ASSERT(values == 1);
+    TEST_ASSERT(last_value_len == 2 && !memcmp(last_value, "\x34\x08", 2));
+
+    TEST_ASSERT(!ble_disconnect(fake_ble_peripheral_mac(sensor)));
+    fake_ble_run();
+    TEST_ASSERT(disconnected == 1);
+}
+
+static void test_operations_are_serialized(void)
+{
+    fake_ble_peripheral_t *sensor = fake_ble_peripheral_add(SENSOR_MAC,
+        BLE_ADDR_TYPE_PUBLIC);
+    uint8_t *mac = fake_ble_peripheral_mac(sensor);
+
+    fake_ble_service_add(sensor, UUID_ENVIRONMENTAL_SENSING);
+    fake_ble_characteristic_add(sensor, UUID_TEMPERATURE,
+        CHAR_PROP_READ | CHAR_PROP_NOTIFY, "\x34\x08", 2);
+    fake_ble_characteristic_add(sensor, UUID_HUMIDITY, CHAR_PROP_READ,
+        "\x10\x27", 2);
+    fake_ble_characteristic_add(sensor, UUID_PRESSURE, CHAR_PROP_READ,
+        "\x00\x00\x00\x01", 4);
+
+    ble_start();
+    sensor_connect(sensor);
+    TEST_ASSERT(!ble_characteristic_read(mac,
+        uuid16(UUID_ENVIRONMENTAL_SENSING), uuid16(UUID_TEMPERATURE)));
+    TEST_ASSERT(!ble_characteristic_read(mac,
+        uuid16(UUID_ENVIRONMENTAL_SENSING), uuid16(UUID_HUMIDITY)));
+    TEST_ASSERT(!ble_characteristic_read(mac,
+        uuid16(UUID_ENVIRONMENTAL_SENSING), uuid16(UUID_PRESSURE)));
+    TEST_ASSERT(!ble_characteristic_notify_register(mac,
+        uuid16(UUID_ENVIRONMENTAL_SENSING), uuid16(UUID_TEMPERATURE)));
+    ble_settle();
+
+    /* Bluedroid handles a single request per connection at a time */
+    TEST_ASSERT(fake_ble_requests == 4);
+    TEST_ASSERT(fake_ble_max_in_flight == 1);
+    TEST_ASSERT(values == 3);
+    TEST_ASSERT(last_value_len == 4);
+}
+
+static void test_operations_parked_until_authenticated(void)
+{
+    uint16_t temperature, humidity;
+    fake_ble_peripheral_t *sensor = sensor_add(SENSOR_MAC,
+        BLE_ADDR_TYPE_PUBLIC, &temperature);
+    fake_ble_peripheral_t *other = fake_ble_peripheral_add(OTHER_MAC,
+        BLE_ADDR_TYPE_PUBLIC);
+
+    fake_ble_service_add(other, UUID_ENVIRONMENTAL_SENSING);
+    humidity = fake_ble_characteristic_add(other, UUID_HUMIDITY,
+        CHAR_PROP_READ, "\x10\x27", 2);
+    fake_ble_attribute_secure(sensor, temperature);
+    fake_ble_attribute_secure(other, humidity);
+    fake_ble_peripheral_pairing_fail(other);
+
+    ble_start();
+    sensor_connect(sensor);
+    sensor_connect(other);
+    TEST_ASSERT(!ble_characteristic_read(fake_ble_peripheral_mac(sensor),
+        uuid16(UUID_ENVIRONMENTAL_SENSING), uuid16(UUID_TEMPERATURE)));
+    TEST_ASSERT(!ble_characteristic_read(fake_ble_peripheral_mac(other),
+        uuid16(UUID_ENVIRONMENTAL_SENSING), uuid16(UUID_HUMIDITY)));
+    ble_settle();
+
+    /* The rejected read is retried once encrypted */
+    TEST_ASSERT(fake_ble_peripheral_is_encrypted(sensor));
+    TEST_ASSERT(fake_ble_is_bonded(sensor));
+    TEST_ASSERT(values == 1);
+    TEST_ASSERT(!memcmp(last_value, "\x34\x08", 2));
+
+    /* It isn't retried again if pairing fails */
+    TEST_ASSERT(!fake_ble_peripheral_is_encrypted(other));
+    TEST_ASSERT(fake_ble_requests == 4);
+    TEST_ASSERT(fake_ble_max_in_flight == 1);
+}
+
+static void test_indications_are_enabled(void)
+{
+    fake_ble_peripheral_t *sensor = fake_ble_peripheral_add(SENSOR_MAC,
+        BLE_ADDR_TYPE_PUBLIC);
+    uint16_t temperature;
+    const uint8_t *cccd;
+    size_t len;
+
+    fake_ble_service_add(sensor, UUID_ENVIRONMENTAL_SENSING);
+    temperature = fake_ble_characteristic_add(sensor, UUID_TEMPERATURE,
+        CHAR_PROP_INDICATE, NULL, 0);
+
+    ble_start();
+    sensor_connect(sensor);
+    TEST_ASSERT(!ble_characteristic_notify_register(
+        fake_ble_peripheral_mac(sensor), uuid16(UUID_ENVIRONMENTAL_SENSING),
+        uuid16(UUID_TEMPERATURE)));
+    ble_settle();
+
+    cccd = fake_ble_attribute_get(sensor, temperature + 1, &len);
+    TEST_ASSERT(len == 2 && cccd[0] == 0x02 && cccd[1] == 0x00);
+    TEST_ASSERT(fake_ble_notify(sensor, temperature, "\x01\x00", 2));
+    TEST_ASSERT(!fake_ble_indicate(sensor, temperature, "\x35\x08", 2));
+    fake_ble_run();
+    TEST_ASSERT(values == 1);
+    TEST_ASSERT(!memcmp(last_value, "\x35\x08", 2));
+}
+
+/* Connects to the sensor and subscribes to its temperature */
+static void sensor_subscribe(fake_ble_peripheral_t *sensor)
+{
+    ble_start();
+    sensor_connect(sensor);
+    TEST_ASSERT(!ble_characteristic_notify_register(
+        fake_ble_peripheral_mac(sensor), uuid16(UUID_ENVIRONMENTAL_SENSING),
+        uuid16(UUID_TEMPERATURE)));
+    ble_settle();
+}
+
+static void test_notify_rate(void)
+{
+    uint16_t temperature;
+    fake_ble_peripheral_t *sensor = sensor_add(SENSOR_MAC,
+        BLE_ADDR_TYPE_PUBLIC, &temperature);
+
+    /* Nothing is sent before the client subscribes */
+    fake_ble_notify_rate_set(sensor, temperature, 50, NULL);
+    sensor_subscribe(sensor);
+    values = 0;
+    fake_ble_notifications = 0;
+
+    fake_clock_advance(1000);
+    fake_ble_run();
+    TEST_ASSERT(values == 50);
+    TEST_ASSERT(last_value_len == 2 && !memcmp(last_value, "\x34\x08", 2));
+
+    /* Above 1 kHz, several are sent each millisecond */
+    fake_ble_notify_rate_set(sensor, temperature, 3000, counter_fill);
+    fake_clock_advance(10);
+    fake_ble_run();
+    TEST_ASSERT(values == 80);
+    TEST_ASSERT(last_counter() == 30);
+
+    fake_ble_notify_rate_set(sensor, temperature, 0, NULL);
+    fake_clock_advance(1000);
+    fake_ble_run();
+    TEST_ASSERT(values == 80);
+    TEST_ASSERT(fake_ble_notifications == 80);
+}
+
+static void test_full_queue_drops_notifications(void)
+{
+    uint16_t temperature;
+    fake_ble_peripheral_t *sensor = sensor_add(SENSOR_MAC,
+        BLE_ADDR_TYPE_PUBLIC, &temperature);
+
+    sensor_subscribe(sensor);
+    values = 0;
+
+    /* The first ones are queued, the others dropped */
+    fake_ble_queue_limit_set(4);
+    fake_ble_notify_rate_set(sensor, temperature, 1000, counter_fill);
+    fake_clock_advance(10);
+    fake_ble_run();
+    TEST_ASSERT(values == 4);
+    TEST_ASSERT(last_counter() == 4);
+    TEST_ASSERT(fake_ble_notifications_dropped == 6);
+}
+
+static void test_btc_thread_delivers_callbacks(void)
+{
+    uint16_t temperature;
+    fake_ble_peripheral_t *sensor = sensor_add(SENSOR_MAC,
+        BLE_ADDR_TYPE_PUBLIC, &temperature);
+
+    sensor_subscribe(sensor);
+    values = 0;
+
+    /* Values are delivered in order, from another thread, while the clock
+     * moves */
+    fake_ble_btc_thread_start();
+    fake_ble_notify_rate_set(sensor, temperature, 1000, counter_fill);
+    fake_clock_advance(100);
+    fake_ble_notify_rate_set(sensor, temperature, 0, NULL);
+    fake_ble_run();
+    TEST_ASSERT(values == 100);
+    TEST_ASSERT(last_counter() == 100);
+    TEST_ASSERT(!pthread_equal(value_thread, pthread_self()));
+    fake_ble_btc_thread_stop();
+
+    /* Back to delivering them from this thread */
+    TEST_ASSERT(!fake_ble_notify(sensor, temperature, "\x35\x08", 2));
+    fake_ble_run();
+    TEST_ASSERT(values == 101);
+    TEST_ASSERT(pthread_equal(value_thread, pthread_self()));
+}
+
+static void test_disconnect_drops_operations(void)
+{
+    uint16_t temperature;
+    fake_ble_peripheral_t *sensor = sensor_add(SENSOR_MAC,
+        BLE_ADDR_TYPE_PUBLIC, &temperature);
+    fake_ble_peripheral_t *other = sensor_add(OTHER_MAC, BLE_ADDR_TYPE_PUBLIC,
+        &temperature);
+    int i;
+
+    ble_start();
+    sensor_connect(sensor);
+    sensor_connect(other);
+    for (i = 0; i < 3; i++)
+    {
+        ble_characteristic_read(fake_ble_peripheral_mac(sensor),
+            uuid16(UUID_ENVIRONMENTAL_SENSING), uuid16(UUID_TEMPERATURE));
+    }
+    ble_characteristic_read(fake_ble_peripheral_mac(other),
+        uuid16(UUID_ENVIRONMENTAL_SENSING), uuid16(UUID_TEMPERATURE));
+
+    /* The first read is in flight when the device goes away */
+    fake_clock_advance(1000);
+    fake_ble_disconnect(sensor);
+    fake_ble_run();
+    TEST_ASSERT(disconnected == 1);
+    TEST_ASSERT(values == 1);
+    TEST_ASSERT(fake_ble_requests == 2);
+}
+
+static void test_failed_descriptor_reads_complete_discovery(void)
+{
+    fake_ble_peripheral_t *sensor = fake_ble_peripheral_add(SENSOR_MAC,
+        BLE_ADDR_TYPE_PUBLIC);
+    uint16_t format, description;
+
+    fake_ble_service_add(sensor, UUID_VENDOR_SERVICE);
+    fake_ble_characteristic_add(sensor, UUID_VENDOR_LEVEL, CHAR_PROP_READ,
+        "\x10", 1);
+    format = fake_ble_descriptor_add(sensor, UUID_PRESENTATION_FORMAT,
+        "\x04\x00\xad\x27\x01\x00\x00", 7);
+    fake_ble_characteristic_add(sensor, UUID_VENDOR_TILT, CHAR_PROP_READ,
+        "\x20", 1);
+    description = fake_ble_descriptor_add(sensor, UUID_USER_DESCRIPTION,
+        "Tilt", 4);
+    fake_ble_attribute_refuse(sensor, format);
+    fake_ble_attribute_refuse(sensor, description);
+
+    ble_start();
+    sensor_connect(sensor);
+    TEST_ASSERT(services_discovered == 0);
+
+    /* Services are discovered even though no descriptor could be read */
+    ble_settle();
+    TEST_ASSERT(services_discovered == 1);
+    TEST_ASSERT(fake_ble_requests == 0);
+
+    /* The queue moved on */
+    TEST_ASSERT(!ble_characteristic_read(fake_ble_peripheral_mac(sensor),
+        uuid16(UUID_VENDOR_SERVICE), uuid16(UUID_VENDOR_TILT)));
+    ble_settle();
+    TEST_ASSERT(values == 1);
+}
+
+static void test_bonds_removed(void)
+{
+    fake_ble_peripheral_t *sensor = fake_ble_peripheral_add(SENSOR_MAC,
+        BLE_ADDR_TYPE_PUBLIC);
+    fake_ble_peripheral_t *other = fake_ble_peripheral_add(OTHER_MAC,
+        BLE_ADDR_TYPE_PUBLIC);
+    fake_ble_peripheral_t *third = fake_ble_peripheral_add("aa:bb:cc:dd:ee:03",
+        BLE_ADDR_TYPE_PUBLIC);
+
+    fake_ble_bond_add(sensor);
+    fake_ble_bond_add(other);
+    fake_ble_bond_add(third);
+
+    ble_start();
+    TEST_ASSERT(ble_remove_bonds(should_remove_bond) == 2);
+    fake_ble_run();
+    TEST_ASSERT(bonds_removed == 1);
+    TEST_ASSERT(!fake_ble_is_bonded(sensor) && !fake_ble_is_bonded(third));
+    TEST_ASSERT(fake_ble_is_bonded(other));
+
+    /* The timeout doesn't report them again */
+    fake_clock_advance(10000);
+    TEST_ASSERT(bonds_removed == 1);
+}
+
+static void test_bond_removal_timeout(void)
+{
+    fake_ble_peripheral_t *sensor = fake_ble_peripheral_add(SENSOR_MAC,
+        BLE_ADDR_TYPE_PUBLIC);
+
+    fake_ble_bond_add(sensor);
+    fake_ble_bond_removal_hang();
+
+    ble_start();
+    TEST_ASSERT(ble_remove_bonds(NULL) == 1);
+    fake_ble_run();
+    fake_clock_advance(4000);
+    TEST_ASSERT(bonds_removed == 0);
+
+    /* The completion never arrives, the app is notified regardless */
+    fake_clock_advance(1000);
+    TEST_ASSERT(bonds_removed == 1);
+}
+
+static void test_whitelist_filters_scan(void)
+{
+    uint16_t temperature;
+    fake_ble_peripheral_t *sensor = sensor_add(SENSOR_MAC,
+        BLE_ADDR_TYPE_PUBLIC, &temperature);
+    fake_ble_peripheral_t *other = sensor_add(OTHER_MAC, BLE_ADDR_TYPE_PUBLIC,
+        &temperature);
+
+    ble_start();
+    TEST_ASSERT(!ble_whitelist_add(fake_ble_peripheral_mac(sensor)));
+    fake_ble_run();
+    TEST_ASSERT(fake_ble_whitelist_size() == 1);
+    TEST_ASSERT(fake_ble_scan_params()->scan_filter_policy ==
+        BLE_SCAN_FILTER_ALLOW_ONLY_WLST);
+
+    ble_scan_start();
+    fake_ble_run();
+    fake_ble_advertise(sensor);
+    fake_ble_advertise(other);
+    fake_ble_run();
+    TEST_ASSERT(discovered == 1);
+}
+
+static void test_random_address_filtering(void)
+{
+    uint16_t temperature;
+    fake_ble_peripheral_t *sensor = sensor_add(SENSOR_MAC,
+        BLE_ADDR_TYPE_RANDOM, &temperature);
+
+    /* Without controller filtering, which is opt-in, the device is reported
+     * and filtered in software */
+    ble_start();
+    TEST_ASSERT(fake_ble_scan_params()->scan_filter_policy ==
+        BLE_SCAN_FILTER_ALLOW_ALL);
+    sensor_connect(sensor);
+    TEST_ASSERT(discovered == 1);
+    TEST_ASSERT(connected == 1);
+}
+
+static void test_controller_whitelist_hides_random_addresses(void)
+{
+    uint16_t temperature;
+    fake_ble_peripheral_t *sensor = sensor_add(SENSOR_MAC,
+        BLE_ADDR_TYPE_RANDOM, &temperature);
+
+    /* Entries are added as public addresses */
+    ble_start();
+    TEST_ASSERT(!ble_whitelist_add(fake_ble_peripheral_mac(sensor)));
+    fake_ble_run();
+    ble_scan_start();
+    fake_ble_run();
+    fake_ble_advertise(sensor);
+    fake_ble_run();
+    TEST_ASSERT(discovered == 0);
+}
+
+int main(void)
+{
+    TEST_RUN(test_scan_and_connect);
+    TEST_RUN(test_operations_are_serialized);
+    TEST_RUN(test_operations_parked_until_authenticated);
+    TEST_RUN(test_indications_are_enabled);
+    TEST_RUN(test_notify_rate);
+    TEST_RUN(test_full_queue_drops_notifications);
+    TEST_RUN(test_btc_thread_delivers_callbacks);
+    TEST_RUN(test_disconnect_drops_operations);
+    TEST_RUN(test_failed_descriptor_reads_complete_discovery);
+    TEST_RUN(test_bonds_removed);
+    TEST_RUN(test_bond_removal_timeout);
+    TEST_RUN(test_whitelist_filters_scan);
+    TEST_RUN(test_random_address_filtering);
+    TEST_RUN(test_controller_whitelist_hides_random_addresses);
+
+    return test_failures;
+}
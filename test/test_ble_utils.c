@@ -0,0 +1,188 @@
+#include "test.h"
+#include "fakes.h"
+#include <ble_utils.h>
+#include <string.h>
+
+/* Constants */
+#define UUID_TEMPERATURE "00002a6e-0000-1000-8000-00805f9b34fb"
+#define UUID_ELEVATION "00002a6c-0000-1000-8000-00805f9b34fb"
+#define UUID_DATE_TIME "00002a08-0000-1000-8000-00805f9b34fb"
+#define UUID_VENDOR "12345678-1234-1234-1234-123456789abc"
+
+/* Internal state */
+static mac_addr_t mac = { 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0x01 };
+
+/* Helpers */
+static uint8_t *uuid(const char *str)
+{
+    static ble_uuid_t ret;
+
+    atouuid(str, ret);
+    return ret;
+}
+
+static const char *encode(const char *uuid_str, ble_payload_format_t format,
+    const char *value, size_t len)
+{
+    return chartoa(mac, uuid(uuid_str), format, (const uint8_t *)value, len,
+        NULL);
+}
+
+static int decode(const char *uuid_str, ble_payload_format_t format,
+    const char *payload, uint8_t *buf, size_t size)
+{
+    return atochar(mac, uuid(uuid_str), format, payload, strlen(payload), buf,
+        size, NULL);
+}
+
+/* Tests */
+static void test_sig_exponent_and_unit(void)
+{
+    /* 20.68 degrees, with an exponent of -2 */
+    TEST_ASSERT(!strcmp(encode(UUID_TEMPERATURE, BLE_PAYLOAD_FORMAT_TEXT,
+        "\x14\x08", 2), "2068"));
+    TEST_ASSERT(!strcmp(encode(UUID_TEMPERATURE, BLE_PAYLOAD_FORMAT_JSON,
+        "\x14\x08", 2), "{\"Temperature\":20.68,"
+        "\"unit\":\"thermodynamic_temperature.degree_celsius\"}"));
+    TEST_ASSERT(!strcmp(encode(UUID_TEMPERATURE, BLE_PAYLOAD_FORMAT_JSON,
+        "\x30\xf8", 2), "{\"Temperature\":-20,"
+        "\"unit\":\"thermodynamic_temperature.degree_celsius\"}"));
+
+    /* Multiple fields have no single unit */
+    TEST_ASSERT(!strcmp(encode(UUID_DATE_TIME, BLE_PAYLOAD_FORMAT_JSON,
+        "\xe8\x07\x01\x02\x03\x04\x05", 7), "{\"Year\":2024,\"Month\":1,"
+        "\"Day\":2,\"Hours\":3,\"Minutes\":4,\"Seconds\":5}"));
+}
+
+static void test_sig_sint24(void)
+{
+    /* -1.5 and the extremes of a 24 bit signed value */
+    TEST_ASSERT(!strcmp(encode(UUID_ELEVATION, BLE_PAYLOAD_FORMAT_TEXT,
+        "\x6a\xff\xff", 3), "-150"));
+    TEST_ASSERT(!strcmp(encode(UUID_ELEVATION, BLE_PAYLOAD_FORMAT_JSON,
+        "\x6a\xff\xff", 3),
+        "{\"Elevation\":-1.5,\"unit\":\"length.metre\"}"));
+    TEST_ASSERT(!strcmp(encode(UUID_ELEVATION, BLE_PAYLOAD_FORMAT_TEXT,
+        "\x00\x00\x80", 3), "-8388608"));
+    TEST_ASSERT(!strcmp(encode(UUID_ELEVATION, BLE_PAYLOAD_FORMAT_TEXT,
+        "\xff\xff\x7f", 3), "8388607"));
+}
+
+static void test_sig_exponent_set(void)
+{
+    uint8_t buf[8];
+
+    /* JSON writes mirror the published value, text ones are as is */
+    TEST_ASSERT(decode(UUID_TEMPERATURE, BLE_PAYLOAD_FORMAT_JSON,
+        "{\"Temperature\":20.68}", buf, sizeof(buf)) == 2);
+    TEST_ASSERT(!memcmp(buf, "\x14\x08", 2));
+    TEST_ASSERT(decode(UUID_TEMPERATURE, BLE_PAYLOAD_FORMAT_JSON,
+        "{\"Temperature\":-20}", buf, sizeof(buf)) == 2);
+    TEST_ASSERT(!memcmp(buf, "\x30\xf8", 2));
+    TEST_ASSERT(decode(UUID_TEMPERATURE, BLE_PAYLOAD_FORMAT_JSON,
+        "{\"Temperature\":\"20.685\"}", buf, sizeof(buf)) == 2);
+    TEST_ASSERT(!memcmp(buf, "\x15\x08", 2));
+    TEST_ASSERT(decode(UUID_TEMPERATURE, BLE_PAYLOAD_FORMAT_TEXT, "2068", buf,
+        sizeof(buf)) == 2);
+    TEST_ASSERT(!memcmp(buf, "\x14\x08", 2));
+
+    /* Range is checked after scaling */
+    TEST_ASSERT(decode(UUID_TEMPERATURE, BLE_PAYLOAD_FORMAT_JSON,
+        "{\"Temperature\":327.67}", buf, sizeof(buf)) == 2);
+    TEST_ASSERT(decode(UUID_TEMPERATURE, BLE_PAYLOAD_FORMAT_JSON,
+        "{\"Temperature\":327.68}", buf, sizeof(buf)) == -1);
+    TEST_ASSERT(decode(UUID_TEMPERATURE, BLE_PAYLOAD_FORMAT_JSON,
+        "{\"Temperature\":1e400}", buf, sizeof(buf)) == -1);
+}
+
+static void test_presentation_format(void)
+{
+    /* sint16, exponent -1, illuminance (lux). Units not used by any SIG
+     * characteristic are known as well */
+    static const uint8_t format[] = { 0x0e, 0xff, 0x31, 0x27, 0x01, 0x00,
+        0x00 };
+    uint8_t buf[8];
+
+    TEST_ASSERT(!ble_characteristic_presentation_format_set(mac,
+        uuid(UUID_VENDOR), format, sizeof(format)));
+    TEST_ASSERT(!strcmp(encode(UUID_VENDOR, BLE_PAYLOAD_FORMAT_TEXT,
+        "\xd7\x00", 2), "21.5"));
+    TEST_ASSERT(!strcmp(encode(UUID_VENDOR, BLE_PAYLOAD_FORMAT_JSON,
+        "\xd7\x00", 2), "{\"value\":21.5,\"unit\":\"illuminance.lux\"}"));
+
+    /* Writes mirror the published values */
+    TEST_ASSERT(decode(UUID_VENDOR, BLE_PAYLOAD_FORMAT_TEXT, "21.5", buf,
+        sizeof(buf)) == 2);
+    TEST_ASSERT(!memcmp(buf, "\xd7\x00", 2));
+    TEST_ASSERT(decode(UUID_VENDOR, BLE_PAYLOAD_FORMAT_JSON,
+        "{\"value\":-0.1}", buf, sizeof(buf)) == 2);
+    TEST_ASSERT(!memcmp(buf, "\xff\xff", 2));
+    TEST_ASSERT(decode(UUID_VENDOR, BLE_PAYLOAD_FORMAT_JSON,
+        "{\"field0\":21.5}", buf, sizeof(buf)) == 0);
+}
+
+static void test_presentation_format_per_device(void)
+{
+    /* uint8, exponent 0, and sint16, exponent -2 */
+    static const uint8_t format1[] = { 0x04, 0x00, 0x00, 0x27, 0x01, 0x00,
+        0x00 };
+    static const uint8_t format2[] = { 0x0e, 0xfe, 0x00, 0x27, 0x01, 0x00,
+        0x00 };
+    mac_addr_t mac1 = { 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0x02 };
+    mac_addr_t mac2 = { 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0x03 };
+    uint8_t buf[8];
+
+    /* The same vendor UUID on two devices is decoded with each one's format */
+    TEST_ASSERT(!ble_characteristic_presentation_format_set(mac1,
+        uuid(UUID_VENDOR), format1, sizeof(format1)));
+    TEST_ASSERT(!ble_characteristic_presentation_format_set(mac2,
+        uuid(UUID_VENDOR), format2, sizeof(format2)));
+    TEST_ASSERT(!strcmp(chartoa(mac1, uuid(UUID_VENDOR),
+        BLE_PAYLOAD_FORMAT_TEXT, (const uint8_t *)"\xd7", 1, NULL), "215"));
+    TEST_ASSERT(!strcmp(chartoa(mac2, uuid(UUID_VENDOR),
+        BLE_PAYLOAD_FORMAT_TEXT, (const uint8_t *)"\xd7\x00", 2, NULL),
+        "2.15"));
+    TEST_ASSERT(atochar(mac1, uuid(UUID_VENDOR), BLE_PAYLOAD_FORMAT_TEXT,
+        "215", 3, buf, sizeof(buf), NULL) == 1);
+    TEST_ASSERT(buf[0] == 0xd7);
+    TEST_ASSERT(atochar(mac2, uuid(UUID_VENDOR), BLE_PAYLOAD_FORMAT_TEXT,
+        "2.15", 4, buf, sizeof(buf), NULL) == 2);
+    TEST_ASSERT(!memcmp(buf, "\xd7\x00", 2));
+
+    /* A device that sent none keeps the raw bytes */
+    TEST_ASSERT(!ble_characteristic_descriptors_are_known(mac1,
+        uuid(UUID_TEMPERATURE)));
+}
+
+static void test_configured_fields(void)
+{
+    static const char *types[] = { "uint8", "sint16", NULL };
+    static const char *fields[] = { "mode", NULL };
+    uint8_t buf[8];
+    size_t err_field;
+
+    fake_config_characteristic_types_set(UUID_VENDOR, types);
+    fake_config_characteristic_fields_set(UUID_VENDOR, fields);
+
+    /* Unnamed fields are named after their index */
+    TEST_ASSERT(!strcmp(encode(UUID_VENDOR, BLE_PAYLOAD_FORMAT_JSON,
+        "\x02\xff\xff", 3), "{\"mode\":2,\"field1\":-1}"));
+    TEST_ASSERT(decode(UUID_VENDOR, BLE_PAYLOAD_FORMAT_JSON,
+        "{\"field1\":-2,\"mode\":3}", buf, sizeof(buf)) == 3);
+    TEST_ASSERT(!memcmp(buf, "\x03\xfe\xff", 3));
+    TEST_ASSERT(atochar(mac, uuid(UUID_VENDOR), BLE_PAYLOAD_FORMAT_JSON,
+        "{\"mode\":256}", 12, buf, sizeof(buf), &err_field) == -1);
+    TEST_ASSERT(err_field == 0);
+}
+
+int main(void)
+{
+    TEST_RUN(test_sig_exponent_and_unit);
+    TEST_RUN(test_sig_sint24);
+    TEST_RUN(test_sig_exponent_set);
+    TEST_RUN(test_presentation_format);
+    TEST_RUN(test_presentation_format_per_device);
+    TEST_RUN(test_configured_fields);
+
+    return test_failures;
+}
@@ -0,0 +1,188 @@
+#include "test.h"
+#include "fake_ble.h"
+#include "fakes.h"
+#include <ble.h>
+#include <capture.h>
+#include <string.h>
+
+/* Constants */
+#define SENSOR_MAC "aa:bb:cc:dd:ee:01"
+#define UUID_ENVIRONMENTAL_SENSING 0x181A
+#define UUID_TEMPERATURE 0x2A6E
+
+/* Internal state */
+static uint8_t stream[16384];
+static size_t stream_len;
+
+/* Helpers */
+static uint8_t *uuid16(uint16_t uuid)
+{
+    static ble_uuid_t uuids[2];
+    static int i;
+    uint8_t *ret = uuids[i++ % 2];
+    char str[37];
+
+    sprintf(str, "0000%04x-0000-1000-8000-00805f9b34fb", uuid);
+    atouuid(str, ret);
+    return ret;
+}
+
+/* Reads what was captured so far, as the capture task would */
+static void capture_drain(void)
+{
+    RingbufHandle_t ringbuf = fake_ringbuf_last();
+    uint8_t *data;
+    size_t len;
+
+    while ((data = xRingbufferReceiveUpTo(ringbuf, &len, 0,
+        sizeof(stream) - stream_len)))
+    {
+        memcpy(stream + stream_len, data, len);
+        stream_len += len;
+        vRingbufferReturnItem(ringbuf, data);
+    }
+}
+
+/* Connects to the sensor, subscribes to its temperature and has it notify
+ * once */
+static void sensor_session(fake_ble_peripheral_t *sensor, uint16_t temperature)
+{
+    uint8_t *mac = fake_ble_peripheral_mac(sensor);
+
+    TEST_ASSERT(!ble_initialize());
+    fake_ble_run();
+    ble_scan_start();
+    fake_ble_run();
+    fake_ble_advertise(sensor);
+    fake_ble_run();
+    TEST_ASSERT(!ble_connect(mac));
+    fake_ble_run();
+    TEST_ASSERT(!ble_services_scan(mac));
+    fake_ble_run();
+    TEST_ASSERT(!ble_characteristic_notify_register(mac,
+        uuid16(UUID_ENVIRONMENTAL_SENSING), uuid16(UUID_TEMPERATURE)));
+    fake_ble_run();
+    fake_clock_advance(1000);
+    fake_ble_run();
+    TEST_ASSERT(!fake_ble_notify(sensor, temperature, "\x35\x08", 2));
+    fake_ble_run();
+}
+
+/* Tests */
+static void test_events_round_trip(void)
+{
+    fake_ble_peripheral_t *sensor = fake_ble_peripheral_add(SENSOR_MAC,
+        BLE_ADDR_TYPE_PUBLIC);
+    uint16_t temperature;
+    const capture_header_t *header = (const capture_header_t *)stream;
+    const capture_record_t *record;
+    esp_ble_gap_cb_param_t gap;
+    esp_ble_gattc_cb_param_t gattc;
+    esp_gattc_db_elem_t db[8];
+    capture_db_t info;
+    size_t offset;
+    int results = 0, notifications = 0, dbs = 0;
+
+    fake_ble_service_add(sensor, UUID_ENVIRONMENTAL_SENSING);
+    temperature = fake_ble_characteristic_add(sensor, UUID_TEMPERATURE,
+        CHAR_PROP_READ | CHAR_PROP_NOTIFY, "\x34\x08", 2);
+
+    TEST_ASSERT(!capture_initialize(sizeof(stream)));
+    TEST_ASSERT(!capture_start());
+    sensor_session(sensor, temperature);
+    capture_stop();
+    capture_drain();
+
+    TEST_ASSERT(stream_len > sizeof(*header));
+    TEST_ASSERT(header->magic == CAPTURE_MAGIC);
+    TEST_ASSERT(header->version == CAPTURE_VERSION);
+
+    /* Records are whole and decode to the events delivered */
+    for (offset = sizeof(*header); offset < stream_len;
+        offset += sizeof(*record) + record->param_len + record->value_len)
+    {
+        record = (const capture_record_t *)(stream + offset);
+        TEST_ASSERT(offset + sizeof(*record) + record->param_len +
+            record->value_len <= stream_len);
+
+        if (record->source == CAPTURE_SOURCE_GAP)
+        {
+            TEST_ASSERT(!capture_gap_event_decode(record,
+                (const uint8_t *)(record + 1), &gap));
+            if (record->event != ESP_GAP_BLE_SCAN_RESULT_EVT)
+                continue;
+
+            results++;
+            TEST_ASSERT(!memcmp(gap.scan_rst.bda,
+                fake_ble_peripheral_mac(sensor), sizeof(esp_bd_addr_t)));
+            TEST_ASSERT(gap.scan_rst.ble_addr_type == BLE_ADDR_TYPE_PUBLIC);
+        }
+        else if (record->source == CAPTURE_SOURCE_GATTC)
+        {
+            TEST_ASSERT(!capture_gattc_event_decode(record,
+                (const uint8_t *)(record + 1), &gattc));
+            if (record->event != ESP_GATTC_NOTIFY_EVT)
+                continue;
+
+            notifications++;
+            TEST_ASSERT(gattc.notify.handle == temperature);
+            TEST_ASSERT(gattc.notify.is_notify);
+            TEST_ASSERT(gattc.notify.value_len == 2);
+            TEST_ASSERT(!memcmp(gattc.notify.value, "\x35\x08", 2));
+        }
+        else
+        {
+            TEST_ASSERT(!capture_gattc_db_decode(record,
+                (const uint8_t *)(record + 1), &info, db,
+                sizeof(db) / sizeof(db[0])));
+            dbs++;
+            TEST_ASSERT(info.index == 0 && info.count == 3);
+            TEST_ASSERT(db[0].type == ESP_GATT_DB_PRIMARY_SERVICE);
+            TEST_ASSERT(db[0].uuid.uuid.uuid16 == UUID_ENVIRONMENTAL_SENSING);
+            TEST_ASSERT(db[1].type == ESP_GATT_DB_CHARACTERISTIC);
+            TEST_ASSERT(db[1].attribute_handle == temperature);
+            TEST_ASSERT(db[1].uuid.len == ESP_UUID_LEN_16);
+            TEST_ASSERT(db[1].uuid.uuid.uuid16 == UUID_TEMPERATURE);
+            TEST_ASSERT(db[2].type == ESP_GATT_DB_DESCRIPTOR);
+        }
+    }
+
+    TEST_ASSERT(offset == stream_len);
+    TEST_ASSERT(results == 1 && notifications == 1 && dbs == 1);
+}
+
+static void test_full_buffer_drops_records(void)
+{
+    fake_ble_peripheral_t *sensor = fake_ble_peripheral_add(SENSOR_MAC,
+        BLE_ADDR_TYPE_PUBLIC);
+    const capture_record_t *record;
+    uint16_t temperature;
+    size_t offset;
+
+    fake_ble_service_add(sensor, UUID_ENVIRONMENTAL_SENSING);
+    temperature = fake_ble_characteristic_add(sensor, UUID_TEMPERATURE,
+        CHAR_PROP_READ | CHAR_PROP_NOTIFY, "\x34\x08", 2);
+
+    /* Room for the header and a few records, the stream is still whole */
+    TEST_ASSERT(!capture_initialize(128));
+    TEST_ASSERT(!capture_start());
+    sensor_session(sensor, temperature);
+    capture_stop();
+    capture_drain();
+
+    for (offset = sizeof(capture_header_t); offset < stream_len;
+        offset += sizeof(*record) + record->param_len + record->value_len)
+    {
+        record = (const capture_record_t *)(stream + offset);
+    }
+    TEST_ASSERT(offset == stream_len);
+    TEST_ASSERT(stream_len <= 128);
+}
+
+int main(void)
+{
+    TEST_RUN(test_events_round_trip);
+    TEST_RUN(test_full_buffer_drops_records);
+
+    return test_failures;
+}
@@ -0,0 +1,76 @@
+#include "test.h"
+#include "fakes.h"
+#include <dlog.h>
+#include <metrics.h>
+
+/* Constants */
+static const char *TAG = "Test";
+
+/* Tests */
+static void test_dropped_without_ring_buffer(void)
+{
+    DLOGE(TAG, "Not initialized");
+    TEST_ASSERT(dlog_dropped_get() == 1);
+    TEST_ASSERT(metrics_counter_get(METRICS_COUNTER_LOG_DROPPED) == 1);
+}
+
+static void test_dropped_when_full(void)
+{
+    int i;
+
+    TEST_ASSERT(!dlog_initialize(512));
+    for (i = 0; i < 20; i++)
+        DLOGE(TAG, "Message %d: %s", i, "a string argument");
+
+    TEST_ASSERT(dlog_dropped_get() > 0);
+    TEST_ASSERT(dlog_dropped_get() < 20);
+}
+
+static void test_rate_limit(void)
+{
+    int i;
+
+    TEST_ASSERT(!dlog_initialize(64 * 1024));
+
+    /* A burst is accepted up to the limit */
+    for (i = 0; i < 150; i++)
+        DLOGI(TAG, "Publishing: %d", i);
+    TEST_ASSERT(dlog_dropped_get() == 50);
+
+    /* Errors and warnings aren't limited */
+    DLOGE(TAG, "Error");
+    DLOGW(TAG, "Warning");
+    TEST_ASSERT(dlog_dropped_get() == 50);
+
+    /* The limit refills over time */
+    fake_clock_advance(100);
+    for (i = 0; i < 10; i++)
+        DLOGD(TAG, "Debug %d", i);
+    TEST_ASSERT(dlog_dropped_get() == 50);
+
+    /* Filtered messages don't count */
+    for (i = 0; i < 10; i++)
+        DLOGV(TAG, "Verbose %d", i);
+    TEST_ASSERT(dlog_dropped_get() == 50);
+}
+
+static void test_rate_limit_refills_up_to_burst(void)
+{
+    int i;
+
+    TEST_ASSERT(!dlog_initialize(64 * 1024));
+    fake_clock_advance(60 * 60 * 1000);
+    for (i = 0; i < 101; i++)
+        DLOGI(TAG, "Publishing: %d", i);
+    TEST_ASSERT(dlog_dropped_get() == 1);
+}
+
+int main(void)
+{
+    TEST_RUN(test_dropped_without_ring_buffer);
+    TEST_RUN(test_dropped_when_full);
+    TEST_RUN(test_rate_limit);
+    TEST_RUN(test_rate_limit_refills_up_to_burst);
+
+    return test_failures;
+}
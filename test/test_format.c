@@ -0,0 +1,297 @@
+#include "test.h"
+#include <format.h>
+#include <float.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The kernels are checked against the sprintf() based formatting they
+ * replaced, numerically where the previous output lost precision */
+
+/* Helpers */
+static uint64_t random_state = 0x2545F4914F6CDD1DULL;
+
+static uint64_t random64(void)
+{
+    /* xorshift64 */
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 7;
+    random_state ^= random_state << 17;
+    return random_state;
+}
+
+/* Formats with one of the kernels and NUL terminates the result */
+#define FORMAT(buf, kernel, value) (*kernel(buf, value) = '\0', buf)
+
+/* The previous IEEE-11073 formatting */
+static double ieee11073_value(int32_t mantissa, int8_t exponent)
+{
+    return mantissa * pow(10.0f, exponent);
+}
+
+/* The digits are the mantissa's, shifted by the exponent, e.g. 36.50 for a
+ * mantissa of 3650 and an exponent of -2 */
+static int ieee11073_is_exact(const char *s, int32_t mantissa,
+    int8_t exponent)
+{
+    char expected[512], *p = expected;
+    const char *point = strchr(s, '.');
+    int fraction = point ? strlen(point + 1) : 0;
+
+    if (!mantissa)
+        return !strcmp(s, "0");
+
+    p += sprintf(p, "%s%u", mantissa < 0 ? "-" : "",
+        mantissa < 0 ? -(uint32_t)mantissa : (uint32_t)mantissa);
+    for (; exponent > 0; exponent--)
+        *p++ = '0';
+    *p = '\0';
+
+    /* Compare without the decimal point and leading zeros */
+    if (fraction != (exponent < 0 ? -exponent : 0))
+        return 0;
+    for (p = expected; *s; s++)
+    {
+        if (*s == '.' || (*s == '0' && p == expected + (mantissa < 0)))
+            continue;
+        if (*s != *p++)
+            return 0;
+    }
+
+    return !*p;
+}
+
+/* The exact decimal is written, so it must read back close to the previous
+ * value and print as before with %f. The previous value may be a ULP away,
+ * which changes the last digit printed for ties, e.g. 0.0005135 */
+static int ieee11073_matches(const char *s, int32_t mantissa, int8_t exponent)
+{
+    char old[512], new[512];
+    double expected = ieee11073_value(mantissa, exponent), d;
+    char *end;
+    int i;
+
+    if (!ieee11073_is_exact(s, mantissa, exponent))
+        return 0;
+
+    d = strtod(s, &end);
+    if (*end || fabs(d - expected) > fabs(expected) * 4 * DBL_EPSILON)
+        return 0;
+
+    /* Values beyond 2^53 print their rounding noise with %f */
+    if (fabs(expected) >= 9007199254740992.0)
+        return 1;
+
+    sprintf(old, "%f", expected);
+    for (i = 0; i < 3; i++)
+    {
+        sprintf(new, "%f", i == 0 ? d : nextafter(d, i == 1 ? -INFINITY :
+            INFINITY));
+        if (!strcmp(old, new))
+            return 1;
+    }
+
+    return 0;
+}
+
+/* Number of significant digits of a formatted double */
+static int significant_digits(const char *s)
+{
+    const char *end = strchr(s, 'e');
+    int n = 0;
+
+    if (!end)
+        end = s + strlen(s);
+    for (; s < end && (*s == '-' || *s == '0' || *s == '.'); s++);
+    for (; end > s && (end[-1] == '0' || end[-1] == '.'); end--);
+    for (; s < end; s++)
+        n += *s != '.';
+
+    return n;
+}
+
+/* Digits of the shortest %g representation that reads back as d */
+static int shortest_digits(double d)
+{
+    char buf[32];
+    int precision;
+
+    for (precision = 1; precision < 17; precision++)
+    {
+        sprintf(buf, "%.*g", precision, d);
+        if (strtod(buf, NULL) == d)
+            break;
+    }
+
+    return precision;
+}
+
+/* Tests */
+static void test_integers(void)
+{
+    static const uint64_t edges[] = { 0, 1, 9, 10, 99, 100, 999, 1000, 9999,
+        10000, 65535, 99999, 100000, 999999, 1000000, 9999999, 10000000,
+        99999999, 100000000, 999999999, 1000000000, 2147483647, 2147483648U,
+        4294967295U, 4294967296ULL, 9999999999ULL, 10000000000ULL,
+        999999999999999999ULL, 1000000000000000000ULL,
+        9223372036854775807ULL, 9999999999999999999ULL,
+        10000000000000000000ULL, 18446744073709551615ULL };
+    char buf[32], expected[32];
+    uint64_t value;
+    size_t i;
+
+    for (i = 0; i < sizeof(edges) / sizeof(edges[0]); i++)
+    {
+        sprintf(expected, "%llu", (unsigned long long)edges[i]);
+        TEST_ASSERT(!strcmp(FORMAT(buf, format_uint64, edges[i]), expected));
+        if (edges[i] > UINT32_MAX)
+            continue;
+
+        sprintf(expected, "%u", (uint32_t)edges[i]);
+        TEST_ASSERT(!strcmp(FORMAT(buf, format_uint32, edges[i]), expected));
+        sprintf(expected, "%d", (int32_t)edges[i]);
+        TEST_ASSERT(!strcmp(FORMAT(buf, format_int32, edges[i]), expected));
+        sprintf(expected, "%d", (int32_t)-(uint32_t)edges[i]);
+        TEST_ASSERT(!strcmp(FORMAT(buf, format_int32, -(uint32_t)edges[i]),
+            expected));
+    }
+
+    /* Random values of every length */
+    for (i = 0; i < 1000000; i++)
+    {
+        value = random64() >> (i % 64);
+
+        sprintf(expected, "%llu", (unsigned long long)value);
+        TEST_ASSERT(!strcmp(FORMAT(buf, format_uint64, value), expected));
+        sprintf(expected, "%u", (uint32_t)value);
+        TEST_ASSERT(!strcmp(FORMAT(buf, format_uint32, value), expected));
+        sprintf(expected, "%d", (int32_t)value);
+        TEST_ASSERT(!strcmp(FORMAT(buf, format_int32, value), expected));
+    }
+}
+
+static void test_sfloat_exhaustive(void)
+{
+    char buf[32];
+    uint32_t value;
+    int16_t mantissa;
+    int8_t exponent;
+
+    TEST_ASSERT(!strcmp(FORMAT(buf, format_sfloat, 0x07FF), "nan"));
+    TEST_ASSERT(!strcmp(FORMAT(buf, format_sfloat, 0x0800), "nan"));
+    TEST_ASSERT(!strcmp(FORMAT(buf, format_sfloat, 0x0801), "nan"));
+    TEST_ASSERT(!strcmp(FORMAT(buf, format_sfloat, 0x07FE), "inf"));
+    TEST_ASSERT(!strcmp(FORMAT(buf, format_sfloat, 0x0802), "-inf"));
+    TEST_ASSERT(!strcmp(FORMAT(buf, format_sfloat, 0xF16D), "36.5"));
+    TEST_ASSERT(!strcmp(FORMAT(buf, format_sfloat, 0x8001), "0.00000001"));
+    TEST_ASSERT(!strcmp(FORMAT(buf, format_sfloat, 0x77FD), "20450000000"));
+
+    for (value = 0; value <= UINT16_MAX; value++)
+    {
+        mantissa = (int16_t)(value << 4) >> 4;
+        exponent = (int16_t)value >> 12;
+        /* Special values are the mantissas 0x07FE-0x0802, at exponent 0 */
+        if (exponent == 0 && (mantissa >= 2046 || mantissa <= -2046))
+            continue;
+
+        TEST_ASSERT(ieee11073_matches(FORMAT(buf, format_sfloat, value),
+            mantissa, exponent));
+    }
+}
+
+static void test_float_sweep(void)
+{
+    static const int32_t edges[] = { 0, 1, -1, 5, -5, 10, 365, -365, 1000000,
+        8388605, -8388605, 0x7FFFFD, -0x7FFFFD };
+    char buf[512];
+    int32_t mantissa;
+    int exponent;
+    size_t i;
+
+    TEST_ASSERT(!strcmp(FORMAT(buf, format_float, 0x007FFFFF), "nan"));
+    TEST_ASSERT(!strcmp(FORMAT(buf, format_float, 0x00800000), "nan"));
+    TEST_ASSERT(!strcmp(FORMAT(buf, format_float, 0x00800001), "nan"));
+    TEST_ASSERT(!strcmp(FORMAT(buf, format_float, 0x007FFFFE), "inf"));
+    TEST_ASSERT(!strcmp(FORMAT(buf, format_float, 0x00800002), "-inf"));
+    TEST_ASSERT(!strcmp(FORMAT(buf, format_float, 0xFF00016D), "36.5"));
+
+    /* Every exponent, with edge and random mantissas */
+    for (exponent = -128; exponent <= 127; exponent++)
+    {
+        for (i = 0; i < sizeof(edges) / sizeof(edges[0]) + 2000; i++)
+        {
+            mantissa = i < sizeof(edges) / sizeof(edges[0]) ? edges[i] :
+                (int32_t)(random64() % 0xFFFFFB) - 0x7FFFFD;
+
+            TEST_ASSERT(ieee11073_matches(FORMAT(buf, format_float,
+                ((uint32_t)exponent << 24) | (mantissa & 0xFFFFFF)),
+                mantissa, exponent));
+        }
+    }
+}
+
+static void test_float64_round_trip(void)
+{
+    static const double edges[] = { 0.0, -0.0, 1.0, 0.1, 1.0 / 3, 36.5,
+        1e-320, 5e-324, 2.2250738585072014e-308, 1.7976931348623157e308,
+        9007199254740993.0, 123456789012345678.0 };
+    static const char *expected[] = { "0", "-0", "1", "0.1",
+        "0.3333333333333333", "36.5", "1e-320", "5e-324",
+        "2.2250738585072014e-308", "1.7976931348623157e+308",
+        "9.007199254740992e+15", "1.2345678901234568e+17" };
+    char buf[64], old[512], new[512], *end;
+    uint64_t bits;
+    double d, read;
+    size_t i, longer = 0;
+
+    for (i = 0; i < sizeof(edges) / sizeof(edges[0]); i++)
+    {
+        TEST_ASSERT(!strcmp(FORMAT(buf, format_float64, (uint8_t *)&edges[i]),
+            expected[i]));
+    }
+
+    for (i = 0; i < sizeof(edges) / sizeof(edges[0]) + 1000000; i++)
+    {
+        if (i < sizeof(edges) / sizeof(edges[0]))
+            d = edges[i];
+        else
+        {
+            bits = random64();
+            memcpy(&d, &bits, sizeof(d));
+        }
+
+        FORMAT(buf, format_float64, (uint8_t *)&d);
+        read = strtod(buf, &end);
+        TEST_ASSERT(!*end && strlen(buf) <= 24);
+        if (isnan(d))
+        {
+            TEST_ASSERT(isnan(read));
+            continue;
+        }
+
+        /* Exact round trip, including the sign of zero */
+        TEST_ASSERT(!memcmp(&read, &d, sizeof(d)));
+        sprintf(old, "%f", d);
+        sprintf(new, "%f", read);
+        TEST_ASSERT(!strcmp(old, new));
+
+        /* Grisu2 may print more digits than needed for a few values, e.g.
+         * if the shorter one is exactly halfway to the next double */
+        if (isinf(d) || d == 0)
+            continue;
+        longer += significant_digits(buf) > shortest_digits(d);
+    }
+
+    TEST_ASSERT(longer < 2000);
+}
+
+int main(void)
+{
+    TEST_RUN(test_integers);
+    TEST_RUN(test_sfloat_exhaustive);
+    TEST_RUN(test_float_sweep);
+    TEST_RUN(test_float64_round_trip);
+
+    return test_failures;
+}
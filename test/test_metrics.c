@@ -0,0 +1,134 @@
+#include "test.h"
+#include <metrics.h>
+#include <string.h>
+
+/* Tests */
+static void test_counters_and_gauges(void)
+{
+    int i;
+
+    for (i = 0; i < 3; i++)
+        metrics_counter_inc(METRICS_COUNTER_BLE_CONNECTS);
+    metrics_counter_inc(METRICS_COUNTER_BLE_DISCONNECTS);
+    TEST_ASSERT(metrics_counter_get(METRICS_COUNTER_BLE_CONNECTS) == 3);
+    TEST_ASSERT(metrics_counter_get(METRICS_COUNTER_BLE_DISCONNECTS) == 1);
+    TEST_ASSERT(metrics_counter_get(METRICS_COUNTER_MQTT_PUBLISHED) == 0);
+
+    metrics_gauge_add(METRICS_GAUGE_QUEUE_DEPTH, 2);
+    metrics_gauge_add(METRICS_GAUGE_QUEUE_DEPTH, -3);
+    TEST_ASSERT(metrics_gauge_get(METRICS_GAUGE_QUEUE_DEPTH) == -1);
+    metrics_gauge_set(METRICS_GAUGE_QUEUE_DEPTH, 7);
+    TEST_ASSERT(metrics_gauge_get(METRICS_GAUGE_QUEUE_DEPTH) == 7);
+}
+
+static void test_histogram_percentiles(void)
+{
+    int i;
+
+    TEST_ASSERT(metrics_histogram_percentile(METRICS_HISTOGRAM_QUEUE_WAIT,
+        50) == 0);
+
+    /* 90 values in the 250us bucket, 9 in the 10ms one and the maximum */
+    for (i = 0; i < 90; i++)
+        metrics_histogram_record(METRICS_HISTOGRAM_QUEUE_WAIT, 101 + i);
+    for (i = 0; i < 9; i++)
+        metrics_histogram_record(METRICS_HISTOGRAM_QUEUE_WAIT, 10000);
+    metrics_histogram_record(METRICS_HISTOGRAM_QUEUE_WAIT, 3000000);
+
+    TEST_ASSERT(metrics_histogram_percentile(METRICS_HISTOGRAM_QUEUE_WAIT,
+        50) == 250);
+    TEST_ASSERT(metrics_histogram_percentile(METRICS_HISTOGRAM_QUEUE_WAIT,
+        90) == 250);
+    TEST_ASSERT(metrics_histogram_percentile(METRICS_HISTOGRAM_QUEUE_WAIT,
+        99) == 10000);
+    TEST_ASSERT(metrics_histogram_percentile(METRICS_HISTOGRAM_QUEUE_WAIT,
+        100) == 3000000);
+    TEST_ASSERT(metrics_histogram_percentile(
+        METRICS_HISTOGRAM_PUBLISH_LATENCY, 50) == 0);
+}
+
+static void test_histogram_bucket_bounds(void)
+{
+    char *json;
+
+    /* Bounds are inclusive */
+    metrics_histogram_record(METRICS_HISTOGRAM_PUBLISH_LATENCY, 0);
+    metrics_histogram_record(METRICS_HISTOGRAM_PUBLISH_LATENCY, 100);
+    metrics_histogram_record(METRICS_HISTOGRAM_PUBLISH_LATENCY, 101);
+    metrics_histogram_record(METRICS_HISTOGRAM_PUBLISH_LATENCY, 1000000);
+    metrics_histogram_record(METRICS_HISTOGRAM_PUBLISH_LATENCY, 1000001);
+
+    json = metrics_to_json();
+    TEST_ASSERT(strstr(json, "\"publish_latency\":{\"n\":5,\"max\":1000001,"
+        "\"p50\":250,\"p99\":1000001,\"b\":[2,1,0,0,0,0,0,0,0,0,0,0,1,1]}"));
+    free(json);
+}
+
+static void test_notifications_per_device(void)
+{
+    mac_addr_t macs[9];
+    char *json;
+    int i;
+
+    for (i = 0; i < 9; i++)
+    {
+        memset(macs[i], 0, sizeof(mac_addr_t));
+        macs[i][5] = i + 1;
+    }
+
+    /* Only 8 devices are tracked */
+    for (i = 0; i < 9; i++)
+        metrics_ble_notification(macs[i]);
+    metrics_ble_notification(macs[0]);
+    json = metrics_to_json();
+    TEST_ASSERT(strstr(json, "\"00:00:00:00:00:01\":2"));
+    TEST_ASSERT(strstr(json, "\"00:00:00:00:00:08\":1"));
+    TEST_ASSERT(!strstr(json, "\"00:00:00:00:00:09\""));
+    free(json);
+
+    /* A disconnected device's slot is reused */
+    metrics_ble_disconnected(macs[0]);
+    metrics_ble_notification(macs[8]);
+    json = metrics_to_json();
+    TEST_ASSERT(!strstr(json, "\"00:00:00:00:00:01\""));
+    TEST_ASSERT(strstr(json, "\"00:00:00:00:00:09\":1"));
+    free(json);
+
+    /* Its count starts over once it reconnects */
+    metrics_ble_disconnected(macs[1]);
+    metrics_ble_notification(macs[0]);
+    json = metrics_to_json();
+    TEST_ASSERT(strstr(json, "\"00:00:00:00:00:01\":1"));
+    free(json);
+}
+
+static void test_report(void)
+{
+    char *json;
+
+    metrics_counter_inc(METRICS_COUNTER_MQTT_PUBLISHED);
+    metrics_ble_gap_event(3);
+    metrics_ble_gap_event(3);
+    metrics_ble_gattc_event(5);
+    metrics_ble_gattc_event(-1);
+    metrics_ble_gattc_event(64);
+
+    json = metrics_to_json();
+    TEST_ASSERT(!strncmp(json, "{\"uptime\":0,\"heap\":{", 20));
+    TEST_ASSERT(strstr(json, "\"published\":1,"));
+    TEST_ASSERT(strstr(json, "\"gap\":{\"3\":2},\"gattc\":{\"5\":1}"));
+    TEST_ASSERT(strstr(json, "\"notifications\":{}}"));
+    TEST_ASSERT(!strstr(json, "publish_rate"));
+    free(json);
+}
+
+int main(void)
+{
+    TEST_RUN(test_counters_and_gauges);
+    TEST_RUN(test_histogram_percentiles);
+    TEST_RUN(test_histogram_bucket_bounds);
+    TEST_RUN(test_notifications_per_device);
+    TEST_RUN(test_report);
+
+    return test_failures;
+}
@@ -0,0 +1,277 @@
+#include "test.h"
+#include "fake_mqtt.h"
+#include "fakes.h"
+#include <dedup.h>
+#include <metrics.h>
+#include <mqtt.h>
+#include <string.h>
+
+/* Internal state */
+static char received[8][32];
+static int received_count;
+static int frees, connects, disconnects;
+
+/* Callback functions */
+static void on_message(const char *topic, const uint8_t *payload, size_t len,
+    void *ctx)
+{
+    if (ctx)
+        (*(int *)ctx)++;
+    if (received_count < 8)
+        snprintf(received[received_count++], 32, "%s=%.*s", topic, (int)len,
+            payload);
+}
+
+static void on_free(void *ctx)
+{
+    frees++;
+}
+
+static void on_connected(void)
+{
+    connects++;
+}
+
+static void on_disconnected(void)
+{
+    disconnects++;
+}
+
+/* Helpers */
+static void session_start(void)
+{
+    mqtt_set_on_connected_cb(on_connected);
+    mqtt_set_on_disconnected_cb(on_disconnected);
+    TEST_ASSERT(!dedup_initialize(0));
+    TEST_ASSERT(!mqtt_initialize());
+    TEST_ASSERT(!mqtt_connect("broker", 1883, "test", NULL, NULL));
+    fake_mqtt_run();
+    TEST_ASSERT(connects == 1);
+}
+
+static int publish(const char *topic, const char *payload, uint8_t retained)
+{
+    return mqtt_publish(topic, (uint8_t *)payload, strlen(payload), 1,
+        retained);
+}
+
+/* Returns the number of matching subscriptions the message was delivered
+ * to */
+static int matches(const char *filter, const char *topic)
+{
+    int count = 0;
+
+    received_count = 0;
+    TEST_ASSERT(!mqtt_subscribe(filter, 0, on_message, &count, NULL));
+    fake_mqtt_publish(topic, "x", 1, 0);
+    fake_mqtt_run();
+    TEST_ASSERT(!mqtt_unsubscribe(filter));
+
+    /* The catch-all subscriptions make sure the broker delivers it */
+    TEST_ASSERT(received_count == count + 1);
+    return count;
+}
+
+/* Tests */
+static void test_subscribe_and_receive(void)
+{
+    int count = 0;
+
+    session_start();
+    TEST_ASSERT(!mqtt_subscribe("home/+/Set", 0, on_message, &count, on_free));
+    TEST_ASSERT(fake_mqtt_is_subscribed("home/+/Set"));
+
+    fake_mqtt_publish("home/lamp/Set", "on", 2, 0);
+    fake_mqtt_publish("home/lamp/State", "on", 2, 0);
+    fake_mqtt_run();
+    TEST_ASSERT(count == 1);
+    TEST_ASSERT(received_count == 1);
+    TEST_ASSERT(!strcmp(received[0], "home/lamp/Set=on"));
+
+    /* The context is freed with the subscription */
+    TEST_ASSERT(!mqtt_unsubscribe("home/+/Set"));
+    TEST_ASSERT(frees == 1);
+    TEST_ASSERT(!fake_mqtt_is_subscribed("home/+/Set"));
+    fake_mqtt_publish("home/lamp/Set", "off", 3, 0);
+    fake_mqtt_run();
+    TEST_ASSERT(count == 1);
+
+    /* Subscribing requires a connection */
+    TEST_ASSERT(!mqtt_disconnect());
+    TEST_ASSERT(mqtt_subscribe("other/#", 0, on_message, NULL, NULL) == -1);
+}
+
+static void test_topic_matches(void)
+{
+    session_start();
+    TEST_ASSERT(!mqtt_subscribe("#", 0, on_message, NULL, NULL));
+    TEST_ASSERT(!mqtt_subscribe("$SYS/#", 0, on_message, NULL, NULL));
+    received_count = 0;
+
+    /* Trailing multi-level wildcard, including the parent level */
+    TEST_ASSERT(matches("a/#", "a") == 1);
+    TEST_ASSERT(matches("a/#", "a/") == 1);
+    TEST_ASSERT(matches("a/#", "a/b/c") == 1);
+    TEST_ASSERT(matches("a/#", "ab") == 0);
+    TEST_ASSERT(matches("a/b/#", "a/b") == 1);
+
+    /* Empty levels are levels */
+    TEST_ASSERT(matches("a/+", "a/") == 1);
+    TEST_ASSERT(matches("a/+", "a/b") == 1);
+    TEST_ASSERT(matches("a/+", "a") == 0);
+    TEST_ASSERT(matches("a/+", "a/b/c") == 0);
+    TEST_ASSERT(matches("a/+/c", "a//c") == 1);
+    TEST_ASSERT(matches("a/+/c", "a/c") == 0);
+    TEST_ASSERT(matches("+/b", "/b") == 1);
+    TEST_ASSERT(matches("a/b", "a/b/") == 0);
+    TEST_ASSERT(matches("a/b", "a/bc") == 0);
+
+    /* Wildcards at the first level don't match '$' topics */
+    TEST_ASSERT(matches("+/uptime", "$SYS/uptime") == 0);
+    TEST_ASSERT(matches("$SYS/uptime", "$SYS/uptime") == 1);
+    TEST_ASSERT(matches("$SYS/+", "$SYS/uptime") == 1);
+    TEST_ASSERT(matches("a/#", "a/$b") == 1);
+}
+
+static void test_retained_on_subscribe(void)
+{
+    size_t len;
+
+    fake_mqtt_publish("home/lamp/Set", "on", 2, 1);
+    fake_mqtt_publish("home/fan/Set", "off", 3, 1);
+    fake_mqtt_publish("home/fan/Set", "", 0, 1);
+    TEST_ASSERT(fake_mqtt_retained_get("home/lamp/Set", &len) && len == 2);
+    TEST_ASSERT(!fake_mqtt_retained_get("home/fan/Set", &len));
+
+    session_start();
+    TEST_ASSERT(!mqtt_subscribe("home/+/Set", 0, on_message, NULL, NULL));
+    fake_mqtt_run();
+    TEST_ASSERT(received_count == 1);
+    TEST_ASSERT(!strcmp(received[0], "home/lamp/Set=on"));
+}
+
+static void test_retained_dedup(void)
+{
+    const uint8_t *retained;
+    size_t len;
+
+    session_start();
+    TEST_ASSERT(!publish("home/lamp/State", "on", 1));
+    TEST_ASSERT(!publish("home/lamp/State", "on", 1));
+    TEST_ASSERT(fake_mqtt_publications() == 1);
+
+    /* Non retained publications are always sent */
+    TEST_ASSERT(!publish("home/lamp/Event", "on", 0));
+    TEST_ASSERT(!publish("home/lamp/Event", "on", 0));
+    TEST_ASSERT(fake_mqtt_publications() == 3);
+
+    /* Another client changed the retained value, it must be restored */
+    TEST_ASSERT(!mqtt_subscribe("home/lamp/State", 0, on_message, NULL,
+        NULL));
+    fake_mqtt_run();
+    fake_mqtt_publish("home/lamp/State", "off", 3, 1);
+    fake_mqtt_run();
+    TEST_ASSERT(!publish("home/lamp/State", "on", 1));
+    TEST_ASSERT(fake_mqtt_publications() == 4);
+    retained = fake_mqtt_retained_get("home/lamp/State", &len);
+    TEST_ASSERT(retained && len == 2 && !memcmp(retained, "on", 2));
+}
+
+static void test_subscribe_retries(void)
+{
+    session_start();
+
+    /* Up to three attempts, each timing out after the command timeout */
+    fake_mqtt_fail_next(2);
+    TEST_ASSERT(!mqtt_subscribe("home/#", 0, on_message, NULL, NULL));
+    TEST_ASSERT(fake_mqtt_is_subscribed("home/#"));
+    TEST_ASSERT(esp_log_timestamp() == 4000);
+
+    fake_mqtt_fail_next(3);
+    TEST_ASSERT(mqtt_subscribe("other/#", 0, on_message, NULL, on_free) == -1);
+    TEST_ASSERT(!fake_mqtt_is_subscribed("other/#"));
+
+    /* Failed publications are counted */
+    fake_mqtt_fail_next(1);
+    TEST_ASSERT(publish("home/lamp/State", "on", 0) == 1);
+    TEST_ASSERT(metrics_counter_get(METRICS_COUNTER_MQTT_PUBLISH_FAILED) == 1);
+}
+
+static void test_reconnect(void)
+{
+    const fake_mqtt_message_t *pub;
+    const uint8_t *retained;
+    int count = 0;
+    size_t len;
+
+    session_start();
+    TEST_ASSERT(!mqtt_subscribe("home/+/Set", 0, on_message, &count, on_free));
+    TEST_ASSERT(!publish("home/lamp/State", "on", 1));
+
+    /* Subscriptions are dropped with the connection, the bridge resubscribes
+     * once connected */
+    fake_mqtt_outage_start();
+    fake_mqtt_run();
+    TEST_ASSERT(disconnects == 1);
+    TEST_ASSERT(frees == 1);
+    TEST_ASSERT(metrics_counter_get(METRICS_COUNTER_MQTT_RECONNECTS) == 1);
+    TEST_ASSERT(mqtt_subscribe("home/+/Set", 0, on_message, &count,
+        NULL) == -1);
+
+    /* Publications are queued meanwhile and sent in order */
+    TEST_ASSERT(!publish("home/lamp/State", "off", 1));
+    TEST_ASSERT(!publish("home/lamp/Event", "pressed", 0));
+    TEST_ASSERT(!publish("home/lamp/State", "on", 1));
+    TEST_ASSERT(metrics_gauge_get(METRICS_GAUGE_OFFLINE_QUEUE_SIZE) == 3);
+    TEST_ASSERT(fake_mqtt_publications() == 1);
+
+    fake_mqtt_outage_end();
+    fake_mqtt_run();
+    TEST_ASSERT(connects == 2);
+    TEST_ASSERT(metrics_gauge_get(METRICS_GAUGE_OFFLINE_QUEUE_SIZE) == 0);
+    TEST_ASSERT(fake_mqtt_publications() == 4);
+    pub = fake_mqtt_publication_get(1);
+    TEST_ASSERT(!strcmp(pub->topic, "home/lamp/State") &&
+        !strcmp((const char *)pub->payload, "off"));
+    pub = fake_mqtt_publication_get(2);
+    TEST_ASSERT(!strcmp(pub->topic, "home/lamp/Event") && !pub->retained);
+    pub = fake_mqtt_publication_get(3);
+    TEST_ASSERT(!strcmp((const char *)pub->payload, "on"));
+    retained = fake_mqtt_retained_get("home/lamp/State", &len);
+    TEST_ASSERT(retained && len == 2 && !memcmp(retained, "on", 2));
+
+    TEST_ASSERT(!mqtt_subscribe("home/+/Set", 0, on_message, &count, NULL));
+    fake_mqtt_publish("home/lamp/Set", "on", 2, 0);
+    fake_mqtt_run();
+    TEST_ASSERT(count == 1);
+}
+
+static void test_publish_latency(void)
+{
+    session_start();
+    fake_mqtt_latency_set(30);
+
+    /* Only QoS 1 waits for the broker's acknowledgment */
+    TEST_ASSERT(!mqtt_publish("home/lamp/State", (uint8_t *)"on", 2, 1, 0));
+    TEST_ASSERT(!mqtt_publish("home/lamp/State", (uint8_t *)"on", 2, 0, 0));
+    TEST_ASSERT(fake_mqtt_publication_get(0)->qos == 1);
+    TEST_ASSERT(fake_mqtt_publication_get(1)->qos == 0);
+    TEST_ASSERT(metrics_counter_get(METRICS_COUNTER_MQTT_PUBLISHED) == 2);
+    TEST_ASSERT(metrics_histogram_percentile(METRICS_HISTOGRAM_PUBLISH_LATENCY,
+        100) == 50000);
+    TEST_ASSERT(metrics_histogram_percentile(METRICS_HISTOGRAM_PUBLISH_LATENCY,
+        50) == 100);
+}
+
+int main(void)
+{
+    TEST_RUN(test_subscribe_and_receive);
+    TEST_RUN(test_topic_matches);
+    TEST_RUN(test_retained_on_subscribe);
+    TEST_RUN(test_retained_dedup);
+    TEST_RUN(test_subscribe_retries);
+    TEST_RUN(test_reconnect);
+    TEST_RUN(test_publish_latency);
+
+    return test_failures;
+}
@@ -0,0 +1,100 @@
+#include "test.h"
+#include "fakes.h"
+#include <state.h>
+#include <string.h>
+
+/* Constants */
+#define UUID_ENVIRONMENTAL_SENSING "0000181a-0000-1000-8000-00805f9b34fb"
+#define UUID_BATTERY "0000180f-0000-1000-8000-00805f9b34fb"
+#define UUID_TEMPERATURE "00002a6e-0000-1000-8000-00805f9b34fb"
+#define UUID_HUMIDITY "00002a6f-0000-1000-8000-00805f9b34fb"
+#define UUID_BATTERY_LEVEL "00002a19-0000-1000-8000-00805f9b34fb"
+#define UUID_VENDOR "12345678-1234-1234-1234-123456789abc"
+
+/* Internal state */
+static mac_addr_t mac = { 0xaa, 0xbb, 0xcc, 0xdd, 0xee, 0x01 };
+static int published;
+static char last_doc[512];
+
+/* Callback functions */
+static void on_publish(mac_addr_t mac, const char *json, size_t len)
+{
+    published++;
+    memcpy(last_doc, json, len);
+    last_doc[len] = '\0';
+}
+
+/* Helpers */
+static uint8_t *uuid(const char *str)
+{
+    static ble_uuid_t uuids[2];
+    static int i;
+    uint8_t *ret = uuids[i++ % 2];
+
+    atouuid(str, ret);
+    return ret;
+}
+
+static void update(const char *service, const char *characteristic,
+    const char *value)
+{
+    TEST_ASSERT(!state_update(mac, uuid(service), uuid(characteristic), value,
+        strlen(value)));
+}
+
+static void state_start(void)
+{
+    state_set_on_publish_cb(on_publish);
+    TEST_ASSERT(!state_initialize(100));
+}
+
+/* Tests */
+static void test_updates_are_debounced(void)
+{
+    state_start();
+    update(UUID_ENVIRONMENTAL_SENSING, UUID_TEMPERATURE, "2068");
+    update(UUID_BATTERY, UUID_BATTERY_LEVEL, "100");
+    fake_clock_advance(50);
+    update(UUID_ENVIRONMENTAL_SENSING, UUID_HUMIDITY, "4500");
+    update(UUID_ENVIRONMENTAL_SENSING, UUID_TEMPERATURE, "2070");
+    TEST_ASSERT(published == 0);
+
+    /* Values are grouped by service, in the order they were first seen */
+    fake_clock_advance(50);
+    TEST_ASSERT(published == 1);
+    TEST_ASSERT(!strcmp(last_doc, "{\"EnvironmentalSensing\":"
+        "{\"Temperature\":2070,\"Humidity\":4500},"
+        "\"BatteryService\":{\"BatteryLevel\":100}}"));
+
+    fake_clock_advance(1000);
+    TEST_ASSERT(published == 1);
+
+    state_remove(mac);
+    update(UUID_BATTERY, UUID_BATTERY_LEVEL, "99");
+    fake_clock_advance(100);
+    TEST_ASSERT(published == 2);
+    TEST_ASSERT(!strcmp(last_doc, "{\"BatteryService\":{\"BatteryLevel\":99}}"));
+}
+
+static void test_names_are_escaped(void)
+{
+    fake_config_service_name_set(UUID_VENDOR, "Living \"Room\"\\");
+    fake_config_characteristic_name_set(UUID_VENDOR, "Line\nFeed");
+
+    state_start();
+    update(UUID_VENDOR, UUID_VENDOR, "[1,2]");
+
+    /* Names are resolved when the value is first seen */
+    fake_config_service_name_set(UUID_VENDOR, "Kitchen");
+    fake_clock_advance(100);
+    TEST_ASSERT(!strcmp(last_doc, "{\"Living \\\"Room\\\"\\\\\":"
+        "{\"Line\\u000aFeed\":[1,2]}}"));
+}
+
+int main(void)
+{
+    TEST_RUN(test_updates_are_debounced);
+    TEST_RUN(test_names_are_escaped);
+
+    return test_failures;
+}